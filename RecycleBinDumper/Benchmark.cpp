@@ -0,0 +1,39 @@
+// Benchmark.cpp
+//
+// Timing of the stages of a dump.
+
+#include "Benchmark.h"
+#include "stdio.h"
+#include <chrono>
+
+static const double MIN_BENCHMARK_SECONDS = 1.0;
+static const uint32_t MIN_BENCHMARK_RUNS = 3;
+
+void PrintBenchmarkHeader()
+	{
+	fwprintf(stderr, L"Benchmark,Runs,Milliseconds per Run,Items per Second,MB per Second\n");
+	}
+
+void RunBenchmark(const wchar_t* szName, BenchmarkFunction fn, void* context)
+	{
+	uint64_t bytes = 0;
+	fn(context, &bytes);
+
+	uint32_t runs = 0;
+	uint64_t totalItems = 0;
+	uint64_t totalBytes = 0;
+	double seconds = 0;
+
+	while ((runs < MIN_BENCHMARK_RUNS) || (seconds < MIN_BENCHMARK_SECONDS))
+		{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		totalItems += fn(context, &bytes);
+		seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		totalBytes += bytes;
+		runs++;
+		}
+
+	fwprintf(stderr, L"%s,%u,%.3f,%.0f,%.1f\n", szName, runs, seconds * 1000 / runs,
+		totalItems / seconds, totalBytes / seconds / (1024 * 1024));
+	}
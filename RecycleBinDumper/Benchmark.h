@@ -0,0 +1,24 @@
+// Benchmark.h
+//
+// Times the stages of a dump one at a time, so that a change that slows one of them down shows
+// up in that stage's numbers rather than only in the time of a whole run.  Each stage is run
+// once untimed (to warm the file system cache and the allocator) and then repeatedly for at
+// least MIN_BENCHMARK_SECONDS, and its mean time per run is reported with the items and bytes
+// it got through per second.
+//
+// The results are printed to stderr as CSV, one row per stage, so that they can be kept and
+// compared between builds.
+
+#pragma once
+
+#include "windows.h"
+#include "cstdint"
+
+// One run of a stage.  Returns the number of items processed, and sets pBytes to the number of
+// bytes processed (0 if bytes mean nothing for the stage).
+typedef uint64_t (*BenchmarkFunction)(void* context, uint64_t* pBytes);
+
+void PrintBenchmarkHeader();
+
+// Time fn and print its row.
+void RunBenchmark(const wchar_t* szName, BenchmarkFunction fn, void* context);
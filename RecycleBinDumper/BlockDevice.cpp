@@ -0,0 +1,147 @@
+// BlockDevice.cpp
+//
+// Raw disk images, the volumes on them, and opening images of the other formats.
+
+#include "BlockDevice.h"
+#include "EwfImage.h"
+#include "VhdImage.h"
+#include "Stats.h"
+
+// ReadFile() reads at most 4GB at a time.
+static const size_t MAX_READ_SIZE = 0x40000000;
+
+RawImage::RawImage()
+	{
+	this->hFile = INVALID_HANDLE_VALUE;
+	this->size = 0;
+	}
+
+RawImage::~RawImage()
+	{
+	if (this->hFile != INVALID_HANDLE_VALUE)
+		{
+		CloseHandle(this->hFile);
+		}
+	}
+
+bool RawImage::Open(const wchar_t* szFileName)
+	{
+	this->hFile = CreateFile(szFileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+	if (this->hFile == INVALID_HANDLE_VALUE)
+		{
+		return false;
+		}
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(this->hFile, &fileSize))
+		{
+		return false;
+		}
+
+	this->size = (uint64_t)fileSize.QuadPart;
+	return true;
+	}
+
+uint64_t RawImage::GetSize()
+	{
+	return this->size;
+	}
+
+bool RawImage::Read(uint64_t offset, void* pBuffer, size_t cbData)
+	{
+	if ((offset > this->size) || (cbData > this->size - offset))
+		{
+		return false;
+		}
+
+	StatsTimer timer(STATS_READ_IMAGE);
+	std::lock_guard<std::mutex> guard(this->lock);
+
+	LARGE_INTEGER position;
+	position.QuadPart = (LONGLONG)offset;
+	if (!SetFilePointerEx(this->hFile, position, NULL, FILE_BEGIN))
+		{
+		return false;
+		}
+
+	uint8_t* p = (uint8_t*)pBuffer;
+	while (cbData > 0)
+		{
+		DWORD count = (DWORD)((cbData < MAX_READ_SIZE) ? cbData : MAX_READ_SIZE);
+		DWORD bytesRead = 0;
+
+		if (!ReadFile(this->hFile, p, count, &bytesRead, NULL) || (bytesRead == 0))
+			{
+			return false;
+			}
+
+		p += bytesRead;
+		cbData -= bytesRead;
+		}
+
+	timer.Stop(p - (uint8_t*)pBuffer);
+	return true;
+	}
+
+VolumeDevice::VolumeDevice(BlockDevice* pDevice, uint64_t offset, uint64_t size)
+	{
+	this->pDevice = pDevice;
+	this->offset = offset;
+	this->size = size;
+	}
+
+uint64_t VolumeDevice::GetSize()
+	{
+	return this->size;
+	}
+
+bool VolumeDevice::Read(uint64_t offset, void* pBuffer, size_t cbData)
+	{
+	if ((offset > this->size) || (cbData > this->size - offset))
+		{
+		return false;
+		}
+
+	return this->pDevice->Read(this->offset + offset, pBuffer, cbData);
+	}
+
+BlockDevice* OpenImage(const wchar_t* szFileName, size_t cacheSize)
+	{
+	RawImage* pRaw = new RawImage();
+	uint8_t header[16];
+
+	if (!pRaw->Open(szFileName))
+		{
+		delete pRaw;
+		return NULL;
+		}
+
+	bool isEwf = pRaw->Read(0, header, sizeof(header)) && EwfImage::IsEwfHeader(header, sizeof(header));
+	bool isVhd = !isEwf && VhdImage::IsVhdImage(pRaw);
+	if (!isEwf && !isVhd)
+		{
+		return pRaw;
+		}
+	delete pRaw;
+
+	if (isVhd)
+		{
+		VhdImage* pVhd = new VhdImage();
+		if (!pVhd->Open(szFileName))
+			{
+			delete pVhd;
+			return NULL;
+			}
+
+		return pVhd;
+		}
+
+	EwfImage* pEwf = new EwfImage(cacheSize);
+	if (!pEwf->Open(szFileName))
+		{
+		delete pEwf;
+		return NULL;
+		}
+
+	return pEwf;
+	}
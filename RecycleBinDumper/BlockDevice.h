@@ -0,0 +1,64 @@
+// BlockDevice.h
+//
+// Random access to the bytes of a disk (or of a volume on it), e.g. a raw disk image file.
+//
+// The volumes of an image are scanned by several threads at once, but they all read the same
+// file, so each read holds the device's lock for its whole length.  The volume readers make
+// their reads large (megabytes of MFT at a time), so the file is read in long sequential runs
+// rather than the disk seeking back and forth between volumes for every small read.
+
+#pragma once
+
+#include "windows.h"
+#include "cstdint"
+#include "cstddef"
+#include <mutex>
+
+class BlockDevice
+	{
+	public:
+		virtual ~BlockDevice() {}
+
+		virtual uint64_t GetSize() = 0;
+
+		// Read cbData bytes at the offset.  Returns false if they could not all be read.
+		virtual bool Read(uint64_t offset, void* pBuffer, size_t cbData) = 0;
+	};
+
+// A raw (dd) image of a disk or volume.
+class RawImage : public BlockDevice
+	{
+	public:
+		RawImage();
+		~RawImage();
+
+		bool Open(const wchar_t* szFileName);
+
+		virtual uint64_t GetSize();
+		virtual bool Read(uint64_t offset, void* pBuffer, size_t cbData);
+
+	protected:
+		HANDLE hFile;
+		uint64_t size;
+		std::mutex lock;
+	};
+
+// The part of a device holding one volume, with offsets from the start of the volume.
+class VolumeDevice : public BlockDevice
+	{
+	public:
+		VolumeDevice(BlockDevice* pDevice, uint64_t offset, uint64_t size);
+
+		virtual uint64_t GetSize();
+		virtual bool Read(uint64_t offset, void* pBuffer, size_t cbData);
+
+	protected:
+		BlockDevice* pDevice;
+		uint64_t offset;
+		uint64_t size;
+	};
+
+// Open a disk image in any of the supported formats (raw, EWF, VHD or VHDX), identified from the start of
+// the file.  cacheSize is the most memory to use for decompressed data of compressed formats.
+// Returns NULL if the image could not be opened.
+BlockDevice* OpenImage(const wchar_t* szFileName, size_t cacheSize);
@@ -0,0 +1,265 @@
+// Carver.cpp
+//
+// Finds $I files anywhere in a disk image.
+
+#include "Carver.h"
+#include "Trace.h"
+#include "RecycleInfo.h"
+#include "string.h"
+#include <thread>
+#include <algorithm>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include "emmintrin.h"
+#define CARVE_SSE2
+#endif
+
+// Deleted times outside these (1995 to 2100) are taken to be something other than a $I file.
+static const uint64_t MIN_DELETED_TIME = 0x01B9B90A9F21C000ULL;
+static const uint64_t MAX_DELETED_TIME = 0x022F716377640000ULL;
+
+// Larger than any disk, so larger sizes are not a $I file either.
+static const uint64_t MAX_DELETED_SIZE = 1ULL << 56;
+
+// The shortest original path, e.g. "C:\a".
+static const uint32_t MIN_FILE_NAME_LENGTH = 4;
+
+// Enough of the next stripe to hold a $I file starting at the end of a stripe.
+static const size_t OVERLAP_SIZE = (MAX_RECYCLE_INFO_SIZE + 7) & ~(size_t)7;
+
+static uint16_t Read16(const uint8_t* p)
+	{
+	uint16_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+	}
+
+static uint32_t Read32(const uint8_t* p)
+	{
+	uint32_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+	}
+
+static uint64_t Read64(const uint8_t* p)
+	{
+	uint64_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+	}
+
+RecycleInfoCarver::RecycleInfoCarver(BlockDevice* pDevice)
+	{
+	this->pDevice = pDevice;
+	this->size = pDevice->GetSize();
+	this->nextStripe = 0;
+	this->pFound = NULL;
+	this->unreadableSize = 0;
+	}
+
+void RecycleInfoCarver::Carve(std::vector<CarvedRecycleInfo>* pFound)
+	{
+	this->pFound = pFound;
+	this->nextStripe = 0;
+	this->unreadableSize = 0;
+
+	unsigned threadCount = std::thread::hardware_concurrency();
+	threadCount = (threadCount == 0) ? 1 : threadCount;
+
+	std::vector<std::thread> threads;
+	for (unsigned i = 0; i < threadCount; i++)
+		{
+		threads.push_back(std::thread(&RecycleInfoCarver::Worker, this));
+		}
+
+	for (size_t i = 0; i < threads.size(); i++)
+		{
+		threads[i].join();
+		}
+
+	// The threads finish their stripes in any order.
+	std::sort(pFound->begin(), pFound->end(), [](const CarvedRecycleInfo& left, const CarvedRecycleInfo& right) { return left.offset < right.offset; });
+	this->pFound = NULL;
+	}
+
+uint64_t RecycleInfoCarver::GetUnreadableSize()
+	{
+	return this->unreadableSize;
+	}
+
+void RecycleInfoCarver::Worker()
+	{
+	uint8_t* pBuffer = new uint8_t[STRIPE_SIZE + OVERLAP_SIZE];
+	std::vector<CarvedRecycleInfo> found;
+	uint64_t unreadable = 0;
+
+	for (;;)
+		{
+		uint64_t offset = this->nextStripe++ * STRIPE_SIZE;
+		if (offset >= this->size)
+			{
+			break;
+			}
+
+		TraceSpan span(L"Carve stripe");
+		size_t cbScan = (size_t)((this->size - offset < STRIPE_SIZE) ? this->size - offset : STRIPE_SIZE);
+		size_t cbData = (size_t)((this->size - offset < STRIPE_SIZE + OVERLAP_SIZE) ? this->size - offset : STRIPE_SIZE + OVERLAP_SIZE);
+
+		if (this->pDevice->Read(offset, pBuffer, cbData))
+			{
+			Scan(pBuffer, cbScan, cbData, offset, &found);
+			}
+		else if ((cbData > cbScan) && this->pDevice->Read(offset, pBuffer, cbScan))
+			{
+			// Only the next stripe is unreadable, which is counted when it is scanned.
+			Scan(pBuffer, cbScan, cbScan, offset, &found);
+			}
+		else
+			{
+			unreadable += cbScan;
+			}
+		}
+
+	delete[] pBuffer;
+
+	std::lock_guard<std::mutex> guard(this->lock);
+	this->unreadableSize += unreadable;
+	for (size_t i = 0; i < found.size(); i++)
+		{
+		this->pFound->push_back(std::move(found[i]));
+		}
+	}
+
+#ifdef CARVE_SSE2
+// All ones in each 8 bytes that hold 1 or 2, the only versions of the $I file.
+static inline __m128i FindVersions(__m128i value)
+	{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i versionBits = _mm_set_epi32(0, 3, 0, 3);
+
+	// No bits set but the two lowest, in both halves...
+	__m128i isSmall = _mm_cmpeq_epi32(_mm_andnot_si128(versionBits, value), zero);
+	isSmall = _mm_and_si128(isSmall, _mm_shuffle_epi32(isSmall, _MM_SHUFFLE(2, 3, 0, 1)));
+
+	// ...and not 0, which all unused space is.
+	__m128i isZero = _mm_shuffle_epi32(_mm_cmpeq_epi32(value, zero), _MM_SHUFFLE(2, 2, 0, 0));
+	return _mm_andnot_si128(isZero, isSmall);
+	}
+#endif
+
+void RecycleInfoCarver::Scan(const uint8_t* pData, size_t cbScan, size_t cbData, uint64_t offset, std::vector<CarvedRecycleInfo>* pFound)
+	{
+	size_t position = 0;
+
+#ifdef CARVE_SSE2
+	for (; position + 64 <= cbScan; position += 64)
+		{
+		const __m128i* p = (const __m128i*)(pData + position);
+		__m128i found = _mm_or_si128(
+			_mm_or_si128(FindVersions(_mm_loadu_si128(p)), FindVersions(_mm_loadu_si128(p + 1))),
+			_mm_or_si128(FindVersions(_mm_loadu_si128(p + 2)), FindVersions(_mm_loadu_si128(p + 3))));
+
+		if (_mm_movemask_epi8(found) != 0)
+			{
+			for (size_t i = 0; i < 64; i += 8)
+				{
+				ScanAt(pData, position + i, cbData, offset, pFound);
+				}
+			}
+		}
+#endif
+
+	for (; position + 8 <= cbScan; position += 8)
+		{
+		uint64_t version = Read64(pData + position);
+		if ((version == 1) || (version == 2))
+			{
+			ScanAt(pData, position, cbData, offset, pFound);
+			}
+		}
+	}
+
+void RecycleInfoCarver::ScanAt(const uint8_t* pData, size_t position, size_t cbData, uint64_t offset, std::vector<CarvedRecycleInfo>* pFound)
+	{
+	size_t cbInfo = MatchRecycleInfo(pData + position, cbData - position);
+	if (cbInfo != 0)
+		{
+		CarvedRecycleInfo carved;
+		carved.offset = offset + position;
+		carved.data.assign(pData + position, pData + position + cbInfo);
+		pFound->push_back(std::move(carved));
+		}
+	}
+
+size_t RecycleInfoCarver::MatchRecycleInfo(const uint8_t* pData, size_t cbData)
+	{
+	if (cbData < RECYCLE_INFO_V2_HEADER_SIZE)
+		{
+		return 0;
+		}
+
+	uint64_t version = Read64(pData);
+	uint64_t deletedSize = Read64(pData + 8);
+	uint64_t deletedTime = Read64(pData + 16);
+
+	if (((version != 1) && (version != 2)) || (deletedSize >= MAX_DELETED_SIZE)
+		|| (deletedTime < MIN_DELETED_TIME) || (deletedTime >= MAX_DELETED_TIME))
+		{
+		return 0;
+		}
+
+	uint32_t fileNameSize = RECYCLE_INFO_V1_FILE_NAME_SIZE;
+	size_t nameOffset = RECYCLE_INFO_V1_HEADER_SIZE;
+	if (version == 2)
+		{
+		fileNameSize = Read32(pData + 24);
+		nameOffset = RECYCLE_INFO_V2_HEADER_SIZE;
+		if ((fileNameSize <= MIN_FILE_NAME_LENGTH) || (fileNameSize > RECYCLE_INFO_MAX_FILE_NAME_SIZE))
+			{
+			return 0;
+			}
+		}
+
+	size_t cbInfo = nameOffset + (size_t)fileNameSize * 2;
+	if (cbInfo > cbData)
+		{
+		return 0;
+		}
+
+	// The original path is a drive letter path or a UNC path, null terminated within its size.
+	const uint8_t* pName = pData + nameOffset;
+	wchar_t first = Read16(pName);
+	wchar_t second = Read16(pName + 2);
+	wchar_t third = Read16(pName + 4);
+
+	bool isDrivePath = (((first >= L'A') && (first <= L'Z')) || ((first >= L'a') && (first <= L'z'))) && (second == L':') && (third == L'\\');
+	bool isUncPath = (first == L'\\') && (second == L'\\');
+	if (!isDrivePath && !isUncPath)
+		{
+		return 0;
+		}
+
+	uint32_t length = 0;
+	for (; length < fileNameSize; length++)
+		{
+		wchar_t c = Read16(pName + 2 * length);
+		if (c == L'\0')
+			{
+			break;
+			}
+
+		if ((c < 0x20) || (c == L'"') || (c == L'<') || (c == L'>') || (c == L'|') || (c == L'*') || (c == L'?'))
+			{
+			return 0;
+			}
+		}
+
+	if ((length < MIN_FILE_NAME_LENGTH) || (length == fileNameSize))
+		{
+		return 0;
+		}
+
+	// The same checks as for a $I file in a Recycle Bin.
+	RecycleInfo info;
+	return DecodeRecycleInfo(pData, cbInfo, &info) ? cbInfo : 0;
+	}
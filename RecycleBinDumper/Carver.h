@@ -0,0 +1,65 @@
+// Carver.h
+//
+// Finds $I files anywhere in a disk image, not just the ones still in a Recycle Bin.  When a
+// Recycle Bin is emptied its $I files are deleted, but their bytes stay where they were until
+// they are overwritten: in unallocated clusters, in the slack after the end of other files, and
+// (for the small ones whose data was resident) in MFT records that are no longer in use.
+//
+// Every byte of the image is searched, so the $I files that were not deleted are found too.
+// A $I file always starts at a multiple of 8 bytes (a cluster, or a resident attribute value in
+// an MFT record), so only those offsets are looked at, first for a version of 1 or 2 (SSE2
+// compares 8 of them at a time, and nearly all are ruled out there), then for a deleted time
+// between 1995 and 2100 and an original path that is a plausible Windows path, and finally
+// by decoding it with DecodeRecycleInfo() exactly as a $I file in a Recycle Bin is.
+//
+// The image is split into stripes that the threads take in turn, each read with enough of the
+// next stripe to hold a $I file that starts at the very end of it.
+
+#pragma once
+
+#include "windows.h"
+#include "cstdint"
+#include "cstddef"
+#include "BlockDevice.h"
+#include <vector>
+#include <mutex>
+#include <atomic>
+
+struct CarvedRecycleInfo
+	{
+	uint64_t offset;                // In the image.
+	std::vector<uint8_t> data;      // The $I file's contents, for DecodeRecycleInfo().
+	};
+
+class RecycleInfoCarver
+	{
+	public:
+		RecycleInfoCarver(BlockDevice* pDevice);
+
+		// Search the whole device.  The $I files found are in order of their offsets.
+		void Carve(std::vector<CarvedRecycleInfo>* pFound);
+
+		// Bytes of the device that could not be read, and so were not searched.
+		uint64_t GetUnreadableSize();
+
+		// Returns the size of the $I file the data starts with, or 0 if it does not start
+		// with one.
+		static size_t MatchRecycleInfo(const uint8_t* pData, size_t cbData);
+
+	protected:
+		void Worker();
+
+		// Look for $I files starting in the first cbScan bytes of the data, which is at the
+		// offset in the device.
+		static void Scan(const uint8_t* pData, size_t cbScan, size_t cbData, uint64_t offset, std::vector<CarvedRecycleInfo>* pFound);
+		static void ScanAt(const uint8_t* pData, size_t position, size_t cbData, uint64_t offset, std::vector<CarvedRecycleInfo>* pFound);
+
+		static const size_t STRIPE_SIZE = 16 * 1024 * 1024;
+
+		BlockDevice* pDevice;
+		uint64_t size;
+		std::atomic<uint64_t> nextStripe;
+		std::mutex lock;
+		std::vector<CarvedRecycleInfo>* pFound;
+		uint64_t unreadableSize;
+	};
@@ -0,0 +1,540 @@
+// Corpus.cpp
+//
+// Writes a synthetic Recycle Bin.
+
+#include "Corpus.h"
+#include "RecycleInfo.h"
+#include "stdio.h"
+#include "string.h"
+#include "wchar.h"
+#include <string>
+#include <vector>
+
+// Deleted times are spread over the ten years from 2016.
+static const uint64_t FIRST_DELETED_TIME = 0x01D144275B804000ULL;
+static const uint32_t DELETED_TIME_SPAN = 10 * 365 * 24 * 60 * 60;
+static const uint64_t FILE_TIME_PER_SECOND = 10000000;
+
+// File contents are taken from this much random data, which is also the largest file size.
+static const size_t CONTENT_SIZE = 1024 * 1024;
+
+// Of the version 2 $I files, whose paths are not limited to MAX_PATH, with a much longer path.
+static const uint32_t LONG_PATH_PERCENT = 2;
+
+// Item numbers are multiplied by this (which has no factor in common with 36) so that their
+// $I names are spread over all the names, like the random ones Windows gives them.
+static const uint64_t NAME_MULTIPLIER = 1000003;
+
+// The Recycle Bin folder in a ZIP archive corpus.
+static const char ZIP_ROOT[] = "$Recycle.Bin/S-1-5-21-3623811015-3361044348-30300820-1013/";
+
+static const uint32_t ZIP_LOCAL_SIGNATURE = 0x04034B50;
+static const uint32_t ZIP_HEADER_SIGNATURE = 0x02014B50;
+static const uint32_t ZIP_END_SIGNATURE = 0x06054B50;
+static const uint32_t ZIP64_END_SIGNATURE = 0x06064B50;
+static const uint32_t ZIP64_LOCATOR_SIGNATURE = 0x07064B50;
+static const uint16_t ZIP_VERSION = 20;
+static const uint16_t ZIP64_VERSION = 45;
+static const uint16_t EXTRA_ZIP64 = 0x0001;
+static const uint16_t EXTRA_NTFS = 0x000A;
+static const uint32_t ZIP64_VALUE = 0xFFFFFFFF;
+
+static const wchar_t* const FOLDER_NAMES[] =
+	{
+	L"Documents", L"Downloads", L"Pictures", L"Desktop", L"Music", L"Videos", L"Projects",
+	L"Reports", L"Archive", L"Work", L"Photos", L"Source", L"Backup", L"Temp", L"Invoices",
+	L"2019", L"2020", L"2021", L"2022", L"2023", L"Old", L"New folder", L"Drafts", L"Shared",
+	L"Clients", L"AppData", L"Local", L"Screenshots", L"Scans", L"Misc",
+	};
+
+static const wchar_t* const FILE_NAMES[] =
+	{
+	L"report", L"invoice", L"photo", L"notes", L"budget", L"draft", L"summary", L"scan",
+	L"letter", L"presentation", L"meeting", L"data", L"export", L"backup", L"readme", L"setup",
+	L"image", L"contract", L"plan", L"schedule", L"IMG", L"DSC", L"Screenshot", L"Copy of report",
+	};
+
+static const wchar_t* const EXTENSIONS[] =
+	{
+	L".docx", L".xlsx", L".pdf", L".jpg", L".png", L".txt", L".zip", L".mp4", L".pptx", L".csv",
+	L".log", L".exe", L".msi", L".doc", L".htm", L".json",
+	};
+
+static const uint32_t FOLDER_NAME_COUNT = sizeof(FOLDER_NAMES) / sizeof(FOLDER_NAMES[0]);
+static const uint32_t FILE_NAME_COUNT = sizeof(FILE_NAMES) / sizeof(FILE_NAMES[0]);
+static const uint32_t EXTENSION_COUNT = sizeof(EXTENSIONS) / sizeof(EXTENSIONS[0]);
+
+static void Write16(uint8_t* p, uint16_t value)
+	{
+	memcpy(p, &value, sizeof(value));
+	}
+
+static void Write32(uint8_t* p, uint32_t value)
+	{
+	memcpy(p, &value, sizeof(value));
+	}
+
+static void Write64(uint8_t* p, uint64_t value)
+	{
+	memcpy(p, &value, sizeof(value));
+	}
+
+// One file or folder of the corpus, by its path below the Recycle Bin folder.
+struct CorpusEntry
+	{
+	const wchar_t* szPath;
+	bool isFolder;
+	const uint8_t* pData;
+	size_t cbData;
+	uint64_t time;              // Of all its times, as a FILETIME value.
+	};
+
+typedef bool (*CorpusEntryHandler)(const CorpusEntry* pEntry, void* context);
+
+class CorpusGenerator
+	{
+	public:
+		CorpusGenerator(const CorpusOptions* pOptions, CorpusEntryHandler fn, void* context);
+
+		// Pass every file and folder of the corpus to fn, in the same order every time.
+		// Returns false if fn did.
+		bool Generate();
+
+	protected:
+		uint64_t Random();
+		uint32_t RandomBelow(uint32_t n);
+		uint32_t RandomFileSize();
+
+		void MakeOriginalPath(bool isFolder, bool isLong, std::wstring* pPath);
+		bool GenerateItem(uint64_t item);
+		bool GenerateFile(std::wstring* pPath, uint64_t* pTotalSize);
+		bool GenerateTree(std::wstring* pPath, uint32_t depth, uint64_t* pTotalSize);
+		bool AddEntry(const std::wstring& path, bool isFolder, const uint8_t* pData, size_t cbData);
+
+		const CorpusOptions* pOptions;
+		CorpusEntryHandler fn;
+		void* context;
+		uint64_t state;
+		uint64_t time;              // Of the item being generated.
+		uint32_t maxFileSize;
+		std::vector<uint8_t> content;
+		std::vector<uint8_t> infoData;
+	};
+
+CorpusGenerator::CorpusGenerator(const CorpusOptions* pOptions, CorpusEntryHandler fn, void* context)
+	{
+	this->pOptions = pOptions;
+	this->fn = fn;
+	this->context = context;
+	this->state = pOptions->seed;
+	this->time = FIRST_DELETED_TIME;
+	this->maxFileSize = (pOptions->maxFileSize < CONTENT_SIZE) ? pOptions->maxFileSize : (uint32_t)CONTENT_SIZE;
+
+	this->content.resize(CONTENT_SIZE);
+	for (size_t i = 0; i < CONTENT_SIZE; i += sizeof(uint64_t))
+		{
+		Write64(this->content.data() + i, this->Random());
+		}
+	}
+
+uint64_t CorpusGenerator::Random()
+	{
+	// SplitMix64, rather than the standard library's generators and distributions, whose
+	// results are not the same with every compiler.
+	uint64_t z = (this->state += 0x9E3779B97F4A7C15ULL);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+	}
+
+uint32_t CorpusGenerator::RandomBelow(uint32_t n)
+	{
+	return (uint32_t)(((this->Random() >> 32) * n) >> 32);
+	}
+
+uint32_t CorpusGenerator::RandomFileSize()
+	{
+	uint32_t bits = 0;
+	while ((bits < 32) && (((uint64_t)1 << bits) <= this->maxFileSize))
+		{
+		bits++;
+		}
+
+	// As many files between 1K and 2K as between 512K and 1M, as on a real disk.
+	uint32_t power = this->RandomBelow(bits + 1);
+	if (power == 0)
+		{
+		return 0;
+		}
+
+	uint32_t size = (1U << (power - 1)) + this->RandomBelow(1U << (power - 1));
+	return (size < this->maxFileSize) ? size : this->maxFileSize;
+	}
+
+bool CorpusGenerator::Generate()
+	{
+	for (uint64_t item = 0; item < this->pOptions->itemCount; item++)
+		{
+		if (!this->GenerateItem(item))
+			{
+			return false;
+			}
+		}
+
+	return true;
+	}
+
+void CorpusGenerator::MakeOriginalPath(bool isFolder, bool isLong, std::wstring* pPath)
+	{
+	wchar_t szPart[64];
+	swprintf_s(szPart, 64, L"C:\\Users\\user%02u", this->RandomBelow(50) + 1);
+	pPath->assign(szPart);
+
+	uint32_t depth = isLong ? 10 + this->RandomBelow(30) : 1 + this->RandomBelow(5);
+	for (uint32_t i = 0; i < depth; i++)
+		{
+		pPath->push_back(L'\\');
+		pPath->append(FOLDER_NAMES[this->RandomBelow(FOLDER_NAME_COUNT)]);
+		}
+
+	if (isFolder)
+		{
+		swprintf_s(szPart, 64, L"\\%s %u", FOLDER_NAMES[this->RandomBelow(FOLDER_NAME_COUNT)], this->RandomBelow(100));
+		}
+	else
+		{
+		swprintf_s(szPart, 64, L"\\%s_%u%s", FILE_NAMES[this->RandomBelow(FILE_NAME_COUNT)], this->RandomBelow(10000), EXTENSIONS[this->RandomBelow(EXTENSION_COUNT)]);
+		}
+	pPath->append(szPart);
+	}
+
+bool CorpusGenerator::GenerateItem(uint64_t item)
+	{
+	bool isFolder = this->RandomBelow(100) < this->pOptions->folderPercent;
+	bool isVersion1 = this->RandomBelow(100) < this->pOptions->version1Percent;
+	bool isLong = !isVersion1 && (this->RandomBelow(100) < LONG_PATH_PERCENT);
+	this->time = FIRST_DELETED_TIME + this->RandomBelow(DELETED_TIME_SPAN) * FILE_TIME_PER_SECOND;
+
+	std::wstring originalPath;
+	this->MakeOriginalPath(isFolder, isLong, &originalPath);
+
+	// Six base 36 digits, followed by the extension of a file.
+	wchar_t szCode[7];
+	uint64_t code = (item * NAME_MULTIPLIER) % MAX_CORPUS_ITEMS;
+	for (int i = 5; i >= 0; i--)
+		{
+		szCode[i] = L"0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ"[code % 36];
+		code /= 36;
+		}
+	szCode[6] = L'\0';
+
+	std::wstring name(szCode);
+	if (!isFolder)
+		{
+		name.append(originalPath, originalPath.rfind(L'.'), std::wstring::npos);
+		}
+
+	// The $R file or folder first, to find the size deleted.
+	std::wstring dataPath = L"$R" + name;
+	uint64_t totalSize = 0;
+	bool added = isFolder ? this->AddEntry(dataPath, true, NULL, 0) && this->GenerateTree(&dataPath, this->pOptions->folderDepth, &totalSize)
+		: this->GenerateFile(&dataPath, &totalSize);
+	if (!added)
+		{
+		return false;
+		}
+
+	size_t headerSize = isVersion1 ? RECYCLE_INFO_V1_HEADER_SIZE : RECYCLE_INFO_V2_HEADER_SIZE;
+	size_t nameSize = isVersion1 ? RECYCLE_INFO_V1_FILE_NAME_SIZE : originalPath.size() + 1;
+	this->infoData.assign(headerSize + nameSize * 2, 0);
+
+	uint8_t* pInfo = this->infoData.data();
+	Write64(pInfo, isVersion1 ? 1 : 2);
+	Write64(pInfo + 8, totalSize);
+	Write64(pInfo + 16, this->time);
+	if (!isVersion1)
+		{
+		Write32(pInfo + 24, (uint32_t)nameSize);
+		}
+	for (size_t i = 0; i < originalPath.size(); i++)
+		{
+		Write16(pInfo + headerSize + 2 * i, (uint16_t)originalPath[i]);
+		}
+
+	return this->AddEntry(L"$I" + name, false, this->infoData.data(), this->infoData.size());
+	}
+
+bool CorpusGenerator::GenerateFile(std::wstring* pPath, uint64_t* pTotalSize)
+	{
+	uint32_t size = this->RandomFileSize();
+	uint32_t offset = this->RandomBelow((uint32_t)(CONTENT_SIZE - size + 1));
+	*pTotalSize += size;
+
+	return this->AddEntry(*pPath, false, this->content.data() + offset, size);
+	}
+
+bool CorpusGenerator::GenerateTree(std::wstring* pPath, uint32_t depth, uint64_t* pTotalSize)
+	{
+	size_t length = pPath->size();
+	wchar_t szName[64];
+
+	for (uint32_t i = 0; i < this->pOptions->folderFanOut; i++)
+		{
+		swprintf_s(szName, 64, L"\\%s_%u%s", FILE_NAMES[this->RandomBelow(FILE_NAME_COUNT)], i, EXTENSIONS[this->RandomBelow(EXTENSION_COUNT)]);
+		pPath->append(szName);
+
+		bool added = this->GenerateFile(pPath, pTotalSize);
+		pPath->resize(length);
+		if (!added)
+			{
+			return false;
+			}
+		}
+
+	for (uint32_t i = 0; (i < this->pOptions->folderFanOut) && (depth > 0); i++)
+		{
+		swprintf_s(szName, 64, L"\\%s %u", FOLDER_NAMES[this->RandomBelow(FOLDER_NAME_COUNT)], i);
+		pPath->append(szName);
+
+		bool added = this->AddEntry(*pPath, true, NULL, 0) && this->GenerateTree(pPath, depth - 1, pTotalSize);
+		pPath->resize(length);
+		if (!added)
+			{
+			return false;
+			}
+		}
+
+	return true;
+	}
+
+bool CorpusGenerator::AddEntry(const std::wstring& path, bool isFolder, const uint8_t* pData, size_t cbData)
+	{
+	CorpusEntry entry = { path.c_str(), isFolder, pData, cbData, this->time };
+	return this->fn(&entry, this->context);
+	}
+
+// Writes each file and folder below the folder in the context.
+static bool WriteFolderEntry(const CorpusEntry* pEntry, void* context)
+	{
+	std::wstring path((const wchar_t*)context);
+	path.push_back(L'\\');
+	path.append(pEntry->szPath);
+
+	if (pEntry->isFolder)
+		{
+		// The folder may be left from an earlier run.  If it could not be made its files will
+		// not be written either.
+		CreateDirectory(path.c_str(), NULL);
+		return true;
+		}
+
+	FILE* pFile;
+	if (_wfopen_s(&pFile, path.c_str(), L"wb") != 0)
+		{
+		return false;
+		}
+
+	bool written = (pEntry->cbData == 0) || (fwrite(pEntry->pData, 1, pEntry->cbData, pFile) == pEntry->cbData);
+	return (fclose(pFile) == 0) && written;
+	}
+
+struct Crc32Table
+	{
+	uint32_t entries[256];
+
+	Crc32Table()
+		{
+		for (uint32_t i = 0; i < 256; i++)
+			{
+			uint32_t crc = i;
+			for (int bit = 0; bit < 8; bit++)
+				{
+				crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+				}
+			this->entries[i] = crc;
+			}
+		}
+	};
+
+static uint32_t Crc32(const uint8_t* pData, size_t cbData)
+	{
+	static const Crc32Table table;
+
+	uint32_t crc = 0xFFFFFFFF;
+	for (size_t i = 0; i < cbData; i++)
+		{
+		crc = table.entries[(crc ^ pData[i]) & 0xFF] ^ (crc >> 8);
+		}
+
+	return ~crc;
+	}
+
+// State of a ZIP archive corpus while it is written.
+struct ZipCorpus
+	{
+	FILE* pFile;
+	uint64_t offset;            // Of the next local header, while the members are written.
+	uint64_t entryCount;
+	std::vector<uint8_t> header;
+	};
+
+// Fill in the header with the member's name (below ZIP_ROOT, with / separators), and its
+// MS-DOS time and date.  Returns the length of the name.
+static uint16_t SetZipName(ZipCorpus* pZip, size_t nameOffset, const CorpusEntry* pEntry, uint8_t* pTime)
+	{
+	std::string name(ZIP_ROOT);
+	for (const wchar_t* p = pEntry->szPath; *p != L'\0'; p++)
+		{
+		// The generated names are all ASCII.
+		name.push_back((*p == L'\\') ? '/' : (char)*p);
+		}
+	if (pEntry->isFolder)
+		{
+		name.push_back('/');
+		}
+
+	pZip->header.resize(nameOffset + name.size());
+	memcpy(pZip->header.data() + nameOffset, name.data(), name.size());
+
+	FILETIME fileTime = { (DWORD)pEntry->time, (DWORD)(pEntry->time >> 32) };
+	SYSTEMTIME systemTime;
+	FileTimeToSystemTime(&fileTime, &systemTime);
+	Write16(pTime, (uint16_t)((systemTime.wHour << 11) | (systemTime.wMinute << 5) | (systemTime.wSecond / 2)));
+	Write16(pTime + 2, (uint16_t)(((systemTime.wYear - 1980) << 9) | (systemTime.wMonth << 5) | systemTime.wDay));
+
+	return (uint16_t)name.size();
+	}
+
+static bool WriteZipLocalHeader(const CorpusEntry* pEntry, void* context)
+	{
+	ZipCorpus* pZip = (ZipCorpus*)context;
+	pZip->header.assign(30, 0);
+	uint16_t nameLength = SetZipName(pZip, 30, pEntry, pZip->header.data() + 10);
+
+	uint8_t* p = pZip->header.data();
+	Write32(p, ZIP_LOCAL_SIGNATURE);
+	Write16(p + 4, ZIP_VERSION);
+	Write32(p + 14, Crc32(pEntry->pData, pEntry->cbData));
+	Write32(p + 18, (uint32_t)pEntry->cbData);
+	Write32(p + 22, (uint32_t)pEntry->cbData);
+	Write16(p + 26, nameLength);
+
+	pZip->offset += pZip->header.size() + pEntry->cbData;
+	pZip->entryCount++;
+
+	return (fwrite(pZip->header.data(), 1, pZip->header.size(), pZip->pFile) == pZip->header.size())
+		&& ((pEntry->cbData == 0) || (fwrite(pEntry->pData, 1, pEntry->cbData, pZip->pFile) == pEntry->cbData));
+	}
+
+static bool WriteZipHeader(const CorpusEntry* pEntry, void* context)
+	{
+	ZipCorpus* pZip = (ZipCorpus*)context;
+	pZip->header.assign(46, 0);
+	uint16_t nameLength = SetZipName(pZip, 46, pEntry, pZip->header.data() + 12);
+	bool isZip64 = pZip->offset >= ZIP64_VALUE;
+
+	// The full times, and the local header's offset if it needs 64 bits.
+	size_t extraOffset = pZip->header.size();
+	pZip->header.resize(extraOffset + 36 + (isZip64 ? 12 : 0), 0);
+	uint8_t* pExtra = pZip->header.data() + extraOffset;
+	Write16(pExtra, EXTRA_NTFS);
+	Write16(pExtra + 2, 32);
+	Write16(pExtra + 8, 1);
+	Write16(pExtra + 10, 24);
+	Write64(pExtra + 12, pEntry->time);
+	Write64(pExtra + 20, pEntry->time);
+	Write64(pExtra + 28, pEntry->time);
+	if (isZip64)
+		{
+		Write16(pExtra + 36, EXTRA_ZIP64);
+		Write16(pExtra + 38, 8);
+		Write64(pExtra + 40, pZip->offset);
+		}
+
+	uint8_t* p = pZip->header.data();
+	Write32(p, ZIP_HEADER_SIGNATURE);
+	Write16(p + 4, ZIP64_VERSION);
+	Write16(p + 6, isZip64 ? ZIP64_VERSION : ZIP_VERSION);
+	Write32(p + 16, Crc32(pEntry->pData, pEntry->cbData));
+	Write32(p + 20, (uint32_t)pEntry->cbData);
+	Write32(p + 24, (uint32_t)pEntry->cbData);
+	Write16(p + 28, nameLength);
+	Write16(p + 30, (uint16_t)(pZip->header.size() - extraOffset));
+	Write32(p + 38, pEntry->isFolder ? FILE_ATTRIBUTE_DIRECTORY : FILE_ATTRIBUTE_ARCHIVE);
+	Write32(p + 42, isZip64 ? ZIP64_VALUE : (uint32_t)pZip->offset);
+
+	// The offsets of the local headers are worked out again as they were when written.
+	pZip->offset += 30 + nameLength + pEntry->cbData;
+
+	return fwrite(pZip->header.data(), 1, pZip->header.size(), pZip->pFile) == pZip->header.size();
+	}
+
+static bool WriteZipEnd(ZipCorpus* pZip, uint64_t directoryOffset, uint64_t directorySize)
+	{
+	bool isZip64 = (pZip->entryCount >= 0xFFFF) || (directoryOffset >= ZIP64_VALUE) || (directorySize >= ZIP64_VALUE);
+	uint8_t end[56 + 20 + 22] = {};
+	uint8_t* p = end;
+
+	if (isZip64)
+		{
+		Write32(p, ZIP64_END_SIGNATURE);
+		Write64(p + 4, 44);
+		Write16(p + 12, ZIP64_VERSION);
+		Write16(p + 14, ZIP64_VERSION);
+		Write64(p + 24, pZip->entryCount);
+		Write64(p + 32, pZip->entryCount);
+		Write64(p + 40, directorySize);
+		Write64(p + 48, directoryOffset);
+		p += 56;
+
+		Write32(p, ZIP64_LOCATOR_SIGNATURE);
+		Write64(p + 8, directoryOffset + directorySize);
+		Write32(p + 16, 1);
+		p += 20;
+		}
+
+	Write32(p, ZIP_END_SIGNATURE);
+	Write16(p + 8, (uint16_t)(isZip64 ? 0xFFFF : pZip->entryCount));
+	Write16(p + 10, (uint16_t)(isZip64 ? 0xFFFF : pZip->entryCount));
+	Write32(p + 12, isZip64 ? ZIP64_VALUE : (uint32_t)directorySize);
+	Write32(p + 16, isZip64 ? ZIP64_VALUE : (uint32_t)directoryOffset);
+	p += 22;
+
+	return fwrite(end, 1, p - end, pZip->pFile) == (size_t)(p - end);
+	}
+
+static bool WriteZipCorpus(const wchar_t* szFileName, const CorpusOptions* pOptions)
+	{
+	ZipCorpus zip;
+	if (_wfopen_s(&zip.pFile, szFileName, L"wb") != 0)
+		{
+		return false;
+		}
+	setvbuf(zip.pFile, NULL, _IOFBF, 1024 * 1024);
+
+	zip.offset = 0;
+	zip.entryCount = 0;
+	CorpusGenerator members(pOptions, WriteZipLocalHeader, &zip);
+	bool written = members.Generate();
+
+	uint64_t directoryOffset = zip.offset;
+	zip.offset = 0;
+	CorpusGenerator headers(pOptions, WriteZipHeader, &zip);
+	written = written && headers.Generate();
+
+	written = written && WriteZipEnd(&zip, directoryOffset, (uint64_t)_ftelli64(zip.pFile) - directoryOffset);
+	return (fclose(zip.pFile) == 0) && written;
+	}
+
+bool WriteCorpus(const wchar_t* szOutput, const CorpusOptions* pOptions)
+	{
+	size_t length = wcslen(szOutput);
+	if ((length > 4) && (_wcsicmp(szOutput + length - 4, L".zip") == 0))
+		{
+		return WriteZipCorpus(szOutput, pOptions);
+		}
+
+	CreateDirectory(szOutput, NULL);
+	CorpusGenerator generator(pOptions, WriteFolderEntry, (void*)szOutput);
+	return generator.Generate();
+	}
@@ -0,0 +1,38 @@
+// Corpus.h
+//
+// Writes a synthetic Recycle Bin, so that the dump can be timed on a corpus anyone can make
+// again (real Recycle Bins are evidence that cannot be shared).  The same options always write
+// the same Recycle Bin, byte for byte, whatever machine or compiler it is written with.
+//
+// Each deleted item is a $I file (in either version of the format) and a $R file or folder.
+// Original paths are common folder and file names below a user's profile, mostly 30 to 120
+// characters long with a few much longer ones, as real paths are.  Each deleted folder has a
+// tree of files and subfolders below it, of the depth and fan out given, and its $I file has
+// the total size of the files in it, as Windows records.
+//
+// The corpus is written to a folder, which is then the Recycle Bin folder to dump, or (if the
+// output name ends in .zip) to a ZIP archive to dump with --archive, which holds any number of
+// items in a single file.  The archive's central directory is not kept in memory while the
+// members are written: the items are generated a second time to write it.
+
+#pragma once
+
+#include "windows.h"
+#include "cstdint"
+
+struct CorpusOptions
+	{
+	uint64_t itemCount;         // Deleted items, each a $I file and a $R file or folder.
+	uint64_t seed;
+	uint32_t folderPercent;     // Of the items that are folders rather than files.
+	uint32_t folderDepth;       // Levels of subfolders below each deleted folder.
+	uint32_t folderFanOut;      // Files, and subfolders, in each folder below a deleted folder.
+	uint32_t version1Percent;   // Of the $I files in the version 1 (before Windows 10) format.
+	uint32_t maxFileSize;       // Sizes up to this are spread evenly over each power of 2.
+	};
+
+// Items past this would not all have different $I names.
+const uint64_t MAX_CORPUS_ITEMS = 2176782336ULL;
+
+// Returns false if the corpus could not all be written.
+bool WriteCorpus(const wchar_t* szOutput, const CorpusOptions* pOptions);
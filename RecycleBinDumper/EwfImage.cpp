@@ -0,0 +1,499 @@
+// EwfImage.cpp
+//
+// EWF segment files, chunk tables and the decompressed chunk cache.
+
+#include "EwfImage.h"
+#include "Inflate.h"
+#include "strsafe.h"
+#include "string.h"
+#include "wchar.h"
+
+static const uint8_t EWF_SIGNATURE[8] = { 'E', 'V', 'F', 0x09, 0x0D, 0x0A, 0xFF, 0x00 };
+static const uint32_t EWF_HEADER_SIZE = 13;
+
+// Section descriptor: a 16 byte type, the offset of the next section in the segment file and
+// the size of this one (descriptor included).
+static const uint32_t SECTION_SIZE = 76;
+static const uint32_t SECTION_NEXT = 16;
+static const uint32_t SECTION_LENGTH = 24;
+
+static const uint32_t VOLUME_CHUNK_COUNT = 4;
+static const uint32_t VOLUME_SECTORS_PER_CHUNK = 8;
+static const uint32_t VOLUME_BYTES_PER_SECTOR = 12;
+static const uint32_t VOLUME_SECTOR_COUNT = 16;
+static const uint32_t VOLUME_MIN_SIZE = 24;
+
+static const uint32_t TABLE_ENTRY_COUNT = 0;
+static const uint32_t TABLE_BASE_OFFSET = 8;
+static const uint32_t TABLE_HEADER_SIZE = 24;
+static const uint32_t TABLE_COMPRESSED = 0x80000000;
+
+// EnCase 5 and earlier write at most 16375 entries to a table, later versions and other tools
+// more, so only a table of over 65536 entries is taken to be damaged.
+static const uint32_t MAX_TABLE_ENTRIES = 65536;
+
+// The largest chunk size allowed, EnCase uses 32KB.
+static const uint32_t MAX_CHUNK_SIZE = 4 * 1024 * 1024;
+
+// A segment with more sections than this is taken to loop.
+static const uint32_t MAX_SECTIONS = 1000000;
+
+static uint32_t Read32(const uint8_t* p)
+	{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+	}
+
+static uint64_t Read64(const uint8_t* p)
+	{
+	return (uint64_t)Read32(p) | ((uint64_t)Read32(p + 4) << 32);
+	}
+
+// The type is not terminated if it fills all 16 bytes.
+static bool IsSectionType(const uint8_t* pSection, const char* szType)
+	{
+	return strncmp((const char*)pSection, szType, 16) == 0;
+	}
+
+// Segment n (1 based) of the image is .E01 to .E99 and then .EAA to .EZZ, .FAA, ... keeping
+// the case of the first segment's extension.
+static bool GetSegmentName(const wchar_t* szFirst, uint32_t segment, wchar_t* buffer, size_t size)
+	{
+	StringCchCopy(buffer, size, szFirst);
+
+	size_t length = wcslen(buffer);
+	if ((length < 4) || (buffer[length - 4] != L'.'))
+		{
+		return false;
+		}
+
+	wchar_t* pExtension = buffer + length - 3;
+	wchar_t base = ((pExtension[0] >= L'a') && (pExtension[0] <= L'z')) ? L'a' : L'A';
+
+	if (segment <= 99)
+		{
+		pExtension[1] = (wchar_t)(L'0' + segment / 10);
+		pExtension[2] = (wchar_t)(L'0' + segment % 10);
+		return true;
+		}
+
+	uint32_t index = segment - 100;
+	uint32_t first = (uint32_t)(pExtension[0] - base) + index / (26 * 26);
+	if (first >= 26)
+		{
+		return false;
+		}
+
+	pExtension[0] = (wchar_t)(base + first);
+	pExtension[1] = (wchar_t)(base + (index / 26) % 26);
+	pExtension[2] = (wchar_t)(base + index % 26);
+	return true;
+	}
+
+bool EwfImage::IsEwfHeader(const uint8_t* pHeader, size_t cbHeader)
+	{
+	return (cbHeader >= sizeof(EWF_SIGNATURE)) && (memcmp(pHeader, EWF_SIGNATURE, sizeof(EWF_SIGNATURE)) == 0);
+	}
+
+EwfImage::EwfImage(size_t cacheSize)
+	{
+	this->size = 0;
+	this->chunkSize = 0;
+	this->cacheChunks = 0;
+	this->cacheSize = cacheSize;
+	for (size_t i = 0; i < SEQUENTIAL_STREAMS; i++)
+		{
+		this->streamEnds[i] = 0;
+		}
+	this->nextStream = 0;
+	this->isStopping = false;
+	}
+
+EwfImage::~EwfImage()
+	{
+	this->lock.lock();
+	this->isStopping = true;
+	this->lock.unlock();
+	this->queued.notify_all();
+
+	for (size_t i = 0; i < this->workers.size(); i++)
+		{
+		this->workers[i].join();
+		}
+
+	for (size_t i = 0; i < this->segments.size(); i++)
+		{
+		delete this->segments[i];
+		}
+	}
+
+bool EwfImage::Open(const wchar_t* szFileName)
+	{
+	wchar_t szSegment[MAX_PATH];
+	StringCchCopy(szSegment, MAX_PATH, szFileName);
+
+	bool isLast = false;
+	for (uint32_t segment = 1; !isLast; segment++)
+		{
+		if ((segment > 1) && !GetSegmentName(szFileName, segment, szSegment, MAX_PATH))
+			{
+			return false;
+			}
+
+		if (!this->OpenSegment(szSegment, &isLast))
+			{
+			return false;
+			}
+		}
+
+	if ((this->chunkSize == 0) || this->chunks.empty())
+		{
+		return false;
+		}
+
+	// A damaged or incomplete set is read as far as it has chunks.
+	if (this->size > (uint64_t)this->chunks.size() * this->chunkSize)
+		{
+		this->size = (uint64_t)this->chunks.size() * this->chunkSize;
+		}
+
+	// Room for at least a few reads' worth of chunks and what is prefetched after them.
+	this->cacheChunks = this->cacheSize / this->chunkSize;
+	if (this->cacheChunks < 4 * PREFETCH_CHUNKS)
+		{
+		this->cacheChunks = 4 * PREFETCH_CHUNKS;
+		}
+
+	unsigned threadCount = std::thread::hardware_concurrency();
+	threadCount = (threadCount == 0) ? 1 : threadCount;
+	for (unsigned i = 0; i < threadCount; i++)
+		{
+		this->workers.push_back(std::thread(&EwfImage::Worker, this));
+		}
+
+	return true;
+	}
+
+bool EwfImage::OpenSegment(const wchar_t* szFileName, bool* pIsLast)
+	{
+	RawImage* pSegment = new RawImage();
+	if (!pSegment->Open(szFileName))
+		{
+		delete pSegment;
+		return false;
+		}
+	this->segments.push_back(pSegment);
+
+	uint8_t header[EWF_HEADER_SIZE];
+	if (!pSegment->Read(0, header, EWF_HEADER_SIZE) || !IsEwfHeader(header, EWF_HEADER_SIZE))
+		{
+		return false;
+		}
+
+	// The chunks of a table end where the sectors section before it ends.
+	uint64_t sectorsEnd = 0;
+	uint64_t offset = EWF_HEADER_SIZE;
+
+	for (uint32_t i = 0; i < MAX_SECTIONS; i++)
+		{
+		uint8_t section[SECTION_SIZE];
+		if (!pSegment->Read(offset, section, SECTION_SIZE))
+			{
+			return false;
+			}
+
+		uint64_t next = Read64(section + SECTION_NEXT);
+		uint64_t length = Read64(section + SECTION_LENGTH);
+
+		if (IsSectionType(section, "volume") || IsSectionType(section, "disk"))
+			{
+			uint8_t volume[VOLUME_MIN_SIZE];
+			if (!pSegment->Read(offset + SECTION_SIZE, volume, VOLUME_MIN_SIZE))
+				{
+				return false;
+				}
+
+			uint64_t chunkSize = (uint64_t)Read32(volume + VOLUME_SECTORS_PER_CHUNK) * Read32(volume + VOLUME_BYTES_PER_SECTOR);
+			if ((chunkSize == 0) || (chunkSize > MAX_CHUNK_SIZE) || (Read32(volume + VOLUME_CHUNK_COUNT) == 0))
+				{
+				return false;
+				}
+
+			this->chunkSize = (uint32_t)chunkSize;
+			this->size = Read64(volume + VOLUME_SECTOR_COUNT) * Read32(volume + VOLUME_BYTES_PER_SECTOR);
+			}
+		else if (IsSectionType(section, "sectors"))
+			{
+			sectorsEnd = offset + length;
+			}
+		else if (IsSectionType(section, "table"))
+			{
+			// "table2" is a copy of the table, for recovery, and is not read.
+			if (!this->ReadTable(pSegment, offset, sectorsEnd))
+				{
+				return false;
+				}
+			}
+		else if (IsSectionType(section, "next") || IsSectionType(section, "done"))
+			{
+			*pIsLast = IsSectionType(section, "done");
+			return true;
+			}
+
+		if (next <= offset)
+			{
+			break;
+			}
+		offset = next;
+		}
+
+	// A segment that ends without a "next" section is taken to be the last one.
+	*pIsLast = true;
+	return true;
+	}
+
+bool EwfImage::ReadTable(RawImage* pSegment, uint64_t sectionOffset, uint64_t sectorsEnd)
+	{
+	uint8_t header[TABLE_HEADER_SIZE];
+	if (!pSegment->Read(sectionOffset + SECTION_SIZE, header, TABLE_HEADER_SIZE))
+		{
+		return false;
+		}
+
+	uint32_t entryCount = Read32(header + TABLE_ENTRY_COUNT);
+	uint64_t baseOffset = Read64(header + TABLE_BASE_OFFSET);
+	if (entryCount > MAX_TABLE_ENTRIES)
+		{
+		return false;
+		}
+
+	std::vector<uint8_t> entries((size_t)entryCount * 4);
+	if (!pSegment->Read(sectionOffset + SECTION_SIZE + TABLE_HEADER_SIZE, entries.data(), entries.size()))
+		{
+		return false;
+		}
+
+	for (uint32_t i = 0; i < entryCount; i++)
+		{
+		uint32_t entry = Read32(entries.data() + 4 * i);
+
+		Chunk chunk;
+		chunk.segment = (uint32_t)this->segments.size() - 1;
+		chunk.offset = baseOffset + (entry & ~TABLE_COMPRESSED);
+		chunk.isCompressed = (entry & TABLE_COMPRESSED) != 0;
+
+		// A chunk's stored size is up to where the next one starts.  The last one ends with the
+		// sectors section, or where the table starts in images written without one.
+		uint64_t chunkEnd = (sectorsEnd > chunk.offset) ? sectorsEnd : sectionOffset;
+		if (i + 1 < entryCount)
+			{
+			chunkEnd = baseOffset + (Read32(entries.data() + 4 * (i + 1)) & ~TABLE_COMPRESSED);
+			}
+		uint64_t size = (chunkEnd > chunk.offset) ? chunkEnd - chunk.offset : 0;
+
+		// A compressed chunk can be a little larger than the chunk itself, never much larger.
+		chunk.size = (uint32_t)((size < 2ULL * this->chunkSize + 64) ? size : 2ULL * this->chunkSize + 64);
+		this->chunks.push_back(chunk);
+		}
+
+	return true;
+	}
+
+uint64_t EwfImage::GetSize()
+	{
+	return this->size;
+	}
+
+bool EwfImage::Read(uint64_t offset, void* pBuffer, size_t cbData)
+	{
+	if ((offset > this->size) || (cbData > this->size - offset))
+		{
+		return false;
+		}
+
+	if (cbData == 0)
+		{
+		return true;
+		}
+
+	uint64_t first = offset / this->chunkSize;
+	uint64_t last = (offset + cbData - 1) / this->chunkSize;
+
+	std::unique_lock<std::mutex> guard(this->lock);
+
+	// A read that follows on from an earlier one (e.g. the MFT being scanned) queues the chunks
+	// after it too, so they are decompressed while this part is being used.  The end of each
+	// of the last few streams is kept, so that the volumes scanned at once on threads of their
+	// own do not break each other's streams.
+	uint64_t queueLast = last;
+	size_t stream = 0;
+	while ((stream < SEQUENTIAL_STREAMS) && (this->streamEnds[stream] != offset))
+		{
+		stream++;
+		}
+
+	if (stream < SEQUENTIAL_STREAMS)
+		{
+		queueLast = last + PREFETCH_CHUNKS;
+		queueLast = (queueLast < this->chunks.size()) ? queueLast : this->chunks.size() - 1;
+		}
+	else
+		{
+		stream = this->nextStream;
+		this->nextStream = (this->nextStream + 1) % SEQUENTIAL_STREAMS;
+		}
+	this->streamEnds[stream] = offset + cbData;
+
+	for (uint64_t chunk = first; chunk <= queueLast; chunk++)
+		{
+		if (this->cache.find(chunk) == this->cache.end())
+			{
+			this->Request(chunk);
+			}
+		}
+	this->queued.notify_all();
+
+	uint8_t* p = (uint8_t*)pBuffer;
+	for (uint64_t chunk = first; chunk <= last; chunk++)
+		{
+		std::unordered_map<uint64_t, CachedChunk>::iterator it;
+		for (;;)
+			{
+			it = this->cache.find(chunk);
+			if (it == this->cache.end())
+				{
+				// Evicted by another reader before it was used.
+				this->Request(chunk);
+				this->queued.notify_all();
+				}
+			else if (it->second.isLoaded)
+				{
+				break;
+				}
+
+			this->loaded.wait(guard);
+			}
+
+		uint64_t chunkStart = chunk * this->chunkSize;
+		size_t start = (size_t)((offset > chunkStart) ? offset - chunkStart : 0);
+		size_t count = this->chunkSize - start;
+		count = (count < cbData) ? count : cbData;
+
+		if (!it->second.isValid || (start + count > it->second.data.size()))
+			{
+			return false;
+			}
+
+		memcpy(p, it->second.data.data() + start, count);
+		p += count;
+		cbData -= count;
+
+		this->lru.splice(this->lru.begin(), this->lru, it->second.lru);
+		}
+
+	return true;
+	}
+
+void EwfImage::Request(uint64_t chunk)
+	{
+	this->lru.push_front(chunk);
+
+	CachedChunk& cached = this->cache[chunk];
+	cached.lru = this->lru.begin();
+	cached.isLoaded = false;
+	cached.isValid = false;
+
+	this->queue.push_back(chunk);
+	this->Evict();
+	}
+
+void EwfImage::Evict()
+	{
+	// Chunks still being decompressed are never evicted.
+	std::list<uint64_t>::iterator it = this->lru.end();
+	while ((this->cache.size() > this->cacheChunks) && (it != this->lru.begin()))
+		{
+		--it;
+		std::unordered_map<uint64_t, CachedChunk>::iterator cached = this->cache.find(*it);
+		if (cached->second.isLoaded)
+			{
+			this->cache.erase(cached);
+			it = this->lru.erase(it);
+			}
+		}
+	}
+
+void EwfImage::Worker()
+	{
+	std::unique_lock<std::mutex> guard(this->lock);
+
+	for (;;)
+		{
+		while (this->queue.empty() && !this->isStopping)
+			{
+			this->queued.wait(guard);
+			}
+
+		if (this->isStopping)
+			{
+			return;
+			}
+
+		uint64_t chunk = this->queue.front();
+		this->queue.pop_front();
+
+		guard.unlock();
+		std::vector<uint8_t> data;
+		bool isValid = this->LoadChunk(chunk, &data);
+		guard.lock();
+
+		std::unordered_map<uint64_t, CachedChunk>::iterator it = this->cache.find(chunk);
+		if ((it != this->cache.end()) && !it->second.isLoaded)
+			{
+			it->second.data.swap(data);
+			it->second.isLoaded = true;
+			it->second.isValid = isValid;
+			}
+		this->loaded.notify_all();
+		}
+	}
+
+bool EwfImage::LoadChunk(uint64_t chunk, std::vector<uint8_t>* pData)
+	{
+	const Chunk& entry = this->chunks[(size_t)chunk];
+	std::vector<uint8_t> stored(entry.size);
+
+	if ((entry.size == 0) || !this->segments[entry.segment]->Read(entry.offset, stored.data(), stored.size()))
+		{
+		return false;
+		}
+
+	// Only the last chunk of the image may be short.
+	uint64_t chunkStart = chunk * this->chunkSize;
+	size_t expected = (size_t)((this->size - chunkStart < this->chunkSize) ? this->size - chunkStart : this->chunkSize);
+
+	if (entry.isCompressed)
+		{
+		size_t written = 0;
+		pData->resize(this->chunkSize);
+		if (!ZlibInflate(stored.data(), stored.size(), pData->data(), pData->size(), &written) || (written < expected))
+			{
+			return false;
+			}
+		pData->resize(written);
+		return true;
+		}
+
+	// An uncompressed chunk is followed by the Adler-32 of its data.
+	if (entry.size < expected + 4)
+		{
+		return false;
+		}
+
+	if (Adler32(stored.data(), expected) != Read32(stored.data() + expected))
+		{
+		return false;
+		}
+
+	pData->assign(stored.begin(), stored.begin() + expected);
+	return true;
+	}
@@ -0,0 +1,102 @@
+// EwfImage.h
+//
+// Reads an Expert Witness Format (EWF, i.e. EnCase .E01) disk image without converting it to a
+// raw image first.
+//
+// An EWF image is a set of segment files (.E01, .E02, ... .E99, .EAA, ...), each a list of
+// sections.  The "volume" (or "disk") section gives the size of the image and of its chunks
+// (usually 32KB), the "sectors" sections hold the chunks, and the "table" sections give where
+// each chunk is and whether it is zlib compressed.  The tables of all the segments are read
+// when the image is opened, so any chunk can be found without reading anything else.
+//
+// Decompressed chunks are kept in a cache of fixed size, least recently used chunks first out,
+// so MFT records and index blocks that are read again (e.g. the records below the $R folders)
+// are not decompressed twice.  Chunks are decompressed by a pool of worker threads, so a large
+// read (the MFT is read 4MB at a time) has all of its chunks decompressed in parallel, and a
+// read that follows on from the last one also queues the chunks after it, so the next part of
+// the MFT is being decompressed while the current one is parsed.
+
+#pragma once
+
+#include "windows.h"
+#include "cstdint"
+#include "cstddef"
+#include "BlockDevice.h"
+#include <vector>
+#include <list>
+#include <deque>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+class EwfImage : public BlockDevice
+	{
+	public:
+		// cacheSize is the most bytes of decompressed chunks to keep.
+		EwfImage(size_t cacheSize);
+		~EwfImage();
+
+		// Open the first segment file of the image, the others are found from its name.
+		bool Open(const wchar_t* szFileName);
+
+		virtual uint64_t GetSize();
+		virtual bool Read(uint64_t offset, void* pBuffer, size_t cbData);
+
+		// Whether the start of a file is an EWF segment file header.
+		static bool IsEwfHeader(const uint8_t* pHeader, size_t cbHeader);
+
+	protected:
+		struct Chunk
+			{
+			uint32_t segment;
+			uint64_t offset;            // In the segment file.
+			uint32_t size;              // Stored size, with the checksum of an uncompressed chunk.
+			bool isCompressed;
+			};
+
+		struct CachedChunk
+			{
+			std::vector<uint8_t> data;
+			std::list<uint64_t>::iterator lru;
+			bool isLoaded;              // Still being decompressed if false.
+			bool isValid;
+			};
+
+		// Reads the sections of one segment file, adding its chunks.  isLast is set if it is
+		// the last segment of the image.
+		bool OpenSegment(const wchar_t* szFileName, bool* pIsLast);
+		bool ReadTable(RawImage* pSegment, uint64_t sectionOffset, uint64_t sectorsEnd);
+
+		// Read and decompress a chunk, called by the workers without the lock held.
+		bool LoadChunk(uint64_t chunk, std::vector<uint8_t>* pData);
+
+		// Called with the lock held.
+		void Request(uint64_t chunk);
+		void Evict();
+
+		void Worker();
+
+		static const uint64_t PREFETCH_CHUNKS = 128;
+		static const size_t SEQUENTIAL_STREAMS = 8;
+
+		std::vector<RawImage*> segments;
+		std::vector<Chunk> chunks;
+		uint64_t size;
+		uint32_t chunkSize;
+		size_t cacheChunks;
+		size_t cacheSize;
+
+		// Guards everything below.
+		std::mutex lock;
+		std::condition_variable queued;
+		std::condition_variable loaded;
+		std::deque<uint64_t> queue;
+		std::unordered_map<uint64_t, CachedChunk> cache;
+		std::list<uint64_t> lru;            // Most recently used first.
+		uint64_t streamEnds[SEQUENTIAL_STREAMS];    // Offset just after the last read of each stream.
+		size_t nextStream;                  // Stream replaced by the next read that starts a new one.
+		bool isStopping;
+
+		std::vector<std::thread> workers;
+	};
@@ -0,0 +1,129 @@
+// FileSource.cpp
+//
+// Reading Recycle Bins through the file system.
+
+#include "FileSource.h"
+#include "Stats.h"
+#include "strsafe.h"
+#include "wchar.h"
+#include "wctype.h"
+
+bool FileSource::MatchWildcard(const wchar_t* szWild, const wchar_t* szName)
+	{
+	// Backtrack to just after the last '*' seen when the rest does not match.
+	const wchar_t* pStar = NULL;
+	const wchar_t* pStarName = NULL;
+
+	while (*szName != L'\0')
+		{
+		if (*szWild == L'*')
+			{
+			pStar = ++szWild;
+			pStarName = szName;
+			}
+		else if ((*szWild == L'?') || ((*szWild != L'\0') && (towupper(*szWild) == towupper(*szName))))
+			{
+			szWild++;
+			szName++;
+			}
+		else if (pStar != NULL)
+			{
+			szWild = pStar;
+			szName = ++pStarName;
+			}
+		else
+			{
+			return false;
+			}
+		}
+
+	while (*szWild == L'*')
+		{
+		szWild++;
+		}
+
+	return *szWild == L'\0';
+	}
+
+LocalFileSource::LocalFileSource()
+	{
+	this->readBuffer = new uint8_t[READ_SIZE];
+	}
+
+LocalFileSource::~LocalFileSource()
+	{
+	delete[] this->readBuffer;
+	}
+
+void LocalFileSource::FindFiles(const wchar_t* szFolder, const wchar_t* szWild, FoundFileHandler fn, void* context)
+	{
+	WIN32_FIND_DATA ffd;
+	wchar_t szPattern[MAX_PATH];
+
+	StringCchCopy(szPattern, MAX_PATH, szFolder);
+	StringCchCat(szPattern, MAX_PATH, L"\\");
+	StringCchCat(szPattern, MAX_PATH, szWild);
+
+	StatsTimer findFirst(STATS_FIND_FIRST_FILE);
+	HANDLE hFind = FindFirstFile(szPattern, &ffd);
+	findFirst.Stop();
+	if (hFind == INVALID_HANDLE_VALUE)
+		{
+		return;
+		}
+
+	// Only the calls are timed, not the handler.
+	bool found;
+	do
+		{
+		fn(&ffd, context);
+
+		StatsTimer findNext(STATS_FIND_NEXT_FILE);
+		found = (FindNextFile(hFind, &ffd) != 0);
+		findNext.Stop();
+		} while (found);
+
+	FindClose(hFind);
+	}
+
+bool LocalFileSource::GetAttributes(const wchar_t* szFileName, WIN32_FILE_ATTRIBUTE_DATA* pAttributes)
+	{
+	StatsTimer timer(STATS_GET_ATTRIBUTES);
+	bool found = (GetFileAttributesEx(szFileName, GetFileExInfoStandard, pAttributes) != 0);
+	timer.Stop();
+
+	return found;
+	}
+
+bool LocalFileSource::ReadFileData(const wchar_t* szFileName, FileDataHandler fn, void* context)
+	{
+	StatsTimer open(STATS_OPEN_FILE);
+	HANDLE hFile = CreateFile(szFileName, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	open.Stop();
+	if (hFile == INVALID_HANDLE_VALUE)
+		{
+		return false;
+		}
+
+	bool complete = true;
+	DWORD bytesRead = 0;
+	do
+		{
+		StatsTimer read(STATS_READ_FILE);
+		if (!ReadFile(hFile, this->readBuffer, READ_SIZE, &bytesRead, NULL))
+			{
+			complete = false;
+			break;
+			}
+		read.Stop(bytesRead);
+
+		if ((bytesRead > 0) && !fn(this->readBuffer, bytesRead, context))
+			{
+			complete = false;
+			break;
+			}
+		} while (bytesRead > 0);
+
+	CloseHandle(hFile);
+	return complete;
+	}
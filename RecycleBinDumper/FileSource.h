@@ -0,0 +1,56 @@
+// FileSource.h
+//
+// Where the files of a Recycle Bin are read from.  The dump only ever enumerates folders,
+// looks up a file's attributes and reads a file's contents, always by a path relative to the
+// Recycle Bin folder (e.g. "$IABC123.txt" or "$RDEF456\sub\y.bin"), so those three operations
+// are all a source has to provide.  LocalFileSource reads the Recycle Bin in the current
+// directory through the file system, and the image readers provide sources that read the
+// Recycle Bins of a volume straight out of a disk image.
+
+#pragma once
+
+#include "windows.h"
+#include "cstdint"
+#include "cstddef"
+
+// Called with each file or folder found.
+typedef void (*FoundFileHandler)(WIN32_FIND_DATA* pffd, void* context);
+
+// Called with each successive part of a file's contents, return false to stop reading.
+typedef bool (*FileDataHandler)(const uint8_t* pData, size_t cbData, void* context);
+
+class FileSource
+	{
+	public:
+		virtual ~FileSource() {}
+
+		// Call fn for each file and folder in the folder whose name matches the wildcard
+		// (* and ? only).  Sources need not report the "." and ".." entries.
+		virtual void FindFiles(const wchar_t* szFolder, const wchar_t* szWild, FoundFileHandler fn, void* context) = 0;
+
+		// Returns false if the file does not exist.
+		virtual bool GetAttributes(const wchar_t* szFileName, WIN32_FILE_ATTRIBUTE_DATA* pAttributes) = 0;
+
+		// Pass the file's contents to fn from the start, in parts of any size.  Returns false if
+		// the file could not be read to the end (or fn stopped it).
+		virtual bool ReadFileData(const wchar_t* szFileName, FileDataHandler fn, void* context) = 0;
+
+		// Case insensitive match of a name against a wildcard with * and ? in it.
+		static bool MatchWildcard(const wchar_t* szWild, const wchar_t* szName);
+	};
+
+// Reads a Recycle Bin through the file system, relative to the current directory.
+class LocalFileSource : public FileSource
+	{
+	public:
+		LocalFileSource();
+		~LocalFileSource();
+
+		virtual void FindFiles(const wchar_t* szFolder, const wchar_t* szWild, FoundFileHandler fn, void* context);
+		virtual bool GetAttributes(const wchar_t* szFileName, WIN32_FILE_ATTRIBUTE_DATA* pAttributes);
+		virtual bool ReadFileData(const wchar_t* szFileName, FileDataHandler fn, void* context);
+
+	protected:
+		static const DWORD READ_SIZE = 1024 * 1024;
+		uint8_t* readBuffer;
+	};
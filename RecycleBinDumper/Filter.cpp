@@ -0,0 +1,375 @@
+// Filter.cpp
+//
+// Row filters evaluated during the walk.
+
+#include "Filter.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "wchar.h"
+
+static uint64_t FileTimeValue(const FILETIME* pFileTime)
+	{
+	return (((uint64_t)pFileTime->dwHighDateTime) << 32) + pFileTime->dwLowDateTime;
+	}
+
+// Parse "YYYY-MM-DD", optionally followed by " HH:MM:SS" (or "THH:MM:SS"), as UTC.
+static bool ParseDateTime(const wchar_t* szValue, uint64_t* pTime)
+	{
+	SYSTEMTIME utc = {};
+	int year = 0, month = 0, day = 0, hour = 0, minute = 0, second = 0;
+	int consumed = 0;
+
+	if (swscanf_s(szValue, L"%d-%d-%d%n", &year, &month, &day, &consumed) != 3)
+		{
+		return false;
+		}
+
+	const wchar_t* szTime = szValue + consumed;
+	if (*szTime != L'\0')
+		{
+		if (((*szTime != L' ') && (*szTime != L'T'))
+			|| (swscanf_s(szTime + 1, L"%d:%d:%d%n", &hour, &minute, &second, &consumed) != 3)
+			|| (szTime[1 + consumed] != L'\0'))
+			{
+			return false;
+			}
+		}
+
+	utc.wYear = (WORD)year;
+	utc.wMonth = (WORD)month;
+	utc.wDay = (WORD)day;
+	utc.wHour = (WORD)hour;
+	utc.wMinute = (WORD)minute;
+	utc.wSecond = (WORD)second;
+
+	FILETIME fileTime;
+	if (!SystemTimeToFileTime(&utc, &fileTime))
+		{
+		return false;
+		}
+
+	*pTime = FileTimeValue(&fileTime);
+	return true;
+	}
+
+static bool ParseSize(const wchar_t* szValue, uint64_t* pSize)
+	{
+	wchar_t* pEnd = NULL;
+	*pSize = _wcstoui64(szValue, &pEnd, 10);
+	return (pEnd != szValue) && (*pEnd == L'\0');
+	}
+
+// Extension of the last component of the path, including the '.', or NULL if it has none.
+static const wchar_t* GetExtension(const wchar_t* szPath)
+	{
+	const wchar_t* pExtension = NULL;
+	for (const wchar_t* p = szPath; *p != L'\0'; p++)
+		{
+		if (*p == L'.')
+			{
+			pExtension = p;
+			}
+		else if (*p == L'\\')
+			{
+			pExtension = NULL;
+			}
+		}
+
+	return pExtension;
+	}
+
+// Read a volume's $UpCase file (128KB) into the table.
+static bool LoadUpcaseTable(const wchar_t* szFileName, UpcaseTable* pUpcase)
+	{
+	FILE* pFile;
+	if (_wfopen_s(&pFile, szFileName, L"rb") != 0)
+		{
+		return false;
+		}
+
+	uint8_t* pData = new uint8_t[65536 * sizeof(uint16_t) + 1];
+	size_t cbData = fread(pData, 1, 65536 * sizeof(uint16_t) + 1, pFile);
+	fclose(pFile);
+
+	bool loaded = pUpcase->Load(pData, cbData);
+	delete[] pData;
+	return loaded;
+	}
+
+Filter::Filter()
+	: includePaths(&this->upcase), excludePaths(&this->upcase)
+	{
+	this->hasDeletedAfter = false;
+	this->hasDeletedBefore = false;
+	this->deletedAfter = 0;
+	this->deletedBefore = 0;
+	this->hasMinSize = false;
+	this->hasMaxSize = false;
+	this->minSize = 0;
+	this->maxSize = 0;
+	}
+
+Filter::~Filter()
+	{
+	for (size_t i = 0; i < this->sids.size(); i++)
+		{
+		free(this->sids[i]);
+		}
+
+	for (size_t i = 0; i < this->extensions.size(); i++)
+		{
+		free(this->extensions[i]);
+		}
+	}
+
+bool Filter::IsFilterOption(const wchar_t* szOption)
+	{
+	return (wcscmp(szOption, L"--deleted-after") == 0)
+		|| (wcscmp(szOption, L"--deleted-before") == 0)
+		|| (wcscmp(szOption, L"--min-size") == 0)
+		|| (wcscmp(szOption, L"--max-size") == 0)
+		|| (wcscmp(szOption, L"--sid") == 0)
+		|| (wcscmp(szOption, L"--path") == 0)
+		|| (wcscmp(szOption, L"--exclude-path") == 0)
+		|| (wcscmp(szOption, L"--path-list") == 0)
+		|| (wcscmp(szOption, L"--exclude-path-list") == 0)
+		|| (wcscmp(szOption, L"--upcase-table") == 0)
+		|| (wcscmp(szOption, L"--ext") == 0);
+	}
+
+bool Filter::SetOption(const wchar_t* szOption, const wchar_t* szValue)
+	{
+	if (wcscmp(szOption, L"--deleted-after") == 0)
+		{
+		this->hasDeletedAfter = ParseDateTime(szValue, &this->deletedAfter);
+		return this->hasDeletedAfter;
+		}
+	else if (wcscmp(szOption, L"--deleted-before") == 0)
+		{
+		this->hasDeletedBefore = ParseDateTime(szValue, &this->deletedBefore);
+		return this->hasDeletedBefore;
+		}
+	else if (wcscmp(szOption, L"--min-size") == 0)
+		{
+		this->hasMinSize = ParseSize(szValue, &this->minSize);
+		return this->hasMinSize;
+		}
+	else if (wcscmp(szOption, L"--max-size") == 0)
+		{
+		this->hasMaxSize = ParseSize(szValue, &this->maxSize);
+		return this->hasMaxSize;
+		}
+	else if (wcscmp(szOption, L"--sid") == 0)
+		{
+		this->sids.push_back(_wcsdup(szValue));
+		return true;
+		}
+	else if (wcscmp(szOption, L"--path") == 0)
+		{
+		this->includePaths.AddPattern(szValue);
+		return true;
+		}
+	else if (wcscmp(szOption, L"--exclude-path") == 0)
+		{
+		this->excludePaths.AddPattern(szValue);
+		return true;
+		}
+	else if (wcscmp(szOption, L"--path-list") == 0)
+		{
+		return this->includePaths.AddPatternFile(szValue);
+		}
+	else if (wcscmp(szOption, L"--exclude-path-list") == 0)
+		{
+		return this->excludePaths.AddPatternFile(szValue);
+		}
+	else if (wcscmp(szOption, L"--upcase-table") == 0)
+		{
+		return LoadUpcaseTable(szValue, &this->upcase);
+		}
+	else if (wcscmp(szOption, L"--ext") == 0)
+		{
+		// A comma separated list, with or without the leading '.' on each extension.
+		const wchar_t* p = szValue;
+		while (*p != L'\0')
+			{
+			const wchar_t* pEnd = wcschr(p, L',');
+			size_t length = (pEnd != NULL) ? (size_t)(pEnd - p) : wcslen(p);
+
+			if (*p == L'.')
+				{
+				p++;
+				length--;
+				}
+
+			if (length > 0)
+				{
+				wchar_t* szExtension = (wchar_t*)malloc((length + 2) * sizeof(wchar_t));
+				szExtension[0] = L'.';
+				memcpy(szExtension + 1, p, length * sizeof(wchar_t));
+				szExtension[length + 1] = L'\0';
+				this->extensions.push_back(szExtension);
+				}
+
+			p += length;
+			if (*p == L',')
+				{
+				p++;
+				}
+			}
+
+		return !this->extensions.empty();
+		}
+
+	return false;
+	}
+
+void Filter::Prepare()
+	{
+	this->includePaths.Compile();
+	this->excludePaths.Compile();
+	}
+
+bool Filter::MatchesBin(const wchar_t* szSid)
+	{
+	if (this->sids.empty())
+		{
+		return true;
+		}
+
+	for (size_t i = 0; i < this->sids.size(); i++)
+		{
+		if (_wcsicmp(this->sids[i], szSid) == 0)
+			{
+			return true;
+			}
+		}
+
+	return false;
+	}
+
+bool Filter::MatchesItem(RecycleInfo* pInfo)
+	{
+	// With no $I file there is no deleted time to test, and no deleted size to rule the item
+	// out by, so MatchesRow() tests the size of each $R file instead.
+	if (pInfo == NULL)
+		{
+		return !this->hasDeletedAfter && !this->hasDeletedBefore;
+		}
+
+	uint64_t deletedTime = FileTimeValue(&pInfo->deletedTime);
+	if (this->hasDeletedAfter && (deletedTime < this->deletedAfter))
+		{
+		return false;
+		}
+
+	if (this->hasDeletedBefore && (deletedTime >= this->deletedBefore))
+		{
+		return false;
+		}
+
+	// The deleted size is the total of every file in a deleted folder, so no file in it
+	// can be any larger.
+	if (this->hasMinSize && (pInfo->deletedSize < this->minSize))
+		{
+		return false;
+		}
+
+	return true;
+	}
+
+bool Filter::MatchesRow(RecycleRow* pRow)
+	{
+	bool selectsFiles = this->hasMinSize || this->hasMaxSize || !this->extensions.empty();
+
+	if (pRow->isFolder && selectsFiles)
+		{
+		return false;
+		}
+
+	if ((this->hasMinSize || this->hasMaxSize) && pRow->isMissing)
+		{
+		return false;
+		}
+
+	if (this->hasMinSize && (pRow->size < this->minSize))
+		{
+		return false;
+		}
+
+	if (this->hasMaxSize && (pRow->size > this->maxSize))
+		{
+		return false;
+		}
+
+	if (!this->extensions.empty())
+		{
+		const wchar_t* szExtension = GetExtension(pRow->szFileName);
+		bool found = false;
+
+		for (size_t i = 0; (i < this->extensions.size()) && !found && (szExtension != NULL); i++)
+			{
+			found = (_wcsicmp(this->extensions[i], szExtension) == 0);
+			}
+
+		if (!found)
+			{
+			return false;
+			}
+		}
+
+	if (!this->includePaths.IsEmpty() || !this->excludePaths.IsEmpty())
+		{
+		size_t length = GetOriginalPath(pRow, this->originalPath, MAX_ORIGINAL_PATH);
+
+		if (!this->includePaths.IsEmpty() && !this->includePaths.Matches(this->originalPath, length))
+			{
+			return false;
+			}
+
+		if (!this->excludePaths.IsEmpty() && this->excludePaths.Matches(this->originalPath, length))
+			{
+			return false;
+			}
+		}
+
+	return true;
+	}
+
+bool Filter::CouldMatchBelow(RecycleRow* pRow)
+	{
+	if (this->includePaths.IsEmpty() && this->excludePaths.IsEmpty())
+		{
+		return true;
+		}
+
+	size_t length = GetOriginalPath(pRow, this->originalPath, MAX_ORIGINAL_PATH - 1);
+	if (length == 0)
+		{
+		return true;
+		}
+
+	// Everything below the folder starts with its path and a separator.
+	this->originalPath[length++] = L'\\';
+
+	bool couldMatch, alwaysMatches;
+	if (!this->includePaths.IsEmpty())
+		{
+		this->includePaths.MatchPrefix(this->originalPath, length, &couldMatch, &alwaysMatches);
+		if (!couldMatch)
+			{
+			return false;
+			}
+		}
+
+	if (!this->excludePaths.IsEmpty())
+		{
+		this->excludePaths.MatchPrefix(this->originalPath, length, &couldMatch, &alwaysMatches);
+		if (alwaysMatches)
+			{
+			return false;
+			}
+		}
+
+	return true;
+	}
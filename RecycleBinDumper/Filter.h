@@ -0,0 +1,72 @@
+// Filter.h
+//
+// Filters that select which rows are output.  They are evaluated on the values of a row before
+// any of its text is formatted, and as early in the walk as each one can be decided:
+//
+//   --sid                              decided per Recycle Bin, before it is enumerated.
+//   --deleted-after, --deleted-before  decided per deleted item from its $I file, before its $R
+//                                      file or folder is looked at.
+//   --min-size                         also decided per deleted item, since no file in a deleted
+//                                      folder can be larger than the folder's "Deleted Size".
+//   --path, --exclude-path             decided per row, and before descending into a folder, which
+//                                      is skipped if no pattern can match anything below it (or an
+//                                      exclude pattern matches everything below it).  All of the
+//                                      patterns are compiled into one PathMatcher for each.
+//   --max-size, --ext                  decided per file.
+//
+// Size and extension filters select files, so the rows for folders are only output when
+// neither is given (the folders are still walked to find the files in them).
+
+#pragma once
+
+#include "windows.h"
+#include "cstdint"
+#include "RecycleRow.h"
+#include "PathMatcher.h"
+#include <vector>
+
+class Filter
+	{
+	public:
+		Filter();
+		~Filter();
+
+		// Returns true if szOption is a filter option (all of which take a value).
+		static bool IsFilterOption(const wchar_t* szOption);
+
+		// Returns false if the value is not valid for the option.
+		bool SetOption(const wchar_t* szOption, const wchar_t* szValue);
+
+		// Must be called after the options are set and before any rows are matched.
+		void Prepare();
+
+		bool MatchesBin(const wchar_t* szSid);
+
+		// pInfo is NULL if the $I file could not be read.
+		bool MatchesItem(RecycleInfo* pInfo);
+
+		bool MatchesRow(RecycleRow* pRow);
+
+		// Returns false if nothing below the row's folder can match, so it need not be walked.
+		bool CouldMatchBelow(RecycleRow* pRow);
+
+	protected:
+		bool hasDeletedAfter;
+		bool hasDeletedBefore;
+		uint64_t deletedAfter;
+		uint64_t deletedBefore;
+
+		bool hasMinSize;
+		bool hasMaxSize;
+		uint64_t minSize;
+		uint64_t maxSize;
+
+		std::vector<wchar_t*> sids;
+		std::vector<wchar_t*> extensions;
+
+		UpcaseTable upcase;
+		PathMatcher includePaths;
+		PathMatcher excludePaths;
+
+		wchar_t originalPath[MAX_ORIGINAL_PATH];
+	};
@@ -0,0 +1,484 @@
+// Inflate.cpp
+//
+// Deflate decoding with table driven Huffman decoding.
+
+#include "Inflate.h"
+#include "string.h"
+
+static const uint32_t MAX_CODE_BITS = 15;
+static const uint32_t FAST_BITS = 10;
+static const uint32_t MAX_LITERAL_CODES = 288;
+static const uint32_t MAX_DISTANCE_CODES = 32;
+
+static const uint16_t lengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const uint8_t lengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const uint16_t distanceBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const uint8_t distanceExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+// Order the code length code lengths are stored in a dynamic block.
+static const uint8_t codeLengthOrder[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+// A canonical Huffman code.  fast[] is indexed by the next FAST_BITS bits of input and holds
+// (symbol << 4) | length, or 0 if the code is longer than FAST_BITS.
+struct Huffman
+	{
+	uint16_t fast[1 << FAST_BITS];
+	uint16_t count[MAX_CODE_BITS + 1];      // Number of codes of each length.
+	uint16_t symbol[MAX_LITERAL_CODES];     // Symbols ordered by code.
+	};
+
+struct InflateState
+	{
+	const uint8_t* pIn;
+	const uint8_t* pInEnd;
+	uint64_t bits;
+	uint32_t bitCount;
+	uint32_t padBytes;          // Zero bytes added to bits past the end of the input.
+	uint8_t* pOut;
+	size_t outPosition;
+	size_t outSize;
+	};
+
+static void Refill(InflateState* pState)
+	{
+	while (pState->bitCount <= 56)
+		{
+		if (pState->pIn < pState->pInEnd)
+			{
+			pState->bits |= (uint64_t)*pState->pIn++ << pState->bitCount;
+			}
+		else
+			{
+			pState->padBytes++;
+			}
+		pState->bitCount += 8;
+		}
+	}
+
+// Returns true if more bits were used than there are in the input.
+static bool IsOverrun(InflateState* pState)
+	{
+	return pState->padBytes * 8 > pState->bitCount;
+	}
+
+static uint32_t GetBits(InflateState* pState, uint32_t count)
+	{
+	if (pState->bitCount < count)
+		{
+		Refill(pState);
+		}
+
+	uint32_t value = (uint32_t)(pState->bits & ((1ULL << count) - 1));
+	pState->bits >>= count;
+	pState->bitCount -= count;
+	return value;
+	}
+
+static uint32_t ReverseBits(uint32_t code, uint32_t length)
+	{
+	uint32_t reversed = 0;
+	for (uint32_t i = 0; i < length; i++)
+		{
+		reversed = (reversed << 1) | (code & 1);
+		code >>= 1;
+		}
+	return reversed;
+	}
+
+// Returns false if the lengths over-subscribe the code.  Incomplete codes are allowed (a
+// distance code may have a single code), the missing codes fail when decoded.
+static bool BuildHuffman(Huffman* pHuffman, const uint8_t* pLengths, uint32_t count)
+	{
+	memset(pHuffman->fast, 0, sizeof(pHuffman->fast));
+	memset(pHuffman->count, 0, sizeof(pHuffman->count));
+
+	for (uint32_t i = 0; i < count; i++)
+		{
+		pHuffman->count[pLengths[i]]++;
+		}
+	pHuffman->count[0] = 0;
+
+	int left = 1;
+	for (uint32_t length = 1; length <= MAX_CODE_BITS; length++)
+		{
+		left = (left << 1) - pHuffman->count[length];
+		if (left < 0)
+			{
+			return false;
+			}
+		}
+
+	uint16_t offsets[MAX_CODE_BITS + 2];
+	uint32_t nextCode[MAX_CODE_BITS + 2];
+	offsets[1] = 0;
+	nextCode[1] = 0;
+	for (uint32_t length = 1; length <= MAX_CODE_BITS; length++)
+		{
+		offsets[length + 1] = offsets[length] + pHuffman->count[length];
+		nextCode[length + 1] = (nextCode[length] + pHuffman->count[length]) << 1;
+		}
+
+	for (uint32_t symbol = 0; symbol < count; symbol++)
+		{
+		uint32_t length = pLengths[symbol];
+		if (length == 0)
+			{
+			continue;
+			}
+
+		pHuffman->symbol[offsets[length]++] = (uint16_t)symbol;
+
+		uint32_t code = nextCode[length]++;
+		if (length <= FAST_BITS)
+			{
+			uint16_t entry = (uint16_t)((symbol << 4) | length);
+			for (uint32_t i = ReverseBits(code, length); i < (1U << FAST_BITS); i += 1U << length)
+				{
+				pHuffman->fast[i] = entry;
+				}
+			}
+		}
+
+	return true;
+	}
+
+// Returns the symbol, or -1 for a code that is not in the table.
+static int Decode(InflateState* pState, const Huffman* pHuffman)
+	{
+	if (pState->bitCount < MAX_CODE_BITS)
+		{
+		Refill(pState);
+		}
+
+	uint16_t entry = pHuffman->fast[pState->bits & ((1U << FAST_BITS) - 1)];
+	if (entry != 0)
+		{
+		uint32_t length = entry & 0x0F;
+		pState->bits >>= length;
+		pState->bitCount -= length;
+		return entry >> 4;
+		}
+
+	// Canonical decoding a bit at a time: codes of each length are consecutive, starting at first.
+	int code = 0;
+	int first = 0;
+	int index = 0;
+	for (uint32_t length = 1; length <= MAX_CODE_BITS; length++)
+		{
+		code |= (int)((pState->bits >> (length - 1)) & 1);
+		int count = pHuffman->count[length];
+		if (code - count < first)
+			{
+			pState->bits >>= length;
+			pState->bitCount -= length;
+			return pHuffman->symbol[index + (code - first)];
+			}
+		index += count;
+		first = (first + count) << 1;
+		code <<= 1;
+		}
+
+	return -1;
+	}
+
+static bool InflateCodes(InflateState* pState, const Huffman* pLiterals, const Huffman* pDistances)
+	{
+	for (;;)
+		{
+		int symbol = Decode(pState, pLiterals);
+		if (symbol < 0)
+			{
+			return false;
+			}
+
+		if (symbol < 256)
+			{
+			if (pState->outPosition >= pState->outSize)
+				{
+				return false;
+				}
+			pState->pOut[pState->outPosition++] = (uint8_t)symbol;
+			continue;
+			}
+
+		if (symbol == 256)
+			{
+			return !IsOverrun(pState);
+			}
+
+		symbol -= 257;
+		if (symbol >= 29)
+			{
+			return false;
+			}
+		size_t length = lengthBase[symbol] + GetBits(pState, lengthExtra[symbol]);
+
+		symbol = Decode(pState, pDistances);
+		if ((symbol < 0) || (symbol >= 30))
+			{
+			return false;
+			}
+		size_t distance = distanceBase[symbol] + GetBits(pState, distanceExtra[symbol]);
+
+		if ((distance > pState->outPosition) || (length > pState->outSize - pState->outPosition))
+			{
+			return false;
+			}
+
+		// The copy may overlap what it writes (e.g. a run of one repeated byte), so it is
+		// done a byte at a time.
+		uint8_t* pTo = pState->pOut + pState->outPosition;
+		const uint8_t* pFrom = pTo - distance;
+		for (size_t i = 0; i < length; i++)
+			{
+			pTo[i] = pFrom[i];
+			}
+		pState->outPosition += length;
+		}
+	}
+
+static bool InflateStored(InflateState* pState)
+	{
+	// The length follows on the next byte boundary.
+	GetBits(pState, pState->bitCount & 7);
+	uint32_t length = GetBits(pState, 16);
+	uint32_t complement = GetBits(pState, 16);
+
+	if ((length != (~complement & 0xFFFF)) || IsOverrun(pState) || (length > pState->outSize - pState->outPosition))
+		{
+		return false;
+		}
+
+	// The first bytes may already be in the bit buffer.
+	while ((length > 0) && (pState->bitCount >= 8))
+		{
+		pState->pOut[pState->outPosition++] = (uint8_t)GetBits(pState, 8);
+		length--;
+		}
+
+	if (IsOverrun(pState) || (length > (size_t)(pState->pInEnd - pState->pIn)))
+		{
+		return false;
+		}
+
+	memcpy(pState->pOut + pState->outPosition, pState->pIn, length);
+	pState->pIn += length;
+	pState->outPosition += length;
+	return true;
+	}
+
+// The codes of fixed Huffman blocks, which never change.
+struct FixedCodes
+	{
+	Huffman literals;
+	Huffman distances;
+
+	FixedCodes()
+		{
+		uint8_t lengths[MAX_LITERAL_CODES];
+		memset(lengths, 8, 144);
+		memset(lengths + 144, 9, 112);
+		memset(lengths + 256, 7, 24);
+		memset(lengths + 280, 8, 8);
+		BuildHuffman(&this->literals, lengths, MAX_LITERAL_CODES);
+
+		memset(lengths, 5, MAX_DISTANCE_CODES);
+		BuildHuffman(&this->distances, lengths, MAX_DISTANCE_CODES);
+		}
+	};
+
+static bool InflateFixed(InflateState* pState)
+	{
+	// Built on first use, which is thread safe for a local static.
+	static const FixedCodes fixed;
+	return InflateCodes(pState, &fixed.literals, &fixed.distances);
+	}
+
+static bool InflateDynamic(InflateState* pState)
+	{
+	uint32_t literalCount = GetBits(pState, 5) + 257;
+	uint32_t distanceCount = GetBits(pState, 5) + 1;
+	uint32_t codeLengthCount = GetBits(pState, 4) + 4;
+
+	if ((literalCount > 286) || (distanceCount > 30))
+		{
+		return false;
+		}
+
+	uint8_t lengths[MAX_LITERAL_CODES + MAX_DISTANCE_CODES];
+	memset(lengths, 0, 19);
+	for (uint32_t i = 0; i < codeLengthCount; i++)
+		{
+		lengths[codeLengthOrder[i]] = (uint8_t)GetBits(pState, 3);
+		}
+
+	Huffman codeLengths;
+	if (!BuildHuffman(&codeLengths, lengths, 19))
+		{
+		return false;
+		}
+
+	// The literal and distance code lengths are one sequence, run length encoded.
+	uint32_t index = 0;
+	while (index < literalCount + distanceCount)
+		{
+		int symbol = Decode(pState, &codeLengths);
+		if (symbol < 0)
+			{
+			return false;
+			}
+
+		if (symbol < 16)
+			{
+			lengths[index++] = (uint8_t)symbol;
+			continue;
+			}
+
+		uint8_t repeated = 0;
+		uint32_t repeat;
+		if (symbol == 16)
+			{
+			if (index == 0)
+				{
+				return false;
+				}
+			repeated = lengths[index - 1];
+			repeat = 3 + GetBits(pState, 2);
+			}
+		else if (symbol == 17)
+			{
+			repeat = 3 + GetBits(pState, 3);
+			}
+		else
+			{
+			repeat = 11 + GetBits(pState, 7);
+			}
+
+		if (index + repeat > literalCount + distanceCount)
+			{
+			return false;
+			}
+		memset(lengths + index, repeated, repeat);
+		index += repeat;
+		}
+
+	// A block must be able to end.
+	if (lengths[256] == 0)
+		{
+		return false;
+		}
+
+	Huffman literals;
+	Huffman distances;
+	if (!BuildHuffman(&literals, lengths, literalCount) || !BuildHuffman(&distances, lengths + literalCount, distanceCount))
+		{
+		return false;
+		}
+
+	return InflateCodes(pState, &literals, &distances);
+	}
+
+static bool InflateBlocks(InflateState* pState)
+	{
+	bool isLast = false;
+	while (!isLast)
+		{
+		isLast = GetBits(pState, 1) != 0;
+		uint32_t type = GetBits(pState, 2);
+
+		bool decoded = false;
+		switch (type)
+			{
+			case 0:
+				decoded = InflateStored(pState);
+				break;
+
+			case 1:
+				decoded = InflateFixed(pState);
+				break;
+
+			case 2:
+				decoded = InflateDynamic(pState);
+				break;
+			}
+
+		if (!decoded || IsOverrun(pState))
+			{
+			return false;
+			}
+		}
+
+	return true;
+	}
+
+bool Inflate(const uint8_t* pIn, size_t cbIn, uint8_t* pOut, size_t cbOut, size_t* pcbWritten)
+	{
+	InflateState state = { pIn, pIn + cbIn, 0, 0, 0, pOut, 0, cbOut };
+
+	*pcbWritten = 0;
+	if (!InflateBlocks(&state))
+		{
+		return false;
+		}
+
+	*pcbWritten = state.outPosition;
+	return true;
+	}
+
+bool ZlibInflate(const uint8_t* pIn, size_t cbIn, uint8_t* pOut, size_t cbOut, size_t* pcbWritten)
+	{
+	*pcbWritten = 0;
+
+	// Compression method 8 (deflate), no preset dictionary, and the header check.
+	if ((cbIn < 6) || ((pIn[0] & 0x0F) != 8) || ((pIn[1] & 0x20) != 0) || ((((uint32_t)pIn[0] << 8) | pIn[1]) % 31 != 0))
+		{
+		return false;
+		}
+
+	InflateState state = { pIn + 2, pIn + cbIn, 0, 0, 0, pOut, 0, cbOut };
+	if (!InflateBlocks(&state))
+		{
+		return false;
+		}
+
+	// The big endian Adler-32 of the data follows on the next byte boundary.
+	GetBits(&state, state.bitCount & 7);
+	uint32_t checksum = 0;
+	for (int i = 0; i < 4; i++)
+		{
+		checksum = (checksum << 8) | GetBits(&state, 8);
+		}
+
+	if (IsOverrun(&state) || (checksum != Adler32(pOut, state.outPosition)))
+		{
+		return false;
+		}
+
+	*pcbWritten = state.outPosition;
+	return true;
+	}
+
+uint32_t Adler32(const uint8_t* pData, size_t cbData)
+	{
+	uint32_t a = 1;
+	uint32_t b = 0;
+
+	while (cbData > 0)
+		{
+		// 5552 bytes is the most that can be summed before b could overflow 32 bits.
+		size_t count = (cbData < 5552) ? cbData : 5552;
+		cbData -= count;
+
+		for (size_t i = 0; i < count; i++)
+			{
+			a += pData[i];
+			b += a;
+			}
+		pData += count;
+
+		a %= 65521;
+		b %= 65521;
+		}
+
+	return (b << 16) | a;
+	}
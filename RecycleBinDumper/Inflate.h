@@ -0,0 +1,26 @@
+// Inflate.h
+//
+// Decompression of deflate data (RFC 1951), as stored in ZIP archive members, and of zlib
+// streams (RFC 1950 wrapping deflate data), which is how the chunks of compressed disk images
+// are stored.  Each chunk or member is decompressed on its own into a buffer of known size, so
+// there is no streaming interface: the whole input is in memory and the output can never be
+// larger than the size recorded for it.
+//
+// Huffman codes up to FAST_BITS long (nearly all of them) are decoded with one table lookup,
+// and only the rare longer codes are decoded a bit at a time.
+
+#pragma once
+
+#include "cstdint"
+#include "cstddef"
+
+// Decompress raw deflate data into pOut.  Returns false if the data is not valid or would
+// decompress to more than cbOut bytes.
+bool Inflate(const uint8_t* pIn, size_t cbIn, uint8_t* pOut, size_t cbOut, size_t* pcbWritten);
+
+// Decompress the zlib stream in pIn into pOut, checking its Adler-32 checksum.  Returns false
+// if the stream is not valid or would decompress to more than cbOut bytes.
+bool ZlibInflate(const uint8_t* pIn, size_t cbIn, uint8_t* pOut, size_t cbOut, size_t* pcbWritten);
+
+// The Adler-32 checksum used by zlib streams (and by EWF for uncompressed chunks).
+uint32_t Adler32(const uint8_t* pData, size_t cbData);
@@ -0,0 +1,159 @@
+// Info2.cpp
+//
+// Decoding of the INFO2 recycle information file of Recycle Bins before Windows Vista.
+
+#include "Info2.h"
+#include "string.h"
+#include "wchar.h"
+
+static const size_t INFO2_HEADER_SIZE = 20;
+static const size_t INFO2_ANSI_RECORD_SIZE = 280;
+static const size_t INFO2_RECORD_SIZE = 800;
+static const size_t INFO2_PATH_SIZE = 260;
+
+// Records larger than this are taken to be something other than an INFO2 file.
+static const size_t MAX_INFO2_RECORD_SIZE = 4096;
+
+static uint16_t Read16(const uint8_t* p)
+	{
+	uint16_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+	}
+
+static uint32_t Read32(const uint8_t* p)
+	{
+	uint32_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+	}
+
+// State of an INFO2 file while it is read.
+struct Info2Parser
+	{
+	uint32_t version;
+	size_t recordSize;          // 0 until the header has been read.
+	bool isValid;
+	std::vector<uint8_t> pending;   // A header or record split between two parts of the file.
+	std::vector<Info2Record>* pRecords;
+	};
+
+static void DecodeInfo2Record(const uint8_t* pData, size_t recordSize, Info2Record* pRecord)
+	{
+	pRecord->index = Read32(pData + 260);
+	pRecord->drive = Read32(pData + 264);
+	memcpy(&pRecord->deletedTime, pData + 268, sizeof(pRecord->deletedTime));
+	pRecord->size = Read32(pData + 276);
+	pRecord->isRemoved = (pData[0] == 0);
+	pRecord->path.clear();
+
+	if (recordSize >= INFO2_RECORD_SIZE)
+		{
+		for (size_t i = 0; i < INFO2_PATH_SIZE; i++)
+			{
+			wchar_t c = Read16(pData + INFO2_ANSI_RECORD_SIZE + 2 * i);
+			if ((c == L'\0') && ((i > 0) || !pRecord->isRemoved))
+				{
+				break;
+				}
+			pRecord->path.push_back(c);
+			}
+		}
+	else
+		{
+		const char* szAnsiPath = (const char*)pData;
+		int length = (int)strnlen(szAnsiPath + 1, INFO2_PATH_SIZE - 1) + 1;
+		wchar_t path[INFO2_PATH_SIZE];
+
+		// The first byte of a removed item's path is 0, and is replaced below.
+		int converted = MultiByteToWideChar(CP_ACP, 0, szAnsiPath + 1, length - 1, path + 1, (int)INFO2_PATH_SIZE - 1);
+		path[0] = (wchar_t)(unsigned char)szAnsiPath[0];
+		pRecord->path.assign(path, converted + 1);
+		}
+
+	// A removed item's path has lost its drive letter, which the drive number gives.
+	if (!pRecord->path.empty() && (pRecord->path[0] == L'\0'))
+		{
+		pRecord->path[0] = (pRecord->drive < 26) ? (wchar_t)(L'A' + pRecord->drive) : L'?';
+		}
+	}
+
+static void ParseInfo2Part(Info2Parser* pParser, const uint8_t* pData)
+	{
+	if (pParser->recordSize == 0)
+		{
+		pParser->version = Read32(pData);
+		pParser->recordSize = Read32(pData + 12);
+		pParser->isValid = (pParser->recordSize >= INFO2_ANSI_RECORD_SIZE) && (pParser->recordSize <= MAX_INFO2_RECORD_SIZE);
+		return;
+		}
+
+	Info2Record record;
+	DecodeInfo2Record(pData, pParser->recordSize, &record);
+	pParser->pRecords->push_back(std::move(record));
+	}
+
+static bool ParseInfo2Data(const uint8_t* pData, size_t cbData, void* context)
+	{
+	Info2Parser* pParser = (Info2Parser*)context;
+
+	while ((cbData > 0) && pParser->isValid)
+		{
+		size_t needed = (pParser->recordSize == 0) ? INFO2_HEADER_SIZE : pParser->recordSize;
+
+		// Whole records are decoded where they are, only one split between parts is copied.
+		if (pParser->pending.empty() && (cbData >= needed))
+			{
+			ParseInfo2Part(pParser, pData);
+			pData += needed;
+			cbData -= needed;
+			continue;
+			}
+
+		size_t count = needed - pParser->pending.size();
+		count = (cbData < count) ? cbData : count;
+		pParser->pending.insert(pParser->pending.end(), pData, pData + count);
+		pData += count;
+		cbData -= count;
+
+		if (pParser->pending.size() == needed)
+			{
+			ParseInfo2Part(pParser, pParser->pending.data());
+			pParser->pending.clear();
+			}
+		}
+
+	return pParser->isValid;
+	}
+
+bool ReadInfo2(FileSource* pSource, const wchar_t* szFileName, uint32_t* pVersion, std::vector<Info2Record>* pRecords)
+	{
+	Info2Parser parser;
+	parser.version = 0;
+	parser.recordSize = 0;
+	parser.isValid = true;
+	parser.pRecords = pRecords;
+
+	bool isRead = pSource->ReadFileData(szFileName, ParseInfo2Data, &parser);
+	*pVersion = parser.version;
+
+	// Anything left over is a partial record at the end of the file.
+	return isRead && parser.isValid && (parser.recordSize != 0) && parser.pending.empty();
+	}
+
+std::wstring GetInfo2DataFileName(const Info2Record* pRecord)
+	{
+	wchar_t szIndex[16];
+	swprintf_s(szIndex, 16, L"Dc%u", pRecord->index);
+
+	// The extension of the original name (but not a dot in the name of a folder above it).
+	std::wstring name(szIndex);
+	size_t slash = pRecord->path.find_last_of(L"\\/");
+	size_t dot = pRecord->path.find_last_of(L'.');
+	if ((dot != std::wstring::npos) && ((slash == std::wstring::npos) || (dot > slash)))
+		{
+		name.append(pRecord->path, dot, std::wstring::npos);
+		}
+
+	return name;
+	}
@@ -0,0 +1,55 @@
+// Info2.h
+//
+// Decoding of the INFO2 file that held the recycle information of every deleted item in a
+// Recycle Bin before Windows Vista (RECYCLER\<SID>\INFO2 on NTFS volumes).  The deleted file or
+// folder itself is renamed "Dc<index>" followed by the extension of its original name.
+//
+//   Header (20 bytes)
+//     uint32_t version;        // 5 for Windows NT 4.0 to XP (4 for Windows 95 to ME)
+//     uint32_t reserved[2];
+//     uint32_t recordSize;     // 800 (280 in versions with no Unicode path)
+//     uint32_t totalSize;      // Of everything in the Recycle Bin
+//
+//   Record (recordSize bytes)
+//     char ansiPath[260];      // The original full path in the ANSI code page
+//     uint32_t index;          // Of the Dc name
+//     uint32_t drive;          // 0 for A:, 2 for C: and so on
+//     FILETIME deletedTime;
+//     uint32_t size;           // The size deleted, in whole clusters
+//     wchar_t path[260];       // The original full path (800 byte records only)
+//
+// When an item is restored or removed, its record stays in the file with the first byte of the
+// ANSI path set to 0, so those records are kept too (with the drive letter put back from the
+// drive number), and their Dc files are then missing.
+//
+// The file is parsed as it is read, a record at a time, so even INFO2 files with hundreds of
+// thousands of records take one pass over the file, and the file itself is never held in
+// memory.  The decoded records are, as their rows can only be output once the file has been
+// read: the rows read the Dc files (e.g. to hash them) from the same FileSource, which cannot
+// be read again from inside its own ReadFileData() callback.
+
+#pragma once
+
+#include "windows.h"
+#include "cstdint"
+#include "FileSource.h"
+#include <string>
+#include <vector>
+
+struct Info2Record
+	{
+	uint32_t index;
+	uint32_t drive;
+	FILETIME deletedTime;
+	uint64_t size;
+	bool isRemoved;             // Restored or removed from the Recycle Bin, so there is no Dc file.
+	std::wstring path;
+	};
+
+// Read and decode every record of an INFO2 file.  Returns false if the file is not a valid
+// INFO2 file (the records decoded before the problem are still added).  pVersion is set to the
+// version in its header.
+bool ReadInfo2(FileSource* pSource, const wchar_t* szFileName, uint32_t* pVersion, std::vector<Info2Record>* pRecords);
+
+// Name of the Dc file of a record, e.g. "Dc12.txt".
+std::wstring GetInfo2DataFileName(const Info2Record* pRecord);
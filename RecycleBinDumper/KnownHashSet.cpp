@@ -0,0 +1,415 @@
+// KnownHashSet.cpp
+//
+// Memory mapped index of known file hashes.  See KnownHashSet.h for the file layout.
+
+#include "KnownHashSet.h"
+#include "stdio.h"
+#include "string.h"
+#include "bcrypt.h"
+#include <vector>
+#include <algorithm>
+
+#pragma comment(lib, "bcrypt.lib")
+
+static const char knownHashSetMagic[8] = { 'R', 'B', 'D', 'H', 'A', 'S', 'H', '1' };
+
+// Number of bits set in the Bloom filter block for each hash, and the number of bits in a block.
+static const int BLOOM_BITS_PER_HASH = 6;
+static const int BLOOM_BLOCK_BITS = 512;
+
+// The leading 32 bits of the hash (in sort order) select the bucket.
+static uint32_t HashPrefix(const uint8_t* pHash)
+	{
+	return ((uint32_t)pHash[0] << 24) | ((uint32_t)pHash[1] << 16) | ((uint32_t)pHash[2] << 8) | pHash[3];
+	}
+
+static uint64_t BloomBlock(const uint8_t* pHash, uint64_t bloomBlockCount)
+	{
+	uint32_t value;
+	memcpy(&value, pHash + 4, sizeof(value));
+	return value & (bloomBlockCount - 1);
+	}
+
+// Bits within the block are taken 9 at a time from bytes 8 to 15 of the hash.
+static uint64_t BloomBits(const uint8_t* pHash)
+	{
+	uint64_t value;
+	memcpy(&value, pHash + 8, sizeof(value));
+	return value;
+	}
+
+KnownHashSet::KnownHashSet()
+	{
+	this->hFile = INVALID_HANDLE_VALUE;
+	this->hMapping = NULL;
+	this->header = NULL;
+	this->bloom = NULL;
+	this->buckets = NULL;
+	this->hashes = NULL;
+	this->hAlgorithm = NULL;
+	this->hHash = NULL;
+	}
+
+KnownHashSet::~KnownHashSet()
+	{
+	if (this->hHash != NULL)
+		{
+		BCryptDestroyHash(this->hHash);
+		}
+
+	if (this->hAlgorithm != NULL)
+		{
+		BCryptCloseAlgorithmProvider(this->hAlgorithm, 0);
+		}
+
+	if (this->header != NULL)
+		{
+		UnmapViewOfFile(this->header);
+		}
+
+	if (this->hMapping != NULL)
+		{
+		CloseHandle(this->hMapping);
+		}
+
+	if (this->hFile != INVALID_HANDLE_VALUE)
+		{
+		CloseHandle(this->hFile);
+		}
+	}
+
+bool KnownHashSet::Open(const wchar_t* szIndexFile)
+	{
+	this->hFile = CreateFile(szIndexFile, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+	if (this->hFile == INVALID_HANDLE_VALUE)
+		{
+		return false;
+		}
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(this->hFile, &fileSize) || (uint64_t)fileSize.QuadPart < sizeof(KnownHashSetHeader))
+		{
+		return false;
+		}
+
+	this->hMapping = CreateFileMapping(this->hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (this->hMapping == NULL)
+		{
+		return false;
+		}
+
+	this->header = (const KnownHashSetHeader*)MapViewOfFile(this->hMapping, FILE_MAP_READ, 0, 0, 0);
+	if (this->header == NULL)
+		{
+		return false;
+		}
+
+	const KnownHashSetHeader* pHeader = this->header;
+	if ((memcmp(pHeader->magic, knownHashSetMagic, sizeof(knownHashSetMagic)) != 0)
+		|| ((pHeader->hashSize != MD5_HASH_SIZE) && (pHeader->hashSize != SHA1_HASH_SIZE))
+		|| (pHeader->bucketBits > 24)
+		|| (pHeader->bloomBlockCount == 0)
+		|| ((pHeader->bloomBlockCount & (pHeader->bloomBlockCount - 1)) != 0))
+		{
+		return false;
+		}
+
+	uint64_t bloomSize = pHeader->bloomBlockCount * (BLOOM_BLOCK_BITS / 8);
+	uint64_t bucketsSize = (((uint64_t)1 << pHeader->bucketBits) + 1) * sizeof(uint32_t);
+	uint64_t expectedSize = sizeof(KnownHashSetHeader) + bloomSize + bucketsSize + pHeader->hashCount * pHeader->hashSize;
+	if ((uint64_t)fileSize.QuadPart != expectedSize)
+		{
+		return false;
+		}
+
+	const uint8_t* pBase = (const uint8_t*)pHeader;
+	this->bloom = (const uint64_t*)(pBase + sizeof(KnownHashSetHeader));
+	this->buckets = (const uint32_t*)(pBase + sizeof(KnownHashSetHeader) + bloomSize);
+	this->hashes = pBase + sizeof(KnownHashSetHeader) + bloomSize + bucketsSize;
+
+	// Contains() searches between the starts of a bucket and the next without checking them,
+	// so they must go up from 0 to the number of hashes.
+	uint32_t bucketCount = (uint32_t)1 << pHeader->bucketBits;
+	if ((this->buckets[0] != 0) || (this->buckets[bucketCount] != pHeader->hashCount))
+		{
+		return false;
+		}
+
+	for (uint32_t i = 0; i < bucketCount; i++)
+		{
+		if (this->buckets[i] > this->buckets[i + 1])
+			{
+			return false;
+			}
+		}
+
+	BCRYPT_ALG_HANDLE hAlgorithm = NULL;
+	const wchar_t* szAlgorithm = (pHeader->hashSize == MD5_HASH_SIZE) ? BCRYPT_MD5_ALGORITHM : BCRYPT_SHA1_ALGORITHM;
+	if (!BCRYPT_SUCCESS(BCryptOpenAlgorithmProvider(&hAlgorithm, szAlgorithm, NULL, BCRYPT_HASH_REUSABLE_FLAG)))
+		{
+		return false;
+		}
+	this->hAlgorithm = hAlgorithm;
+
+	BCRYPT_HASH_HANDLE hHash = NULL;
+	if (!BCRYPT_SUCCESS(BCryptCreateHash(hAlgorithm, &hHash, NULL, 0, NULL, 0, BCRYPT_HASH_REUSABLE_FLAG)))
+		{
+		return false;
+		}
+	this->hHash = hHash;
+
+	return true;
+	}
+
+bool KnownHashSet::Contains(const uint8_t* pHash)
+	{
+	// Almost all unknown files are rejected here after touching a single cache line.
+	const uint64_t* pBlock = this->bloom + BloomBlock(pHash, this->header->bloomBlockCount) * (BLOOM_BLOCK_BITS / 64);
+	uint64_t bits = BloomBits(pHash);
+	for (int i = 0; i < BLOOM_BITS_PER_HASH; i++)
+		{
+		uint32_t bit = (uint32_t)(bits & (BLOOM_BLOCK_BITS - 1));
+		if ((pBlock[bit / 64] & ((uint64_t)1 << (bit % 64))) == 0)
+			{
+			return false;
+			}
+		bits >>= 9;
+		}
+
+	uint32_t hashSize = this->header->hashSize;
+	uint32_t bucket = (this->header->bucketBits == 0) ? 0 : (HashPrefix(pHash) >> (32 - this->header->bucketBits));
+	uint32_t low = this->buckets[bucket];
+	uint32_t high = this->buckets[bucket + 1];
+
+	while (low < high)
+		{
+		uint32_t middle = low + (high - low) / 2;
+		int compare = memcmp(this->hashes + (uint64_t)middle * hashSize, pHash, hashSize);
+		if (compare == 0)
+			{
+			return true;
+			}
+		else if (compare < 0)
+			{
+			low = middle + 1;
+			}
+		else
+			{
+			high = middle;
+			}
+		}
+
+	return false;
+	}
+
+bool KnownHashSet::HashData(const uint8_t* pData, size_t cbData, void* context)
+	{
+	KnownHashSet* pSet = (KnownHashSet*)context;
+	return BCRYPT_SUCCESS(BCryptHashData(pSet->hHash, (PUCHAR)pData, (ULONG)cbData, 0));
+	}
+
+bool KnownHashSet::ContainsFile(FileSource* pSource, const wchar_t* szFileName)
+	{
+	bool hashed = pSource->ReadFileData(szFileName, HashData, this);
+
+	// Finishing the hash also resets it for the next file, so it must be done even on failure.
+	uint8_t hash[MAX_HASH_SIZE];
+	BCryptFinishHash(this->hHash, hash, this->header->hashSize, 0);
+
+	return hashed && this->Contains(hash);
+	}
+
+static int HexDigit(char c)
+	{
+	if ((c >= '0') && (c <= '9'))
+		{
+		return c - '0';
+		}
+	else if ((c >= 'a') && (c <= 'f'))
+		{
+		return c - 'a' + 10;
+		}
+	else if ((c >= 'A') && (c <= 'F'))
+		{
+		return c - 'A' + 10;
+		}
+
+	return -1;
+	}
+
+// Find the first run of hex digits on the line that is a whole MD5 or SHA-1 hash.
+// Returns the size in bytes of the hash found, or 0 if there is none.
+static uint32_t ParseHashLine(const char* szLine, uint8_t* pHash)
+	{
+	const char* p = szLine;
+	while (*p != '\0')
+		{
+		if (HexDigit(*p) < 0)
+			{
+			p++;
+			continue;
+			}
+
+		const char* pStart = p;
+		while (HexDigit(*p) >= 0)
+			{
+			p++;
+			}
+
+		size_t digits = p - pStart;
+		if ((digits == 2 * MD5_HASH_SIZE) || (digits == 2 * SHA1_HASH_SIZE))
+			{
+			for (size_t i = 0; i < digits / 2; i++)
+				{
+				pHash[i] = (uint8_t)((HexDigit(pStart[2 * i]) << 4) | HexDigit(pStart[2 * i + 1]));
+				}
+			return (uint32_t)(digits / 2);
+			}
+		}
+
+	return 0;
+	}
+
+template <uint32_t N> struct HashRecord
+	{
+	uint8_t bytes[N];
+
+	bool operator<(const HashRecord& other) const
+		{
+		return memcmp(this->bytes, other.bytes, N) < 0;
+		}
+
+	bool operator==(const HashRecord& other) const
+		{
+		return memcmp(this->bytes, other.bytes, N) == 0;
+		}
+	};
+
+// Sort the packed hashes and remove duplicates, returning the number remaining.
+template <uint32_t N> static size_t SortUnique(std::vector<uint8_t>& hashes)
+	{
+	HashRecord<N>* pBegin = (HashRecord<N>*)hashes.data();
+	HashRecord<N>* pEnd = pBegin + hashes.size() / N;
+
+	std::sort(pBegin, pEnd);
+	return std::unique(pBegin, pEnd) - pBegin;
+	}
+
+bool BuildKnownHashSet(const wchar_t* szTextFile, const wchar_t* szIndexFile)
+	{
+	FILE* pText;
+	if (_wfopen_s(&pText, szTextFile, L"rb") != 0)
+		{
+		fwprintf(stderr, L"Unable to open %s\n", szTextFile);
+		return false;
+		}
+
+	// The size of the first hash found decides whether this is an MD5 or SHA-1 set.
+	uint32_t hashSize = 0;
+	std::vector<uint8_t> hashes;
+	char line[4096];
+	while (fgets(line, sizeof(line), pText) != NULL)
+		{
+		uint8_t hash[MAX_HASH_SIZE];
+		uint32_t size = ParseHashLine(line, hash);
+		if (size == 0)
+			{
+			continue;
+			}
+
+		if (hashSize == 0)
+			{
+			hashSize = size;
+			}
+
+		if (size == hashSize)
+			{
+			hashes.insert(hashes.end(), hash, hash + size);
+			}
+		}
+	fclose(pText);
+
+	if (hashSize == 0)
+		{
+		fwprintf(stderr, L"No MD5 or SHA-1 hashes found in %s\n", szTextFile);
+		return false;
+		}
+
+	size_t hashCount = (hashSize == MD5_HASH_SIZE) ? SortUnique<MD5_HASH_SIZE>(hashes) : SortUnique<SHA1_HASH_SIZE>(hashes);
+	if (hashCount >= UINT32_MAX)
+		{
+		fwprintf(stderr, L"Too many hashes in %s\n", szTextFile);
+		return false;
+		}
+
+	KnownHashSetHeader header;
+	memcpy(header.magic, knownHashSetMagic, sizeof(header.magic));
+	header.hashSize = hashSize;
+	header.hashCount = hashCount;
+
+	// About 4 hashes per bucket keeps the search after a Bloom filter hit to a couple of compares.
+	header.bucketBits = 0;
+	while ((header.bucketBits < 24) && (((uint64_t)4 << (header.bucketBits + 1)) <= hashCount))
+		{
+		header.bucketBits++;
+		}
+
+	// About 16 Bloom filter bits per hash gives a false positive rate well under 1%.
+	header.bloomBlockCount = 1;
+	while (header.bloomBlockCount * BLOOM_BLOCK_BITS < hashCount * 16)
+		{
+		header.bloomBlockCount *= 2;
+		}
+
+	std::vector<uint64_t> bloom(header.bloomBlockCount * (BLOOM_BLOCK_BITS / 64), 0);
+	std::vector<uint32_t> buckets(((size_t)1 << header.bucketBits) + 1, 0);
+
+	for (size_t i = 0; i < hashCount; i++)
+		{
+		const uint8_t* pHash = hashes.data() + i * hashSize;
+
+		uint64_t* pBlock = bloom.data() + BloomBlock(pHash, header.bloomBlockCount) * (BLOOM_BLOCK_BITS / 64);
+		uint64_t bits = BloomBits(pHash);
+		for (int j = 0; j < BLOOM_BITS_PER_HASH; j++)
+			{
+			uint32_t bit = (uint32_t)(bits & (BLOOM_BLOCK_BITS - 1));
+			pBlock[bit / 64] |= (uint64_t)1 << (bit % 64);
+			bits >>= 9;
+			}
+
+		uint32_t bucket = (header.bucketBits == 0) ? 0 : (HashPrefix(pHash) >> (32 - header.bucketBits));
+		buckets[bucket + 1]++;
+		}
+
+	// Turn the bucket counts into start positions.
+	for (size_t i = 1; i < buckets.size(); i++)
+		{
+		buckets[i] += buckets[i - 1];
+		}
+
+	FILE* pIndex;
+	if (_wfopen_s(&pIndex, szIndexFile, L"wb") != 0)
+		{
+		fwprintf(stderr, L"Unable to create %s\n", szIndexFile);
+		return false;
+		}
+
+	bool written = (fwrite(&header, sizeof(header), 1, pIndex) == 1)
+		&& (fwrite(bloom.data(), sizeof(uint64_t), bloom.size(), pIndex) == bloom.size())
+		&& (fwrite(buckets.data(), sizeof(uint32_t), buckets.size(), pIndex) == buckets.size())
+		&& (fwrite(hashes.data(), hashSize, hashCount, pIndex) == hashCount);
+
+	if (fclose(pIndex) != 0)
+		{
+		written = false;
+		}
+
+	if (!written)
+		{
+		fwprintf(stderr, L"Unable to write %s\n", szIndexFile);
+		return false;
+		}
+
+	fwprintf(stderr, L"%lld hashes written to %s\n", (long long)hashCount, szIndexFile);
+	return true;
+	}
@@ -0,0 +1,82 @@
+// KnownHashSet.h
+//
+// Index of known file hashes (e.g. an NSRL reference data set) used to suppress rows for
+// operating system and vendor files from the dump.
+//
+// Reference sets hold tens of millions of hashes, so rather than parsing a text file on every
+// run the hashes are converted once (see BuildKnownHashSet()) into a binary index file which is
+// memory mapped by KnownHashSet::Open().  Nothing is read up front so opening takes milliseconds,
+// and the operating system pages in only the parts of the index that lookups actually touch.
+//
+// The index file layout is:
+//
+//     KnownHashSetHeader header;
+//     uint64_t bloom[bloomBlockCount * 8];     // Blocked Bloom filter, one 64 byte block per cache line.
+//     uint32_t buckets[(1 << bucketBits) + 1];  // Start of each bucket in the hash table.
+//     uint8_t  hashes[hashCount * hashSize];    // Sorted, duplicate free table of hashes.
+//
+// A lookup first tests the single cache line of the Bloom filter selected by the hash, which
+// rejects almost every unknown file.  Only for probable members is the sorted table searched,
+// and then only within the small bucket selected by the leading bits of the hash.
+//
+// The hashes are cryptographic digests and so already uniformly distributed, which means their
+// bits are used directly to select the Bloom block, the Bloom bits and the bucket.
+
+#pragma once
+
+#include "windows.h"
+#include "cstdint"
+#include "FileSource.h"
+
+// Size in bytes of the supported digests.
+const uint32_t MD5_HASH_SIZE = 16;
+const uint32_t SHA1_HASH_SIZE = 20;
+const uint32_t MAX_HASH_SIZE = SHA1_HASH_SIZE;
+
+struct KnownHashSetHeader
+	{
+	char magic[8];              // "RBDHASH1"
+	uint32_t hashSize;          // MD5_HASH_SIZE or SHA1_HASH_SIZE
+	uint32_t bucketBits;        // Number of leading hash bits used to select a bucket.
+	uint64_t hashCount;         // Number of hashes in the sorted table.
+	uint64_t bloomBlockCount;   // Number of 64 byte Bloom filter blocks (a power of 2).
+	};
+
+class KnownHashSet
+	{
+	public:
+		KnownHashSet();
+		~KnownHashSet();
+
+		// Memory map an index file written by BuildKnownHashSet().
+		bool Open(const wchar_t* szIndexFile);
+
+		// Size in bytes of the hashes held in the set.
+		uint32_t GetHashSize()
+			{
+			return this->header->hashSize;
+			}
+
+		bool Contains(const uint8_t* pHash);
+
+		// Hash the contents of a file with the algorithm used by the set and look it up.
+		bool ContainsFile(FileSource* pSource, const wchar_t* szFileName);
+
+	protected:
+		HANDLE hFile;
+		HANDLE hMapping;
+		const KnownHashSetHeader* header;
+		const uint64_t* bloom;
+		const uint32_t* buckets;
+		const uint8_t* hashes;
+
+		// Hashing state (BCrypt handles) for ContainsFile().
+		void* hAlgorithm;
+		void* hHash;
+
+		static bool HashData(const uint8_t* pData, size_t cbData, void* context);
+	};
+
+// Convert a text file of hex encoded hashes (one per line, or an NSRL style csv file where
+// the first hash on each line is used) into an index file for KnownHashSet.
+bool BuildKnownHashSet(const wchar_t* szTextFile, const wchar_t* szIndexFile);
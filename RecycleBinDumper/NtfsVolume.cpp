@@ -0,0 +1,948 @@
+// NtfsVolume.cpp
+//
+// Reading the Recycle Bins of an NTFS volume from its MFT.
+
+#include "NtfsVolume.h"
+#include "strsafe.h"
+#include "string.h"
+#include "wchar.h"
+#include "wctype.h"
+#include <algorithm>
+
+// Offsets of the fields used from the boot sector, records and attributes.
+static const uint32_t BOOT_BYTES_PER_SECTOR = 0x0B;
+static const uint32_t BOOT_SECTORS_PER_CLUSTER = 0x0D;
+static const uint32_t BOOT_MFT_CLUSTER = 0x30;
+static const uint32_t BOOT_CLUSTERS_PER_RECORD = 0x40;
+
+static const uint32_t RECORD_USA_OFFSET = 0x04;
+static const uint32_t RECORD_USA_COUNT = 0x06;
+static const uint32_t RECORD_FIRST_ATTRIBUTE = 0x14;
+static const uint32_t RECORD_FLAGS = 0x16;
+static const uint32_t RECORD_USED_SIZE = 0x18;
+static const uint32_t RECORD_BASE_RECORD = 0x20;
+static const uint16_t RECORD_IN_USE = 0x0001;
+static const uint16_t RECORD_IS_DIRECTORY = 0x0002;
+
+static const uint32_t ATTRIBUTE_TYPE = 0x00;
+static const uint32_t ATTRIBUTE_LENGTH = 0x04;
+static const uint32_t ATTRIBUTE_NON_RESIDENT = 0x08;
+static const uint32_t ATTRIBUTE_NAME_LENGTH = 0x09;
+static const uint32_t ATTRIBUTE_FLAGS = 0x0C;
+static const uint32_t ATTRIBUTE_VALUE_LENGTH = 0x10;
+static const uint32_t ATTRIBUTE_VALUE_OFFSET = 0x14;
+static const uint32_t ATTRIBUTE_START_VCN = 0x10;
+static const uint32_t ATTRIBUTE_RUNS_OFFSET = 0x20;
+static const uint32_t ATTRIBUTE_REAL_SIZE = 0x30;
+static const uint32_t ATTRIBUTE_NON_RESIDENT_HEADER_SIZE = 0x40;
+static const uint16_t ATTRIBUTE_COMPRESSED = 0x00FF;
+static const uint16_t ATTRIBUTE_ENCRYPTED = 0x4000;
+
+static const uint32_t TYPE_STANDARD_INFORMATION = 0x10;
+static const uint32_t TYPE_ATTRIBUTE_LIST = 0x20;
+static const uint32_t TYPE_FILE_NAME = 0x30;
+static const uint32_t TYPE_DATA = 0x80;
+static const uint32_t TYPE_END = 0xFFFFFFFF;
+
+static const uint32_t FILE_NAME_PARENT = 0x00;
+static const uint32_t FILE_NAME_LENGTH = 0x40;
+static const uint32_t FILE_NAME_NAMESPACE = 0x41;
+static const uint32_t FILE_NAME_NAME = 0x42;
+static const uint8_t FILE_NAME_DOS = 2;
+static const uint8_t FILE_NAME_NONE = 0xFF;
+
+static const uint32_t ATTRIBUTE_LIST_LENGTH = 0x04;
+static const uint32_t ATTRIBUTE_LIST_RECORD = 0x10;
+
+// The update sequence fixups are applied every 512 bytes, whatever the sector size.
+static const uint32_t USA_STRIDE = 512;
+
+static const uint32_t ROOT_RECORD = 5;
+
+// A parent chain longer than this is taken to be a loop in a damaged MFT.
+static const size_t MAX_FOLDER_DEPTH = 4096;
+
+static uint16_t Read16(const uint8_t* p)
+	{
+	return (uint16_t)(p[0] | (p[1] << 8));
+	}
+
+static uint32_t Read32(const uint8_t* p)
+	{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+	}
+
+static uint64_t Read64(const uint8_t* p)
+	{
+	return (uint64_t)Read32(p) | ((uint64_t)Read32(p + 4) << 32);
+	}
+
+static FILETIME ReadFileTime(const uint8_t* p)
+	{
+	FILETIME fileTime;
+	fileTime.dwLowDateTime = Read32(p);
+	fileTime.dwHighDateTime = Read32(p + 4);
+	return fileTime;
+	}
+
+// Record numbers are 48 bits, the top 16 bits of a reference are a sequence number.
+static uint32_t RecordNumber(uint64_t reference)
+	{
+	uint64_t record = reference & 0x0000FFFFFFFFFFFFULL;
+	return (record < 0xFFFFFFFF) ? (uint32_t)record : 0xFFFFFFFF;
+	}
+
+static bool NameStartsWith(const std::wstring& name, const wchar_t* szPrefix)
+	{
+	size_t length = wcslen(szPrefix);
+	return (name.size() >= length) && (_wcsnicmp(name.c_str(), szPrefix, length) == 0);
+	}
+
+static bool NameEquals(const std::wstring& name, const wchar_t* szName, size_t length)
+	{
+	return (name.size() == length) && (_wcsnicmp(name.c_str(), szName, length) == 0);
+	}
+
+// \$Recycle.Bin, or \RECYCLER before Windows Vista.
+static bool IsRecycleBinRoot(const NtfsFile& file)
+	{
+	return file.isFolder && (file.parent == ROOT_RECORD)
+		&& (NameEquals(file.name, L"$Recycle.Bin", 12) || NameEquals(file.name, L"RECYCLER", 8));
+	}
+
+static bool CompareNames(const NtfsFile* pLeft, const NtfsFile* pRight)
+	{
+	return _wcsicmp(pLeft->name.c_str(), pRight->name.c_str()) < 0;
+	}
+
+// The same order as CompareNames(), for a name that is not null terminated.
+static int CompareName(const std::wstring& name, const wchar_t* szName, size_t length)
+	{
+	int compare = _wcsnicmp(name.c_str(), szName, (name.size() < length) ? name.size() : length);
+	if (compare != 0)
+		{
+		return compare;
+		}
+
+	return (name.size() == length) ? 0 : ((name.size() < length) ? -1 : 1);
+	}
+
+static void DecodeRuns(const uint8_t* p, const uint8_t* pEnd, uint64_t vcn, std::vector<NtfsRun>* pRuns)
+	{
+	int64_t lcn = 0;
+
+	// Each run is a header byte with the sizes of the length and offset fields, the length in
+	// clusters, and the offset from the previous run's first cluster (none for a sparse run).
+	while ((p < pEnd) && (*p != 0))
+		{
+		uint32_t lengthSize = *p & 0x0F;
+		uint32_t offsetSize = *p >> 4;
+		p++;
+
+		if ((lengthSize == 0) || (lengthSize > 8) || (offsetSize > 8) || (p + lengthSize + offsetSize > pEnd))
+			{
+			return;
+			}
+
+		uint64_t length = 0;
+		for (uint32_t i = 0; i < lengthSize; i++)
+			{
+			length |= (uint64_t)p[i] << (8 * i);
+			}
+		p += lengthSize;
+
+		NtfsRun run = { vcn, NTFS_SPARSE_RUN, length };
+		if (offsetSize > 0)
+			{
+			int64_t offset = (p[offsetSize - 1] & 0x80) ? -1 : 0;
+			for (uint32_t i = offsetSize; i > 0; i--)
+				{
+				offset = (int64_t)(((uint64_t)offset << 8) | p[i - 1]);
+				}
+			p += offsetSize;
+
+			lcn += offset;
+			run.lcn = (uint64_t)lcn;
+			}
+
+		pRuns->push_back(run);
+		vcn += length;
+		}
+	}
+
+NtfsVolume::NtfsVolume(BlockDevice* pDevice)
+	{
+	this->pDevice = pDevice;
+	this->bytesPerCluster = 0;
+	this->recordSize = 0;
+	this->recordCount = 0;
+	this->readBuffer = new uint8_t[READ_SIZE];
+	}
+
+NtfsVolume::~NtfsVolume()
+	{
+	delete[] this->readBuffer;
+	}
+
+bool NtfsVolume::Scan()
+	{
+	uint8_t boot[512];
+	if (!this->pDevice->Read(0, boot, sizeof(boot)) || (memcmp(boot + 3, "NTFS    ", 8) != 0))
+		{
+		return false;
+		}
+
+	uint32_t bytesPerSector = Read16(boot + BOOT_BYTES_PER_SECTOR);
+	uint32_t sectorsPerCluster = boot[BOOT_SECTORS_PER_CLUSTER];
+	int8_t clustersPerRecord = (int8_t)boot[BOOT_CLUSTERS_PER_RECORD];
+
+	// Clusters larger than 64KB have the power of two stored as a negative number.
+	if (sectorsPerCluster > 0x80)
+		{
+		sectorsPerCluster = 1U << (256 - sectorsPerCluster);
+		}
+
+	if ((bytesPerSector < 256) || (bytesPerSector > 4096) || (sectorsPerCluster == 0))
+		{
+		return false;
+		}
+
+	this->bytesPerCluster = bytesPerSector * sectorsPerCluster;
+	this->recordSize = (clustersPerRecord > 0) ? (uint32_t)clustersPerRecord * this->bytesPerCluster : 1U << -clustersPerRecord;
+
+	if ((this->recordSize < USA_STRIDE) || (this->recordSize > 65536) || (SCAN_SIZE % this->recordSize != 0))
+		{
+		return false;
+		}
+
+	// The MFT describes itself in record 0, which is found from the boot sector.
+	this->mftRuns.clear();
+	NtfsRun firstRun = { 0, Read64(boot + BOOT_MFT_CLUSTER), ((uint64_t)this->recordSize + this->bytesPerCluster - 1) / this->bytesPerCluster };
+	this->mftRuns.push_back(firstRun);
+
+	if (!this->ReadMftRuns())
+		{
+		return false;
+		}
+
+	this->ScanMft();
+	this->FindRecycleBins();
+	return true;
+	}
+
+bool NtfsVolume::ApplyFixups(uint8_t* pRecord)
+	{
+	uint32_t usaOffset = Read16(pRecord + RECORD_USA_OFFSET);
+	uint32_t usaCount = Read16(pRecord + RECORD_USA_COUNT);
+
+	// The last two bytes of every 512 were replaced by the update sequence number when the
+	// record was written, and the original bytes stored in the array that follows it.
+	if ((usaCount < 2) || (usaOffset + usaCount * 2 > this->recordSize) || ((usaCount - 1) * USA_STRIDE > this->recordSize))
+		{
+		return false;
+		}
+
+	const uint8_t* pUsn = pRecord + usaOffset;
+	for (uint32_t i = 1; i < usaCount; i++)
+		{
+		uint8_t* pEnd = pRecord + i * USA_STRIDE - 2;
+		if ((pEnd[0] != pUsn[0]) || (pEnd[1] != pUsn[1]))
+			{
+			return false;
+			}
+
+		pEnd[0] = pUsn[2 * i];
+		pEnd[1] = pUsn[2 * i + 1];
+		}
+
+	return true;
+	}
+
+bool NtfsVolume::ReadRecord(uint64_t record, uint8_t* pRecord)
+	{
+	uint64_t offset = record * this->recordSize;
+	uint32_t cbLeft = this->recordSize;
+
+	// A record can start in one run and end in the next when the MFT is fragmented, so it is
+	// read a run at a time.
+	while (cbLeft > 0)
+		{
+		uint64_t vcn = offset / this->bytesPerCluster;
+		const NtfsRun* pRun = NULL;
+		for (size_t i = 0; i < this->mftRuns.size(); i++)
+			{
+			const NtfsRun& run = this->mftRuns[i];
+			if ((vcn >= run.vcn) && (vcn < run.vcn + run.length) && (run.lcn != NTFS_SPARSE_RUN))
+				{
+				pRun = &run;
+				break;
+				}
+			}
+
+		if (pRun == NULL)
+			{
+			return false;
+			}
+
+		uint64_t cbInRun = (pRun->vcn + pRun->length) * this->bytesPerCluster - offset;
+		uint32_t cbRead = (cbInRun < cbLeft) ? (uint32_t)cbInRun : cbLeft;
+		uint64_t position = pRun->lcn * this->bytesPerCluster + (offset - pRun->vcn * this->bytesPerCluster);
+		if (!this->pDevice->Read(position, pRecord + (this->recordSize - cbLeft), cbRead))
+			{
+			return false;
+			}
+
+		offset += cbRead;
+		cbLeft -= cbRead;
+		}
+
+	return this->ApplyFixups(pRecord);
+	}
+
+bool NtfsVolume::ParseRecord(uint32_t record, const uint8_t* pRecord, NtfsFile* pFile, uint32_t* pBase)
+	{
+	uint16_t flags = Read16(pRecord + RECORD_FLAGS);
+	if ((memcmp(pRecord, "FILE", 4) != 0) || ((flags & RECORD_IN_USE) == 0))
+		{
+		return false;
+		}
+
+	*pBase = RecordNumber(Read64(pRecord + RECORD_BASE_RECORD));
+
+	pFile->record = record;
+	pFile->parent = NO_RECORD;
+	pFile->name.clear();
+	pFile->nameSpace = FILE_NAME_NONE;
+	pFile->isFolder = (flags & RECORD_IS_DIRECTORY) != 0;
+	pFile->isResident = false;
+	pFile->isUnreadable = false;
+	pFile->size = 0;
+	pFile->created = pFile->modified = pFile->accessed = FILETIME();
+	pFile->runs.clear();
+	pFile->residentData.clear();
+	pFile->children.clear();
+
+	uint32_t usedSize = Read32(pRecord + RECORD_USED_SIZE);
+	if (usedSize > this->recordSize)
+		{
+		usedSize = this->recordSize;
+		}
+
+	uint32_t offset = Read16(pRecord + RECORD_FIRST_ATTRIBUTE);
+	while (offset + 0x18 <= usedSize)
+		{
+		const uint8_t* pAttribute = pRecord + offset;
+		uint32_t type = Read32(pAttribute + ATTRIBUTE_TYPE);
+		uint32_t length = Read32(pAttribute + ATTRIBUTE_LENGTH);
+
+		if ((type == TYPE_END) || (length < 0x18) || (offset + length > usedSize))
+			{
+			break;
+			}
+
+		bool isNonResident = pAttribute[ATTRIBUTE_NON_RESIDENT] != 0;
+		bool isNamed = pAttribute[ATTRIBUTE_NAME_LENGTH] != 0;
+
+		const uint8_t* pValue = NULL;
+		uint32_t valueLength = 0;
+		if (!isNonResident)
+			{
+			valueLength = Read32(pAttribute + ATTRIBUTE_VALUE_LENGTH);
+			uint32_t valueOffset = Read16(pAttribute + ATTRIBUTE_VALUE_OFFSET);
+			if ((uint64_t)valueOffset + valueLength <= length)
+				{
+				pValue = pAttribute + valueOffset;
+				}
+			}
+
+		if ((type == TYPE_STANDARD_INFORMATION) && (pValue != NULL) && (valueLength >= 0x20))
+			{
+			pFile->created = ReadFileTime(pValue + 0x00);
+			pFile->modified = ReadFileTime(pValue + 0x08);
+			pFile->accessed = ReadFileTime(pValue + 0x18);
+			}
+		else if ((type == TYPE_FILE_NAME) && (pValue != NULL) && (valueLength >= FILE_NAME_NAME))
+			{
+			uint32_t nameLength = pValue[FILE_NAME_LENGTH];
+			uint8_t nameSpace = pValue[FILE_NAME_NAMESPACE];
+
+			// A file has a DOS 8.3 name as well as its long name unless the long name is a
+			// valid 8.3 name, so the DOS name is only used if there is no other.
+			bool isBetter = (pFile->nameSpace == FILE_NAME_NONE) || ((pFile->nameSpace == FILE_NAME_DOS) && (nameSpace != FILE_NAME_DOS));
+			if (isBetter && (FILE_NAME_NAME + nameLength * 2 <= valueLength))
+				{
+				pFile->name.resize(nameLength);
+				for (uint32_t i = 0; i < nameLength; i++)
+					{
+					pFile->name[i] = (wchar_t)Read16(pValue + FILE_NAME_NAME + 2 * i);
+					}
+				pFile->parent = RecordNumber(Read64(pValue + FILE_NAME_PARENT));
+				pFile->nameSpace = nameSpace;
+				}
+			}
+		else if ((type == TYPE_DATA) && !isNamed)
+			{
+			if ((Read16(pAttribute + ATTRIBUTE_FLAGS) & (ATTRIBUTE_COMPRESSED | ATTRIBUTE_ENCRYPTED)) != 0)
+				{
+				pFile->isUnreadable = true;
+				}
+
+			if (!isNonResident)
+				{
+				// Copied now, while the record is in memory, so reading the file later (every
+				// $I file is read) needs no I/O at all.
+				pFile->isResident = true;
+				pFile->size = valueLength;
+				if (pValue != NULL)
+					{
+					pFile->residentData.assign(pValue, pValue + valueLength);
+					}
+				else
+					{
+					pFile->isUnreadable = true;
+					}
+				}
+			else if (length >= ATTRIBUTE_NON_RESIDENT_HEADER_SIZE)
+				{
+				// The data of a large, fragmented file may be split over several extension
+				// records, each with the runs from its starting cluster.
+				uint64_t startVcn = Read64(pAttribute + ATTRIBUTE_START_VCN);
+				if (startVcn == 0)
+					{
+					pFile->size = Read64(pAttribute + ATTRIBUTE_REAL_SIZE);
+					}
+
+				uint32_t runsOffset = Read16(pAttribute + ATTRIBUTE_RUNS_OFFSET);
+				if (runsOffset < length)
+					{
+					DecodeRuns(pAttribute + runsOffset, pAttribute + length, startVcn, &pFile->runs);
+					}
+				}
+			}
+
+		offset += length;
+		}
+
+	return true;
+	}
+
+bool NtfsVolume::ReadMftRuns()
+	{
+	std::vector<uint8_t> record(this->recordSize);
+	NtfsFile mft;
+	uint32_t base;
+
+	if (!this->ReadRecord(0, record.data()) || !this->ParseRecord(0, record.data(), &mft, &base) || mft.runs.empty())
+		{
+		return false;
+		}
+
+	this->mftRuns = mft.runs;
+
+	// If the MFT is very fragmented its runs continue in other records, listed in its
+	// attribute list (which is looked for only if it is resident, as it nearly always is).
+	uint32_t usedSize = Read32(record.data() + RECORD_USED_SIZE);
+	uint32_t offset = Read16(record.data() + RECORD_FIRST_ATTRIBUTE);
+	std::vector<uint32_t> extensionRecords;
+
+	while ((offset + 0x18 <= usedSize) && (usedSize <= this->recordSize))
+		{
+		const uint8_t* pAttribute = record.data() + offset;
+		uint32_t type = Read32(pAttribute + ATTRIBUTE_TYPE);
+		uint32_t length = Read32(pAttribute + ATTRIBUTE_LENGTH);
+
+		if ((type == TYPE_END) || (length < 0x18) || (offset + length > usedSize))
+			{
+			break;
+			}
+
+		if ((type == TYPE_ATTRIBUTE_LIST) && (pAttribute[ATTRIBUTE_NON_RESIDENT] == 0))
+			{
+			uint32_t valueLength = Read32(pAttribute + ATTRIBUTE_VALUE_LENGTH);
+			uint32_t valueOffset = Read16(pAttribute + ATTRIBUTE_VALUE_OFFSET);
+			const uint8_t* pEntry = pAttribute + valueOffset;
+			const uint8_t* pEnd = pEntry + valueLength;
+
+			while ((pEntry + 0x1A <= pEnd) && (pEnd <= pAttribute + length))
+				{
+				uint32_t entryLength = Read16(pEntry + ATTRIBUTE_LIST_LENGTH);
+				uint32_t entryRecord = RecordNumber(Read64(pEntry + ATTRIBUTE_LIST_RECORD));
+				if (entryLength == 0)
+					{
+					break;
+					}
+
+				if ((Read32(pEntry) == TYPE_DATA) && (entryRecord != 0))
+					{
+					extensionRecords.push_back(entryRecord);
+					}
+				pEntry += entryLength;
+				}
+			}
+
+		offset += length;
+		}
+
+	for (size_t i = 0; i < extensionRecords.size(); i++)
+		{
+		NtfsFile extension;
+		if (this->ReadRecord(extensionRecords[i], record.data()) && this->ParseRecord(extensionRecords[i], record.data(), &extension, &base))
+			{
+			this->AddExtension(&mft, &extension);
+			this->mftRuns = mft.runs;
+			}
+		}
+
+	this->recordCount = mft.size / this->recordSize;
+	return this->recordCount > ROOT_RECORD;
+	}
+
+void NtfsVolume::ScanMft()
+	{
+	this->parents.assign((size_t)this->recordCount, NO_RECORD);
+	this->files.clear();
+	this->extensions.clear();
+
+	uint8_t* pChunk = new uint8_t[SCAN_SIZE];
+	NtfsFile file;
+	uint64_t lastSplitRecord = UINT64_MAX;
+
+	for (size_t i = 0; i < this->mftRuns.size(); i++)
+		{
+		const NtfsRun& run = this->mftRuns[i];
+		if (run.lcn == NTFS_SPARSE_RUN)
+			{
+			continue;
+			}
+
+		// A record that starts in the run before and ends in this one (or a later one) is read
+		// on its own, and the chunks start at the first record that is wholly in the run.
+		uint64_t runStart = run.vcn * this->bytesPerCluster;
+		uint64_t runSize = run.length * this->bytesPerCluster;
+		uint64_t firstInRun = (runStart + this->recordSize - 1) / this->recordSize;
+		if ((runStart % this->recordSize != 0) && (firstInRun - 1 < this->recordCount) && (firstInRun - 1 != lastSplitRecord))
+			{
+			lastSplitRecord = firstInRun - 1;
+			if (this->ReadRecord(lastSplitRecord, pChunk))
+				{
+				this->ScanRecord((uint32_t)lastSplitRecord, pChunk, &file);
+				}
+			}
+
+		for (uint64_t position = firstInRun * this->recordSize - runStart; position + this->recordSize <= runSize; position += SCAN_SIZE)
+			{
+			uint64_t firstRecord = (runStart + position) / this->recordSize;
+			if (firstRecord >= this->recordCount)
+				{
+				break;
+				}
+
+			uint64_t size = runSize - position;
+			size = (size < SCAN_SIZE) ? size : SCAN_SIZE;
+			size = (size < (this->recordCount - firstRecord) * this->recordSize) ? size : (this->recordCount - firstRecord) * this->recordSize;
+
+			// One large read for many records, during which no other volume reads the image.
+			if (!this->pDevice->Read(run.lcn * this->bytesPerCluster + position, pChunk, (size_t)size))
+				{
+				continue;
+				}
+
+			for (uint64_t j = 0; j < size / this->recordSize; j++)
+				{
+				uint8_t* pRecord = pChunk + j * this->recordSize;
+				if (this->ApplyFixups(pRecord))
+					{
+					this->ScanRecord((uint32_t)(firstRecord + j), pRecord, &file);
+					}
+				}
+			}
+		}
+
+	delete[] pChunk;
+	}
+
+void NtfsVolume::ScanRecord(uint32_t record, const uint8_t* pRecord, NtfsFile* pFile)
+	{
+	uint32_t base;
+	if (!this->ParseRecord(record, pRecord, pFile, &base))
+		{
+		return;
+		}
+
+	// Only the number of an extension record is kept, as few of them are of files that are
+	// kept.  A file whose names are all in extension records still needs its parent.
+	if (base != 0)
+		{
+		if (!pFile->runs.empty() || !pFile->name.empty() || pFile->isResident)
+			{
+			this->extensions.push_back(std::make_pair(base, record));
+			}
+
+		if (!pFile->name.empty() && (base < this->recordCount) && (this->parents[base] == NO_RECORD))
+			{
+			this->parents[base] = pFile->parent;
+			}
+		return;
+		}
+
+	if (pFile->parent != NO_RECORD)
+		{
+		this->parents[record] = pFile->parent;
+		}
+
+	bool isKept = pFile->isFolder ? (NameStartsWith(pFile->name, L"S-1-") || IsRecycleBinRoot(*pFile)) : false;
+	isKept = isKept || NameStartsWith(pFile->name, L"$I") || NameStartsWith(pFile->name, L"$R")
+		|| NameStartsWith(pFile->name, L"Dc") || NameEquals(pFile->name, L"INFO2", 5);
+
+	if (isKept)
+		{
+		this->files[record] = *pFile;
+		}
+	}
+
+void NtfsVolume::AddExtension(NtfsFile* pFile, NtfsFile* pExtension)
+	{
+	if ((pFile->nameSpace == FILE_NAME_NONE) || ((pFile->nameSpace == FILE_NAME_DOS) && (pExtension->nameSpace != FILE_NAME_NONE)))
+		{
+		if (!pExtension->name.empty())
+			{
+			pFile->name = pExtension->name;
+			pFile->parent = pExtension->parent;
+			pFile->nameSpace = pExtension->nameSpace;
+			}
+		}
+
+	if (pExtension->isResident && !pFile->isResident)
+		{
+		pFile->isResident = true;
+		pFile->size = pExtension->size;
+		pFile->residentData = pExtension->residentData;
+		}
+
+	pFile->runs.insert(pFile->runs.end(), pExtension->runs.begin(), pExtension->runs.end());
+	std::sort(pFile->runs.begin(), pFile->runs.end(), [](const NtfsRun& left, const NtfsRun& right) { return left.vcn < right.vcn; });
+	pFile->isUnreadable = pFile->isUnreadable || pExtension->isUnreadable;
+	}
+
+void NtfsVolume::FindRecycleBins()
+	{
+	std::vector<uint32_t> roots;
+	for (std::unordered_map<uint32_t, NtfsFile>::iterator it = this->files.begin(); it != this->files.end(); ++it)
+		{
+		if (IsRecycleBinRoot(it->second))
+			{
+			roots.push_back(it->first);
+			}
+		}
+
+	this->recycleBins.clear();
+	for (std::unordered_map<uint32_t, NtfsFile>::iterator it = this->files.begin(); it != this->files.end(); ++it)
+		{
+		if (it->second.isFolder && NameStartsWith(it->second.name, L"S-1-")
+			&& (std::find(roots.begin(), roots.end(), it->second.parent) != roots.end()))
+			{
+			this->recycleBins.push_back(it->first);
+			}
+		}
+	std::sort(this->recycleBins.begin(), this->recycleBins.end());
+
+	// Everything else was only kept because of its name, so the $I and $R files (and SID
+	// folders) elsewhere on the volume are dropped.
+	std::vector<uint32_t> dataFolders;
+	for (std::unordered_map<uint32_t, NtfsFile>::iterator it = this->files.begin(); it != this->files.end(); )
+		{
+		bool isRoot = std::find(roots.begin(), roots.end(), it->first) != roots.end();
+		bool isBin = std::binary_search(this->recycleBins.begin(), this->recycleBins.end(), it->first);
+		bool isInBin = std::binary_search(this->recycleBins.begin(), this->recycleBins.end(), it->second.parent);
+
+		if (!isRoot && !isBin && !isInBin)
+			{
+			it = this->files.erase(it);
+			continue;
+			}
+
+		if (isInBin && it->second.isFolder)
+			{
+			dataFolders.push_back(it->first);
+			}
+		++it;
+		}
+
+	this->ReadFilesBelow(dataFolders);
+
+	// The extension records of the files kept are read again, in record order.
+	std::sort(this->extensions.begin(), this->extensions.end(), [](const std::pair<uint32_t, uint32_t>& left, const std::pair<uint32_t, uint32_t>& right) { return left.second < right.second; });
+
+	std::vector<uint8_t> record(this->recordSize);
+	NtfsFile extension;
+	for (size_t i = 0; i < this->extensions.size(); i++)
+		{
+		std::unordered_map<uint32_t, NtfsFile>::iterator file = this->files.find(this->extensions[i].first);
+		uint32_t base;
+		if ((file != this->files.end()) && this->ReadRecord(this->extensions[i].second, record.data())
+			&& this->ParseRecord(this->extensions[i].second, record.data(), &extension, &base) && (base == file->first))
+			{
+			this->AddExtension(&file->second, &extension);
+			}
+		}
+	this->extensions.clear();
+	this->extensions.shrink_to_fit();
+
+	std::vector<NtfsFile*> sorted;
+	for (std::unordered_map<uint32_t, NtfsFile>::iterator it = this->files.begin(); it != this->files.end(); ++it)
+		{
+		sorted.push_back(&it->second);
+		}
+	std::sort(sorted.begin(), sorted.end(), CompareNames);
+
+	for (size_t i = 0; i < sorted.size(); i++)
+		{
+		std::unordered_map<uint32_t, NtfsFile>::iterator parent = this->files.find(sorted[i]->parent);
+		if ((parent != this->files.end()) && (sorted[i]->record != sorted[i]->parent))
+			{
+			parent->second.children.push_back(sorted[i]->record);
+			}
+		}
+	}
+
+void NtfsVolume::ReadFilesBelow(const std::vector<uint32_t>& folders)
+	{
+	if (folders.empty())
+		{
+		return;
+		}
+
+	// For each record, whether it is below one of the folders: 0 not known yet, 1 below,
+	// 2 not below, 3 on the parent chain being followed.
+	std::vector<uint8_t> below((size_t)this->recordCount, 0);
+	for (size_t i = 0; i < folders.size(); i++)
+		{
+		below[folders[i]] = 1;
+		}
+	below[ROOT_RECORD] = 2;
+
+	std::vector<uint32_t> chain;
+	std::vector<uint32_t> needed;
+	for (uint32_t record = 0; record < this->recordCount; record++)
+		{
+		if ((below[record] != 0) || (this->parents[record] == NO_RECORD))
+			{
+			continue;
+			}
+
+		chain.clear();
+		uint32_t ancestor = record;
+		while ((ancestor < this->recordCount) && (below[ancestor] == 0) && (this->parents[ancestor] != NO_RECORD) && (chain.size() < MAX_FOLDER_DEPTH))
+			{
+			chain.push_back(ancestor);
+			below[ancestor] = 3;
+			ancestor = this->parents[ancestor];
+			}
+
+		uint8_t state = ((ancestor < this->recordCount) && (below[ancestor] == 1)) ? 1 : 2;
+		for (size_t i = 0; i < chain.size(); i++)
+			{
+			below[chain[i]] = state;
+			if ((state == 1) && (this->files.find(chain[i]) == this->files.end()))
+				{
+				needed.push_back(chain[i]);
+				}
+			}
+		}
+
+	std::sort(needed.begin(), needed.end());
+
+	std::vector<uint8_t> record(this->recordSize);
+	NtfsFile file;
+	for (size_t i = 0; i < needed.size(); i++)
+		{
+		uint32_t base;
+		if (this->ReadRecord(needed[i], record.data()) && this->ParseRecord(needed[i], record.data(), &file, &base) && (base == 0))
+			{
+			this->files[needed[i]] = file;
+			}
+		}
+	}
+
+size_t NtfsVolume::GetRecycleBinCount()
+	{
+	return this->recycleBins.size();
+	}
+
+NtfsFile* NtfsVolume::GetRecycleBin(size_t index)
+	{
+	return this->GetFile(this->recycleBins[index]);
+	}
+
+NtfsFile* NtfsVolume::GetFile(uint32_t record)
+	{
+	std::unordered_map<uint32_t, NtfsFile>::iterator it = this->files.find(record);
+	return (it != this->files.end()) ? &it->second : NULL;
+	}
+
+NtfsFile* NtfsVolume::FindChild(NtfsFile* pFolder, const wchar_t* szName, size_t length)
+	{
+	// The children are in name order (see FindRecycleBins()), so every $I file read or $R
+	// file looked up in a big Recycle Bin is a binary search rather than a scan of them all.
+	size_t low = 0;
+	size_t high = pFolder->children.size();
+	while (low < high)
+		{
+		size_t middle = low + (high - low) / 2;
+		NtfsFile* pChild = this->GetFile(pFolder->children[middle]);
+		if (CompareName(pChild->name, szName, length) < 0)
+			{
+			low = middle + 1;
+			}
+		else
+			{
+			high = middle;
+			}
+		}
+
+	if (low < pFolder->children.size())
+		{
+		NtfsFile* pChild = this->GetFile(pFolder->children[low]);
+		if (NameEquals(pChild->name, szName, length))
+			{
+			return pChild;
+			}
+		}
+
+	return NULL;
+	}
+
+bool NtfsVolume::ReadFileData(NtfsFile* pFile, FileDataHandler fn, void* context)
+	{
+	if (pFile->isFolder || pFile->isUnreadable)
+		{
+		return false;
+		}
+
+	if (pFile->isResident)
+		{
+		return pFile->residentData.empty() || fn(pFile->residentData.data(), pFile->residentData.size(), context);
+		}
+
+	uint64_t remaining = pFile->size;
+	uint64_t vcn = 0;
+
+	for (size_t i = 0; (i < pFile->runs.size()) && (remaining > 0); i++)
+		{
+		const NtfsRun& run = pFile->runs[i];
+		if (run.vcn != vcn)
+			{
+			return false;
+			}
+
+		uint64_t runSize = run.length * this->bytesPerCluster;
+		for (uint64_t position = 0; (position < runSize) && (remaining > 0); )
+			{
+			size_t count = (size_t)((runSize - position < READ_SIZE) ? runSize - position : READ_SIZE);
+			count = (size_t)((remaining < count) ? remaining : count);
+
+			if (run.lcn == NTFS_SPARSE_RUN)
+				{
+				memset(this->readBuffer, 0, count);
+				}
+			else if (!this->pDevice->Read(run.lcn * this->bytesPerCluster + position, this->readBuffer, count))
+				{
+				return false;
+				}
+
+			if (!fn(this->readBuffer, count, context))
+				{
+				return false;
+				}
+
+			position += count;
+			remaining -= count;
+			}
+
+		vcn += run.length;
+		}
+
+	return remaining == 0;
+	}
+
+NtfsRecycleBin::NtfsRecycleBin(NtfsVolume* pVolume, NtfsFile* pFolder)
+	{
+	this->pVolume = pVolume;
+	this->pFolder = pFolder;
+	}
+
+NtfsFile* NtfsRecycleBin::Resolve(const wchar_t* szPath)
+	{
+	NtfsFile* pFile = this->pFolder;
+
+	while ((pFile != NULL) && (*szPath != L'\0'))
+		{
+		const wchar_t* pEnd = wcschr(szPath, L'\\');
+		size_t length = (pEnd != NULL) ? (size_t)(pEnd - szPath) : wcslen(szPath);
+
+		if ((length > 0) && !((length == 1) && (szPath[0] == L'.')))
+			{
+			pFile = this->pVolume->FindChild(pFile, szPath, length);
+			}
+
+		szPath += length;
+		if (*szPath == L'\\')
+			{
+			szPath++;
+			}
+		}
+
+	return pFile;
+	}
+
+void NtfsRecycleBin::FindFiles(const wchar_t* szFolder, const wchar_t* szWild, FoundFileHandler fn, void* context)
+	{
+	NtfsFile* pFolder = this->Resolve(szFolder);
+	if ((pFolder == NULL) || !pFolder->isFolder)
+		{
+		return;
+		}
+
+	for (size_t i = 0; i < pFolder->children.size(); i++)
+		{
+		NtfsFile* pFile = this->pVolume->GetFile(pFolder->children[i]);
+		if ((pFile == NULL) || !MatchWildcard(szWild, pFile->name.c_str()))
+			{
+			continue;
+			}
+
+		WIN32_FIND_DATA ffd = {};
+		ffd.dwFileAttributes = pFile->isFolder ? FILE_ATTRIBUTE_DIRECTORY : FILE_ATTRIBUTE_NORMAL;
+		ffd.ftCreationTime = pFile->created;
+		ffd.ftLastWriteTime = pFile->modified;
+		ffd.ftLastAccessTime = pFile->accessed;
+		ffd.nFileSizeHigh = (DWORD)(pFile->size >> 32);
+		ffd.nFileSizeLow = (DWORD)pFile->size;
+		StringCchCopy(ffd.cFileName, MAX_PATH, pFile->name.c_str());
+
+		fn(&ffd, context);
+		}
+	}
+
+bool NtfsRecycleBin::GetAttributes(const wchar_t* szFileName, WIN32_FILE_ATTRIBUTE_DATA* pAttributes)
+	{
+	NtfsFile* pFile = this->Resolve(szFileName);
+	if (pFile == NULL)
+		{
+		return false;
+		}
+
+	pAttributes->dwFileAttributes = pFile->isFolder ? FILE_ATTRIBUTE_DIRECTORY : FILE_ATTRIBUTE_NORMAL;
+	pAttributes->ftCreationTime = pFile->created;
+	pAttributes->ftLastWriteTime = pFile->modified;
+	pAttributes->ftLastAccessTime = pFile->accessed;
+	pAttributes->nFileSizeHigh = pFile->isFolder ? 0 : (DWORD)(pFile->size >> 32);
+	pAttributes->nFileSizeLow = pFile->isFolder ? 0 : (DWORD)pFile->size;
+	return true;
+	}
+
+bool NtfsRecycleBin::ReadFileData(const wchar_t* szFileName, FileDataHandler fn, void* context)
+	{
+	NtfsFile* pFile = this->Resolve(szFileName);
+	return (pFile != NULL) && this->pVolume->ReadFileData(pFile, fn, context);
+	}
@@ -0,0 +1,134 @@
+// NtfsVolume.h
+//
+// Finds the Recycle Bins of an NTFS volume in an image by reading its master file table (MFT)
+// directly, without the volume being mounted.
+//
+// Every file on an NTFS volume has a record in the MFT, and each record names the file's
+// parent folder (in its $FILE_NAME attribute), so the folder tree can be built from the MFT
+// alone, without reading any directory indexes.  The MFT is read from start to end in large
+// sequential chunks, and rather than keeping every file of the volume only these are kept:
+//
+//     \$Recycle.Bin, the SID folders in it, and the $I and $R files in those.
+//     \RECYCLER (before Windows Vista), its SID folders, and the INFO2 and Dc files in those.
+//
+// Just the parent of every other record is kept, and once the whole MFT has been read it is
+// used to find the files and folders below the $R (and Dc) folders, whose records are then read again
+// one at a time (there are rarely many of them).
+//
+// File contents are read through the runs of the $DATA attribute.  Resident data (small
+// files, which includes nearly every $I file) is stored in the MFT record itself, and is copied
+// out of the record as the MFT is scanned, so reading the $I files of a volume costs nothing
+// beyond the one sequential read of its MFT.  Compressed and encrypted data is not supported.
+
+#pragma once
+
+#include "windows.h"
+#include "cstdint"
+#include "BlockDevice.h"
+#include "FileSource.h"
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+// A run of clusters of a file's data.
+struct NtfsRun
+	{
+	uint64_t vcn;               // First cluster of the run within the file.
+	uint64_t lcn;               // First cluster of the run on the volume, NTFS_SPARSE_RUN if not allocated.
+	uint64_t length;            // In clusters.
+	};
+
+const uint64_t NTFS_SPARSE_RUN = 0xFFFFFFFFFFFFFFFFULL;
+
+struct NtfsFile
+	{
+	uint32_t record;
+	uint32_t parent;
+	std::wstring name;
+	uint8_t nameSpace;          // Of the $FILE_NAME the name is from, 2 (DOS) names are replaced by any other.
+	bool isFolder;
+	bool isResident;            // The $DATA is stored in the MFT record.
+	bool isUnreadable;          // The $DATA is compressed or encrypted.
+	uint64_t size;
+	FILETIME created;
+	FILETIME modified;
+	FILETIME accessed;
+	std::vector<NtfsRun> runs;
+	std::vector<uint8_t> residentData;
+	std::vector<uint32_t> children;
+	};
+
+class NtfsVolume
+	{
+	public:
+		NtfsVolume(BlockDevice* pDevice);
+		~NtfsVolume();
+
+		// Read the boot sector and the MFT.  Returns false if the volume is not readable NTFS.
+		bool Scan();
+
+		// The SID folders of the volume's Recycle Bin.
+		size_t GetRecycleBinCount();
+		NtfsFile* GetRecycleBin(size_t index);
+
+		// Returns NULL if the record was not kept by Scan().
+		NtfsFile* GetFile(uint32_t record);
+		NtfsFile* FindChild(NtfsFile* pFolder, const wchar_t* szName, size_t length);
+
+		bool ReadFileData(NtfsFile* pFile, FileDataHandler fn, void* context);
+
+	protected:
+		// Read a record through the MFT's runs and undo its update sequence fixups.
+		bool ReadRecord(uint64_t record, uint8_t* pRecord);
+		bool ApplyFixups(uint8_t* pRecord);
+
+		// Returns false if the record is not in use.  pBase is set to the base record of an
+		// extension record and to 0 otherwise.
+		bool ParseRecord(uint32_t record, const uint8_t* pRecord, NtfsFile* pFile, uint32_t* pBase);
+
+		bool ReadMftRuns();
+		void ScanMft();
+		void ScanRecord(uint32_t record, const uint8_t* pRecord, NtfsFile* pFile);
+		void AddExtension(NtfsFile* pFile, NtfsFile* pExtension);
+		void FindRecycleBins();
+		void ReadFilesBelow(const std::vector<uint32_t>& folders);
+
+		static const size_t SCAN_SIZE = 4 * 1024 * 1024;
+		static const size_t READ_SIZE = 1024 * 1024;
+		static const uint32_t NO_RECORD = 0xFFFFFFFF;
+
+		BlockDevice* pDevice;
+		uint32_t bytesPerCluster;
+		uint32_t recordSize;
+		uint64_t recordCount;
+		std::vector<NtfsRun> mftRuns;
+
+		// Parent of every record in use, NO_RECORD for the rest.
+		std::vector<uint32_t> parents;
+
+		// The records kept, and the extension records of files whose attributes do not fit
+		// in one record, as (base record, extension record) until those of the files kept are
+		// read again by FindRecycleBins().
+		std::unordered_map<uint32_t, NtfsFile> files;
+		std::vector<std::pair<uint32_t, uint32_t>> extensions;
+
+		std::vector<uint32_t> recycleBins;
+		uint8_t* readBuffer;
+	};
+
+// The files of one SID folder of an NTFS volume's Recycle Bin.
+class NtfsRecycleBin : public FileSource
+	{
+	public:
+		NtfsRecycleBin(NtfsVolume* pVolume, NtfsFile* pFolder);
+
+		virtual void FindFiles(const wchar_t* szFolder, const wchar_t* szWild, FoundFileHandler fn, void* context);
+		virtual bool GetAttributes(const wchar_t* szFileName, WIN32_FILE_ATTRIBUTE_DATA* pAttributes);
+		virtual bool ReadFileData(const wchar_t* szFileName, FileDataHandler fn, void* context);
+
+	protected:
+		NtfsFile* Resolve(const wchar_t* szPath);
+
+		NtfsVolume* pVolume;
+		NtfsFile* pFolder;
+	};
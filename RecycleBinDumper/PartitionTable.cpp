@@ -0,0 +1,207 @@
+// PartitionTable.cpp
+//
+// MBR and GPT partition tables.
+
+#include "PartitionTable.h"
+#include "string.h"
+
+static const uint32_t MBR_ENTRIES = 446;
+static const uint32_t MBR_ENTRY_SIZE = 16;
+static const uint8_t MBR_TYPE_GPT = 0xEE;
+
+// An extended partition chain longer than this is assumed to be a loop.
+static const uint32_t MAX_LOGICAL_PARTITIONS = 128;
+
+// A GPT partition table may have up to this many entries read.
+static const uint32_t MAX_GPT_ENTRIES = 1024;
+
+static uint32_t Read32(const uint8_t* p)
+	{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+	}
+
+static uint64_t Read64(const uint8_t* p)
+	{
+	return (uint64_t)Read32(p) | ((uint64_t)Read32(p + 4) << 32);
+	}
+
+static bool IsExtendedType(uint8_t type)
+	{
+	return (type == 0x05) || (type == 0x0F) || (type == 0x85);
+	}
+
+static bool HasBootSignature(const uint8_t* pSector)
+	{
+	return (pSector[510] == 0x55) && (pSector[511] == 0xAA);
+	}
+
+static void AddPartition(BlockDevice* pDevice, uint64_t offset, uint64_t size, std::vector<Partition>* pPartitions)
+	{
+	if ((size == 0) || (offset >= pDevice->GetSize()))
+		{
+		return;
+		}
+
+	// A partition table may claim more than the image holds (e.g. a truncated image).
+	if (size > pDevice->GetSize() - offset)
+		{
+		size = pDevice->GetSize() - offset;
+		}
+
+	Partition partition;
+	partition.number = (uint32_t)pPartitions->size() + 1;
+	partition.offset = offset;
+	partition.size = size;
+	partition.type = GetVolumeType(pDevice, offset);
+	pPartitions->push_back(partition);
+	}
+
+static void AddLogicalPartitions(BlockDevice* pDevice, uint64_t extendedStart, std::vector<Partition>* pPartitions)
+	{
+	uint8_t sector[SECTOR_SIZE];
+	uint64_t recordOffset = extendedStart;
+
+	for (uint32_t i = 0; i < MAX_LOGICAL_PARTITIONS; i++)
+		{
+		if (!pDevice->Read(recordOffset, sector, SECTOR_SIZE) || !HasBootSignature(sector))
+			{
+			return;
+			}
+
+		const uint8_t* pLogical = sector + MBR_ENTRIES;
+		const uint8_t* pNext = sector + MBR_ENTRIES + MBR_ENTRY_SIZE;
+
+		if (pLogical[4] != 0)
+			{
+			AddPartition(pDevice, recordOffset + (uint64_t)Read32(pLogical + 8) * SECTOR_SIZE, (uint64_t)Read32(pLogical + 12) * SECTOR_SIZE, pPartitions);
+			}
+
+		if (!IsExtendedType(pNext[4]) || (Read32(pNext + 8) == 0))
+			{
+			return;
+			}
+
+		recordOffset = extendedStart + (uint64_t)Read32(pNext + 8) * SECTOR_SIZE;
+		}
+	}
+
+static bool AddGptPartitions(BlockDevice* pDevice, std::vector<Partition>* pPartitions)
+	{
+	uint8_t header[SECTOR_SIZE];
+	if (!pDevice->Read(SECTOR_SIZE, header, SECTOR_SIZE) || (memcmp(header, "EFI PART", 8) != 0))
+		{
+		return false;
+		}
+
+	uint64_t entriesOffset = Read64(header + 0x48) * SECTOR_SIZE;
+	uint32_t entryCount = Read32(header + 0x50);
+	uint32_t entrySize = Read32(header + 0x54);
+
+	if ((entrySize < 128) || (entrySize > SECTOR_SIZE) || (entryCount > MAX_GPT_ENTRIES))
+		{
+		return false;
+		}
+
+	std::vector<uint8_t> entries((size_t)entryCount * entrySize);
+	if (!pDevice->Read(entriesOffset, entries.data(), entries.size()))
+		{
+		return false;
+		}
+
+	static const uint8_t unusedType[16] = {};
+	for (uint32_t i = 0; i < entryCount; i++)
+		{
+		const uint8_t* pEntry = entries.data() + (size_t)i * entrySize;
+		uint64_t firstSector = Read64(pEntry + 0x20);
+		uint64_t lastSector = Read64(pEntry + 0x28);
+
+		if ((memcmp(pEntry, unusedType, 16) != 0) && (lastSector >= firstSector))
+			{
+			AddPartition(pDevice, firstSector * SECTOR_SIZE, (lastSector - firstSector + 1) * SECTOR_SIZE, pPartitions);
+			}
+		}
+
+	return true;
+	}
+
+bool FindPartitions(BlockDevice* pDevice, std::vector<Partition>* pPartitions)
+	{
+	pPartitions->clear();
+
+	uint8_t sector[SECTOR_SIZE];
+	if (!pDevice->Read(0, sector, SECTOR_SIZE) || !HasBootSignature(sector))
+		{
+		return false;
+		}
+
+	// A volume boot sector is not a partition table, even though it also ends in 0x55AA.
+	if (GetVolumeType(pDevice, 0) != VOLUME_UNKNOWN)
+		{
+		AddPartition(pDevice, 0, pDevice->GetSize(), pPartitions);
+		return true;
+		}
+
+	for (uint32_t i = 0; i < 4; i++)
+		{
+		const uint8_t* pEntry = sector + MBR_ENTRIES + i * MBR_ENTRY_SIZE;
+		uint8_t type = pEntry[4];
+		uint64_t offset = (uint64_t)Read32(pEntry + 8) * SECTOR_SIZE;
+
+		if (type == MBR_TYPE_GPT)
+			{
+			return AddGptPartitions(pDevice, pPartitions);
+			}
+		else if (IsExtendedType(type))
+			{
+			AddLogicalPartitions(pDevice, offset, pPartitions);
+			}
+		else if (type != 0)
+			{
+			AddPartition(pDevice, offset, (uint64_t)Read32(pEntry + 12) * SECTOR_SIZE, pPartitions);
+			}
+		}
+
+	return true;
+	}
+
+VolumeType GetVolumeType(BlockDevice* pDevice, uint64_t offset)
+	{
+	uint8_t sector[SECTOR_SIZE];
+	if (!pDevice->Read(offset, sector, SECTOR_SIZE) || !HasBootSignature(sector))
+		{
+		return VOLUME_UNKNOWN;
+		}
+
+	if (memcmp(sector + 3, "NTFS    ", 8) == 0)
+		{
+		return VOLUME_NTFS;
+		}
+	else if (memcmp(sector + 3, "EXFAT   ", 8) == 0)
+		{
+		return VOLUME_EXFAT;
+		}
+	else if ((memcmp(sector + 0x36, "FAT", 3) == 0) || (memcmp(sector + 0x52, "FAT32", 5) == 0))
+		{
+		return VOLUME_FAT;
+		}
+
+	return VOLUME_UNKNOWN;
+	}
+
+const wchar_t* GetVolumeTypeName(VolumeType type)
+	{
+	switch (type)
+		{
+		case VOLUME_NTFS:
+			return L"NTFS";
+
+		case VOLUME_FAT:
+			return L"FAT";
+
+		case VOLUME_EXFAT:
+			return L"exFAT";
+
+		default:
+			return L"unknown";
+		}
+	}
@@ -0,0 +1,46 @@
+// PartitionTable.h
+//
+// Finds the volumes on a disk image from its partition table:
+//
+//   MBR  four primary partition entries at offset 446 of sector 0.  An extended partition
+//        (type 0x05, 0x0F or 0x85) holds a chain of extended boot records, each with one
+//        logical partition (relative to that record) and the next record of the chain
+//        (relative to the start of the extended partition).
+//   GPT  a protective MBR entry of type 0xEE, the GPT header in sector 1 ("EFI PART") and
+//        its table of partition entries.
+//
+// An image with no partition table that starts with a boot sector is a single volume image.
+// The file system of each volume is identified from its boot sector.  Sectors are assumed to
+// be 512 bytes, as they are on almost every image.
+
+#pragma once
+
+#include "windows.h"
+#include "cstdint"
+#include "BlockDevice.h"
+#include <vector>
+
+enum VolumeType
+	{
+	VOLUME_UNKNOWN,
+	VOLUME_NTFS,
+	VOLUME_FAT,
+	VOLUME_EXFAT,
+	};
+
+struct Partition
+	{
+	uint32_t number;            // 1 based, in the order they were found.
+	uint64_t offset;            // Bytes from the start of the disk.
+	uint64_t size;
+	VolumeType type;
+	};
+
+const uint32_t SECTOR_SIZE = 512;
+
+// Returns false if the image has neither a partition table nor a boot sector.
+bool FindPartitions(BlockDevice* pDevice, std::vector<Partition>* pPartitions);
+
+VolumeType GetVolumeType(BlockDevice* pDevice, uint64_t offset);
+
+const wchar_t* GetVolumeTypeName(VolumeType type);
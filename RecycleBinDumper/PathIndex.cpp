@@ -0,0 +1,539 @@
+// PathIndex.cpp
+//
+// Memory mapped trie of original paths.  See PathIndex.h for the file layout.
+
+#include "PathIndex.h"
+#include "stdio.h"
+#include "string.h"
+#include "wchar.h"
+#include "wctype.h"
+#include <algorithm>
+
+static const char pathIndexMagic[8] = { 'R', 'B', 'D', 'P', 'A', 'T', 'H', '1' };
+
+static const wchar_t pathIndexHeader[] = L"Original Full Path,Deleted Date Time,Size,Folder,Deleted Item,SID,";
+
+// Paths sort with '\' before every other character, which puts them in the depth first order of
+// their trie, with the children of each node in name order.
+static int ComparePaths(const wchar_t* left, size_t leftLength, const wchar_t* right, size_t rightLength)
+	{
+	size_t length = (leftLength < rightLength) ? leftLength : rightLength;
+	for (size_t i = 0; i < length; i++)
+		{
+		uint32_t leftChar = (left[i] == L'\\') ? 0 : (uint32_t)towupper(left[i]);
+		uint32_t rightChar = (right[i] == L'\\') ? 0 : (uint32_t)towupper(right[i]);
+		if (leftChar != rightChar)
+			{
+			return (leftChar < rightChar) ? -1 : 1;
+			}
+		}
+
+	return (leftLength == rightLength) ? 0 : ((leftLength < rightLength) ? -1 : 1);
+	}
+
+PathIndexBuilder::PathIndexBuilder()
+	{
+	this->path.resize(MAX_ORIGINAL_PATH);
+	}
+
+uint32_t PathIndexBuilder::AddName(const wchar_t* name, size_t length)
+	{
+	std::wstring key(name, length);
+	std::unordered_map<std::wstring, uint32_t>::iterator found = this->nameOffsets.find(key);
+	if (found != this->nameOffsets.end())
+		{
+		return found->second;
+		}
+
+	uint32_t offset = (uint32_t)this->names.size();
+	this->names.insert(this->names.end(), name, name + length);
+	this->nameOffsets[key] = offset;
+	return offset;
+	}
+
+void PathIndexBuilder::AddBin(const wchar_t* szSid)
+	{
+	size_t length = wcslen(szSid);
+	this->bins.push_back(this->AddName(szSid, length));
+	this->bins.push_back((uint32_t)length);
+	}
+
+void PathIndexBuilder::AddRow(RecycleRow* pRow)
+	{
+	size_t length = GetOriginalPath(pRow, this->path.data(), MAX_ORIGINAL_PATH);
+	if (length == 0)
+		{
+		return;
+		}
+
+	if (this->bins.empty())
+		{
+		this->AddBin(pRow->szSid);
+		}
+
+	Entry entry;
+	entry.pathOffset = this->paths.size();
+	entry.pathLength = (uint32_t)length;
+	entry.posting.deletedTime = (((uint64_t)pRow->pInfo->deletedTime.dwHighDateTime) << 32) + pRow->pInfo->deletedTime.dwLowDateTime;
+	entry.posting.size = pRow->isItem ? pRow->pInfo->deletedSize : pRow->size;
+	entry.posting.bin = (uint32_t)(this->bins.size() / 2 - 1);
+	entry.posting.flags = (pRow->isItem ? PATH_INDEX_ITEM : 0) | (pRow->isFolder ? PATH_INDEX_FOLDER : 0);
+
+	this->paths.insert(this->paths.end(), this->path.data(), this->path.data() + length);
+	this->entries.push_back(entry);
+	}
+
+bool PathIndexBuilder::Write(const wchar_t* szIndexFile)
+	{
+	const wchar_t* pPaths = this->paths.data();
+	std::stable_sort(this->entries.begin(), this->entries.end(), [pPaths](const Entry& left, const Entry& right)
+		{
+		return ComparePaths(pPaths + left.pathOffset, left.pathLength, pPaths + right.pathOffset, right.pathLength) < 0;
+		});
+
+	// The nodes are made as the sorted paths first reach them, which is depth first order, and
+	// each path's posting then belongs to the last node on the way.
+	std::vector<PathIndexNode> nodes;
+	std::vector<uint32_t> parents;
+	std::vector<uint64_t> postingStarts;
+	std::vector<PathIndexPosting> postings;
+	std::vector<uint32_t> open;         // Nodes on the way to the last path, starting at the root.
+
+	PathIndexNode root = { 0, 0, 0, 0, 0 };
+	nodes.push_back(root);
+	parents.push_back(0);
+	postingStarts.push_back(0);
+	open.push_back(0);
+
+	for (size_t i = 0; i < this->entries.size(); i++)
+		{
+		const wchar_t* pPath = pPaths + this->entries[i].pathOffset;
+		size_t pathLength = this->entries[i].pathLength;
+
+		size_t depth = 1;
+		for (size_t start = 0; start <= pathLength; depth++)
+			{
+			const wchar_t* pEnd = (const wchar_t*)wmemchr(pPath + start, L'\\', pathLength - start);
+			size_t end = (pEnd != NULL) ? pEnd - pPath : pathLength;
+
+			// A component that is not the one already open closes it, and everything below it.
+			if (depth < open.size())
+				{
+				const PathIndexNode* pOpen = &nodes[open[depth]];
+				if (ComparePaths(this->names.data() + pOpen->nameOffset, pOpen->nameLength, pPath + start, end - start) == 0)
+					{
+					start = end + 1;
+					continue;
+					}
+
+				while (open.size() > depth)
+					{
+					nodes[open.back()].subtreeEnd = (uint32_t)nodes.size();
+					open.pop_back();
+					}
+				}
+
+			PathIndexNode node = { this->AddName(pPath + start, end - start), (uint32_t)(end - start), 0, 0, 0 };
+			open.push_back((uint32_t)nodes.size());
+			parents.push_back(open[depth - 1]);
+			postingStarts.push_back(postings.size());
+			nodes.push_back(node);
+
+			start = end + 1;
+			}
+
+		postings.push_back(this->entries[i].posting);
+		}
+
+	while (!open.empty())
+		{
+		nodes[open.back()].subtreeEnd = (uint32_t)nodes.size();
+		open.pop_back();
+		}
+	postingStarts.push_back(postings.size());
+
+	// The children of each node, which are in name order as they are in node order.
+	for (size_t i = 1; i < nodes.size(); i++)
+		{
+		nodes[parents[i]].childCount++;
+		}
+
+	uint32_t childStart = 0;
+	for (size_t i = 0; i < nodes.size(); i++)
+		{
+		nodes[i].childStart = childStart;
+		childStart += nodes[i].childCount;
+		}
+
+	std::vector<uint32_t> children(nodes.size() - 1);
+	std::vector<uint32_t> childEnds(nodes.size());
+	for (size_t i = 0; i < nodes.size(); i++)
+		{
+		childEnds[i] = nodes[i].childStart;
+		}
+	for (size_t i = 1; i < nodes.size(); i++)
+		{
+		children[childEnds[parents[i]]++] = (uint32_t)i;
+		}
+
+	PathIndexHeader header;
+	memcpy(header.magic, pathIndexMagic, sizeof(header.magic));
+	header.nodeCount = (uint32_t)nodes.size();
+	header.binCount = (uint32_t)(this->bins.size() / 2);
+	header.postingCount = postings.size();
+	header.nameLength = this->names.size();
+
+	FILE* pIndex;
+	if (_wfopen_s(&pIndex, szIndexFile, L"wb") != 0)
+		{
+		return false;
+		}
+
+	bool written = (fwrite(&header, sizeof(header), 1, pIndex) == 1)
+		&& (fwrite(postings.data(), sizeof(PathIndexPosting), postings.size(), pIndex) == postings.size())
+		&& (fwrite(postingStarts.data(), sizeof(uint64_t), postingStarts.size(), pIndex) == postingStarts.size())
+		&& (fwrite(nodes.data(), sizeof(PathIndexNode), nodes.size(), pIndex) == nodes.size())
+		&& (fwrite(children.data(), sizeof(uint32_t), children.size(), pIndex) == children.size())
+		&& (fwrite(this->bins.data(), sizeof(uint32_t), this->bins.size(), pIndex) == this->bins.size())
+		&& (fwrite(this->names.data(), sizeof(wchar_t), this->names.size(), pIndex) == this->names.size());
+
+	if (fclose(pIndex) != 0)
+		{
+		written = false;
+		}
+
+	if (written)
+		{
+		fwprintf(stderr, L"%lld paths (%u folders and files) written to %s\n", (long long)postings.size(), header.nodeCount - 1, szIndexFile);
+		}
+	return written;
+	}
+
+PathIndex::PathIndex()
+	{
+	this->hFile = INVALID_HANDLE_VALUE;
+	this->hMapping = NULL;
+	this->header = NULL;
+	this->postings = NULL;
+	this->postingStarts = NULL;
+	this->nodes = NULL;
+	this->children = NULL;
+	this->bins = NULL;
+	this->names = NULL;
+	this->isDamaged = false;
+	}
+
+PathIndex::~PathIndex()
+	{
+	if (this->header != NULL)
+		{
+		UnmapViewOfFile(this->header);
+		}
+
+	if (this->hMapping != NULL)
+		{
+		CloseHandle(this->hMapping);
+		}
+
+	if (this->hFile != INVALID_HANDLE_VALUE)
+		{
+		CloseHandle(this->hFile);
+		}
+	}
+
+bool PathIndex::Open(const wchar_t* szIndexFile)
+	{
+	this->hFile = CreateFile(szIndexFile, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+	if (this->hFile == INVALID_HANDLE_VALUE)
+		{
+		return false;
+		}
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(this->hFile, &fileSize) || (uint64_t)fileSize.QuadPart < sizeof(PathIndexHeader))
+		{
+		return false;
+		}
+
+	this->hMapping = CreateFileMapping(this->hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (this->hMapping == NULL)
+		{
+		return false;
+		}
+
+	this->header = (const PathIndexHeader*)MapViewOfFile(this->hMapping, FILE_MAP_READ, 0, 0, 0);
+	if (this->header == NULL)
+		{
+		return false;
+		}
+
+	const PathIndexHeader* pHeader = this->header;
+	if ((memcmp(pHeader->magic, pathIndexMagic, sizeof(pathIndexMagic)) != 0) || (pHeader->nodeCount == 0))
+		{
+		return false;
+		}
+
+	uint64_t postingsSize = pHeader->postingCount * sizeof(PathIndexPosting);
+	uint64_t postingStartsSize = ((uint64_t)pHeader->nodeCount + 1) * sizeof(uint64_t);
+	uint64_t nodesSize = (uint64_t)pHeader->nodeCount * sizeof(PathIndexNode);
+	uint64_t childrenSize = ((uint64_t)pHeader->nodeCount - 1) * sizeof(uint32_t);
+	uint64_t binsSize = (uint64_t)pHeader->binCount * 2 * sizeof(uint32_t);
+	uint64_t expectedSize = sizeof(PathIndexHeader) + postingsSize + postingStartsSize + nodesSize + childrenSize + binsSize + pHeader->nameLength * sizeof(wchar_t);
+	if ((uint64_t)fileSize.QuadPart != expectedSize)
+		{
+		return false;
+		}
+
+	const uint8_t* p = (const uint8_t*)pHeader + sizeof(PathIndexHeader);
+	this->postings = (const PathIndexPosting*)p;
+	p += postingsSize;
+	this->postingStarts = (const uint64_t*)p;
+	p += postingStartsSize;
+	this->nodes = (const PathIndexNode*)p;
+	p += nodesSize;
+	this->children = (const uint32_t*)p;
+	p += childrenSize;
+	this->bins = (const uint32_t*)p;
+	p += binsSize;
+	this->names = (const wchar_t*)p;
+
+	return true;
+	}
+
+bool PathIndex::CheckNode(uint32_t node)
+	{
+	const PathIndexHeader* pHeader = this->header;
+	const PathIndexNode* pNode = this->nodes + node;
+	bool isValid = (node < pHeader->nodeCount)
+		&& ((uint64_t)pNode->nameOffset + pNode->nameLength <= pHeader->nameLength)
+		&& ((uint64_t)pNode->childStart + pNode->childCount <= pHeader->nodeCount - 1)
+		&& (pNode->subtreeEnd > node) && (pNode->subtreeEnd <= pHeader->nodeCount)
+		&& (this->postingStarts[node] <= this->postingStarts[node + 1]) && (this->postingStarts[node + 1] <= pHeader->postingCount);
+
+	if (!isValid)
+		{
+		this->isDamaged = true;
+		}
+	return isValid;
+	}
+
+int PathIndex::CompareName(uint32_t node, const wchar_t* name, size_t length, bool isPrefix)
+	{
+	const PathIndexNode* pNode = this->nodes + node;
+	if (isPrefix && (pNode->nameLength >= length))
+		{
+		return ComparePaths(this->names + pNode->nameOffset, length, name, length);
+		}
+
+	return ComparePaths(this->names + pNode->nameOffset, pNode->nameLength, name, length);
+	}
+
+void PathIndex::AppendName(uint32_t node, uint32_t depth, std::vector<wchar_t>* pPath)
+	{
+	// The components below the first are separated by '\'.
+	if (depth > 1)
+		{
+		pPath->push_back(L'\\');
+		}
+
+	const PathIndexNode* pNode = this->nodes + node;
+	pPath->insert(pPath->end(), this->names + pNode->nameOffset, this->names + pNode->nameOffset + pNode->nameLength);
+	}
+
+uint64_t PathIndex::PrintPostings(uint32_t node, const std::vector<wchar_t>& path)
+	{
+	for (uint64_t i = this->postingStarts[node]; i < this->postingStarts[node + 1]; i++)
+		{
+		const PathIndexPosting* pPosting = this->postings + i;
+		bool isItem = (pPosting->flags & PATH_INDEX_ITEM) != 0;
+		bool isFolder = (pPosting->flags & PATH_INDEX_FOLDER) != 0;
+
+		FILETIME deletedTime = { (DWORD)pPosting->deletedTime, (DWORD)(pPosting->deletedTime >> 32) };
+		SYSTEMTIME utc;
+		FileTimeToSystemTime(&deletedTime, &utc);
+
+		// A folder in a deleted folder has no size of its own.
+		wchar_t szSize[24] = L"";
+		if (isItem || !isFolder)
+			{
+			swprintf_s(szSize, 24, L"%llu", pPosting->size);
+			}
+
+		const uint32_t* pBin = this->bins + 2 * pPosting->bin;
+		if ((pPosting->bin >= this->header->binCount) || ((uint64_t)pBin[0] + pBin[1] > this->header->nameLength))
+			{
+			this->isDamaged = true;
+			return i - this->postingStarts[node];
+			}
+
+		wprintf(L"%.*s,%4d-%02d-%02d %02d:%02d:%02d,%s,%s,%s,%.*s,\n", (int)path.size(), path.data(),
+			utc.wYear, utc.wMonth, utc.wDay, utc.wHour, utc.wMinute, utc.wSecond,
+			szSize, isFolder ? L"Yes" : L"No", isItem ? L"Yes" : L"No", (int)pBin[1], this->names + pBin[0]);
+		}
+
+	return this->postingStarts[node + 1] - this->postingStarts[node];
+	}
+
+uint64_t PathIndex::PrintSubtree(uint32_t node, uint32_t depth, std::vector<wchar_t>* pPath)
+	{
+	// The path length before each node on the way to the current one.
+	struct Level
+		{
+		uint32_t subtreeEnd;
+		size_t pathLength;
+		};
+	std::vector<Level> levels;
+
+	if (!this->CheckNode(node))
+		{
+		return 0;
+		}
+
+	size_t baseLength = pPath->size();
+	uint64_t rows = 0;
+	for (uint32_t i = node; (i < this->nodes[node].subtreeEnd) && this->CheckNode(i); i++)
+		{
+		while (!levels.empty() && (levels.back().subtreeEnd <= i))
+			{
+			pPath->resize(levels.back().pathLength);
+			levels.pop_back();
+			}
+
+		Level level = { this->nodes[i].subtreeEnd, pPath->size() };
+		levels.push_back(level);
+		this->AppendName(i, depth + (uint32_t)levels.size() - 1, pPath);
+		rows += this->PrintPostings(i, *pPath);
+		}
+
+	pPath->resize(baseLength);
+	return rows;
+	}
+
+uint64_t PathIndex::PrintPrefix(const wchar_t* szPrefix)
+	{
+	wprintf(L"%s\n", pathIndexHeader);
+
+	std::vector<wchar_t> path;
+	uint32_t node = 0;
+	uint32_t depth = 0;
+	const wchar_t* pComponent = szPrefix;
+
+	for (;;)
+		{
+		if (!this->CheckNode(node))
+			{
+			return 0;
+			}
+
+		const wchar_t* pEnd = wcschr(pComponent, L'\\');
+		bool isLast = (pEnd == NULL);
+		size_t length = isLast ? wcslen(pComponent) : pEnd - pComponent;
+
+		// The first child that is not before the component (or the names starting with it).
+		const uint32_t* pChildren = this->children + this->nodes[node].childStart;
+		uint32_t low = 0;
+		uint32_t high = this->nodes[node].childCount;
+		while (low < high)
+			{
+			uint32_t middle = low + (high - low) / 2;
+			if (!this->CheckNode(pChildren[middle]))
+				{
+				return 0;
+				}
+
+			if (this->CompareName(pChildren[middle], pComponent, length, isLast) < 0)
+				{
+				low = middle + 1;
+				}
+			else
+				{
+				high = middle;
+				}
+			}
+
+		if (isLast)
+			{
+			uint64_t rows = 0;
+			for (uint32_t i = low; (i < this->nodes[node].childCount) && this->CheckNode(pChildren[i]) && (this->CompareName(pChildren[i], pComponent, length, true) == 0); i++)
+				{
+				rows += this->PrintSubtree(pChildren[i], depth + 1, &path);
+				}
+			return rows;
+			}
+
+		if ((low == this->nodes[node].childCount) || !this->CheckNode(pChildren[low]) || (this->CompareName(pChildren[low], pComponent, length, false) != 0))
+			{
+			return 0;
+			}
+
+		node = pChildren[low];
+		depth++;
+		this->AppendName(node, depth, &path);
+		pComponent = pEnd + 1;
+		}
+	}
+
+uint64_t PathIndex::PrintSubstring(const wchar_t* szText)
+	{
+	wprintf(L"%s\n", pathIndexHeader);
+
+	std::vector<wchar_t> path;
+	size_t textLength = wcslen(szText);
+	if (textLength == 0)
+		{
+		return this->PrintSubtree(0, 0, &path);
+		}
+
+	std::vector<wchar_t> text(szText, szText + textLength);
+	for (size_t i = 0; i < textLength; i++)
+		{
+		text[i] = towupper(text[i]);
+		}
+
+	// Path length before each node on the way to the current one (below the root).
+	std::vector<size_t> pathLengths;
+	std::vector<uint32_t> subtreeEnds;
+	uint64_t rows = 0;
+
+	for (uint32_t i = 1; (i < this->header->nodeCount) && this->CheckNode(i); i++)
+		{
+		while (!subtreeEnds.empty() && (subtreeEnds.back() <= i))
+			{
+			path.resize(pathLengths.back());
+			pathLengths.pop_back();
+			subtreeEnds.pop_back();
+			}
+
+		size_t parentLength = path.size();
+		uint32_t depth = (uint32_t)subtreeEnds.size() + 1;
+		this->AppendName(i, depth, &path);
+
+		// The rest of the path was searched with the node's parent, so only a match that ends
+		// in this node's part of it is new.
+		size_t from = (parentLength + 1 > textLength) ? parentLength + 1 - textLength : 0;
+		bool isMatch = false;
+		for (size_t start = from; !isMatch && (start + textLength <= path.size()); start++)
+			{
+			size_t j = 0;
+			while ((j < textLength) && ((wchar_t)towupper(path[start + j]) == text[j]))
+				{
+				j++;
+				}
+			isMatch = (j == textLength);
+			}
+
+		if (isMatch)
+			{
+			// Everything below it matches too.
+			path.resize(parentLength);
+			rows += this->PrintSubtree(i, depth, &path);
+			i = this->nodes[i].subtreeEnd - 1;
+			continue;
+			}
+
+		pathLengths.push_back(parentLength);
+		subtreeEnds.push_back(this->nodes[i].subtreeEnd);
+		}
+
+	return rows;
+	}
@@ -0,0 +1,153 @@
+// PathIndex.h
+//
+// Index of the original paths of everything in the Recycle Bins dumped, to answer questions
+// like "was anything under D:\Finance\Q3 deleted, and when?" without dumping them again.
+//
+// BuildPathIndex mode (--build-path-index) takes the rows in place of the output and writes the
+// index file at the end.  Every row with a known original path is in it: each deleted item (its
+// path from the $I file) and each file and folder in a deleted folder.  Rows with no $I file have
+// no original path and are left out.
+//
+// The paths are held as a trie of path components, so the "C:\Users\someone" that starts most of
+// them is held once, and the names of the components are held once however many folders have
+// them (e.g. "Documents").  The trie nodes are in depth first order, with each node's children
+// sorted by name (case insensitive, as paths are on Windows), so everything below a node is the
+// nodes and postings from it up to the end of its subtree.  Each row is a posting of the node of
+// its path, with its deleted time, size and Recycle Bin.
+//
+// The index file layout is:
+//
+//     PathIndexHeader header;
+//     PathIndexPosting postings[postingCount];     // The rows of each node, in node order.
+//     uint64_t postingStarts[nodeCount + 1];       // Index of each node's first posting.
+//     PathIndexNode nodes[nodeCount];              // Depth first, the root (with no name) first.
+//     uint32_t children[nodeCount - 1];            // Node number of each node's children in turn.
+//     uint32_t bins[binCount * 2];                 // Offset and length of each Recycle Bin's SID.
+//     wchar_t names[nameLength];                   // Names of the components and the SIDs.
+//
+// PathIndex::Open() memory maps the file, so nothing is read up front.  A prefix query looks up
+// one component at a time with a binary search of the node's children, and then reads just the
+// one range of nodes and postings below it.  A substring query reads every node once, but not
+// the postings of nodes that do not match, and the nodes are far fewer than the rows.
+
+#pragma once
+
+#include "windows.h"
+#include "cstdint"
+#include "RecycleRow.h"
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+struct PathIndexHeader
+	{
+	char magic[8];              // "RBDPATH1"
+	uint32_t nodeCount;
+	uint32_t binCount;
+	uint64_t postingCount;
+	uint64_t nameLength;        // In characters.
+	};
+
+struct PathIndexPosting
+	{
+	uint64_t deletedTime;       // As a FILETIME value.
+	uint64_t size;              // "Deleted Size" of a deleted item, "Original File Size" of a file in one.
+	uint32_t bin;               // Index of the Recycle Bin.
+	uint32_t flags;             // PATH_INDEX_ITEM and PATH_INDEX_FOLDER.
+	};
+
+const uint32_t PATH_INDEX_ITEM = 1;         // The deleted item itself rather than something in a deleted folder.
+const uint32_t PATH_INDEX_FOLDER = 2;
+
+struct PathIndexNode
+	{
+	uint32_t nameOffset;        // In names.
+	uint32_t nameLength;
+	uint32_t childStart;        // In children.
+	uint32_t childCount;
+	uint32_t subtreeEnd;        // Number of the first node after the ones below this one.
+	};
+
+// Collects the rows of a dump and writes them to an index file.  The paths are kept in memory
+// until the index is written.
+class PathIndexBuilder
+	{
+	public:
+		PathIndexBuilder();
+
+		// Rows are in the Recycle Bin last added.
+		void AddBin(const wchar_t* szSid);
+		void AddRow(RecycleRow* pRow);
+
+		// Returns false if the index could not be written.
+		bool Write(const wchar_t* szIndexFile);
+
+	protected:
+		struct Entry
+			{
+			size_t pathOffset;      // In paths.
+			uint32_t pathLength;
+			PathIndexPosting posting;
+			};
+
+		uint32_t AddName(const wchar_t* name, size_t length);
+
+		std::vector<wchar_t> paths;
+		std::vector<Entry> entries;
+		std::vector<uint32_t> bins;
+		std::vector<wchar_t> names;
+		std::unordered_map<std::wstring, uint32_t> nameOffsets;
+		std::vector<wchar_t> path;
+	};
+
+class PathIndex
+	{
+	public:
+		PathIndex();
+		~PathIndex();
+
+		// Memory map an index file written by PathIndexBuilder.
+		bool Open(const wchar_t* szIndexFile);
+
+		// Output a csv row for every posting whose path starts with the prefix, ending with
+		// whole components (but the last may be only the start of one).  Returns the number
+		// of rows.
+		uint64_t PrintPrefix(const wchar_t* szPrefix);
+
+		// Output a csv row for every posting whose path contains the text anywhere.  Returns
+		// the number of rows.
+		uint64_t PrintSubstring(const wchar_t* szText);
+
+		// Whether a query stopped at a node or posting that points outside the file.  Open()
+		// only checks the file's size, so a query checks each node and posting it reads.
+		bool IsDamaged()
+			{
+			return this->isDamaged;
+			}
+
+	protected:
+		// Returns false, and marks the index damaged, if the node or its fields point outside
+		// the file (or its subtree does not follow it).
+		bool CheckNode(uint32_t node);
+
+		// Compare a node's name with (the start of) a component, case insensitive.
+		int CompareName(uint32_t node, const wchar_t* name, size_t length, bool isPrefix);
+
+		// Output the rows of the node and every node below it.  The path is that of its parent
+		// and depth the node's own (0 for the root), and the path is left as it was.
+		uint64_t PrintSubtree(uint32_t node, uint32_t depth, std::vector<wchar_t>* pPath);
+
+		void AppendName(uint32_t node, uint32_t depth, std::vector<wchar_t>* pPath);
+		uint64_t PrintPostings(uint32_t node, const std::vector<wchar_t>& path);
+
+		HANDLE hFile;
+		HANDLE hMapping;
+		const PathIndexHeader* header;
+		const PathIndexPosting* postings;
+		const uint64_t* postingStarts;
+		const PathIndexNode* nodes;
+		const uint32_t* children;
+		const uint32_t* bins;
+		const wchar_t* names;
+		bool isDamaged;
+	};
@@ -0,0 +1,404 @@
+// PathMatcher.cpp
+//
+// Multi-pattern glob matching with an Aho-Corasick automaton and a lazily built DFA.
+
+#include "PathMatcher.h"
+#include "stdio.h"
+#include "string.h"
+#include "wchar.h"
+#include <algorithm>
+#include <deque>
+
+UpcaseTable::UpcaseTable()
+	{
+	static wchar_t characters[65536];
+
+	for (uint32_t c = 0; c < 65536; c++)
+		{
+		characters[c] = (wchar_t)c;
+		}
+
+	// Surrogates only have a case as pairs, so they map to themselves.
+	CharUpperBuff(characters, 0xD800);
+	CharUpperBuff(characters + 0xE000, 65536 - 0xE000);
+
+	for (uint32_t c = 0; c < 65536; c++)
+		{
+		this->table[c] = (uint16_t)characters[c];
+		}
+	}
+
+bool UpcaseTable::Load(const uint8_t* pData, size_t cbData)
+	{
+	if (cbData != sizeof(this->table))
+		{
+		return false;
+		}
+
+	memcpy(this->table, pData, sizeof(this->table));
+	return true;
+	}
+
+PathMatcher::PathMatcher(UpcaseTable* pUpcase)
+	{
+	this->pUpcase = pUpcase;
+	this->patternCount = 0;
+	this->classCount = 1;
+	this->dfaStart = -1;
+	this->dfaDead = -1;
+	}
+
+void PathMatcher::AddPattern(const wchar_t* szGlob)
+	{
+	size_t length = wcslen(szGlob);
+	if (length == 0)
+		{
+		return;
+		}
+
+	std::vector<uint16_t> pattern;
+	for (size_t i = 0; i < length; i++)
+		{
+		pattern.push_back((uint16_t)szGlob[i]);
+		}
+
+	// *text* (with no other wildcards) is a plain "contains" test.
+	bool isLiteral = (length > 2) && (szGlob[0] == L'*') && (szGlob[length - 1] == L'*');
+	for (size_t i = 1; isLiteral && (i + 1 < length); i++)
+		{
+		isLiteral = (szGlob[i] != L'*') && (szGlob[i] != L'?');
+		}
+
+	if (isLiteral)
+		{
+		this->literals.push_back(std::vector<uint16_t>(pattern.begin() + 1, pattern.end() - 1));
+		}
+	else
+		{
+		this->globs.push_back(pattern);
+		}
+
+	this->patternCount++;
+	}
+
+bool PathMatcher::AddPatternFile(const wchar_t* szFileName)
+	{
+	FILE* pFile;
+	if (_wfopen_s(&pFile, szFileName, L"rb") != 0)
+		{
+		return false;
+		}
+
+	char line[4096];
+	wchar_t pattern[4096];
+	while (fgets(line, sizeof(line), pFile) != NULL)
+		{
+		size_t length = strlen(line);
+		while ((length > 0) && ((line[length - 1] == '\n') || (line[length - 1] == '\r')))
+			{
+			line[--length] = '\0';
+			}
+
+		// Skip a UTF-8 byte order mark.
+		const char* pLine = line;
+		if (strncmp(pLine, "\xEF\xBB\xBF", 3) == 0)
+			{
+			pLine += 3;
+			}
+
+		if (*pLine == '\0')
+			{
+			continue;
+			}
+
+		int count = MultiByteToWideChar(CP_UTF8, 0, pLine, -1, pattern, 4096);
+		if (count > 0)
+			{
+			this->AddPattern(pattern);
+			}
+		}
+
+	fclose(pFile);
+	return true;
+	}
+
+void PathMatcher::Compile()
+	{
+	// Aho-Corasick: build the trie of the literals, then the failure links breadth first.
+	this->literalEdges.clear();
+	this->literalFail.assign(1, 0);
+	this->literalOutput.assign(1, 0);
+
+	std::vector<std::vector<uint32_t>> children(1);
+	for (size_t i = 0; i < this->literals.size(); i++)
+		{
+		uint32_t node = 0;
+		for (size_t j = 0; j < this->literals[i].size(); j++)
+			{
+			uint16_t c = (uint16_t)this->pUpcase->Upcase(this->literals[i][j]);
+			uint32_t child = this->FindLiteralEdge(node, c);
+			if (child == 0)
+				{
+				child = (uint32_t)this->literalFail.size();
+				this->literalFail.push_back(0);
+				this->literalOutput.push_back(0);
+				children.push_back(std::vector<uint32_t>());
+				this->literalEdges[((uint64_t)node << 16) | c] = child;
+				children[node].push_back(c);
+				}
+			node = child;
+			}
+		this->literalOutput[node] = 1;
+		}
+
+	std::deque<uint32_t> queue;
+	queue.push_back(0);
+	while (!queue.empty())
+		{
+		uint32_t node = queue.front();
+		queue.pop_front();
+
+		for (size_t i = 0; i < children[node].size(); i++)
+			{
+			uint16_t c = (uint16_t)children[node][i];
+			uint32_t child = this->FindLiteralEdge(node, c);
+
+			uint32_t fail = 0;
+			if (node != 0)
+				{
+				fail = this->literalFail[node];
+				while ((fail != 0) && (this->FindLiteralEdge(fail, c) == 0))
+					{
+					fail = this->literalFail[fail];
+					}
+				fail = this->FindLiteralEdge(fail, c);
+				}
+
+			this->literalFail[child] = fail;
+			this->literalOutput[child] |= this->literalOutput[fail];
+			queue.push_back(child);
+			}
+		}
+
+	// NFA: lay the globs out one after another, and give each distinct literal character
+	// its own class.
+	this->characterClasses.assign(65536, 0);
+	this->classCount = 1;
+	this->globKinds.clear();
+	this->globClasses.clear();
+	this->globStarts.clear();
+
+	for (size_t i = 0; i < this->globs.size(); i++)
+		{
+		this->globStarts.push_back((uint32_t)this->globKinds.size());
+
+		for (size_t j = 0; j < this->globs[i].size(); j++)
+			{
+			uint16_t c = (uint16_t)this->pUpcase->Upcase(this->globs[i][j]);
+			if (c == L'*')
+				{
+				this->globKinds.push_back(GLOB_STAR);
+				this->globClasses.push_back(0);
+				}
+			else if (c == L'?')
+				{
+				this->globKinds.push_back(GLOB_ANY);
+				this->globClasses.push_back(0);
+				}
+			else
+				{
+				if (this->characterClasses[c] == 0)
+					{
+					this->characterClasses[c] = (uint16_t)this->classCount++;
+					}
+				this->globKinds.push_back(GLOB_LITERAL);
+				this->globClasses.push_back(this->characterClasses[c]);
+				}
+			}
+
+		this->globKinds.push_back(GLOB_END);
+		this->globClasses.push_back(0);
+		}
+
+	this->ResetDfa();
+	}
+
+void PathMatcher::AddClosure(std::vector<uint32_t>& states, uint32_t state)
+	{
+	// A '*' may match nothing, so the state after it is also reached.
+	states.push_back(state);
+	while (this->globKinds[state] == GLOB_STAR)
+		{
+		states.push_back(++state);
+		}
+	}
+
+int32_t PathMatcher::GetDfaState(std::vector<uint32_t>& states)
+	{
+	std::sort(states.begin(), states.end());
+	states.erase(std::unique(states.begin(), states.end()), states.end());
+
+	std::map<std::vector<uint32_t>, int32_t>::iterator it = this->dfaStateIds.find(states);
+	if (it != this->dfaStateIds.end())
+		{
+		return it->second;
+		}
+
+	int32_t id = (int32_t)this->dfaStates.size();
+	bool accepting = false;
+	bool universal = false;
+
+	for (size_t i = 0; i < states.size(); i++)
+		{
+		uint32_t state = states[i];
+		if (this->globKinds[state] == GLOB_END)
+			{
+			accepting = true;
+			}
+
+		// Only stars (or nothing) left in the pattern means it matches whatever follows.
+		while (this->globKinds[state] == GLOB_STAR)
+			{
+			state++;
+			}
+		if ((this->globKinds[state] == GLOB_END) && (state != states[i]))
+			{
+			universal = true;
+			}
+		}
+
+	this->dfaStateIds[states] = id;
+	this->dfaStates.push_back(states);
+	this->dfaTransitions.resize(this->dfaTransitions.size() + this->classCount, -1);
+	this->dfaAccepting.push_back(accepting ? 1 : 0);
+	this->dfaUniversal.push_back(universal ? 1 : 0);
+
+	return id;
+	}
+
+int32_t PathMatcher::GetDfaTransition(int32_t state, uint16_t characterClass)
+	{
+	int32_t* pTransition = &this->dfaTransitions[(size_t)state * this->classCount + characterClass];
+	if (*pTransition >= 0)
+		{
+		return *pTransition;
+		}
+
+	std::vector<uint32_t> next;
+	const std::vector<uint32_t>& current = this->dfaStates[state];
+	for (size_t i = 0; i < current.size(); i++)
+		{
+		uint32_t nfaState = current[i];
+		switch (this->globKinds[nfaState])
+			{
+			case GLOB_STAR:
+				this->AddClosure(next, nfaState);
+				break;
+
+			case GLOB_ANY:
+				this->AddClosure(next, nfaState + 1);
+				break;
+
+			case GLOB_LITERAL:
+				if (this->globClasses[nfaState] == characterClass)
+					{
+					this->AddClosure(next, nfaState + 1);
+					}
+				break;
+
+			default:
+				break;
+			}
+		}
+
+	int32_t nextState = this->GetDfaState(next);
+
+	// GetDfaState() may have grown the transition table.
+	this->dfaTransitions[(size_t)state * this->classCount + characterClass] = nextState;
+	return nextState;
+	}
+
+void PathMatcher::ResetDfa()
+	{
+	this->dfaStateIds.clear();
+	this->dfaStates.clear();
+	this->dfaTransitions.clear();
+	this->dfaAccepting.clear();
+	this->dfaUniversal.clear();
+
+	std::vector<uint32_t> dead;
+	this->dfaDead = this->GetDfaState(dead);
+
+	std::vector<uint32_t> start;
+	for (size_t i = 0; i < this->globStarts.size(); i++)
+		{
+		this->AddClosure(start, this->globStarts[i]);
+		}
+	this->dfaStart = this->GetDfaState(start);
+	}
+
+bool PathMatcher::Run(const wchar_t* text, size_t length, bool* pAccepted, bool* pUniversal, bool* pDead)
+	{
+	// The DFA is rebuilt from scratch if unusual paths have made it too large.
+	if (this->dfaStates.size() > MAX_DFA_STATES)
+		{
+		this->ResetDfa();
+		}
+
+	bool hasLiterals = !this->literals.empty();
+	uint32_t node = 0;
+	int32_t state = this->dfaStart;
+
+	for (size_t i = 0; i < length; i++)
+		{
+		uint16_t c = (uint16_t)this->pUpcase->Upcase(text[i]);
+
+		if (hasLiterals)
+			{
+			uint32_t child;
+			while (((child = this->FindLiteralEdge(node, c)) == 0) && (node != 0))
+				{
+				node = this->literalFail[node];
+				}
+			node = child;
+
+			// Anything containing a literal pattern matches, however it continues.
+			if (this->literalOutput[node])
+				{
+				*pAccepted = true;
+				*pUniversal = true;
+				*pDead = false;
+				return true;
+				}
+			}
+
+		if (state != this->dfaDead)
+			{
+			state = this->GetDfaTransition(state, this->characterClasses[c]);
+			}
+		else if (!hasLiterals)
+			{
+			break;
+			}
+		}
+
+	*pAccepted = this->dfaAccepting[state] != 0;
+	*pUniversal = this->dfaUniversal[state] != 0;
+	*pDead = !hasLiterals && (state == this->dfaDead);
+	return !*pDead;
+	}
+
+bool PathMatcher::Matches(const wchar_t* path, size_t length)
+	{
+	bool accepted, universal, dead;
+	this->Run(path, length, &accepted, &universal, &dead);
+	return accepted;
+	}
+
+void PathMatcher::MatchPrefix(const wchar_t* prefix, size_t length, bool* pCouldMatch, bool* pAlwaysMatches)
+	{
+	bool accepted, universal, dead;
+	this->Run(prefix, length, &accepted, &universal, &dead);
+	*pCouldMatch = !dead;
+	*pAlwaysMatches = universal;
+	}
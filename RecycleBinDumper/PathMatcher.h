@@ -0,0 +1,121 @@
+// PathMatcher.h
+//
+// Matches paths against a whole list of glob patterns (* and ? wildcards) at once, so that
+// the cost of matching a path stays about the same whether there are ten patterns or tens of
+// thousands.
+//
+// Patterns of the form *text* (i.e. "the path contains text") are the most common and are
+// matched with an Aho-Corasick automaton built over all of them.  Every other pattern is
+// compiled into a single NFA that is turned into a DFA lazily, one state at a time as paths
+// need it, with the characters that appear in the patterns as its alphabet (every other
+// character behaves the same).  Each path is then matched in one pass through both automata.
+//
+// Comparison is case insensitive in the same way as NTFS: both the patterns and the paths are
+// mapped through an upcase table of the 65536 UTF-16 code units.
+
+#pragma once
+
+#include "windows.h"
+#include "cstdint"
+#include "cstddef"
+#include <vector>
+#include <map>
+#include <unordered_map>
+
+class UpcaseTable
+	{
+	public:
+		// Builds the table from the system's uppercase mapping, which is what NTFS writes into
+		// the $UpCase file of a new volume.
+		UpcaseTable();
+
+		// Replace the table with the contents of a volume's $UpCase file.
+		bool Load(const uint8_t* pData, size_t cbData);
+
+		wchar_t Upcase(wchar_t c)
+			{
+			return ((uint32_t)c < 65536) ? (wchar_t)this->table[(uint16_t)c] : c;
+			}
+
+	protected:
+		uint16_t table[65536];
+	};
+
+class PathMatcher
+	{
+	public:
+		PathMatcher(UpcaseTable* pUpcase);
+
+		void AddPattern(const wchar_t* szGlob);
+
+		// Read patterns from a text (UTF-8) file, one per line.
+		bool AddPatternFile(const wchar_t* szFileName);
+
+		// Must be called after the patterns are added (and the upcase table loaded) and before
+		// matching.
+		void Compile();
+
+		bool IsEmpty()
+			{
+			return this->patternCount == 0;
+			}
+
+		bool Matches(const wchar_t* path, size_t length);
+
+		// For every path that starts with the prefix, report whether any of them could match
+		// and whether all of them will.
+		void MatchPrefix(const wchar_t* prefix, size_t length, bool* pCouldMatch, bool* pAlwaysMatches);
+
+	protected:
+		// Run both automata over the text.  Returns false as soon as neither can match.
+		bool Run(const wchar_t* text, size_t length, bool* pAccepted, bool* pUniversal, bool* pDead);
+
+		UpcaseTable* pUpcase;
+		size_t patternCount;
+
+		// Aho-Corasick automaton for the *text* patterns.  Node 0 is the root.
+		std::vector<std::vector<uint16_t>> literals;
+		std::unordered_map<uint64_t, uint32_t> literalEdges;
+		std::vector<uint32_t> literalFail;
+		std::vector<uint8_t> literalOutput;
+
+		uint32_t FindLiteralEdge(uint32_t node, uint16_t c)
+			{
+			std::unordered_map<uint64_t, uint32_t>::iterator it = this->literalEdges.find(((uint64_t)node << 16) | c);
+			return (it != this->literalEdges.end()) ? it->second : 0;
+			}
+
+		// NFA for the other patterns, one state per pattern character plus an end state for
+		// each pattern.
+		enum GlobKind : uint8_t
+			{
+			GLOB_LITERAL,
+			GLOB_ANY,
+			GLOB_STAR,
+			GLOB_END,
+			};
+
+		std::vector<std::vector<uint16_t>> globs;
+		std::vector<uint8_t> globKinds;
+		std::vector<uint16_t> globClasses;
+		std::vector<uint32_t> globStarts;
+
+		// Characters in the patterns each have their own class, every other character is class 0.
+		std::vector<uint16_t> characterClasses;
+		size_t classCount;
+
+		// The lazily built DFA.  A transition of -1 has not been worked out yet.
+		static const size_t MAX_DFA_STATES = 10000;
+		std::map<std::vector<uint32_t>, int32_t> dfaStateIds;
+		std::vector<std::vector<uint32_t>> dfaStates;
+		std::vector<int32_t> dfaTransitions;
+		std::vector<uint8_t> dfaAccepting;
+		std::vector<uint8_t> dfaUniversal;
+		int32_t dfaStart;
+		int32_t dfaDead;
+
+		void AddClosure(std::vector<uint32_t>& states, uint32_t state);
+		int32_t GetDfaState(std::vector<uint32_t>& states);
+		int32_t GetDfaTransition(int32_t state, uint16_t characterClass);
+		void ResetDfa();
+	};
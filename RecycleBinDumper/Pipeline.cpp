@@ -0,0 +1,179 @@
+// Pipeline.cpp
+//
+// The $I reading and row writing stages of --pipeline.
+
+#include "Pipeline.h"
+#include "RecycleInfo.h"
+#include "stdio.h"
+#include "string.h"
+
+SharedFileSource::SharedFileSource(FileSource* pSource)
+	{
+	this->pSource = pSource;
+	}
+
+void SharedFileSource::FindFiles(const wchar_t* szFolder, const wchar_t* szWild, FoundFileHandler fn, void* context)
+	{
+	this->pSource->FindFiles(szFolder, szWild, fn, context);
+	}
+
+bool SharedFileSource::GetAttributes(const wchar_t* szFileName, WIN32_FILE_ATTRIBUTE_DATA* pAttributes)
+	{
+	return this->pSource->GetAttributes(szFileName, pAttributes);
+	}
+
+bool SharedFileSource::ReadFileData(const wchar_t* szFileName, FileDataHandler fn, void* context)
+	{
+	std::lock_guard<std::mutex> guard(this->lock);
+	return this->pSource->ReadFileData(szFileName, fn, context);
+	}
+
+InfoReader::InfoReader(FileSource* pSource, size_t memoryBudget)
+	{
+	this->pSource = pSource;
+	this->maxQueuedSize = memoryBudget;
+	this->queuedSize = 0;
+	this->isStopping = false;
+	}
+
+InfoReader::~InfoReader()
+	{
+	if (this->thread.joinable())
+		{
+		std::unique_lock<std::mutex> guard(this->lock);
+		this->isStopping = true;
+		guard.unlock();
+
+		this->taken.notify_one();
+		this->thread.join();
+		}
+	}
+
+void InfoReader::Start(const std::vector<const wchar_t*>& fileNames)
+	{
+	this->fileNames = fileNames;
+	this->thread = std::thread(&InfoReader::Run, this);
+	}
+
+void InfoReader::Run()
+	{
+	uint8_t* pBuffer = new uint8_t[MAX_RECYCLE_INFO_SIZE];
+
+	for (size_t i = 0; i < this->fileNames.size(); i++)
+		{
+		size_t cbData = ReadRecycleInfoData(this->pSource, this->fileNames[i], pBuffer);
+
+		// There is always room for one file, however large, so the reader cannot wait forever.
+		std::unique_lock<std::mutex> guard(this->lock);
+		this->taken.wait(guard, [this] { return this->isStopping || this->files.empty() || (this->queuedSize < this->maxQueuedSize); });
+		if (this->isStopping)
+			{
+			break;
+			}
+
+		this->files.push_back(std::vector<uint8_t>(pBuffer, pBuffer + cbData));
+		this->queuedSize += cbData;
+		guard.unlock();
+
+		this->queued.notify_one();
+		}
+
+	delete[] pBuffer;
+	}
+
+size_t InfoReader::Next(uint8_t* pBuffer)
+	{
+	std::unique_lock<std::mutex> guard(this->lock);
+	this->queued.wait(guard, [this] { return !this->files.empty(); });
+
+	std::vector<uint8_t> data = std::move(this->files.front());
+	this->files.pop_front();
+	this->queuedSize -= data.size();
+	guard.unlock();
+
+	this->taken.notify_one();
+
+	if (!data.empty())
+		{
+		memcpy(pBuffer, data.data(), data.size());
+		}
+	return data.size();
+	}
+
+RowWriter::RowWriter(size_t memoryBudget)
+	{
+	this->maxQueuedSize = memoryBudget;
+	this->queuedSize = 0;
+	this->isClosing = false;
+	this->batch.reserve(BATCH_SIZE);
+	this->thread = std::thread(&RowWriter::Run, this);
+	}
+
+RowWriter::~RowWriter()
+	{
+	this->QueueBatch();
+
+	std::unique_lock<std::mutex> guard(this->lock);
+	this->isClosing = true;
+	guard.unlock();
+
+	this->queued.notify_one();
+	this->thread.join();
+	fflush(stdout);
+	}
+
+void RowWriter::Write(const wchar_t* szRow, size_t length)
+	{
+	this->batch.append(szRow, length);
+	this->batch.push_back(L'\n');
+
+	if (this->batch.size() >= BATCH_SIZE)
+		{
+		this->QueueBatch();
+		}
+	}
+
+void RowWriter::QueueBatch()
+	{
+	if (this->batch.empty())
+		{
+		return;
+		}
+
+	size_t size = this->batch.size() * sizeof(wchar_t);
+
+	std::unique_lock<std::mutex> guard(this->lock);
+	this->written.wait(guard, [this] { return this->batches.empty() || (this->queuedSize < this->maxQueuedSize); });
+	this->batches.push_back(std::move(this->batch));
+	this->queuedSize += size;
+	guard.unlock();
+
+	this->queued.notify_one();
+
+	this->batch = std::wstring();
+	this->batch.reserve(BATCH_SIZE);
+	}
+
+void RowWriter::Run()
+	{
+	std::unique_lock<std::mutex> guard(this->lock);
+
+	for (;;)
+		{
+		this->queued.wait(guard, [this] { return this->isClosing || !this->batches.empty(); });
+		if (this->batches.empty())
+			{
+			break;
+			}
+
+		std::wstring batch = std::move(this->batches.front());
+		this->batches.pop_front();
+		guard.unlock();
+
+		wprintf(L"%s", batch.c_str());
+
+		guard.lock();
+		this->queuedSize -= batch.size() * sizeof(wchar_t);
+		this->written.notify_one();
+		}
+	}
@@ -0,0 +1,101 @@
+// Pipeline.h
+//
+// The stages that --pipeline runs on threads of their own, so that reading the $I files,
+// formatting the rows and writing them overlap instead of each waiting for the others:
+//
+//   InfoReader - reads the $I files of a Recycle Bin, in order, ahead of the thread formatting
+//                their rows (which still walks the deleted folders itself, since their rows are
+//                built up as they are walked).
+//   RowWriter  - writes the rows to stdout behind the threads formatting them, a batch at a time.
+//
+// The stages are joined by queues with a memory budget each.  A stage that gets that far ahead
+// of the next waits for it, so a slow disk or a slow pipe on stdout holds the others back rather
+// than the queues growing with the size of the Recycle Bin.  The rows come out in the same order
+// as without --pipeline.
+
+#pragma once
+
+#include "windows.h"
+#include "cstdint"
+#include "FileSource.h"
+#include <deque>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Lets an InfoReader and the thread walking the deleted folders share a source.  Every source
+// reads through a buffer of its own, so its reads are made one at a time (finding files and
+// their attributes use no shared state, and are passed straight through).
+class SharedFileSource : public FileSource
+	{
+	public:
+		SharedFileSource(FileSource* pSource);
+
+		virtual void FindFiles(const wchar_t* szFolder, const wchar_t* szWild, FoundFileHandler fn, void* context);
+		virtual bool GetAttributes(const wchar_t* szFileName, WIN32_FILE_ATTRIBUTE_DATA* pAttributes);
+		virtual bool ReadFileData(const wchar_t* szFileName, FileDataHandler fn, void* context);
+
+	protected:
+		FileSource* pSource;
+		std::mutex lock;
+	};
+
+class InfoReader
+	{
+	public:
+		InfoReader(FileSource* pSource, size_t memoryBudget);
+		~InfoReader();
+
+		// Start reading the $I files.  Next() must then be called once for each of them, in order.
+		void Start(const std::vector<const wchar_t*>& fileNames);
+
+		// Copy the data of the next $I file (of at most MAX_RECYCLE_INFO_SIZE bytes) into pBuffer,
+		// waiting for it to be read if need be.  Returns its size, 0 if it could not be read.
+		size_t Next(uint8_t* pBuffer);
+
+	protected:
+		void Run();
+
+		FileSource* pSource;
+		std::vector<const wchar_t*> fileNames;
+		size_t maxQueuedSize;
+		std::thread thread;
+		std::mutex lock;
+		std::condition_variable queued;
+		std::condition_variable taken;
+		std::deque<std::vector<uint8_t>> files;
+		size_t queuedSize;
+		bool isStopping;
+	};
+
+class RowWriter
+	{
+	public:
+		RowWriter(size_t memoryBudget);
+
+		// Writes any rows still queued.
+		~RowWriter();
+
+		// Queue a row (without its newline).  Rows are output a thread at a time (see OutputTurns),
+		// so this is never called by two threads at once.
+		void Write(const wchar_t* szRow, size_t length);
+
+	protected:
+		void Run();
+		void QueueBatch();
+
+		// Characters of rows written to stdout at once.
+		static const size_t BATCH_SIZE = 64 * 1024;
+
+		size_t maxQueuedSize;
+		std::wstring batch;
+		std::thread thread;
+		std::mutex lock;
+		std::condition_variable queued;
+		std::condition_variable written;
+		std::deque<std::wstring> batches;
+		size_t queuedSize;
+		bool isClosing;
+	};
@@ -0,0 +1,78 @@
+// Progress.cpp
+//
+// Periodic progress lines on stderr.
+
+#include "Progress.h"
+#include "stdio.h"
+
+Progress::Progress(uint32_t intervalSeconds)
+	{
+	this->intervalSeconds = (intervalSeconds == 0) ? 1 : intervalSeconds;
+	this->isStopping = false;
+	this->expectedBins = 0;
+	this->expectedItems = 0;
+	this->bins = 0;
+	this->items = 0;
+	this->entries = 0;
+	this->bytes = 0;
+	}
+
+Progress::~Progress()
+	{
+	this->Stop();
+	}
+
+void Progress::Start()
+	{
+	this->start = std::chrono::steady_clock::now();
+	this->thread = std::thread(&Progress::Run, this);
+	}
+
+void Progress::Stop()
+	{
+	if (!this->thread.joinable())
+		{
+		return;
+		}
+
+	std::unique_lock<std::mutex> guard(this->lock);
+	this->isStopping = true;
+	guard.unlock();
+
+	this->stopped.notify_one();
+	this->thread.join();
+
+	this->Print(true);
+	}
+
+void Progress::Run()
+	{
+	std::unique_lock<std::mutex> guard(this->lock);
+	while (!this->stopped.wait_for(guard, std::chrono::seconds(this->intervalSeconds), [this] { return this->isStopping; }))
+		{
+		this->Print(false);
+		}
+	}
+
+void Progress::Print(bool isFinal)
+	{
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - this->start).count();
+	uint64_t expectedBins = this->expectedBins.load(std::memory_order_relaxed);
+	uint64_t expectedItems = this->expectedItems.load(std::memory_order_relaxed);
+	uint64_t items = this->items.load(std::memory_order_relaxed);
+	double percent = (expectedItems > 0) ? 100.0 * items / expectedItems : 0;
+	double rate = (seconds > 0) ? items / seconds : 0;
+
+	fwprintf(stderr, L"%s %.0fs: %llu/%llu Recycle Bins, %llu/%llu $I files (%.1f%%), %llu $R files and folders, %.1f MB, %.0f $I files/s",
+		isFinal ? L"Done in" : L"Progress at", seconds,
+		this->bins.load(std::memory_order_relaxed), expectedBins, items, expectedItems, percent,
+		this->entries.load(std::memory_order_relaxed), this->bytes.load(std::memory_order_relaxed) / (1024.0 * 1024), rate);
+
+	// Until some $I files are done there is no rate to estimate from.
+	if (!isFinal && (rate > 0) && (items < expectedItems))
+		{
+		uint64_t left = (uint64_t)((expectedItems - items) / rate);
+		fwprintf(stderr, L", about %llu:%02llu:%02llu left", left / 3600, (left / 60) % 60, left % 60);
+		}
+	fwprintf(stderr, L"\n");
+	}
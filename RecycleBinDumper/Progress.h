@@ -0,0 +1,72 @@
+// Progress.h
+//
+// Progress of a long run (--progress), printed to stderr every few seconds while the rows go
+// to stdout: the Recycle Bins and $I files done so far out of those counted before they are
+// dumped, the $R files and folders listed and their bytes, the rate, and an estimate of the
+// time left.
+//
+// The counts are relaxed atomic counters, which the threads doing the work only ever add to,
+// and a thread of its own samples them and prints the line.  The total number of $I files is
+// counted a Recycle Bin at a time, from an enumeration of just its $I files before it is
+// dumped (the folders of a local Recycle Bin before any of them are dumped, an image's when its
+// volume has been scanned), so the estimate improves as the totals of more of them are known.
+
+#pragma once
+
+#include "cstdint"
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+class Progress
+	{
+	public:
+		Progress(uint32_t intervalSeconds);
+		~Progress();
+
+		// Start and stop the thread printing the progress.  Stop() prints a last line.
+		void Start();
+		void Stop();
+
+		void AddExpected(uint64_t binCount, uint64_t itemCount)
+			{
+			this->expectedBins.fetch_add(binCount, std::memory_order_relaxed);
+			this->expectedItems.fetch_add(itemCount, std::memory_order_relaxed);
+			}
+
+		void AddBin()
+			{
+			this->bins.fetch_add(1, std::memory_order_relaxed);
+			}
+
+		void AddItem()
+			{
+			this->items.fetch_add(1, std::memory_order_relaxed);
+			}
+
+		void AddEntry(uint64_t size)
+			{
+			this->entries.fetch_add(1, std::memory_order_relaxed);
+			this->bytes.fetch_add(size, std::memory_order_relaxed);
+			}
+
+	protected:
+		void Run();
+		void Print(bool isFinal);
+
+		uint32_t intervalSeconds;
+		std::chrono::steady_clock::time_point start;
+		std::thread thread;
+		std::mutex lock;
+		std::condition_variable stopped;
+		bool isStopping;
+
+		std::atomic<uint64_t> expectedBins;
+		std::atomic<uint64_t> expectedItems;
+		std::atomic<uint64_t> bins;
+		std::atomic<uint64_t> items;
+		std::atomic<uint64_t> entries;      // $R files and folders, and those below them.
+		std::atomic<uint64_t> bytes;        // Of the $R files.
+	};
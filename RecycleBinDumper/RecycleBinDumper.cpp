@@ -52,14 +52,164 @@
 // Because files and folders in deleted folders share the same information about when the folder
 // was deleted, that information is repeated on each row for those files and folders.
 //
+// Before Windows Vista the Recycle Bin was RECYCLER\<SID> (on NTFS volumes), with one INFO2 file
+// holding the recycle information of every deleted item, and the deleted files and folders
+// renamed Dc<index>.<original extension>.  Those Recycle Bins are dumped too, with INFO2 as the
+// recycle info file of every row (see Info2.h for its format).
+//
+// The $I and $R files of the Recycle Bin are matched up by the rest of their names (after the
+// $I or $R), so a $I file with no $R file has "Missing" for the original file, and a $R file or
+// folder with no $I file (whose original path is not known) has "Missing" for the recycle info.
+//
 // For deleted files, the value under "Deleted Size" should equal the value under "Original File Size".
 // For a particular deleted folder, the sum of all the values under "Original File Size" should
 // equal the value under "Deleted Size".
+//
+// Usage:
+//     RecycleBinDumper [options] <Recycle Bin folder>...
+//     RecycleBinDumper [options] --image <disk image> [<Recycle Bin folder>...]
+//     RecycleBinDumper [options] --archive <zip> [<Recycle Bin folder>...]
+//     RecycleBinDumper [options] --carve <disk image> [<Recycle Bin folder>...]
+//
+// Options:
+//     --image <disk image>                    Also dump the Recycle Bins of every NTFS volume in a raw disk or
+//                                             volume image (may be repeated).  The volumes are found from the
+//                                             MBR or GPT partition table and are scanned in parallel, but
+//                                             output in the order of the partition table, so the output is
+//                                             the same from run to run.  Raw (dd), EWF (.E01), VHD and VHDX
+//                                             images are supported.
+//     --image-cache <MB>                      Memory for decompressed chunks of EWF images (default 256).
+//     --archive <zip>                         Also dump the Recycle Bins in a ZIP archive of collected files
+//                                             (every SID folder in a $Recycle.Bin folder), without extracting
+//                                             them (may be repeated).
+//     --carve <disk image>                    Also search every byte of a disk image (unallocated space, file
+//                                             slack and unused MFT records included) for $I files, e.g. of
+//                                             emptied Recycle Bins, and output a row for each one with its
+//                                             offset in the image, after a header of its own (may be repeated).
+//                                             Only the deleted date and --min-size filters apply to these rows,
+//                                             and it cannot be used with --summary, --top, --sort, --sqlite or
+//                                             --build-path-index.
+//     --software-hive <file>                  Add a User column with the user name for each Recycle Bin's SID,
+//                                             from the profile list in a SOFTWARE registry hive.
+//     --sam-hive <file>                       Also use the local account names in a SAM registry hive.
+//                                             The hives given apply to every Recycle Bin dumped, those of
+//                                             every volume of an --image included; the hives on the volumes
+//                                             themselves are not read.
+//     --known-hashes <index>                  Do not output rows for files whose hash is in the index
+//                                             (e.g. operating system and vendor files from an NSRL set).
+//     --build-known-hashes <text> <index>     Convert a text or NSRL csv file of MD5 or SHA-1 hashes
+//                                             into an index for --known-hashes, then exit.
+//     --stats                                 Print the count, total time, bytes and latency percentiles of the
+//                                             file system calls, image reads, formatting and row writes of the
+//                                             run to stderr at the end (see Stats.h).
+//     --stats-json <file>                     Also write them, with the latency histograms, to a JSON file.
+//     --trace <file>                          Write a timeline of each thread's Recycle Bins, $I files, folders
+//                                             walked, rows written, volume scans and carved stripes to a Chrome
+//                                             trace file, to open in chrome://tracing or ui.perfetto.dev (see
+//                                             Trace.h).
+//     --progress <seconds>                    Print the Recycle Bins and $I files done out of those counted, the
+//                                             $R files and bytes listed, the rate and the time left to stderr
+//                                             every few seconds (see Progress.h).
+//     --pipeline <MB>                         Read the $I files ahead, and write the rows behind, on threads of
+//                                             their own, using at most this much memory for the files and rows
+//                                             queued between them (half each; see Pipeline.h).
+//     --generate-corpus <folder|zip> <count>  Write a synthetic Recycle Bin of count deleted items to a folder,
+//                                             or to a ZIP archive (to dump with --archive), then exit.  The
+//                                             same options always write the same corpus (see Corpus.h).
+//     --benchmark <folder|zip>                Time each stage of dumping a Recycle Bin folder (or the first
+//                                             Recycle Bin in a ZIP archive), e.g. a --generate-corpus one,
+//                                             and print the time per run and items and MB per second of
+//                                             each stage to stderr, then exit.  The stages that write rows
+//                                             write them to stdout, so redirect it to NUL to time formatting
+//                                             alone or to a file to include the writes.  The filter, rollup
+//                                             and output options given apply to the whole dump stage, but
+//                                             it cannot be used with --summary, --top, --sort, --sqlite or
+//                                             --build-path-index, which only output at the end of a dump.
+//     --corpus-seed <n>                       Seed of the corpus (default 1).
+//     --corpus-folders <percent>              Deleted items that are folders (default 10).
+//     --corpus-depth <n>, --corpus-fan-out <n>
+//                                             Levels of subfolders below each deleted folder (default 2), and
+//                                             files and subfolders in each folder (default 4).
+//     --corpus-v1 <percent>                   $I files in the version 1 format (default 20).
+//     --corpus-max-size <bytes>               Largest generated file (default 4096, at most 1MB).
+//                                             The --corpus options must come before --generate-corpus.
+//     --rollup                                Add file count, folder count and byte totals for each deleted
+//                                             folder (and each subfolder), and flag items whose totals do
+//                                             not match the "Deleted Size".
+//     --summary                               Instead of a row for each file and folder, output totals per
+//                                             user (SID), extension, deleted date and top level folder, and
+//                                             estimates of distinct paths and file size quantiles.
+//     --top <K> <size|deleted-size|deleted-time>
+//                                             Output only the K files with the largest size, or the K deleted
+//                                             items with the largest deleted size or most recent deleted time.
+//     --sort <deleted-time|path>              Output the rows sorted by deleted time (oldest first) or by
+//                                             original path, using temporary files for the rows that do not
+//                                             fit in memory (see RowSorter.h).
+//     --sort-memory <MB>                      Memory for the rows sorted at once (default 256).
+//     --sort-temp <folder>                    Folder for the temporary files (default the user's temporary
+//                                             folder).
+//     --sqlite <file>                         Instead of csv, write the Recycle Bins, the deleted items and the
+//                                             files and folders in deleted folders to tables of a SQLite
+//                                             database (see SqliteWriter.h).
+//     --build-path-index <index>              Instead of output, write the original paths of the rows, with their
+//                                             deleted times, sizes and SIDs, to an index file to query later
+//                                             without reading the Recycle Bins again (see PathIndex.h).
+//     --query-path-index <index> <prefix>     Output the rows in the index whose original path starts with the
+//                                             prefix (e.g. D:\Finance\Q3), then exit.
+//     --search-path-index <index> <text>      Output the rows in the index whose original path contains the
+//                                             text, then exit.
+//     --sid <SID>                             Only the Recycle Bins of these users (may be repeated).
+//     --deleted-after <date>                  Only items deleted at or after the date (YYYY-MM-DD[ HH:MM:SS], UTC).
+//     --deleted-before <date>                 Only items deleted before the date.
+//     --path <glob>                           Only files and folders whose original path matches the glob
+//                                             (* and ? wildcards, case insensitive; may be repeated).
+//     --exclude-path <glob>                   Leave out files and folders whose original path matches the glob.
+//     --path-list <file>, --exclude-path-list <file>
+//                                             Read --path or --exclude-path globs from a text file, one per line.
+//     --upcase-table <file>                   Compare paths using a copy of a volume's $UpCase file instead of
+//                                             the system's uppercase mapping.
+//     --min-size <bytes>, --max-size <bytes>  Only files within the size range.
+//     --ext <ext>[,<ext>...]                  Only files with these extensions.
 
 #include "windows.h"
 #include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "wctype.h"
 #include "cstdint"
 #include "strsafe.h"
+#include "KnownHashSet.h"
+#include "RecycleInfo.h"
+#include "RecycleRow.h"
+#include "Summary.h"
+#include "TopK.h"
+#include "RowSorter.h"
+#include "SqliteWriter.h"
+#include "PathIndex.h"
+#include "Filter.h"
+#include "UserMap.h"
+#include "FileSource.h"
+#include "BlockDevice.h"
+#include "PartitionTable.h"
+#include "NtfsVolume.h"
+#include "ZipArchive.h"
+#include "Carver.h"
+#include "Info2.h"
+#include "Corpus.h"
+#include "Benchmark.h"
+#include "Stats.h"
+#include "Trace.h"
+#include "Progress.h"
+#include "Pipeline.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+// Set by --pipeline (NULL otherwise), the rows are written by its thread.
+RowWriter* rowWriter = NULL;
 
 // Helper class to buffer line output.
 class CharBuffer
@@ -79,7 +229,17 @@ class CharBuffer
 
 		void PrintLine()
 			{
-			wprintf(L"%s\n", buffer);
+			TraceSpan span(L"Write row");
+			StatsTimer timer(STATS_WRITE_ROW);
+			if (rowWriter != NULL)
+				{
+				rowWriter->Write(this->buffer, this->position);
+				}
+			else
+				{
+				wprintf(L"%s\n", buffer);
+				}
+			timer.Stop(this->position + 1);
 			}
 
 		size_t PrintF(const wchar_t* format...)
@@ -87,7 +247,9 @@ class CharBuffer
 			va_list args;
 			va_start(args, format);
 
+			StatsTimer timer(STATS_FORMAT);
 			this->position += vswprintf_s(this->buffer + this->position, this->size - this->position, format, args);
+			timer.Stop();
 
 			return this->position;
 			}
@@ -109,22 +271,84 @@ class CharBuffer
 		size_t position;
 	};
 
-typedef void (*EachFileHandler)(const wchar_t *szRoot, WIN32_FIND_DATA* pffd, CharBuffer *lineBuffer);
-void ForeachFile(const wchar_t* szRoot, const wchar_t* szWild, EachFileHandler fn, CharBuffer *lineBuffer);
+// Totals for everything under a deleted folder, accumulated bottom-up while the folder is printed.
+struct FolderTotals
+	{
+	uint64_t fileCount;
+	uint64_t folderCount;
+	uint64_t byteCount;
+	};
+
+// Context passed down the walk of a deleted folder.
+struct FolderWalk
+	{
+	FileSource* pSource;
+	RecycleRow* pItemRow;       // Row of the deleted item ($R folder) being walked.
+	FolderTotals* pTotals;      // Totals of the folder being walked.
+	};
+
+// Context for the deleted items in one Recycle Bin.
+struct RecycleBin
+	{
+	FileSource* pSource;        // The Recycle Bin's files, in a folder or in an image.
+	const wchar_t* szSid;
+	const wchar_t* szUser;      // Looked up once for the whole Recycle Bin.
+	InfoReader* pReader;        // Reading the $I files ahead with --pipeline (NULL otherwise).
+	};
+
+// The context is passed through ForeachFile() to the handler unchanged.
+typedef void (*EachFileHandler)(const wchar_t *szRoot, WIN32_FIND_DATA* pffd, CharBuffer *lineBuffer, void* context);
+void ForeachFile(FileSource* pSource, const wchar_t* szRoot, const wchar_t* szWild, EachFileHandler fn, CharBuffer *lineBuffer, void* context);
+
+// The $I and $R files of one deleted item, either of which may be missing.
+struct RecycleItem
+	{
+	WIN32_FIND_DATA infoFile;
+	WIN32_FIND_DATA dataFile;
+	bool hasInfoFile;
+	bool hasDataFile;
+	};
+
+// The deleted items of a Recycle Bin, from one enumeration of its folder.
+struct RecycleItems
+	{
+	std::vector<RecycleItem> items;                         // In the order they were first found.
+	std::unordered_map<std::wstring, size_t> bySuffix;      // Index of each item by the (upper cased) name after $I or $R.
 
-// PrintRecycledFileInfo is an EachFileHandler (i.e. called from ForeachFile())
-void PrintRecycledFileInfo(const wchar_t* szRoot, WIN32_FIND_DATA* pffd, CharBuffer *lineBuffer);
+	// A Recycle Bin from before Windows Vista has an INFO2 file instead, and Dc files.
+	bool hasInfo2File;
+	WIN32_FIND_DATA info2File;
+	std::vector<WIN32_FIND_DATA> dcFiles;
+	std::unordered_map<uint32_t, size_t> dcFilesByIndex;
+	};
+
+// AddRecycleFile is a FoundFileHandler, the context is the RecycleItems.
+void AddRecycleFile(WIN32_FIND_DATA* pffd, void* context);
+
+void PrintRecycleItem(RecycleBin* pBin, RecycleItem* pItem, CharBuffer *lineBuffer);
+
+// Output a row for each record of the INFO2 file, and for each Dc file with no record.
+void PrintInfo2Items(RecycleBin* pBin, RecycleItems* pItems, CharBuffer *lineBuffer);
 
-void PrintRecycleInfo(CharBuffer *lineBuffer, const wchar_t* szFileName);
-void PrintFileAttributes(CharBuffer *lineBuffer, const wchar_t* szFullPath, bool *pfFolder);
+// Output the rows of a deleted item.  pInfoFile is its $I (or INFO2) file and pDataFile is its
+// $R (or Dc) file, either NULL if it is missing, and szDataFile is the data file's name.
+void PrintDeletedItem(RecycleBin* pBin, RecycleInfo* pInfo, WIN32_FIND_DATA* pInfoFile, WIN32_FIND_DATA* pDataFile, const wchar_t* szDataFile, CharBuffer *lineBuffer);
+
+void PrintRecycleInfo(CharBuffer *lineBuffer, RecycleInfo* pInfo);
+// Fills in the size, times and type of the row from the $R file found, NULL if it is missing.
+void SetDataFileAttributes(WIN32_FIND_DATA* pffd, RecycleRow* pRow);
+void PrintDataFile(CharBuffer *lineBuffer, RecycleRow* pRow);
 void PrintFileDetails(CharBuffer *lineBuffer, const wchar_t* szFileName, FILETIME* pFileTimeCreated, FILETIME* pFileTimeModified, FILETIME* pFileTimeAccessed);
 void PrintFileTime(CharBuffer *lineBuffer, FILETIME* pFileTime, bool comma = true);
 
-// Recursively print out the folder
-void PrintFolder(const wchar_t* szFolder, CharBuffer *lineBuffer);
+// pInfo is the deleted item the totals are for, or NULL for a subfolder.
+void PrintFolderTotals(CharBuffer *lineBuffer, FolderTotals* pTotals, RecycleInfo* pInfo);
+
+// Recursively print out the folder, adding everything in it to the totals.
+void PrintFolder(FileSource* pSource, const wchar_t* szFolder, CharBuffer *lineBuffer, RecycleRow* pItemRow, FolderTotals* pTotals);
 
-// PrintFileOrFolder is an EachFileHandler (i.e. called from ForeachFile())
-void PrintFileOrFolder(const wchar_t * szRoot, WIN32_FIND_DATA* pffd, CharBuffer *lineBuffer);
+// PrintFileOrFolder is an EachFileHandler (i.e. called from ForeachFile()), the context is the FolderWalk.
+void PrintFileOrFolder(const wchar_t * szRoot, WIN32_FIND_DATA* pffd, CharBuffer *lineBuffer, void* context);
 
 wchar_t header[] =
 	L"Original Full Path,"
@@ -141,215 +365,1564 @@ wchar_t header[] =
 	L"Original File Size,"
 	;
 
-int __cdecl wmain(int argc, const wchar_t** argv)
-	{
-	CharBuffer* lineBuffer = new CharBuffer(2 * 1024);
+// Extra column output first with --software-hive or --sam-hive.
+wchar_t userHeader[] =
+	L"User,"
+	;
 
-	for (int i = 1; i < argc; i++)
-		{
-		wprintf(L"%s\n", header);
-		SetCurrentDirectory(argv[i]);
+// Columns of the rows output for --carve.
+wchar_t carveHeader[] =
+	L"Original Full Path,"
+	L"Deleted Date Time,"
+	L"Deleted File Size,"
+	L"Recycle Info Version,"
+	L"Image Offset,"
+	;
 
-		// Look for the Recycle Bin information files.
-		ForeachFile(L".", L"$I*", PrintRecycledFileInfo, lineBuffer);
-		}
+// Extra columns output with --rollup.
+wchar_t rollupHeader[] =
+	L"Total Files,"
+	L"Total Folders,"
+	L"Total Size,"
+	L"Size Mismatch,"
+	;
 
-	delete lineBuffer;
-	}
+// Set by --software-hive and --sam-hive (NULL otherwise).
+UserMap* users = NULL;
+
+// Set by --rollup.
+bool rollup = false;
+
+// Set by --summary (NULL otherwise), rows are added to the summary instead of being output.
+Summary* summary = NULL;
+
+// Set by --top (NULL otherwise), only the best rows are kept and they are output at the end.
+TopK* topK = NULL;
+
+// Set by --sort (NULL otherwise), the rows are kept and output in order at the end.
+RowSorter* rowSorter = NULL;
 
-void ForeachFile(const wchar_t *szRoot, const wchar_t* szWild, EachFileHandler fn, CharBuffer *lineBuffer)
+// Set by --sqlite (NULL otherwise), the rows are written to the database instead of being output.
+SqliteWriter* database = NULL;
+
+// Set by --build-path-index (NULL otherwise), the rows are added to the index instead of being output.
+PathIndexBuilder* pathIndexBuilder = NULL;
+
+// Rows not selected by the filter options are skipped (NULL if none were given).
+Filter* filter = NULL;
+
+// Set by --progress (NULL otherwise).
+Progress* progress = NULL;
+
+// Add a Recycle Bin folder and the number of $I files in it to the totals of the progress,
+// unless --sid leaves it out.
+void CountRecycleBin(FileSource* pSource, const wchar_t* szFolder, const wchar_t* szSid);
+
+// Output the row in lineBuffer, or hand it to the mode that replaces the row output.
+// The --rollup totals rows (pRow->isTotals) are left out of the modes that count each file and
+// folder once.
+void OutputRow(CharBuffer *lineBuffer, RecycleRow* pRow);
+
+// Name of a Recycle Bin folder (i.e. the SID) from its path.
+const wchar_t* GetBinName(const wchar_t* szFolder, wchar_t* buffer, size_t size);
+
+// Output the rows of the Recycle Bin (i.e. one SID folder) in the source.
+void DumpRecycleBin(FileSource* pSource, const wchar_t* szSid, CharBuffer *lineBuffer);
+
+// Find the volumes of a disk image and dump the Recycle Bins of each NTFS volume, one thread
+// per volume.  Returns false if the image could not be read.
+bool DumpImage(const wchar_t* szImage);
+
+// Lets threads that finish their work in any order output their rows in a fixed order, each
+// waiting for the ones before it, so the output is the same however the threads are scheduled
+// (and the same as if they had run one after another).  It also keeps the filter, summary, top
+// K and known hash state to one thread at a time.  Only a thread's turn number is kept, and a
+// thread waiting for its turn holds no rows, only what it has read.
+class OutputTurns
 	{
-	WIN32_FIND_DATA ffd;
-	HANDLE hFind = INVALID_HANDLE_VALUE;
-	CharBuffer* findPattern = new CharBuffer(MAX_PATH);
+	public:
+		OutputTurns()
+			{
+			this->next = 0;
+			}
 
-	findPattern->PrintF(L"%s\\%s", szRoot, szWild);
+		// Wait for the turn (numbered from 0) to come round.
+		void Wait(uint32_t turn)
+			{
+			std::unique_lock<std::mutex> guard(this->lock);
+			this->changed.wait(guard, [this, turn] { return this->next == turn; });
+			}
 
-	size_t initialPosition = lineBuffer->GetPosition();
-	hFind = FindFirstFile(findPattern->buffer, &ffd);
+		// Pass the turn on to the next thread.
+		void End()
+			{
+			std::unique_lock<std::mutex> guard(this->lock);
+			this->next++;
+			guard.unlock();
 
-	if (hFind != INVALID_HANDLE_VALUE)
+			this->changed.notify_all();
+			}
+
+	protected:
+		std::mutex lock;
+		std::condition_variable changed;
+		uint32_t next;
+	};
+
+// Dump the Recycle Bins of one NTFS volume of an image, which is scanned as soon as the thread
+// starts and output in its turn, that of its place among the NTFS volumes in the partition table.
+void DumpVolume(const wchar_t* szImage, BlockDevice* pImage, Partition partition, OutputTurns* pTurns, uint32_t turn);
+
+// Dump the Recycle Bins in a ZIP archive.  Returns false if the archive could not be read.
+bool DumpArchive(const wchar_t* szArchive, CharBuffer *lineBuffer);
+
+// Output a row for each $I file found anywhere in a disk image.  Returns false if the image
+// could not be read.
+bool CarveImage(const wchar_t* szImage, CharBuffer *lineBuffer);
+
+// Time each stage of dumping a Recycle Bin folder, or the first Recycle Bin in a ZIP archive.
+// Returns false if it could not be read.
+bool RunBenchmarks(const wchar_t* szCorpus, CharBuffer *lineBuffer);
+
+// Set by --image-cache.
+size_t imageCacheSize = 256 * 1024 * 1024;
+
+// Set by --pipeline, the memory for the $I files read ahead and the rows to be written (0 if
+// they are read and written by the thread formatting the rows).
+size_t pipelineMemory = 0;
+
+// The header row, with the columns of the options given.
+CharBuffer* headerBuffer = NULL;
+
+// Files whose hash is in this set are not output (NULL if --known-hashes was not given).
+KnownHashSet* knownHashes = NULL;
+
+// Set by the --corpus options, for --generate-corpus.
+CorpusOptions corpusOptions = { 0, 1, 10, 2, 4, 20, 4096 };
+
+// Returns true if the row for this file should be left out of the output.
+bool IsKnownFile(FileSource* pSource, const wchar_t* szFileName);
+
+void PrintUsage()
+	{
+	fwprintf(stderr,
+		L"Usage: RecycleBinDumper [options] <Recycle Bin folder>...\n"
+		L"       RecycleBinDumper [options] --image <disk image> [<Recycle Bin folder>...]\n"
+		L"       RecycleBinDumper [options] --archive <zip> [<Recycle Bin folder>...]\n"
+		L"       RecycleBinDumper [options] --carve <disk image> [<Recycle Bin folder>...]\n"
+		L"    --image <disk image>\n"
+		L"    --image-cache <MB>\n"
+		L"    --archive <zip>\n"
+		L"    --carve <disk image>\n"
+		L"    --software-hive <file>, --sam-hive <file>\n"
+		L"    --known-hashes <index>\n"
+		L"    --build-known-hashes <text> <index>\n"
+		L"    --stats, --stats-json <file>\n"
+		L"    --trace <file>\n"
+		L"    --progress <seconds>\n"
+		L"    --pipeline <MB>\n"
+		L"    --generate-corpus <folder|zip> <count>\n"
+		L"    --benchmark <folder|zip>\n"
+		L"    --corpus-seed <n>, --corpus-folders <percent>, --corpus-v1 <percent>\n"
+		L"    --corpus-depth <n>, --corpus-fan-out <n>, --corpus-max-size <bytes>\n"
+		L"    --rollup\n"
+		L"    --summary\n"
+		L"    --top <K> <size|deleted-size|deleted-time>\n"
+		L"    --sort <deleted-time|path>, --sort-memory <MB>, --sort-temp <folder>\n"
+		L"    --sqlite <file>\n"
+		L"    --build-path-index <index>\n"
+		L"    --query-path-index <index> <prefix>, --search-path-index <index> <text>\n"
+		L"    --sid <SID>\n"
+		L"    --deleted-after <date>, --deleted-before <date>\n"
+		L"    --path <glob>, --exclude-path <glob>\n"
+		L"    --path-list <file>, --exclude-path-list <file>\n"
+		L"    --upcase-table <file>\n"
+		L"    --min-size <bytes>, --max-size <bytes>\n"
+		L"    --ext <ext>[,<ext>...]\n");
+	}
+
+int __cdecl wmain(int argc, const wchar_t** argv)
+	{
+	// Options come before the Recycle Bin folders.
+	int i = 1;
+	std::vector<const wchar_t*> images;
+	std::vector<const wchar_t*> archives;
+	std::vector<const wchar_t*> carves;
+	const wchar_t* szBenchmark = NULL;
+	const wchar_t* szStatsJson = NULL;
+	const wchar_t* szTrace = NULL;
+	const wchar_t* szSortKey = NULL;
+	const wchar_t* szSortTemp = NULL;
+	size_t sortMemory = 256 * 1024 * 1024;
+	const wchar_t* szDatabase = NULL;
+	const wchar_t* szPathIndex = NULL;
+	for (; (i < argc) && (wcsncmp(argv[i], L"--", 2) == 0); i++)
 		{
-		do
+		if ((wcscmp(argv[i], L"--image") == 0) && (i + 1 < argc))
+			{
+			images.push_back(argv[++i]);
+			}
+		else if ((wcscmp(argv[i], L"--archive") == 0) && (i + 1 < argc))
+			{
+			archives.push_back(argv[++i]);
+			}
+		else if ((wcscmp(argv[i], L"--carve") == 0) && (i + 1 < argc))
+			{
+			carves.push_back(argv[++i]);
+			}
+		else if ((wcscmp(argv[i], L"--image-cache") == 0) && (i + 1 < argc))
+			{
+			imageCacheSize = (size_t)_wtoi64(argv[++i]) * 1024 * 1024;
+			}
+		else if (((wcscmp(argv[i], L"--software-hive") == 0) || (wcscmp(argv[i], L"--sam-hive") == 0)) && (i + 1 < argc))
+			{
+			if (users == NULL)
+				{
+				users = new UserMap();
+				}
+
+			bool loaded = (wcscmp(argv[i], L"--software-hive") == 0) ? users->LoadSoftwareHive(argv[i + 1]) : users->LoadSamHive(argv[i + 1]);
+			if (!loaded)
+				{
+				fwprintf(stderr, L"Unable to read the user names from registry hive %s\n", argv[i + 1]);
+				return 1;
+				}
+			i++;
+			}
+		else if ((wcscmp(argv[i], L"--known-hashes") == 0) && (i + 1 < argc))
+			{
+			knownHashes = new KnownHashSet();
+			if (!knownHashes->Open(argv[++i]))
+				{
+				fwprintf(stderr, L"Unable to open known hash index %s\n", argv[i]);
+				return 1;
+				}
+			}
+		else if ((wcscmp(argv[i], L"--build-known-hashes") == 0) && (i + 2 < argc))
+			{
+			return BuildKnownHashSet(argv[i + 1], argv[i + 2]) ? 0 : 1;
+			}
+		else if ((wcscmp(argv[i], L"--generate-corpus") == 0) && (i + 2 < argc))
+			{
+			corpusOptions.itemCount = (uint64_t)_wtoi64(argv[i + 2]);
+			if (corpusOptions.itemCount > MAX_CORPUS_ITEMS)
+				{
+				fwprintf(stderr, L"A corpus can have at most %llu items\n", MAX_CORPUS_ITEMS);
+				return 1;
+				}
+
+			if (!WriteCorpus(argv[i + 1], &corpusOptions))
+				{
+				fwprintf(stderr, L"Unable to write the corpus to %s\n", argv[i + 1]);
+				return 1;
+				}
+			return 0;
+			}
+		else if (wcscmp(argv[i], L"--stats") == 0)
+			{
+			EnableStats();
+			}
+		else if ((wcscmp(argv[i], L"--stats-json") == 0) && (i + 1 < argc))
+			{
+			EnableStats();
+			szStatsJson = argv[++i];
+			}
+		else if ((wcscmp(argv[i], L"--trace") == 0) && (i + 1 < argc))
+			{
+			EnableTrace();
+			szTrace = argv[++i];
+			}
+		else if ((wcscmp(argv[i], L"--progress") == 0) && (i + 1 < argc))
+			{
+			progress = new Progress((uint32_t)_wtoi(argv[++i]));
+			}
+		else if ((wcscmp(argv[i], L"--pipeline") == 0) && (i + 1 < argc))
+			{
+			pipelineMemory = (size_t)_wtoi64(argv[++i]) * 1024 * 1024;
+			}
+		else if ((wcscmp(argv[i], L"--benchmark") == 0) && (i + 1 < argc))
+			{
+			szBenchmark = argv[++i];
+			}
+		else if ((wcscmp(argv[i], L"--corpus-seed") == 0) && (i + 1 < argc))
+			{
+			corpusOptions.seed = (uint64_t)_wtoi64(argv[++i]);
+			}
+		else if ((wcscmp(argv[i], L"--corpus-folders") == 0) && (i + 1 < argc))
+			{
+			corpusOptions.folderPercent = (uint32_t)_wtoi(argv[++i]);
+			}
+		else if ((wcscmp(argv[i], L"--corpus-depth") == 0) && (i + 1 < argc))
 			{
-			bool skip = false;
+			corpusOptions.folderDepth = (uint32_t)_wtoi(argv[++i]);
+			}
+		else if ((wcscmp(argv[i], L"--corpus-fan-out") == 0) && (i + 1 < argc))
+			{
+			corpusOptions.folderFanOut = (uint32_t)_wtoi(argv[++i]);
+			}
+		else if ((wcscmp(argv[i], L"--corpus-v1") == 0) && (i + 1 < argc))
+			{
+			corpusOptions.version1Percent = (uint32_t)_wtoi(argv[++i]);
+			}
+		else if ((wcscmp(argv[i], L"--corpus-max-size") == 0) && (i + 1 < argc))
+			{
+			corpusOptions.maxFileSize = (uint32_t)_wtoi64(argv[++i]);
+			}
+		else if (wcscmp(argv[i], L"--rollup") == 0)
+			{
+			rollup = true;
+			}
+		else if (wcscmp(argv[i], L"--summary") == 0)
+			{
+			summary = new Summary();
+			}
+		else if ((wcscmp(argv[i], L"--top") == 0) && (i + 2 < argc))
+			{
+			size_t k = (size_t)_wtoi64(argv[++i]);
+			const wchar_t* szKey = argv[++i];
 
-			if (ffd.cFileName[0] == L'.')
+			if (wcscmp(szKey, L"size") == 0)
+				{
+				topK = new TopK(k, TOP_BY_SIZE);
+				}
+			else if (wcscmp(szKey, L"deleted-size") == 0)
+				{
+				topK = new TopK(k, TOP_BY_DELETED_SIZE);
+				}
+			else if (wcscmp(szKey, L"deleted-time") == 0)
+				{
+				topK = new TopK(k, TOP_BY_DELETED_TIME);
+				}
+			else
+				{
+				PrintUsage();
+				return 1;
+				}
+			}
+		else if ((wcscmp(argv[i], L"--sort") == 0) && (i + 1 < argc))
+			{
+			szSortKey = argv[++i];
+			if ((wcscmp(szSortKey, L"deleted-time") != 0) && (wcscmp(szSortKey, L"path") != 0))
+				{
+				PrintUsage();
+				return 1;
+				}
+			}
+		else if ((wcscmp(argv[i], L"--sort-memory") == 0) && (i + 1 < argc))
+			{
+			sortMemory = (size_t)_wtoi64(argv[++i]) * 1024 * 1024;
+			}
+		else if ((wcscmp(argv[i], L"--sort-temp") == 0) && (i + 1 < argc))
+			{
+			szSortTemp = argv[++i];
+			}
+		else if ((wcscmp(argv[i], L"--sqlite") == 0) && (i + 1 < argc))
+			{
+			szDatabase = argv[++i];
+			}
+		else if ((wcscmp(argv[i], L"--build-path-index") == 0) && (i + 1 < argc))
+			{
+			szPathIndex = argv[++i];
+			}
+		else if (((wcscmp(argv[i], L"--query-path-index") == 0) || (wcscmp(argv[i], L"--search-path-index") == 0)) && (i + 2 < argc))
+			{
+			PathIndex index;
+			if (!index.Open(argv[i + 1]))
 				{
-				skip = (ffd.cFileName[1] == L'\0')
-					|| ((ffd.cFileName[1] == L'.') && (ffd.cFileName[2] == L'\0'));
+				fwprintf(stderr, L"Unable to open path index %s\n", argv[i + 1]);
+				return 1;
 				}
 
-			if (!skip)
+			if (wcscmp(argv[i], L"--query-path-index") == 0)
 				{
-				lineBuffer->SetPosition(initialPosition);
-				fn(szRoot, &ffd, lineBuffer);
+				index.PrintPrefix(argv[i + 2]);
 				}
 			else
 				{
+				index.PrintSubstring(argv[i + 2]);
+				}
+
+			if (index.IsDamaged())
+				{
+				fwprintf(stderr, L"Path index %s is damaged, the rows may not all have been output\n", argv[i + 1]);
+				return 1;
+				}
+			return 0;
+			}
+		else if (Filter::IsFilterOption(argv[i]) && (i + 1 < argc))
+			{
+			if (filter == NULL)
+				{
+				filter = new Filter();
+				}
 
+			if (!filter->SetOption(argv[i], argv[i + 1]))
+				{
+				fwprintf(stderr, L"Invalid value for %s: %s\n", argv[i], argv[i + 1]);
+				return 1;
 				}
-			} while (FindNextFile(hFind, &ffd) != 0);
-		FindClose(hFind);
+			i++;
+			}
+		else
+			{
+			PrintUsage();
+			return 1;
+			}
 		}
-	}
 
-void PrintRecycledFileInfo(const wchar_t* szRoot, WIN32_FIND_DATA* pffd, CharBuffer *lineBuffer)
-	{
-	if (pffd->dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+	if ((i == argc) && images.empty() && archives.empty() && carves.empty() && (szBenchmark == NULL))
 		{
+		PrintUsage();
+		return 1;
 		}
-	else
-		{
-		PrintRecycleInfo(lineBuffer, pffd->cFileName);
-		PrintFileDetails(lineBuffer, pffd->cFileName, &(pffd->ftCreationTime), &(pffd->ftLastWriteTime), &(pffd->ftLastAccessTime));
 
-		wchar_t szDataFile[MAX_PATH];
+	// The carved rows have columns of their own, which the modes that replace the row output
+	// do not take.
+	if (!carves.empty() && ((summary != NULL) || (topK != NULL) || (szSortKey != NULL) || (szDatabase != NULL) || (szPathIndex != NULL)))
+		{
+		fwprintf(stderr, L"--carve cannot be used with --summary, --top, --sort, --sqlite or --build-path-index\n");
+		return 1;
+		}
 
-		// Data file is the same as the recycle info file except it starts with "$R" instead of "$I".
-		StringCchCopy(szDataFile, MAX_PATH, pffd->cFileName);
-		szDataFile[1] = L'R';
+	// The benchmark runs the dump over and over and exits, so those modes would never output
+	// (or clean up) anything.
+	if ((szBenchmark != NULL) && ((summary != NULL) || (topK != NULL) || (szSortKey != NULL) || (szDatabase != NULL) || (szPathIndex != NULL)))
+		{
+		fwprintf(stderr, L"--benchmark cannot be used with --summary, --top, --sort, --sqlite or --build-path-index\n");
+		return 1;
+		}
 
-		bool isFolder = false;
-		size_t pos = lineBuffer->GetPosition();
-		PrintFileAttributes(lineBuffer, szDataFile, &isFolder);
+	if (filter != NULL)
+		{
+		filter->Prepare();
+		}
 
-		lineBuffer->PrintLine();
+	// Two runs are held at once, one filled while the other is sorted and written.
+	if (szSortKey != NULL)
+		{
+		rowSorter = new RowSorter((wcscmp(szSortKey, L"path") == 0) ? SORT_BY_PATH : SORT_BY_DELETED_TIME, sortMemory / 2, szSortTemp);
+		}
 
-		if (isFolder)
+	if (szDatabase != NULL)
+		{
+		database = new SqliteWriter();
+		if (!database->Create(szDatabase))
 			{
-			// Everything before pos is repeated for all the files and folders under this folder.
-			lineBuffer->SetPosition(pos);
-			PrintFolder(szDataFile, lineBuffer);
+			fwprintf(stderr, L"Unable to create the database %s\n", szDatabase);
+			return 1;
 			}
 		}
-	}
 
-void PrintRecycleInfo(CharBuffer *lineBuffer, const wchar_t* szFileName)
-	{
-	FILE* pFile;
-	errno_t err = _wfopen_s(&pFile, szFileName, L"rb");
+	if (szPathIndex != NULL)
+		{
+		pathIndexBuilder = new PathIndexBuilder();
+		}
+
+	CharBuffer* lineBuffer = new CharBuffer(2 * 1024);
+	headerBuffer = new CharBuffer(1024);
+	headerBuffer->PrintF(L"%s%s%s", (users != NULL) ? userHeader : L"", header, rollup ? rollupHeader : L"");
 
-	if (err == 0)
+	// The benchmark is run with the rest of the options in effect, in place of the dump.
+	if (szBenchmark != NULL)
 		{
-		uint64_t version;
-		size_t count = fread(&version, sizeof(version), 1, pFile);
-		if (count == 1)
+		if (!RunBenchmarks(szBenchmark, lineBuffer))
 			{
-			uint64_t fileSize;
-			count = fread(&fileSize, sizeof(fileSize), 1, pFile);
-			if (count == 1)
-				{
-				FILETIME timeStamp;
-
-				count = fread(&timeStamp, sizeof(timeStamp), 1, pFile);
-				if (count == 1)
-					{
-					uint32_t fileNameSize = 0;
-
-					if (version == 1)
-						{
-						fileNameSize = 520 / sizeof(wchar_t);
-						}
-					else
-						{
-						count = fread(&fileNameSize, sizeof(fileNameSize), 1, pFile);
-						if (count != 1)
-							{
-							fileNameSize = 0;
-							}
-						}
-
-					if (fileNameSize > 0)
-						{
-						wchar_t* pOriginalFileName = new wchar_t[fileNameSize + 1];
-						count = fread(pOriginalFileName, sizeof(wchar_t), fileNameSize, pFile);
-						if (count == fileNameSize)
-							{
-							pOriginalFileName[fileNameSize] = L'\0';
-
-							lineBuffer->PrintF(L"%s,", pOriginalFileName);
-							PrintFileTime(lineBuffer, &timeStamp);
-							lineBuffer->PrintF(L"%lld,", fileSize);
-							}
-
-						delete[] pOriginalFileName;
-						}
-					}
-				}
+			fwprintf(stderr, L"Unable to read the Recycle Bin %s\n", szBenchmark);
+			return 1;
 			}
-
-		fclose(pFile);
+		return 0;
 		}
-	}
 
-void PrintFileAttributes(CharBuffer *lineBuffer, const wchar_t* szFileName, bool *pIsFolder)
-	{
-	WIN32_FILE_ATTRIBUTE_DATA fileAttributeData;
+	int result = 0;
+	LocalFileSource localSource;
 
-	int err = GetFileAttributesEx(szFileName, GetFileExInfoStandard, &fileAttributeData);
-	if (err == 0)
+	if (pipelineMemory != 0)
 		{
-		*pIsFolder = false;
-		lineBuffer->PrintF(L"Missing,,,,,");
-		return;
+		rowWriter = new RowWriter(pipelineMemory / 2);
 		}
 
-	PrintFileDetails(lineBuffer, szFileName, &(fileAttributeData.ftCreationTime), &(fileAttributeData.ftLastWriteTime), &(fileAttributeData.ftLastAccessTime));
-	uint64_t size = (((uint64_t)fileAttributeData.nFileSizeHigh) << 32) + fileAttributeData.nFileSizeLow;
-	lineBuffer->PrintF(L"%lld,", size);
-
-	*pIsFolder = (fileAttributeData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
-	}
-
-void PrintFileDetails(CharBuffer *lineBuffer, const wchar_t* szFileName, FILETIME* pFileTimeCreated, FILETIME* pFileTimeModified, FILETIME* pFileTimeAccessed)
-	{
-	lineBuffer->PrintF(L"%s,", szFileName);
-	PrintFileTime(lineBuffer, pFileTimeCreated);
-	PrintFileTime(lineBuffer, pFileTimeModified);
-	PrintFileTime(lineBuffer, pFileTimeAccessed);
-	}
+	if (progress != NULL)
+		{
+		for (int folder = i; folder < argc; folder++)
+			{
+			wchar_t szSid[MAX_PATH];
+			CountRecycleBin(&localSource, argv[folder], GetBinName(argv[folder], szSid, MAX_PATH));
+			}
+		progress->Start();
+		}
 
+	for (; i < argc; i++)
+		{
+		wchar_t szSid[MAX_PATH];
+		GetBinName(argv[i], szSid, MAX_PATH);
 
-void PrintFileTime(CharBuffer *lineBuffer, FILETIME *pFileTime, bool comma)
-	{
-	SYSTEMTIME utc;
-	FileTimeToSystemTime(pFileTime, &utc);
+		SetCurrentDirectory(argv[i]);
+		DumpRecycleBin(&localSource, szSid, lineBuffer);
+		}
 
-	lineBuffer->PrintF(L"%4d-%02d-%02d %02d:%02d:%02d",
-		utc.wYear, utc.wMonth, utc.wDay, utc.wHour, utc.wMinute, utc.wSecond);
+	for (size_t archive = 0; archive < archives.size(); archive++)
+		{
+		if (!DumpArchive(archives[archive], lineBuffer))
+			{
+			fwprintf(stderr, L"Unable to read archive %s\n", archives[archive]);
+			result = 1;
+			}
+		}
 
-	if (comma)
+	for (size_t image = 0; image < images.size(); image++)
 		{
-		lineBuffer->PrintF(L",");
+		if (!DumpImage(images[image]))
+			{
+			fwprintf(stderr, L"Unable to read disk image %s\n", images[image]);
+			result = 1;
+			}
 		}
-	}
 
-void PrintFolder(const wchar_t* szFolder, CharBuffer *lineBuffer)
-	{
-	ForeachFile(szFolder, L"*", PrintFileOrFolder, lineBuffer);
-	}
+	for (size_t carve = 0; carve < carves.size(); carve++)
+		{
+		if (!CarveImage(carves[carve], lineBuffer))
+			{
+			fwprintf(stderr, L"Unable to read disk image %s\n", carves[carve]);
+			result = 1;
+			}
+		}
 
-void PrintFileOrFolder(const wchar_t * szRoot, WIN32_FIND_DATA* pffd, CharBuffer *lineBuffer)
-	{
-	size_t initialPosition = lineBuffer->GetPosition();
+	if (progress != NULL)
+		{
+		progress->Stop();
+		delete progress;
+		}
 
-	CharBuffer* fileName = new CharBuffer(MAX_PATH);
+	// The rows queued are written before anything that follows them.
+	delete rowWriter;
+	rowWriter = NULL;
 
-	fileName->PrintF(L"%s\\%s", szRoot, pffd->cFileName);
+	if (summary != NULL)
+		{
+		summary->Print();
+		delete summary;
+		}
 
-	PrintFileDetails(lineBuffer, fileName->buffer, &(pffd->ftCreationTime), &(pffd->ftLastWriteTime), &(pffd->ftLastAccessTime));
-	delete fileName;
-	fileName = NULL;
+	if (topK != NULL)
+		{
+		topK->Print(headerBuffer->buffer);
+		delete topK;
+		}
 
-	uint64_t size = (((uint64_t)pffd->nFileSizeHigh) << 32) + pffd->nFileSizeLow;
-	lineBuffer->PrintF(L"%lld,", size);
+	if (rowSorter != NULL)
+		{
+		if (!rowSorter->Print(headerBuffer->buffer))
+			{
+			fwprintf(stderr, L"Unable to sort all the rows, the temporary files could not be written or read\n");
+			result = 1;
+			}
+		delete rowSorter;
+		}
+
+	if (database != NULL)
+		{
+		if (!database->Close())
+			{
+			fwprintf(stderr, L"Unable to write the database %s\n", szDatabase);
+			result = 1;
+			}
+		delete database;
+		}
+
+	if (pathIndexBuilder != NULL)
+		{
+		if (!pathIndexBuilder->Write(szPathIndex))
+			{
+			fwprintf(stderr, L"Unable to write the path index %s\n", szPathIndex);
+			result = 1;
+			}
+		delete pathIndexBuilder;
+		}
+
+	// The rows are all written by now, so the stats follow them.
+	if (IsStatsEnabled() && !PrintStats(szStatsJson))
+		{
+		fwprintf(stderr, L"Unable to write the stats to %s\n", szStatsJson);
+		result = 1;
+		}
+
+	if (IsTraceEnabled() && !WriteTrace(szTrace))
+		{
+		fwprintf(stderr, L"Unable to write the trace to %s\n", szTrace);
+		result = 1;
+		}
+
+	delete lineBuffer;
+	delete headerBuffer;
+	delete users;
+	delete knownHashes;
+	delete filter;
+
+	return result;
+	}
+
+void DumpRecycleBin(FileSource* pSource, const wchar_t* szSid, CharBuffer *lineBuffer)
+	{
+	TraceSpan span(L"Recycle Bin", szSid);
+
+	// A Recycle Bin left out by --sid outputs nothing at all, not even its header, and is not
+	// counted by the progress either.
+	if ((filter != NULL) && !filter->MatchesBin(szSid))
+		{
+		return;
+		}
+
+	if (progress != NULL)
+		{
+		progress->AddBin();
+		}
+
+	// The modes that replace the row output print their own header at the end.
+	if ((summary == NULL) && (topK == NULL) && (rowSorter == NULL) && (database == NULL) && (pathIndexBuilder == NULL))
+		{
+		headerBuffer->PrintLine();
+		}
+
+	// Look for the Recycle Bin information files.
+	const wchar_t* szUser = (users != NULL) ? users->Lookup(szSid) : NULL;
+	RecycleBin bin = { pSource, szSid, (szUser != NULL) ? szUser : L"", NULL };
+	if (database != NULL)
+		{
+		database->AddBin(szSid, bin.szUser);
+		}
+
+	if (pathIndexBuilder != NULL)
+		{
+		pathIndexBuilder->AddBin(szSid);
+		}
+
+	// The $I and $R files all come from one enumeration of the folder, so the $R file of each
+	// $I file (and any $R file without one) is known without looking for it.
+	RecycleItems items;
+	items.hasInfo2File = false;
+	pSource->FindFiles(L".", L"*", AddRecycleFile, &items);
+
+	// The $I files are read, in the order their items are printed, by a thread of their own.
+	SharedFileSource sharedSource(pSource);
+	InfoReader reader(&sharedSource, pipelineMemory / 2);
+	if (pipelineMemory != 0)
+		{
+		std::vector<const wchar_t*> infoFiles;
+		for (size_t i = 0; i < items.items.size(); i++)
+			{
+			if (items.items[i].hasInfoFile)
+				{
+				infoFiles.push_back(items.items[i].infoFile.cFileName);
+				}
+			}
+
+		bin.pSource = &sharedSource;
+		bin.pReader = &reader;
+		reader.Start(infoFiles);
+		}
+
+	for (size_t i = 0; i < items.items.size(); i++)
+		{
+		// Each item's rows start from an empty line.
+		lineBuffer->SetPosition(0);
+		PrintRecycleItem(&bin, &items.items[i], lineBuffer);
+		}
+
+	if (items.hasInfo2File || !items.dcFiles.empty())
+		{
+		PrintInfo2Items(&bin, &items, lineBuffer);
+		}
+	}
+
+void AddRecycleFile(WIN32_FIND_DATA* pffd, void* context)
+	{
+	RecycleItems* pItems = (RecycleItems*)context;
+	bool isFolder = (pffd->dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+
+	if (!isFolder && (_wcsicmp(pffd->cFileName, L"INFO2") == 0))
+		{
+		pItems->info2File = *pffd;
+		pItems->hasInfo2File = true;
+		return;
+		}
+
+	if ((towupper(pffd->cFileName[0]) == L'D') && (towupper(pffd->cFileName[1]) == L'C') && iswdigit(pffd->cFileName[2]))
+		{
+		uint32_t index = (uint32_t)wcstoul(pffd->cFileName + 2, NULL, 10);
+		pItems->dcFilesByIndex[index] = pItems->dcFiles.size();
+		pItems->dcFiles.push_back(*pffd);
+		return;
+		}
+
+	wchar_t type = towupper(pffd->cFileName[1]);
+	if ((pffd->cFileName[0] != L'$') || ((type != L'I') && (type != L'R')) || (pffd->cFileName[2] == L'\0'))
+		{
+		return;
+		}
+
+	bool isInfoFile = (type == L'I');
+	if (isInfoFile && isFolder)
+		{
+		return;
+		}
+
+	std::wstring suffix(pffd->cFileName + 2);
+	for (size_t i = 0; i < suffix.size(); i++)
+		{
+		suffix[i] = towupper(suffix[i]);
+		}
+
+	std::pair<std::unordered_map<std::wstring, size_t>::iterator, bool> found = pItems->bySuffix.insert(std::make_pair(suffix, pItems->items.size()));
+	if (found.second)
+		{
+		RecycleItem item = {};
+		pItems->items.push_back(item);
+		}
+
+	RecycleItem* pItem = &pItems->items[found.first->second];
+	if (isInfoFile)
+		{
+		pItem->infoFile = *pffd;
+		pItem->hasInfoFile = true;
+		}
+	else
+		{
+		pItem->dataFile = *pffd;
+		pItem->hasDataFile = true;
+		}
+	}
+
+bool DumpImage(const wchar_t* szImage)
+	{
+	BlockDevice* pImage = OpenImage(szImage, imageCacheSize);
+	std::vector<Partition> partitions;
+
+	if ((pImage == NULL) || !FindPartitions(pImage, &partitions))
+		{
+		delete pImage;
+		return false;
+		}
+
+	OutputTurns turns;
+	std::vector<std::thread> threads;
+	for (size_t i = 0; i < partitions.size(); i++)
+		{
+		if (partitions[i].type == VOLUME_NTFS)
+			{
+			threads.push_back(std::thread(DumpVolume, szImage, pImage, partitions[i], &turns, (uint32_t)threads.size()));
+			}
+		else
+			{
+			// There is no Recycle Bin reader for FAT and exFAT volumes (e.g. USB drives) yet.
+			fwprintf(stderr, L"%s: volume %u (%s) not scanned\n", szImage, partitions[i].number, GetVolumeTypeName(partitions[i].type));
+			}
+		}
+
+	for (size_t i = 0; i < threads.size(); i++)
+		{
+		threads[i].join();
+		}
+
+	delete pImage;
+	return true;
+	}
+
+void DumpVolume(const wchar_t* szImage, BlockDevice* pImage, Partition partition, OutputTurns* pTurns, uint32_t turn)
+	{
+	VolumeDevice volume(pImage, partition.offset, partition.size);
+	NtfsVolume ntfs(&volume);
+
+	TraceSpan scan(L"Volume scan", szImage);
+	bool isScanned = ntfs.Scan();
+	scan.End();
+
+	// A volume that could not be read still takes its turn, for the ones after it.
+	if (!isScanned)
+		{
+		pTurns->Wait(turn);
+		fwprintf(stderr, L"%s: volume %u (NTFS) could not be read\n", szImage, partition.number);
+		pTurns->End();
+		return;
+		}
+
+	if (progress != NULL)
+		{
+		for (size_t i = 0; i < ntfs.GetRecycleBinCount(); i++)
+			{
+			NtfsFile* pFolder = ntfs.GetRecycleBin(i);
+			NtfsRecycleBin bin(&ntfs, pFolder);
+			CountRecycleBin(&bin, L".", pFolder->name.c_str());
+			}
+		}
+
+	CharBuffer* lineBuffer = new CharBuffer(2 * 1024);
+	TraceSpan wait(L"Output wait");
+	pTurns->Wait(turn);
+	wait.End();
+
+	for (size_t i = 0; i < ntfs.GetRecycleBinCount(); i++)
+		{
+		NtfsFile* pFolder = ntfs.GetRecycleBin(i);
+		NtfsRecycleBin bin(&ntfs, pFolder);
+
+		DumpRecycleBin(&bin, pFolder->name.c_str(), lineBuffer);
+		}
+
+	delete lineBuffer;
+	pTurns->End();
+	}
+
+bool DumpArchive(const wchar_t* szArchive, CharBuffer *lineBuffer)
+	{
+	ZipArchive archive;
+	if (!archive.Open(szArchive))
+		{
+		return false;
+		}
+
+	if (progress != NULL)
+		{
+		for (size_t i = 0; i < archive.GetRecycleBinCount(); i++)
+			{
+			ZipEntry* pFolder = archive.GetRecycleBin(i);
+			ZipRecycleBin bin(&archive, pFolder);
+			CountRecycleBin(&bin, L".", pFolder->name.c_str());
+			}
+		}
 
+	for (size_t i = 0; i < archive.GetRecycleBinCount(); i++)
+		{
+		ZipEntry* pFolder = archive.GetRecycleBin(i);
+		ZipRecycleBin bin(&archive, pFolder);
+
+		DumpRecycleBin(&bin, pFolder->name.c_str(), lineBuffer);
+		}
+
+	return true;
+	}
+
+bool CarveImage(const wchar_t* szImage, CharBuffer *lineBuffer)
+	{
+	BlockDevice* pImage = OpenImage(szImage, imageCacheSize);
+	if (pImage == NULL)
+		{
+		return false;
+		}
+
+	RecycleInfoCarver carver(pImage);
+	std::vector<CarvedRecycleInfo> found;
+	carver.Carve(&found);
+
+	if (carver.GetUnreadableSize() != 0)
+		{
+		fwprintf(stderr, L"%s: %llu bytes could not be read and were not searched\n", szImage, carver.GetUnreadableSize());
+		}
+
+	// Written like the rows, so it follows the rows of the dumps still queued with --pipeline.
+	lineBuffer->SetPosition(0);
+	lineBuffer->PrintF(L"%s", carveHeader);
 	lineBuffer->PrintLine();
 
-	if ((pffd->dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0)
+	for (size_t i = 0; i < found.size(); i++)
 		{
-		lineBuffer->SetPosition(initialPosition);
-		PrintFolder(fileName->buffer, lineBuffer);
+		RecycleInfo info;
+		if (!DecodeRecycleInfo(found[i].data.data(), found[i].data.size(), &info))
+			{
+			continue;
+			}
+
+		if ((filter != NULL) && !filter->MatchesItem(&info))
+			{
+			continue;
+			}
+
+		lineBuffer->SetPosition(0);
+		PrintRecycleInfo(lineBuffer, &info);
+		lineBuffer->PrintF(L"%lld,%lld,", info.version, found[i].offset);
+		lineBuffer->PrintLine();
+		}
+
+	delete pImage;
+	return true;
+	}
+
+// Context of ForeachFile() for the FileSource's FoundFileHandler.
+struct ForeachContext
+	{
+	const wchar_t* szRoot;
+	EachFileHandler fn;
+	CharBuffer* lineBuffer;
+	size_t initialPosition;
+	void* context;
+	};
+
+// The Recycle Bin the stages are timed on, with what each stage needs from the ones before it
+// so that each stage is timed on its own.
+struct BenchmarkCorpus
+	{
+	RecycleBin bin;
+	CharBuffer* lineBuffer;
+	RecycleItems items;
+	std::vector<uint8_t> infoData;      // Every $I file, one after another.
+	std::vector<size_t> infoEnds;       // Offset of the end of each $I file in infoData.
+	std::vector<RecycleInfo> infos;     // One for each $I file, pointing into infoData.
+	std::vector<std::wstring> rows;     // One for each item.
+	};
+
+static uint64_t BenchmarkEnumerate(void* context, uint64_t* pBytes)
+	{
+	BenchmarkCorpus* pCorpus = (BenchmarkCorpus*)context;
+
+	RecycleItems items;
+	items.hasInfo2File = false;
+	pCorpus->bin.pSource->FindFiles(L".", L"*", AddRecycleFile, &items);
+
+	*pBytes = 0;
+	return items.items.size();
+	}
+
+static bool AppendInfoData(const uint8_t* pData, size_t cbData, void* context)
+	{
+	std::vector<uint8_t>* pInfoData = (std::vector<uint8_t>*)context;
+	pInfoData->insert(pInfoData->end(), pData, pData + cbData);
+	return true;
+	}
+
+static uint64_t BenchmarkReadInfo(void* context, uint64_t* pBytes)
+	{
+	BenchmarkCorpus* pCorpus = (BenchmarkCorpus*)context;
+	pCorpus->infoData.clear();
+	pCorpus->infoEnds.clear();
+
+	for (size_t i = 0; i < pCorpus->items.items.size(); i++)
+		{
+		RecycleItem* pItem = &pCorpus->items.items[i];
+		if (pItem->hasInfoFile)
+			{
+			pCorpus->bin.pSource->ReadFileData(pItem->infoFile.cFileName, AppendInfoData, &pCorpus->infoData);
+			pCorpus->infoEnds.push_back(pCorpus->infoData.size());
+			}
 		}
+
+	*pBytes = pCorpus->infoData.size();
+	return pCorpus->infoEnds.size();
+	}
+
+static uint64_t BenchmarkDecodeInfo(void* context, uint64_t* pBytes)
+	{
+	BenchmarkCorpus* pCorpus = (BenchmarkCorpus*)context;
+	pCorpus->infos.clear();
+
+	size_t start = 0;
+	for (size_t i = 0; i < pCorpus->infoEnds.size(); i++)
+		{
+		// A $I file that does not decode is kept with an empty path, so every $I file has one.
+		RecycleInfo info = {};
+		if (!DecodeRecycleInfo(pCorpus->infoData.data() + start, pCorpus->infoEnds[i] - start, &info))
+			{
+			info.fileName = L"";
+			info.fileNameLength = 0;
+			}
+		pCorpus->infos.push_back(info);
+		start = pCorpus->infoEnds[i];
+		}
+
+	*pBytes = pCorpus->infoData.size();
+	return pCorpus->infos.size();
+	}
+
+static uint64_t BenchmarkFormatTimes(void* context, uint64_t* pBytes)
+	{
+	BenchmarkCorpus* pCorpus = (BenchmarkCorpus*)context;
+
+	*pBytes = 0;
+	for (size_t i = 0; i < pCorpus->infos.size(); i++)
+		{
+		pCorpus->lineBuffer->SetPosition(0);
+		PrintFileTime(pCorpus->lineBuffer, &pCorpus->infos[i].deletedTime);
+		*pBytes += pCorpus->lineBuffer->GetPosition() * sizeof(wchar_t);
+		}
+
+	return pCorpus->infos.size();
+	}
+
+static uint64_t BenchmarkFormatValues(void* context, uint64_t* pBytes)
+	{
+	BenchmarkCorpus* pCorpus = (BenchmarkCorpus*)context;
+
+	*pBytes = 0;
+	for (size_t i = 0; i < pCorpus->infos.size(); i++)
+		{
+		RecycleInfo* pInfo = &pCorpus->infos[i];
+		pCorpus->lineBuffer->SetPosition(0);
+		pCorpus->lineBuffer->PrintF(L"%.*s,%lld,", (int)pInfo->fileNameLength, pInfo->fileName, pInfo->deletedSize);
+		*pBytes += pCorpus->lineBuffer->GetPosition() * sizeof(wchar_t);
+		}
+
+	return pCorpus->infos.size();
+	}
+
+static uint64_t BenchmarkAssembleRows(void* context, uint64_t* pBytes)
+	{
+	BenchmarkCorpus* pCorpus = (BenchmarkCorpus*)context;
+	CharBuffer* lineBuffer = pCorpus->lineBuffer;
+
+	// The columns of an item's row in PrintDeletedItem(), with no filters or output.
+	*pBytes = 0;
+	size_t info = 0;
+	for (size_t i = 0; i < pCorpus->items.items.size(); i++)
+		{
+		RecycleItem* pItem = &pCorpus->items.items[i];
+		lineBuffer->SetPosition(0);
+		PrintRecycleInfo(lineBuffer, pItem->hasInfoFile ? &pCorpus->infos[info++] : NULL);
+
+		if (pItem->hasInfoFile)
+			{
+			PrintFileDetails(lineBuffer, pItem->infoFile.cFileName, &pItem->infoFile.ftCreationTime, &pItem->infoFile.ftLastWriteTime, &pItem->infoFile.ftLastAccessTime);
+			}
+		else
+			{
+			lineBuffer->PrintF(L"Missing,,,,");
+			}
+
+		RecycleRow row = {};
+		row.szFileName = pItem->hasDataFile ? pItem->dataFile.cFileName : L"";
+		SetDataFileAttributes(pItem->hasDataFile ? &pItem->dataFile : NULL, &row);
+		PrintDataFile(lineBuffer, &row);
+
+		pCorpus->rows[i].assign(lineBuffer->buffer, lineBuffer->GetPosition());
+		*pBytes += lineBuffer->GetPosition() * sizeof(wchar_t);
+		}
+
+	return pCorpus->items.items.size();
+	}
+
+static uint64_t BenchmarkWriteRows(void* context, uint64_t* pBytes)
+	{
+	BenchmarkCorpus* pCorpus = (BenchmarkCorpus*)context;
+
+	// Written as CharBuffer::PrintLine() writes them, and flushed so the writes are all timed.
+	*pBytes = 0;
+	for (size_t i = 0; i < pCorpus->rows.size(); i++)
+		{
+		wprintf(L"%s\n", pCorpus->rows[i].c_str());
+		*pBytes += pCorpus->rows[i].size() + 1;
+		}
+	fflush(stdout);
+
+	return pCorpus->rows.size();
+	}
+
+static uint64_t BenchmarkDump(void* context, uint64_t* pBytes)
+	{
+	BenchmarkCorpus* pCorpus = (BenchmarkCorpus*)context;
+
+	DumpRecycleBin(pCorpus->bin.pSource, pCorpus->bin.szSid, pCorpus->lineBuffer);
+	fflush(stdout);
+
+	*pBytes = 0;
+	return pCorpus->items.items.size();
+	}
+
+bool RunBenchmarks(const wchar_t* szCorpus, CharBuffer *lineBuffer)
+	{
+	wchar_t szSid[MAX_PATH];
+	LocalFileSource localSource;
+	ZipArchive archive;
+	ZipRecycleBin* pZipBin = NULL;
+	FileSource* pSource = &localSource;
+
+	size_t length = wcslen(szCorpus);
+	if ((length > 4) && (_wcsicmp(szCorpus + length - 4, L".zip") == 0))
+		{
+		if (!archive.Open(szCorpus) || (archive.GetRecycleBinCount() == 0))
+			{
+			return false;
+			}
+
+		ZipEntry* pFolder = archive.GetRecycleBin(0);
+		StringCchCopy(szSid, MAX_PATH, pFolder->name.c_str());
+		pZipBin = new ZipRecycleBin(&archive, pFolder);
+		pSource = pZipBin;
+		}
+	else
+		{
+		GetBinName(szCorpus, szSid, MAX_PATH);
+		if (!SetCurrentDirectory(szCorpus))
+			{
+			return false;
+			}
+		}
+
+	BenchmarkCorpus corpus;
+	corpus.bin.pSource = pSource;
+	corpus.bin.szSid = szSid;
+	corpus.bin.szUser = L"";
+	corpus.bin.pReader = NULL;
+	corpus.lineBuffer = lineBuffer;
+	corpus.items.hasInfo2File = false;
+	pSource->FindFiles(L".", L"*", AddRecycleFile, &corpus.items);
+	corpus.rows.resize(corpus.items.items.size());
+
+	PrintBenchmarkHeader();
+	RunBenchmark(L"Enumerate", BenchmarkEnumerate, &corpus);
+	RunBenchmark(L"Read $I", BenchmarkReadInfo, &corpus);
+	RunBenchmark(L"Decode $I", BenchmarkDecodeInfo, &corpus);
+	RunBenchmark(L"Format times", BenchmarkFormatTimes, &corpus);
+	RunBenchmark(L"Format paths and sizes", BenchmarkFormatValues, &corpus);
+	RunBenchmark(L"Assemble rows", BenchmarkAssembleRows, &corpus);
+	RunBenchmark(L"Write rows", BenchmarkWriteRows, &corpus);
+	RunBenchmark(L"Dump", BenchmarkDump, &corpus);
+
+	delete pZipBin;
+	return true;
+	}
+
+static void CountInfoFile(WIN32_FIND_DATA* /* pffd */, void* context)
+	{
+	(*(uint64_t*)context)++;
+	}
+
+void CountRecycleBin(FileSource* pSource, const wchar_t* szFolder, const wchar_t* szSid)
+	{
+	if ((filter != NULL) && !filter->MatchesBin(szSid))
+		{
+		return;
+		}
+
+	uint64_t count = 0;
+	pSource->FindFiles(szFolder, L"$I*", CountInfoFile, &count);
+	progress->AddExpected(1, count);
+	}
+
+static void ForeachFound(WIN32_FIND_DATA* pffd, void* context)
+	{
+	ForeachContext* pForeach = (ForeachContext*)context;
+	bool skip = false;
+
+	if (pffd->cFileName[0] == L'.')
+		{
+		skip = (pffd->cFileName[1] == L'\0')
+			|| ((pffd->cFileName[1] == L'.') && (pffd->cFileName[2] == L'\0'));
+		}
+
+	if (!skip)
+		{
+		pForeach->lineBuffer->SetPosition(pForeach->initialPosition);
+		pForeach->fn(pForeach->szRoot, pffd, pForeach->lineBuffer, pForeach->context);
+		}
+	}
+
+void ForeachFile(FileSource* pSource, const wchar_t *szRoot, const wchar_t* szWild, EachFileHandler fn, CharBuffer *lineBuffer, void* context)
+	{
+	ForeachContext foreach = { szRoot, fn, lineBuffer, lineBuffer->GetPosition(), context };
+	pSource->FindFiles(szRoot, szWild, ForeachFound, &foreach);
+	}
+
+void PrintRecycleItem(RecycleBin* pBin, RecycleItem* pItem, CharBuffer *lineBuffer)
+	{
+	TraceSpan span(L"$I", pItem->hasInfoFile ? pItem->infoFile.cFileName : pItem->dataFile.cFileName);
+	if ((progress != NULL) && pItem->hasInfoFile)
+		{
+		progress->AddItem();
+		}
+
+	uint8_t* pInfoData = NULL;
+	RecycleInfo info;
+	RecycleInfo* pInfo = NULL;
+
+	if (pItem->hasInfoFile)
+		{
+		pInfoData = new uint8_t[MAX_RECYCLE_INFO_SIZE];
+		size_t cbInfo = (pBin->pReader != NULL) ? pBin->pReader->Next(pInfoData) : ReadRecycleInfoData(pBin->pSource, pItem->infoFile.cFileName, pInfoData);
+		pInfo = DecodeRecycleInfo(pInfoData, cbInfo, &info) ? &info : NULL;
+		}
+
+	wchar_t szDataFile[MAX_PATH];
+
+	// Data file is the same as the recycle info file except it starts with "$R" instead of "$I".
+	if (pItem->hasDataFile)
+		{
+		StringCchCopy(szDataFile, MAX_PATH, pItem->dataFile.cFileName);
+		}
+	else
+		{
+		StringCchCopy(szDataFile, MAX_PATH, pItem->infoFile.cFileName);
+		szDataFile[1] = L'R';
+		}
+
+	PrintDeletedItem(pBin, pInfo, pItem->hasInfoFile ? &pItem->infoFile : NULL, pItem->hasDataFile ? &pItem->dataFile : NULL, szDataFile, lineBuffer);
+	delete[] pInfoData;
+	}
+
+void PrintInfo2Items(RecycleBin* pBin, RecycleItems* pItems, CharBuffer *lineBuffer)
+	{
+	uint32_t version = 0;
+	std::vector<Info2Record> records;
+
+	if (pItems->hasInfo2File && !ReadInfo2(pBin->pSource, pItems->info2File.cFileName, &version, &records))
+		{
+		fwprintf(stderr, L"%s: the INFO2 file could not all be read\n", pBin->szSid);
+		}
+
+	std::vector<bool> isMatched(pItems->dcFiles.size(), false);
+	for (size_t i = 0; i < records.size(); i++)
+		{
+		RecycleInfo info;
+		info.version = version;
+		info.deletedSize = records[i].size;
+		info.deletedTime = records[i].deletedTime;
+		info.fileName = records[i].path.c_str();
+		info.fileNameLength = (uint32_t)records[i].path.size();
+
+		// A removed item has no Dc file, even if a later item has the same index.
+		WIN32_FIND_DATA* pDataFile = NULL;
+		std::unordered_map<uint32_t, size_t>::iterator dcFile = pItems->dcFilesByIndex.find(records[i].index);
+		if (!records[i].isRemoved && (dcFile != pItems->dcFilesByIndex.end()))
+			{
+			pDataFile = &pItems->dcFiles[dcFile->second];
+			isMatched[dcFile->second] = true;
+			}
+
+		std::wstring dataFile = (pDataFile != NULL) ? std::wstring(pDataFile->cFileName) : GetInfo2DataFileName(&records[i]);
+
+		lineBuffer->SetPosition(0);
+		PrintDeletedItem(pBin, &info, &pItems->info2File, pDataFile, dataFile.c_str(), lineBuffer);
+		}
+
+	for (size_t i = 0; i < pItems->dcFiles.size(); i++)
+		{
+		if (!isMatched[i])
+			{
+			lineBuffer->SetPosition(0);
+			PrintDeletedItem(pBin, NULL, NULL, &pItems->dcFiles[i], pItems->dcFiles[i].cFileName, lineBuffer);
+			}
+		}
+	}
+
+void PrintDeletedItem(RecycleBin* pBin, RecycleInfo* pInfo, WIN32_FIND_DATA* pInfoFile, WIN32_FIND_DATA* pDataFile, const wchar_t* szDataFile, CharBuffer *lineBuffer)
+	{
+	// Items the filters rule out are skipped before their $R file is even looked at.
+	if ((filter != NULL) && !filter->MatchesItem(pInfo))
+		{
+		return;
+		}
+
+	RecycleRow row = {};
+	row.szSid = pBin->szSid;
+	row.szUser = pBin->szUser;
+	row.pInfo = pInfo;
+	row.szInfoFile = (pInfoFile != NULL) ? pInfoFile->cFileName : L"";
+	row.szFileName = szDataFile;
+	row.isItem = true;
+	SetDataFileAttributes(pDataFile, &row);
+
+	if ((progress != NULL) && !row.isMissing)
+		{
+		progress->AddEntry(row.isFolder ? 0 : row.size);
+		}
+
+	// The totals need the whole folder walked, whatever the filters.
+	bool matches = (filter == NULL) || filter->MatchesRow(&row);
+	bool walk = row.isFolder && ((filter == NULL) || rollup || filter->CouldMatchBelow(&row));
+
+	if (!matches && !walk)
+		{
+		return;
+		}
+
+	if (users != NULL)
+		{
+		lineBuffer->PrintF(L"%s,", row.szUser);
+		}
+	PrintRecycleInfo(lineBuffer, pInfo);
+
+	if (pInfoFile != NULL)
+		{
+		PrintFileDetails(lineBuffer, pInfoFile->cFileName, &pInfoFile->ftCreationTime, &pInfoFile->ftLastWriteTime, &pInfoFile->ftLastAccessTime);
+		}
+	else
+		{
+		lineBuffer->PrintF(L"Missing,,,,");
+		}
+
+	size_t pos = lineBuffer->GetPosition();
+	PrintDataFile(lineBuffer, &row);
+
+	if (row.isFolder)
+		{
+		// The folder's own columns are needed again for its totals row after the walk.
+		wchar_t* szFolderColumns = rollup ? _wcsdup(lineBuffer->buffer + pos) : NULL;
+
+		if (matches)
+			{
+			OutputRow(lineBuffer, &row);
+			}
+
+		// Everything before pos is repeated for all the files and folders under this folder.
+		// A folder that cannot hold a match is not walked (--rollup always walks it).
+		if (walk)
+			{
+			FolderTotals totals = { 0, 0, 0 };
+			lineBuffer->SetPosition(pos);
+			PrintFolder(pBin->pSource, szDataFile, lineBuffer, &row, &totals);
+
+			if (rollup)
+				{
+				if (matches)
+					{
+					lineBuffer->SetPosition(pos);
+					lineBuffer->PrintF(L"%s", szFolderColumns);
+					PrintFolderTotals(lineBuffer, &totals, pInfo);
+					row.isTotals = true;
+					OutputRow(lineBuffer, &row);
+					}
+				}
+			}
+		free(szFolderColumns);
+		}
+	else if (!IsKnownFile(pBin->pSource, szDataFile))
+		{
+		if (rollup && !row.isMissing)
+			{
+			FolderTotals totals = { 1, 0, row.size };
+			PrintFolderTotals(lineBuffer, &totals, pInfo);
+			}
+
+		OutputRow(lineBuffer, &row);
+		}
+	}
+
+void PrintRecycleInfo(CharBuffer *lineBuffer, RecycleInfo* pInfo)
+	{
+	if (pInfo != NULL)
+		{
+		lineBuffer->PrintF(L"%.*s,", (int)pInfo->fileNameLength, pInfo->fileName);
+		PrintFileTime(lineBuffer, &pInfo->deletedTime);
+		lineBuffer->PrintF(L"%lld,", pInfo->deletedSize);
+		}
+	else
+		{
+		// Empty columns keep the rest of the row in line with the header.
+		lineBuffer->PrintF(L",,,");
+		}
+	}
+
+void SetDataFileAttributes(WIN32_FIND_DATA* pffd, RecycleRow* pRow)
+	{
+	if (pffd == NULL)
+		{
+		pRow->isFolder = false;
+		pRow->isMissing = true;
+		pRow->size = 0;
+		return;
+		}
+
+	pRow->isFolder = (pffd->dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+	pRow->isMissing = false;
+	pRow->size = (((uint64_t)pffd->nFileSizeHigh) << 32) + pffd->nFileSizeLow;
+	pRow->created = pffd->ftCreationTime;
+	pRow->modified = pffd->ftLastWriteTime;
+	pRow->accessed = pffd->ftLastAccessTime;
+	}
+
+void PrintDataFile(CharBuffer *lineBuffer, RecycleRow* pRow)
+	{
+	if (pRow->isMissing)
+		{
+		lineBuffer->PrintF(L"Missing,,,,,");
+		return;
+		}
+
+	PrintFileDetails(lineBuffer, pRow->szFileName, &pRow->created, &pRow->modified, &pRow->accessed);
+	lineBuffer->PrintF(L"%lld,", pRow->size);
+	}
+
+void PrintFileDetails(CharBuffer *lineBuffer, const wchar_t* szFileName, FILETIME* pFileTimeCreated, FILETIME* pFileTimeModified, FILETIME* pFileTimeAccessed)
+	{
+	lineBuffer->PrintF(L"%s,", szFileName);
+	PrintFileTime(lineBuffer, pFileTimeCreated);
+	PrintFileTime(lineBuffer, pFileTimeModified);
+	PrintFileTime(lineBuffer, pFileTimeAccessed);
+	}
+
+
+void PrintFileTime(CharBuffer *lineBuffer, FILETIME *pFileTime, bool comma)
+	{
+	SYSTEMTIME utc;
+	FileTimeToSystemTime(pFileTime, &utc);
+
+	lineBuffer->PrintF(L"%4d-%02d-%02d %02d:%02d:%02d",
+		utc.wYear, utc.wMonth, utc.wDay, utc.wHour, utc.wMinute, utc.wSecond);
+
+	if (comma)
+		{
+		lineBuffer->PrintF(L",");
+		}
+	}
+
+void PrintFolderTotals(CharBuffer *lineBuffer, FolderTotals* pTotals, RecycleInfo* pInfo)
+	{
+	lineBuffer->PrintF(L"%lld,%lld,%lld,", pTotals->fileCount, pTotals->folderCount, pTotals->byteCount);
+
+	// Only the deleted item itself has a "Deleted Size" to check against.
+	if (pInfo != NULL)
+		{
+		lineBuffer->PrintF(L"%s,", (pInfo->deletedSize == pTotals->byteCount) ? L"No" : L"Yes");
+		}
+	else
+		{
+		lineBuffer->PrintF(L",");
+		}
+	}
+
+void PrintFolder(FileSource* pSource, const wchar_t* szFolder, CharBuffer *lineBuffer, RecycleRow* pItemRow, FolderTotals* pTotals)
+	{
+	TraceSpan span(L"Folder", szFolder);
+	FolderWalk walk = { pSource, pItemRow, pTotals };
+	ForeachFile(pSource, szFolder, L"*", PrintFileOrFolder, lineBuffer, &walk);
+	}
+
+void PrintFileOrFolder(const wchar_t * szRoot, WIN32_FIND_DATA* pffd, CharBuffer *lineBuffer, void* context)
+	{
+	FolderWalk* pWalk = (FolderWalk*)context;
+	FolderTotals* pTotals = pWalk->pTotals;
+	size_t initialPosition = lineBuffer->GetPosition();
+
+	CharBuffer* fileName = new CharBuffer(MAX_PATH);
+
+	fileName->PrintF(L"%s\\%s", szRoot, pffd->cFileName);
+
+	// Everything but the file itself is the same as for the deleted item.
+	RecycleRow row = *pWalk->pItemRow;
+	row.szFileName = fileName->buffer;
+	row.size = (((uint64_t)pffd->nFileSizeHigh) << 32) + pffd->nFileSizeLow;
+	row.created = pffd->ftCreationTime;
+	row.modified = pffd->ftLastWriteTime;
+	row.accessed = pffd->ftLastAccessTime;
+	row.isItem = false;
+	row.isFolder = (pffd->dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+	row.isMissing = false;
+
+	if (progress != NULL)
+		{
+		progress->AddEntry(row.isFolder ? 0 : row.size);
+		}
+
+	// Nothing is formatted for rows the filters rule out.
+	bool matches = (filter == NULL) || filter->MatchesRow(&row);
+
+	if (row.isFolder)
+		{
+		wchar_t* szFolderColumns = NULL;
+
+		if (matches)
+			{
+			PrintDataFile(lineBuffer, &row);
+			szFolderColumns = rollup ? _wcsdup(lineBuffer->buffer + initialPosition) : NULL;
+
+			OutputRow(lineBuffer, &row);
+			lineBuffer->SetPosition(initialPosition);
+			}
+
+		// Subfolders that cannot hold a match are not walked, unless the totals need them.
+		FolderTotals folderTotals = { 0, 0, 0 };
+		if ((filter == NULL) || rollup || filter->CouldMatchBelow(&row))
+			{
+			PrintFolder(pWalk->pSource, fileName->buffer, lineBuffer, pWalk->pItemRow, &folderTotals);
+			}
+
+		if (szFolderColumns != NULL)
+			{
+			lineBuffer->SetPosition(initialPosition);
+			lineBuffer->PrintF(L"%s", szFolderColumns);
+			PrintFolderTotals(lineBuffer, &folderTotals, NULL);
+			row.isTotals = true;
+			OutputRow(lineBuffer, &row);
+			free(szFolderColumns);
+			}
+
+		pTotals->fileCount += folderTotals.fileCount;
+		pTotals->folderCount += folderTotals.folderCount + 1;
+		pTotals->byteCount += folderTotals.byteCount;
+		}
+	else
+		{
+		// Known files are left out of the output but still count towards the totals.
+		if (matches && !IsKnownFile(pWalk->pSource, fileName->buffer))
+			{
+			PrintDataFile(lineBuffer, &row);
+			OutputRow(lineBuffer, &row);
+			}
+
+		pTotals->fileCount++;
+		pTotals->byteCount += row.size;
+		}
+
+	delete fileName;
+	}
+
+void OutputRow(CharBuffer *lineBuffer, RecycleRow* pRow)
+	{
+	if (summary != NULL)
+		{
+		if (!pRow->isTotals)
+			{
+			summary->AddRow(pRow);
+			}
+		}
+	else if (topK != NULL)
+		{
+		if (!pRow->isTotals)
+			{
+			topK->AddRow(pRow, lineBuffer->buffer);
+			}
+		}
+	else if (database != NULL)
+		{
+		if (!pRow->isTotals)
+			{
+			database->AddRow(pRow);
+			}
+		}
+	else if (pathIndexBuilder != NULL)
+		{
+		if (!pRow->isTotals)
+			{
+			pathIndexBuilder->AddRow(pRow);
+			}
+		}
+	else if (rowSorter != NULL)
+		{
+		rowSorter->AddRow(pRow, lineBuffer->buffer);
+		}
+	else
+		{
+		lineBuffer->PrintLine();
+		}
+	}
+
+const wchar_t* GetBinName(const wchar_t* szFolder, wchar_t* buffer, size_t size)
+	{
+	StringCchCopy(buffer, size, szFolder);
+
+	size_t length = wcslen(buffer);
+	while ((length > 0) && ((buffer[length - 1] == L'\\') || (buffer[length - 1] == L'/')))
+		{
+		buffer[--length] = L'\0';
+		}
+
+	size_t start = length;
+	while ((start > 0) && (buffer[start - 1] != L'\\') && (buffer[start - 1] != L'/') && (buffer[start - 1] != L':'))
+		{
+		start--;
+		}
+
+	memmove(buffer, buffer + start, (length - start + 1) * sizeof(wchar_t));
+	return buffer;
+	}
+
+bool IsKnownFile(FileSource* pSource, const wchar_t* szFileName)
+	{
+	return (knownHashes != NULL) && knownHashes->ContainsFile(pSource, szFileName);
 	}
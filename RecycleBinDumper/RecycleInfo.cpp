@@ -0,0 +1,112 @@
+// RecycleInfo.cpp
+//
+// Decoding of the $I recycle information files.
+
+#include "RecycleInfo.h"
+#include "RecycleRow.h"
+#include "stdio.h"
+#include "string.h"
+#include "wchar.h"
+
+bool DecodeRecycleInfo(const uint8_t* pData, size_t cbData, RecycleInfo* pInfo)
+	{
+	if (cbData < RECYCLE_INFO_V1_HEADER_SIZE)
+		{
+		return false;
+		}
+
+	memcpy(&pInfo->version, pData, sizeof(pInfo->version));
+	memcpy(&pInfo->deletedSize, pData + 8, sizeof(pInfo->deletedSize));
+	memcpy(&pInfo->deletedTime, pData + 16, sizeof(pInfo->deletedTime));
+
+	uint32_t fileNameSize = 0;
+	size_t offset = 0;
+
+	if (pInfo->version == 1)
+		{
+		fileNameSize = RECYCLE_INFO_V1_FILE_NAME_SIZE;
+		offset = RECYCLE_INFO_V1_HEADER_SIZE;
+		}
+	else
+		{
+		if (cbData < RECYCLE_INFO_V2_HEADER_SIZE)
+			{
+			return false;
+			}
+
+		memcpy(&fileNameSize, pData + 24, sizeof(fileNameSize));
+		offset = RECYCLE_INFO_V2_HEADER_SIZE;
+		}
+
+	if ((fileNameSize == 0) || ((cbData - offset) / sizeof(wchar_t) < fileNameSize))
+		{
+		return false;
+		}
+
+	// The name is null terminated (and padded with nulls in version 1) within its size.
+	pInfo->fileName = (const wchar_t*)(pData + offset);
+	pInfo->fileNameLength = (uint32_t)wcsnlen(pInfo->fileName, fileNameSize);
+
+	return true;
+	}
+
+// Destination of a $I file's contents while it is read.
+struct RecycleInfoBuffer
+	{
+	uint8_t* pBuffer;
+	size_t count;
+	};
+
+static bool CopyRecycleInfo(const uint8_t* pData, size_t cbData, void* context)
+	{
+	RecycleInfoBuffer* pInfoBuffer = (RecycleInfoBuffer*)context;
+	size_t count = MAX_RECYCLE_INFO_SIZE - pInfoBuffer->count;
+	if (cbData < count)
+		{
+		count = cbData;
+		}
+
+	memcpy(pInfoBuffer->pBuffer + pInfoBuffer->count, pData, count);
+	pInfoBuffer->count += count;
+
+	// Anything past the largest possible $I file is not needed.
+	return pInfoBuffer->count < MAX_RECYCLE_INFO_SIZE;
+	}
+
+size_t ReadRecycleInfoData(FileSource* pSource, const wchar_t* szFileName, uint8_t* pBuffer)
+	{
+	RecycleInfoBuffer infoBuffer = { pBuffer, 0 };
+	pSource->ReadFileData(szFileName, CopyRecycleInfo, &infoBuffer);
+	return infoBuffer.count;
+	}
+
+bool ReadRecycleInfo(FileSource* pSource, const wchar_t* szFileName, uint8_t* pBuffer, RecycleInfo* pInfo)
+	{
+	return DecodeRecycleInfo(pBuffer, ReadRecycleInfoData(pSource, szFileName, pBuffer), pInfo);
+	}
+
+size_t GetOriginalPath(RecycleRow* pRow, wchar_t* buffer, size_t size)
+	{
+	if (pRow->pInfo == NULL)
+		{
+		return 0;
+		}
+
+	// Everything after the $R name is the path below the deleted folder.
+	const wchar_t* szBelow = wcschr(pRow->szFileName, L'\\');
+	size_t belowLength = (szBelow != NULL) ? wcslen(szBelow) : 0;
+	size_t length = pRow->pInfo->fileNameLength + belowLength;
+	if (length + 1 > size)
+		{
+		return 0;
+		}
+
+	memcpy(buffer, pRow->pInfo->fileName, pRow->pInfo->fileNameLength * sizeof(wchar_t));
+	if (szBelow != NULL)
+		{
+		memcpy(buffer + pRow->pInfo->fileNameLength, szBelow, belowLength * sizeof(wchar_t));
+		}
+	buffer[length] = L'\0';
+
+	return length;
+	}
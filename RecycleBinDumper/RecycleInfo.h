@@ -0,0 +1,48 @@
+// RecycleInfo.h
+//
+// Decoding of the $I recycle information files (see RecycleBinDumper.cpp for the two versions
+// of the file format).
+//
+// The decoder works on bytes already in memory so the same code is used whether the $I file
+// was read from a folder or found some other way.
+
+#pragma once
+
+#include "windows.h"
+#include "cstdint"
+#include "FileSource.h"
+
+// Size of the fixed part of each version of the $I file.
+const size_t RECYCLE_INFO_V1_HEADER_SIZE = 24;
+const size_t RECYCLE_INFO_V2_HEADER_SIZE = 28;
+
+// Version 1 files always hold a MAX_PATH file name.
+const uint32_t RECYCLE_INFO_V1_FILE_NAME_SIZE = 520 / sizeof(wchar_t);
+
+// Largest file name a version 2 file can hold (the longest path Windows allows).
+const uint32_t RECYCLE_INFO_MAX_FILE_NAME_SIZE = 32768;
+
+// Largest possible $I file, the size of buffer to pass to ReadRecycleInfo().
+const size_t MAX_RECYCLE_INFO_SIZE = RECYCLE_INFO_V2_HEADER_SIZE + RECYCLE_INFO_MAX_FILE_NAME_SIZE * sizeof(wchar_t);
+
+struct RecycleInfo
+	{
+	uint64_t version;
+	uint64_t deletedSize;
+	FILETIME deletedTime;
+
+	// Points into the data that was decoded and is not null terminated.
+	const wchar_t* fileName;
+	uint32_t fileNameLength;
+	};
+
+// Decode the contents of a $I file.  Returns false if the data is too short for its version.
+bool DecodeRecycleInfo(const uint8_t* pData, size_t cbData, RecycleInfo* pInfo);
+
+// Read up to MAX_RECYCLE_INFO_SIZE bytes of a $I file into pBuffer.  Returns the number of
+// bytes read.
+size_t ReadRecycleInfoData(FileSource* pSource, const wchar_t* szFileName, uint8_t* pBuffer);
+
+// Read and decode a $I file.  pBuffer must be MAX_RECYCLE_INFO_SIZE bytes and holds the
+// file name pointed to by pInfo.
+bool ReadRecycleInfo(FileSource* pSource, const wchar_t* szFileName, uint8_t* pBuffer, RecycleInfo* pInfo);
@@ -0,0 +1,34 @@
+// RecycleRow.h
+//
+// What is known about a row of output.  The csv output only needs the text of each row, but
+// the modes that aggregate, filter or reorder rows need the values the text was made from.
+
+#pragma once
+
+#include "windows.h"
+#include "cstdint"
+#include "RecycleInfo.h"
+
+struct RecycleRow
+	{
+	const wchar_t* szSid;       // Name of the Recycle Bin folder, which is the SID of its user.
+	const wchar_t* szUser;      // User name for the SID, "" if it is not known.
+	RecycleInfo* pInfo;         // The deleted item's $I file contents, NULL if it could not be read.
+	const wchar_t* szInfoFile;  // Name of the $I file.
+	const wchar_t* szFileName;  // Path of this file or folder in the Recycle Bin, starting with the $R name.
+	uint64_t size;
+	FILETIME created;
+	FILETIME modified;
+	FILETIME accessed;
+	bool isItem;                // The deleted item itself rather than something inside a deleted folder.
+	bool isFolder;
+	bool isMissing;             // The $R file or folder does not exist.
+	bool isTotals;              // The --rollup totals row of this folder, output after its own row.
+	};
+
+// Path the row's file or folder had before it was deleted: the deleted item's original path
+// followed by the row's path below the $R folder.  Returns the length, 0 if it is not known.
+size_t GetOriginalPath(RecycleRow* pRow, wchar_t* buffer, size_t size);
+
+// Largest original path GetOriginalPath() produces.
+const size_t MAX_ORIGINAL_PATH = RECYCLE_INFO_MAX_FILE_NAME_SIZE + MAX_PATH;
@@ -0,0 +1,336 @@
+// RegistryHive.cpp
+//
+// Offline registry hive parser.
+
+#include "RegistryHive.h"
+#include "stdio.h"
+#include "string.h"
+#include "wchar.h"
+
+// Size of the base block at the start of the file, cell offsets are from its end.
+static const uint32_t HIVE_BASE_BLOCK_SIZE = 4096;
+
+// Offsets of the fields used from the base block and cells.
+static const uint32_t BASE_ROOT_CELL = 0x24;
+
+static const uint32_t KEY_SUBKEY_COUNT = 0x14;
+static const uint32_t KEY_SUBKEY_LIST = 0x1C;
+static const uint32_t KEY_VALUE_COUNT = 0x24;
+static const uint32_t KEY_VALUE_LIST = 0x28;
+static const uint32_t KEY_NAME_LENGTH = 0x48;
+static const uint32_t KEY_NAME = 0x4C;
+static const uint16_t KEY_COMPRESSED_NAME = 0x0020;
+
+static const uint32_t VALUE_NAME_LENGTH = 0x02;
+static const uint32_t VALUE_DATA_SIZE = 0x04;
+static const uint32_t VALUE_DATA = 0x08;
+static const uint32_t VALUE_TYPE = 0x0C;
+static const uint32_t VALUE_FLAGS = 0x10;
+static const uint32_t VALUE_NAME = 0x14;
+static const uint16_t VALUE_COMPRESSED_NAME = 0x0001;
+static const uint32_t VALUE_DATA_RESIDENT = 0x80000000;
+
+static const uint32_t NO_CELL = 0xFFFFFFFF;
+
+// A ri list of ri lists is not valid, but a damaged hive must not recurse forever.
+static const int MAX_LIST_DEPTH = 4;
+
+static uint16_t Read16(const uint8_t* p)
+	{
+	return (uint16_t)(p[0] | (p[1] << 8));
+	}
+
+static uint32_t Read32(const uint8_t* p)
+	{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+	}
+
+RegistryHive::RegistryHive()
+	{
+	this->pData = NULL;
+	this->cbData = 0;
+	}
+
+RegistryHive::~RegistryHive()
+	{
+	delete[] this->pData;
+	}
+
+bool RegistryHive::Open(const wchar_t* szFileName)
+	{
+	FILE* pFile;
+	if (_wfopen_s(&pFile, szFileName, L"rb") != 0)
+		{
+		return false;
+		}
+
+	fseek(pFile, 0, SEEK_END);
+	long size = ftell(pFile);
+	fseek(pFile, 0, SEEK_SET);
+
+	if (size < (long)HIVE_BASE_BLOCK_SIZE)
+		{
+		fclose(pFile);
+		return false;
+		}
+
+	delete[] this->pData;
+	this->pData = new uint8_t[size];
+	this->cbData = fread(this->pData, 1, size, pFile);
+	fclose(pFile);
+
+	return (this->cbData == (size_t)size) && (memcmp(this->pData, "regf", 4) == 0);
+	}
+
+const uint8_t* RegistryHive::GetCell(uint32_t offset, uint32_t cbMinimum, uint32_t* pcbCell)
+	{
+	// Compared by subtracting, as adding to an offset from the file could wrap around.
+	size_t cbCells = (this->cbData > HIVE_BASE_BLOCK_SIZE) ? this->cbData - HIVE_BASE_BLOCK_SIZE : 0;
+	if ((offset == NO_CELL) || (offset > cbCells) || (4 > cbCells - offset))
+		{
+		return NULL;
+		}
+
+	// The size is negative for cells in use, and includes the size field itself.
+	const uint8_t* pCell = this->pData + HIVE_BASE_BLOCK_SIZE + offset;
+	int32_t cellSize = (int32_t)Read32(pCell);
+	if (cellSize >= 0)
+		{
+		return NULL;
+		}
+
+	uint32_t cbCell = (uint32_t)(-(int64_t)cellSize) - 4;
+	if ((cbCell < cbMinimum) || (cbCell > cbCells - offset - 4))
+		{
+		return NULL;
+		}
+
+	if (pcbCell != NULL)
+		{
+		*pcbCell = cbCell;
+		}
+	return pCell + 4;
+	}
+
+size_t RegistryHive::GetName(const uint8_t* pName, uint32_t cbName, bool isCompressed, wchar_t* buffer, size_t size)
+	{
+	size_t length = isCompressed ? cbName : cbName / 2;
+	if (length + 1 > size)
+		{
+		length = size - 1;
+		}
+
+	for (size_t i = 0; i < length; i++)
+		{
+		buffer[i] = isCompressed ? (wchar_t)pName[i] : (wchar_t)Read16(pName + 2 * i);
+		}
+	buffer[length] = L'\0';
+
+	return length;
+	}
+
+uint32_t RegistryHive::GetRootKey()
+	{
+	uint32_t root = Read32(this->pData + BASE_ROOT_CELL);
+	const uint8_t* pKey = this->GetCell(root, KEY_NAME, NULL);
+
+	return ((pKey != NULL) && (memcmp(pKey, "nk", 2) == 0)) ? root : 0;
+	}
+
+size_t RegistryHive::GetKeyName(uint32_t key, wchar_t* buffer, size_t size)
+	{
+	uint32_t cbKey;
+	const uint8_t* pKey = this->GetCell(key, KEY_NAME, &cbKey);
+	if ((pKey == NULL) || (memcmp(pKey, "nk", 2) != 0))
+		{
+		buffer[0] = L'\0';
+		return 0;
+		}
+
+	uint32_t cbName = Read16(pKey + KEY_NAME_LENGTH);
+	if (KEY_NAME + cbName > cbKey)
+		{
+		cbName = cbKey - KEY_NAME;
+		}
+
+	bool isCompressed = (Read16(pKey + 2) & KEY_COMPRESSED_NAME) != 0;
+	return GetName(pKey + KEY_NAME, cbName, isCompressed, buffer, size);
+	}
+
+void RegistryHive::AddSubkeys(uint32_t list, std::vector<uint32_t>* pSubkeys, int depth)
+	{
+	uint32_t cbList;
+	const uint8_t* pList = this->GetCell(list, 4, &cbList);
+	if ((pList == NULL) || (depth > MAX_LIST_DEPTH))
+		{
+		return;
+		}
+
+	uint32_t count = Read16(pList + 2);
+
+	// lf and lh entries are an offset and a hash of the name, li and ri entries just an offset.
+	uint32_t entrySize;
+	if ((memcmp(pList, "lf", 2) == 0) || (memcmp(pList, "lh", 2) == 0))
+		{
+		entrySize = 8;
+		}
+	else if ((memcmp(pList, "li", 2) == 0) || (memcmp(pList, "ri", 2) == 0))
+		{
+		entrySize = 4;
+		}
+	else
+		{
+		return;
+		}
+
+	if (4 + count * entrySize > cbList)
+		{
+		count = (cbList - 4) / entrySize;
+		}
+
+	bool isIndexRoot = (memcmp(pList, "ri", 2) == 0);
+	for (uint32_t i = 0; i < count; i++)
+		{
+		uint32_t offset = Read32(pList + 4 + i * entrySize);
+		if (isIndexRoot)
+			{
+			this->AddSubkeys(offset, pSubkeys, depth + 1);
+			}
+		else
+			{
+			pSubkeys->push_back(offset);
+			}
+		}
+	}
+
+void RegistryHive::GetSubkeys(uint32_t key, std::vector<uint32_t>* pSubkeys)
+	{
+	pSubkeys->clear();
+
+	const uint8_t* pKey = this->GetCell(key, KEY_NAME, NULL);
+	if ((pKey == NULL) || (memcmp(pKey, "nk", 2) != 0) || (Read32(pKey + KEY_SUBKEY_COUNT) == 0))
+		{
+		return;
+		}
+
+	this->AddSubkeys(Read32(pKey + KEY_SUBKEY_LIST), pSubkeys, 0);
+	}
+
+uint32_t RegistryHive::FindKey(uint32_t key, const wchar_t* szPath)
+	{
+	std::vector<uint32_t> subkeys;
+	wchar_t szName[256];
+
+	while ((key != 0) && (*szPath != L'\0'))
+		{
+		const wchar_t* pEnd = wcschr(szPath, L'\\');
+		size_t length = (pEnd != NULL) ? (size_t)(pEnd - szPath) : wcslen(szPath);
+
+		this->GetSubkeys(key, &subkeys);
+		key = 0;
+
+		for (size_t i = 0; i < subkeys.size(); i++)
+			{
+			size_t nameLength = this->GetKeyName(subkeys[i], szName, 256);
+			if ((nameLength == length) && (_wcsnicmp(szName, szPath, length) == 0))
+				{
+				key = subkeys[i];
+				break;
+				}
+			}
+
+		szPath += length;
+		if (*szPath == L'\\')
+			{
+			szPath++;
+			}
+		}
+
+	return key;
+	}
+
+bool RegistryHive::GetValue(uint32_t key, const wchar_t* szName, uint32_t* pType, const uint8_t** ppData, uint32_t* pcbData)
+	{
+	const uint8_t* pKey = this->GetCell(key, KEY_NAME, NULL);
+	if ((pKey == NULL) || (memcmp(pKey, "nk", 2) != 0))
+		{
+		return false;
+		}
+
+	uint32_t count = Read32(pKey + KEY_VALUE_COUNT);
+	uint32_t cbList;
+	const uint8_t* pList = (count > 0) ? this->GetCell(Read32(pKey + KEY_VALUE_LIST), 0, &cbList) : NULL;
+	if (pList == NULL)
+		{
+		return false;
+		}
+
+	if (count > cbList / 4)
+		{
+		count = cbList / 4;
+		}
+
+	size_t length = wcslen(szName);
+	wchar_t szValueName[256];
+
+	for (uint32_t i = 0; i < count; i++)
+		{
+		uint32_t cbValue;
+		const uint8_t* pValue = this->GetCell(Read32(pList + 4 * i), VALUE_NAME, &cbValue);
+		if ((pValue == NULL) || (memcmp(pValue, "vk", 2) != 0))
+			{
+			continue;
+			}
+
+		uint32_t cbName = Read16(pValue + VALUE_NAME_LENGTH);
+		if (VALUE_NAME + cbName > cbValue)
+			{
+			continue;
+			}
+
+		bool isCompressed = (Read16(pValue + VALUE_FLAGS) & VALUE_COMPRESSED_NAME) != 0;
+		size_t nameLength = GetName(pValue + VALUE_NAME, cbName, isCompressed, szValueName, 256);
+		if ((nameLength != length) || (_wcsnicmp(szValueName, szName, length) != 0))
+			{
+			continue;
+			}
+
+		uint32_t cbValueData = Read32(pValue + VALUE_DATA_SIZE);
+		*pType = Read32(pValue + VALUE_TYPE);
+
+		// Small values are stored in the data offset field itself.
+		if ((cbValueData & VALUE_DATA_RESIDENT) != 0)
+			{
+			cbValueData &= ~VALUE_DATA_RESIDENT;
+			*ppData = pValue + VALUE_DATA;
+			*pcbData = (cbValueData <= 4) ? cbValueData : 4;
+			return true;
+			}
+
+		uint32_t cbCell;
+		const uint8_t* pValueData = (cbValueData > 0) ? this->GetCell(Read32(pValue + VALUE_DATA), 0, &cbCell) : NULL;
+		*ppData = pValueData;
+		*pcbData = (pValueData == NULL) ? 0 : ((cbValueData <= cbCell) ? cbValueData : cbCell);
+		return true;
+		}
+
+	return false;
+	}
+
+bool RegistryHive::GetStringValue(uint32_t key, const wchar_t* szName, wchar_t* buffer, size_t size)
+	{
+	uint32_t type;
+	const uint8_t* pValueData;
+	uint32_t cbValueData;
+
+	if (!this->GetValue(key, szName, &type, &pValueData, &cbValueData)
+		|| ((type != REG_SZ) && (type != REG_EXPAND_SZ)) || (pValueData == NULL))
+		{
+		return false;
+		}
+
+	// The stored string usually, but not always, includes its terminating null.
+	size_t length = GetName(pValueData, cbValueData, false, buffer, size);
+	buffer[wcsnlen(buffer, length)] = L'\0';
+	return true;
+	}
@@ -0,0 +1,62 @@
+// RegistryHive.h
+//
+// Read only parser for registry hive files (the "regf" format of SOFTWARE, SAM, NTUSER.DAT,
+// etc.) copied out of an image, so that keys and values can be read without loading the hive
+// into the registry of the machine doing the analysis (or without Windows at all).
+//
+// The whole file is read into memory.  After the 4096 byte base block the file is a series of
+// hive bins holding cells, and cells refer to each other by their offset from the end of the
+// base block.  The cells used here are:
+//
+//     nk  a key, with the offsets of its subkey list and value list.
+//     lf, lh, li  a list of subkeys; ri  a list of such lists.
+//     vk  a value, with its data stored in the offset field if it is 4 bytes or smaller.
+//
+// Keys are identified by the offset of their nk cell, 0 meaning "no key" (cell offsets are
+// never 0 since every hive bin starts with a header).  Every offset is checked against the
+// size of the file, so a damaged hive gives missing keys rather than a crash.
+
+#pragma once
+
+#include "windows.h"
+#include "cstdint"
+#include "cstddef"
+#include <vector>
+
+class RegistryHive
+	{
+	public:
+		RegistryHive();
+		~RegistryHive();
+
+		bool Open(const wchar_t* szFileName);
+
+		uint32_t GetRootKey();
+
+		// Find the key at the path (names separated by '\', case insensitive) below the key.
+		// Returns 0 if there is no such key.
+		uint32_t FindKey(uint32_t key, const wchar_t* szPath);
+
+		void GetSubkeys(uint32_t key, std::vector<uint32_t>* pSubkeys);
+
+		size_t GetKeyName(uint32_t key, wchar_t* buffer, size_t size);
+
+		// Find a value of the key ("" for its default value).  The data is not copied.
+		bool GetValue(uint32_t key, const wchar_t* szName, uint32_t* pType, const uint8_t** ppData, uint32_t* pcbData);
+
+		// Read a REG_SZ or REG_EXPAND_SZ value (UTF-16 in the hive) into the buffer.
+		bool GetStringValue(uint32_t key, const wchar_t* szName, wchar_t* buffer, size_t size);
+
+	protected:
+		// Returns the data of the cell at the offset, or NULL if it is not a valid cell of at
+		// least cbMinimum bytes.
+		const uint8_t* GetCell(uint32_t offset, uint32_t cbMinimum, uint32_t* pcbCell);
+
+		// Names of keys and values are either Latin-1 (compressed) or UTF-16.
+		static size_t GetName(const uint8_t* pName, uint32_t cbName, bool isCompressed, wchar_t* buffer, size_t size);
+
+		void AddSubkeys(uint32_t list, std::vector<uint32_t>* pSubkeys, int depth);
+
+		uint8_t* pData;
+		size_t cbData;
+	};
@@ -0,0 +1,351 @@
+// RowSorter.cpp
+//
+// External merge sort of the rows for the --sort mode.
+
+#include "RowSorter.h"
+#include "string.h"
+#include "wchar.h"
+#include "wctype.h"
+#include <algorithm>
+
+// Buffers of the run files, which are written and read sequentially.
+static const size_t WRITE_BUFFER_SIZE = 1024 * 1024;
+static const size_t READ_BUFFER_SIZE = 256 * 1024;
+
+RowSorter::RowSorter(SortKey key, size_t runSize, const wchar_t* szTempFolder)
+	{
+	this->keyType = key;
+	this->runSize = runSize;
+	this->sequence = 0;
+	this->path.resize(MAX_ORIGINAL_PATH);
+	this->isSpillFailed = false;
+	this->filling.data.reserve(runSize);
+
+	if (szTempFolder != NULL)
+		{
+		this->tempFolder.assign(szTempFolder);
+		}
+	else
+		{
+		wchar_t szTempPath[MAX_PATH];
+		DWORD length = GetTempPath(MAX_PATH, szTempPath);
+		this->tempFolder.assign(((length > 0) && (length < MAX_PATH)) ? szTempPath : L".");
+		}
+	}
+
+RowSorter::~RowSorter()
+	{
+	this->WaitForSpill();
+
+	for (size_t i = 0; i < this->runFiles.size(); i++)
+		{
+		DeleteFile(this->runFiles[i].c_str());
+		}
+	}
+
+size_t RowSorter::GetRecordSize(const Record* pRecord)
+	{
+	size_t size = sizeof(Record) + ((size_t)pRecord->pathLength + pRecord->lineLength) * sizeof(wchar_t);
+	return (size + 7) & ~(size_t)7;
+	}
+
+bool RowSorter::IsBefore(const Record* pLeft, const Record* pRight)
+	{
+	if (pLeft->key != pRight->key)
+		{
+		return pLeft->key < pRight->key;
+		}
+
+	// Only paths that start with the same 4 characters are compared in full.
+	if ((pLeft->pathLength != 0) || (pRight->pathLength != 0))
+		{
+		uint32_t length = (pLeft->pathLength < pRight->pathLength) ? pLeft->pathLength : pRight->pathLength;
+		int compared = wmemcmp((const wchar_t*)(pLeft + 1), (const wchar_t*)(pRight + 1), length);
+		if (compared != 0)
+			{
+			return compared < 0;
+			}
+
+		if (pLeft->pathLength != pRight->pathLength)
+			{
+			return pLeft->pathLength < pRight->pathLength;
+			}
+		}
+
+	return pLeft->sequence < pRight->sequence;
+	}
+
+void RowSorter::AddRow(RecycleRow* pRow, const wchar_t* szLine)
+	{
+	Record record = { 0, this->sequence++, 0, (uint32_t)wcslen(szLine) };
+
+	if (this->keyType == SORT_BY_DELETED_TIME)
+		{
+		if (pRow->pInfo != NULL)
+			{
+			record.key = (((uint64_t)pRow->pInfo->deletedTime.dwHighDateTime) << 32) + pRow->pInfo->deletedTime.dwLowDateTime;
+			}
+		}
+	else
+		{
+		wchar_t* pPath = this->path.data();
+		record.pathLength = (uint32_t)GetOriginalPath(pRow, pPath, MAX_ORIGINAL_PATH);
+
+		for (uint32_t i = 0; i < record.pathLength; i++)
+			{
+			pPath[i] = towupper(pPath[i]);
+			}
+
+		// Most comparisons are settled by the first 4 characters, without looking at the records.
+		for (uint32_t i = 0; i < 4; i++)
+			{
+			record.key = (record.key << 16) | ((i < record.pathLength) ? (uint16_t)pPath[i] : 0);
+			}
+		}
+
+	// A row bigger than a whole run is still added, to a run of its own.
+	size_t recordSize = GetRecordSize(&record);
+	if (!this->filling.offsets.empty() && (this->filling.data.size() + recordSize > this->runSize))
+		{
+		this->SpillRun();
+		}
+
+	size_t offset = this->filling.data.size();
+	this->filling.data.resize(offset + recordSize);
+	this->filling.offsets.push_back(offset);
+
+	uint8_t* pRecord = this->filling.data.data() + offset;
+	wchar_t* pText = (wchar_t*)(pRecord + sizeof(Record));
+	memcpy(pRecord, &record, sizeof(Record));
+	memcpy(pText, this->path.data(), record.pathLength * sizeof(wchar_t));
+	memcpy(pText + record.pathLength, szLine, record.lineLength * sizeof(wchar_t));
+	}
+
+void RowSorter::SortRun(Run* pRun)
+	{
+	const uint8_t* pData = pRun->data.data();
+	std::sort(pRun->offsets.begin(), pRun->offsets.end(), [pData](size_t left, size_t right)
+		{
+		return IsBefore((const Record*)(pData + left), (const Record*)(pData + right));
+		});
+	}
+
+void RowSorter::WriteRun(Run* pRun)
+	{
+	std::wstring fileName;
+	FILE* pFile;
+	if (!this->CreateRunFile(&fileName, &pFile))
+		{
+		this->isSpillFailed = true;
+		return;
+		}
+
+	bool written = true;
+	for (size_t i = 0; (i < pRun->offsets.size()) && written; i++)
+		{
+		const uint8_t* pRecord = pRun->data.data() + pRun->offsets[i];
+		size_t recordSize = GetRecordSize((const Record*)pRecord);
+		written = (fwrite(pRecord, 1, recordSize, pFile) == recordSize);
+		}
+
+	// The run file is merged with the rest even if it was cut short.
+	written = (fclose(pFile) == 0) && written;
+	this->runFiles.push_back(fileName);
+	if (!written)
+		{
+		this->isSpillFailed = true;
+		}
+	}
+
+void RowSorter::SpillRun()
+	{
+	this->WaitForSpill();
+
+	std::swap(this->filling, this->spilling);
+	this->filling.data.clear();
+	this->filling.offsets.clear();
+	this->filling.data.reserve(this->runSize);
+
+	this->spillThread = std::thread([this]
+		{
+		this->SortRun(&this->spilling);
+		this->WriteRun(&this->spilling);
+		});
+	}
+
+void RowSorter::WaitForSpill()
+	{
+	if (this->spillThread.joinable())
+		{
+		this->spillThread.join();
+		}
+	}
+
+bool RowSorter::CreateRunFile(std::wstring* pFileName, FILE** ppFile)
+	{
+	wchar_t szFileName[MAX_PATH];
+	if (GetTempFileName(this->tempFolder.c_str(), L"rbs", 0, szFileName) == 0)
+		{
+		return false;
+		}
+
+	if (_wfopen_s(ppFile, szFileName, L"wb") != 0)
+		{
+		DeleteFile(szFileName);
+		return false;
+		}
+
+	setvbuf(*ppFile, NULL, _IOFBF, WRITE_BUFFER_SIZE);
+	pFileName->assign(szFileName);
+	return true;
+	}
+
+bool RowSorter::ReadRecord(RunReader* pReader)
+	{
+	// Kept as uint64_t so the record is aligned.
+	pReader->record.resize(sizeof(Record) / sizeof(uint64_t));
+	if (fread(pReader->record.data(), 1, sizeof(Record), pReader->pFile) != sizeof(Record))
+		{
+		return false;
+		}
+
+	size_t recordSize = GetRecordSize((const Record*)pReader->record.data());
+	pReader->record.resize(recordSize / sizeof(uint64_t));
+
+	size_t rest = recordSize - sizeof(Record);
+	if (fread((uint8_t*)pReader->record.data() + sizeof(Record), 1, rest, pReader->pFile) != rest)
+		{
+		pReader->isFailed = true;
+		return false;
+		}
+
+	return true;
+	}
+
+void RowSorter::PrintRecord(const Record* pRecord)
+	{
+	wprintf(L"%.*s\n", (int)pRecord->lineLength, (const wchar_t*)(pRecord + 1) + pRecord->pathLength);
+	}
+
+bool RowSorter::MergeRuns(size_t first, size_t count, FILE* pOutput)
+	{
+	std::vector<RunReader> readers(count);
+	std::vector<size_t> heap;
+	bool merged = true;
+
+	for (size_t i = 0; i < count; i++)
+		{
+		readers[i].isFailed = false;
+		if (_wfopen_s(&readers[i].pFile, this->runFiles[first + i].c_str(), L"rb") != 0)
+			{
+			readers[i].pFile = NULL;
+			merged = false;
+			continue;
+			}
+		setvbuf(readers[i].pFile, NULL, _IOFBF, READ_BUFFER_SIZE);
+
+		if (ReadRecord(&readers[i]))
+			{
+			heap.push_back(i);
+			}
+		}
+
+	// The front of the heap is the reader with the first record.
+	std::vector<RunReader>* pReaders = &readers;
+	auto isAfter = [pReaders](size_t left, size_t right)
+		{
+		return IsBefore((const Record*)(*pReaders)[right].record.data(), (const Record*)(*pReaders)[left].record.data());
+		};
+	std::make_heap(heap.begin(), heap.end(), isAfter);
+
+	while (!heap.empty())
+		{
+		std::pop_heap(heap.begin(), heap.end(), isAfter);
+		RunReader* pReader = &readers[heap.back()];
+		const Record* pRecord = (const Record*)pReader->record.data();
+
+		if (pOutput == NULL)
+			{
+			PrintRecord(pRecord);
+			}
+		else if (fwrite(pRecord, 1, GetRecordSize(pRecord), pOutput) != GetRecordSize(pRecord))
+			{
+			merged = false;
+			break;
+			}
+
+		if (ReadRecord(pReader))
+			{
+			std::push_heap(heap.begin(), heap.end(), isAfter);
+			}
+		else
+			{
+			heap.pop_back();
+			}
+		}
+
+	for (size_t i = 0; i < count; i++)
+		{
+		if (readers[i].pFile != NULL)
+			{
+			merged = merged && !readers[i].isFailed && !ferror(readers[i].pFile);
+			fclose(readers[i].pFile);
+			}
+		}
+
+	return merged;
+	}
+
+bool RowSorter::Print(const wchar_t* szHeader)
+	{
+	this->WaitForSpill();
+	wprintf(L"%s\n", szHeader);
+
+	if (this->runFiles.empty() && !this->isSpillFailed)
+		{
+		this->SortRun(&this->filling);
+		for (size_t i = 0; i < this->filling.offsets.size(); i++)
+			{
+			PrintRecord((const Record*)(this->filling.data.data() + this->filling.offsets[i]));
+			}
+		return true;
+		}
+
+	// The last run is written out too, and merged with the rest.
+	if (!this->filling.offsets.empty())
+		{
+		this->SortRun(&this->filling);
+		this->WriteRun(&this->filling);
+		}
+	bool sorted = !this->isSpillFailed;
+
+	// Too many runs to merge at once are merged into bigger runs first.
+	while (sorted && (this->runFiles.size() > MAX_MERGE_RUNS))
+		{
+		std::wstring fileName;
+		FILE* pFile;
+		if (!this->CreateRunFile(&fileName, &pFile))
+			{
+			sorted = false;
+			break;
+			}
+
+		bool written = this->MergeRuns(0, MAX_MERGE_RUNS, pFile);
+		written = (fclose(pFile) == 0) && written;
+		if (!written)
+			{
+			DeleteFile(fileName.c_str());
+			sorted = false;
+			break;
+			}
+
+		for (size_t i = 0; i < MAX_MERGE_RUNS; i++)
+			{
+			DeleteFile(this->runFiles[i].c_str());
+			}
+		this->runFiles.erase(this->runFiles.begin(), this->runFiles.begin() + MAX_MERGE_RUNS);
+		this->runFiles.push_back(fileName);
+		}
+
+	return this->MergeRuns(0, this->runFiles.size(), NULL) && sorted;
+	}
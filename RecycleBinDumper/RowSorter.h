@@ -0,0 +1,101 @@
+// RowSorter.h
+//
+// The --sort mode: the rows are output sorted by deleted time or by original path, however
+// many there are, in the same single pass over the Recycle Bins.
+//
+// The rows are copied into a run of a fixed size, as binary records with their sort key.  When
+// a run is full it is handed to a thread of its own, which sorts it and writes it to a temporary
+// file while the next run is filled, so memory is two runs no matter how many rows there are.
+// At the end the runs are merged (MAX_MERGE_RUNS at a time, merging them into bigger runs first
+// if there are more) and the rows output in order.  If every row fits in the first run it is
+// simply sorted in memory and nothing is written to disk.
+//
+// Rows with the same key keep the order they were output in (the rows of a deleted folder stay
+// below the folder's row, for example), as every record also has its place in the dump.
+
+#pragma once
+
+#include "windows.h"
+#include "cstdint"
+#include "cstddef"
+#include "stdio.h"
+#include "RecycleRow.h"
+#include <string>
+#include <vector>
+#include <thread>
+
+enum SortKey
+	{
+	SORT_BY_DELETED_TIME,   // Time each item was deleted, oldest first (rows with no $I file first).
+	SORT_BY_PATH,           // Original path, case insensitive (rows with no $I file first).
+	};
+
+class RowSorter
+	{
+	public:
+		// runSize is the memory for each of the two runs.  The temporary files are written to
+		// szTempFolder, or to the user's temporary folder if it is NULL.
+		RowSorter(SortKey key, size_t runSize, const wchar_t* szTempFolder);
+		~RowSorter();
+
+		// szLine is the formatted csv row.  A --rollup totals row sorts with its folder's row.
+		void AddRow(RecycleRow* pRow, const wchar_t* szLine);
+
+		// Output the header and the rows in order.  Returns false if the runs could not all be
+		// written to or read back from the temporary files (the rows that could are output).
+		bool Print(const wchar_t* szHeader);
+
+	protected:
+		// Header of each record, followed by the path of SORT_BY_PATH (upper cased) and the
+		// line, with no terminators, and padded to a multiple of 8 bytes.
+		struct Record
+			{
+			uint64_t key;           // Deleted time, or the first 4 characters of the path.
+			uint64_t sequence;      // Order the row was output, so equal keys keep that order.
+			uint32_t pathLength;
+			uint32_t lineLength;
+			};
+
+		struct Run
+			{
+			std::vector<uint8_t> data;
+			std::vector<size_t> offsets;    // Of each record in data, sorted by SortRun().
+			};
+
+		// Reads the records of a run file back one at a time.
+		struct RunReader
+			{
+			FILE* pFile;
+			std::vector<uint64_t> record;   // The current record.
+			bool isFailed;                  // The file ended part way through a record.
+			};
+
+		// Merges at most this many runs at once, to keep the files open and their buffers
+		// within limits.
+		static const size_t MAX_MERGE_RUNS = 256;
+
+		static size_t GetRecordSize(const Record* pRecord);
+		static bool IsBefore(const Record* pLeft, const Record* pRight);
+		static bool ReadRecord(RunReader* pReader);
+		static void PrintRecord(const Record* pRecord);
+
+		void SortRun(Run* pRun);
+		void WriteRun(Run* pRun);
+		void SpillRun();
+		void WaitForSpill();
+
+		// Merge runs [first, first + count) into pOutput, or output their rows if it is NULL.
+		bool MergeRuns(size_t first, size_t count, FILE* pOutput);
+		bool CreateRunFile(std::wstring* pFileName, FILE** ppFile);
+
+		SortKey keyType;
+		size_t runSize;
+		std::wstring tempFolder;
+		uint64_t sequence;
+		std::vector<wchar_t> path;
+		Run filling;
+		Run spilling;
+		std::thread spillThread;
+		bool isSpillFailed;
+		std::vector<std::wstring> runFiles;
+	};
@@ -0,0 +1,222 @@
+// Sketches.cpp
+//
+// HyperLogLog distinct count estimation and merging t-digest quantile estimation.
+
+#include "Sketches.h"
+#include "string.h"
+#include "math.h"
+#include <algorithm>
+
+static const double PI = 3.14159265358979323846;
+
+uint64_t HashString(const wchar_t* s, size_t length)
+	{
+	// FNV-1a, which is fast but poorly mixed in the high bits ...
+	uint64_t hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < length; i++)
+		{
+		wchar_t c = s[i];
+		if ((c >= L'a') && (c <= L'z'))
+			{
+			c = c - L'a' + L'A';
+			}
+
+		hash ^= (uint64_t)c;
+		hash *= 1099511628211ULL;
+		}
+
+	// ... so finish with the MurmurHash3 finalizer.
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdULL;
+	hash ^= hash >> 33;
+	hash *= 0xc4ceb9fe1a85ec53ULL;
+	hash ^= hash >> 33;
+
+	return hash;
+	}
+
+HyperLogLog::HyperLogLog()
+	{
+	memset(this->registers, 0, sizeof(this->registers));
+	}
+
+void HyperLogLog::Add(uint64_t hash)
+	{
+	uint32_t index = (uint32_t)(hash >> (64 - PRECISION));
+
+	// The rank is the position of the first 1 bit in the remaining bits.  The guard bit
+	// limits it to 64 - PRECISION + 1.
+	uint64_t remaining = (hash << PRECISION) | ((uint64_t)1 << (PRECISION - 1));
+	uint8_t rank = 1;
+	while ((remaining & ((uint64_t)1 << 63)) == 0)
+		{
+		remaining <<= 1;
+		rank++;
+		}
+
+	if (rank > this->registers[index])
+		{
+		this->registers[index] = rank;
+		}
+	}
+
+double HyperLogLog::Estimate()
+	{
+	double sum = 0;
+	int zeros = 0;
+	for (int i = 0; i < REGISTER_COUNT; i++)
+		{
+		sum += ldexp(1.0, -this->registers[i]);
+		if (this->registers[i] == 0)
+			{
+			zeros++;
+			}
+		}
+
+	double m = REGISTER_COUNT;
+	double alpha = 0.7213 / (1 + 1.079 / m);
+	double estimate = alpha * m * m / sum;
+
+	// Linear counting is more accurate while many registers are still empty.
+	if ((estimate <= 2.5 * m) && (zeros > 0))
+		{
+		estimate = m * log(m / zeros);
+		}
+
+	return estimate;
+	}
+
+TDigest::TDigest(double compression)
+	{
+	this->compression = compression;
+	this->count = 0;
+	this->min = 0;
+	this->max = 0;
+
+	// The merged digest never holds more than about compression centroids, and buffering
+	// several times that many values amortizes the sort in Merge().
+	this->bufferCapacity = (size_t)(compression * 5);
+	this->centroids.reserve((size_t)(compression * 2) + this->bufferCapacity);
+	this->buffer.reserve(this->bufferCapacity);
+	}
+
+void TDigest::Add(double value)
+	{
+	if ((this->count == 0) || (value < this->min))
+		{
+		this->min = value;
+		}
+
+	if ((this->count == 0) || (value > this->max))
+		{
+		this->max = value;
+		}
+
+	this->count++;
+
+	Centroid centroid = { value, 1 };
+	this->buffer.push_back(centroid);
+	if (this->buffer.size() >= this->bufferCapacity)
+		{
+		this->Merge();
+		}
+	}
+
+void TDigest::Merge()
+	{
+	if (this->buffer.empty())
+		{
+		return;
+		}
+
+	this->centroids.insert(this->centroids.end(), this->buffer.begin(), this->buffer.end());
+	this->buffer.clear();
+	std::sort(this->centroids.begin(), this->centroids.end());
+
+	double total = 0;
+	for (size_t i = 0; i < this->centroids.size(); i++)
+		{
+		total += this->centroids[i].weight;
+		}
+
+	// Merge neighbouring centroids as long as the result stays within one unit of the
+	// k1 scale function k(q) = compression / (2 pi) * asin(2q - 1), which allows large
+	// centroids in the middle of the distribution but keeps them small in the tails.
+	double scale = this->compression / (2 * PI);
+	double weightSoFar = 0;
+	double kLimit = scale * asin(-1.0) + 1;
+	double qLimit = (kLimit >= scale * PI / 2) ? 1 : (sin(kLimit / scale) + 1) / 2;
+
+	size_t last = 0;
+	for (size_t i = 1; i < this->centroids.size(); i++)
+		{
+		Centroid& merged = this->centroids[last];
+		Centroid& next = this->centroids[i];
+		double proposed = merged.weight + next.weight;
+
+		if ((weightSoFar + proposed) / total <= qLimit)
+			{
+			merged.mean += (next.mean - merged.mean) * next.weight / proposed;
+			merged.weight = proposed;
+			}
+		else
+			{
+			weightSoFar += merged.weight;
+			kLimit = scale * asin(2 * weightSoFar / total - 1) + 1;
+			qLimit = (kLimit >= scale * PI / 2) ? 1 : (sin(kLimit / scale) + 1) / 2;
+
+			this->centroids[++last] = next;
+			}
+		}
+
+	this->centroids.resize(last + 1);
+	}
+
+double TDigest::Quantile(double q)
+	{
+	this->Merge();
+
+	if (this->centroids.empty())
+		{
+		return 0;
+		}
+
+	if (this->centroids.size() == 1)
+		{
+		return this->centroids[0].mean;
+		}
+
+	double total = (double)this->count;
+	double index = q * total;
+
+	// Interpolate between the centres of neighbouring centroids, and between the extreme
+	// centroids and the exact minimum and maximum.
+	double cumulative = this->centroids[0].weight / 2;
+	if (index <= cumulative)
+		{
+		return this->min + (this->centroids[0].mean - this->min) * index / cumulative;
+		}
+
+	for (size_t i = 0; i + 1 < this->centroids.size(); i++)
+		{
+		const Centroid& left = this->centroids[i];
+		const Centroid& right = this->centroids[i + 1];
+		double next = cumulative + (left.weight + right.weight) / 2;
+
+		if (index <= next)
+			{
+			return left.mean + (right.mean - left.mean) * (index - cumulative) / (next - cumulative);
+			}
+
+		cumulative = next;
+		}
+
+	const Centroid& last = this->centroids.back();
+	double tail = total - cumulative;
+	if (tail <= 0)
+		{
+		return this->max;
+		}
+
+	return last.mean + (this->max - last.mean) * std::min(1.0, (index - cumulative) / tail);
+	}
@@ -0,0 +1,77 @@
+// Sketches.h
+//
+// Fixed size summaries of unbounded streams of values, used by the --summary mode so that a
+// Recycle Bin of any size is summarized in the same amount of memory.
+//
+//   HyperLogLog - estimates the number of distinct values (e.g. distinct original paths) to
+//                 within about 1% using 16 KB.
+//   TDigest     - estimates quantiles (e.g. the median file size), most accurately near the
+//                 extremes, using a few hundred centroids.
+
+#pragma once
+
+#include "cstdint"
+#include "cstddef"
+#include <vector>
+
+// Case insensitive (for ASCII letters) 64 bit hash of a string, suitable for the sketches
+// and hash tables which rely on every bit of the hash being well mixed.
+uint64_t HashString(const wchar_t* s, size_t length);
+
+class HyperLogLog
+	{
+	public:
+		HyperLogLog();
+
+		void Add(uint64_t hash);
+
+		double Estimate();
+
+	protected:
+		// 2^14 registers gives a standard error of 1.04 / sqrt(2^14), i.e. about 0.8%.
+		static const int PRECISION = 14;
+		static const int REGISTER_COUNT = 1 << PRECISION;
+
+		uint8_t registers[REGISTER_COUNT];
+	};
+
+class TDigest
+	{
+	public:
+		// Higher compression keeps more centroids and gives more accurate quantiles.
+		TDigest(double compression = 200);
+
+		void Add(double value);
+
+		// Estimate the value at quantile q (0 to 1).
+		double Quantile(double q);
+
+		uint64_t GetCount()
+			{
+			return this->count;
+			}
+
+	protected:
+		struct Centroid
+			{
+			double mean;
+			double weight;
+
+			bool operator<(const Centroid& other) const
+				{
+				return this->mean < other.mean;
+				}
+			};
+
+		// Fold the buffered values into the centroids.
+		void Merge();
+
+		double compression;
+		uint64_t count;
+		double min;
+		double max;
+
+		std::vector<Centroid> centroids;
+		std::vector<Centroid> buffer;
+		size_t bufferCapacity;
+	};
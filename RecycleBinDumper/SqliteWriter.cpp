@@ -0,0 +1,616 @@
+// SqliteWriter.cpp
+//
+// Writes the rows to a SQLite database file, in the format described at
+// https://www.sqlite.org/fileformat.html.
+
+#include "SqliteWriter.h"
+#include "string.h"
+#include "wchar.h"
+
+static const size_t PAGE_SIZE = SqliteWriter::PAGE_SIZE;
+
+static const size_t FILE_HEADER_SIZE = 100;
+static const size_t LEAF_HEADER_SIZE = 8;
+static const size_t INTERIOR_HEADER_SIZE = 12;
+
+static const uint8_t PAGE_TABLE_INTERIOR = 0x05;
+static const uint8_t PAGE_TABLE_LEAF = 0x0D;
+
+// The largest payload kept entirely on a table leaf page, and the least kept on the page of one
+// that is larger (the rest is on overflow pages, each of which starts with the next one's number).
+static const size_t MAX_LOCAL = PAGE_SIZE - 35;
+static const size_t MIN_LOCAL = (PAGE_SIZE - 12) * 32 / 255 - 23;
+static const size_t OVERFLOW_SIZE = PAGE_SIZE - 4;
+
+// Each cell of an interior page is a 4 byte page number and a varint rowid (at most 9 bytes),
+// with a 2 byte pointer to it.
+static const size_t MAX_INTERIOR_CELLS = (PAGE_SIZE - INTERIOR_HEADER_SIZE) / (2 + 4 + 9);
+
+// The SQLite version the database is compatible with, as recorded in its header.
+static const uint32_t SQLITE_VERSION = 3037000;
+static const uint32_t TEXT_UTF16LE = 2;
+
+static const size_t TABLE_COUNT = 3;
+static const wchar_t* const TABLE_NAMES[TABLE_COUNT] = { L"bins", L"items", L"files" };
+static const wchar_t* const TABLE_SQL[TABLE_COUNT] =
+	{
+	L"CREATE TABLE bins(id INTEGER PRIMARY KEY, sid TEXT, user TEXT)",
+	L"CREATE TABLE items(id INTEGER PRIMARY KEY, bin_id INTEGER REFERENCES bins(id), info_file TEXT, "
+		L"version INTEGER, original_path TEXT, deleted_time TEXT, deleted_size INTEGER, data_file TEXT, "
+		L"is_folder INTEGER, is_missing INTEGER, size INTEGER, created TEXT, modified TEXT, accessed TEXT)",
+	L"CREATE TABLE files(id INTEGER PRIMARY KEY, item_id INTEGER REFERENCES items(id), path TEXT, "
+		L"original_path TEXT, is_folder INTEGER, size INTEGER, created TEXT, modified TEXT, accessed TEXT)",
+	};
+
+// Numbers in the file are big endian.
+static void Put16(uint8_t* p, uint16_t value)
+	{
+	p[0] = (uint8_t)(value >> 8);
+	p[1] = (uint8_t)value;
+	}
+
+static void Put32(uint8_t* p, uint32_t value)
+	{
+	p[0] = (uint8_t)(value >> 24);
+	p[1] = (uint8_t)(value >> 16);
+	p[2] = (uint8_t)(value >> 8);
+	p[3] = (uint8_t)value;
+	}
+
+// SQLite's varints are 7 bits a byte, most significant first, except that a 9th byte holds 8.
+// Returns the length.
+static size_t PutVarint(uint8_t* p, uint64_t value)
+	{
+	if (value > 0x00FFFFFFFFFFFFFFULL)
+		{
+		p[8] = (uint8_t)value;
+		value >>= 8;
+		for (int i = 7; i >= 0; i--)
+			{
+			p[i] = (uint8_t)((value & 0x7F) | 0x80);
+			value >>= 7;
+			}
+		return 9;
+		}
+
+	uint8_t reversed[8];
+	size_t length = 0;
+	do
+		{
+		reversed[length++] = (uint8_t)((value & 0x7F) | 0x80);
+		value >>= 7;
+		}
+	while (value != 0);
+	reversed[0] &= 0x7F;
+
+	for (size_t i = 0; i < length; i++)
+		{
+		p[i] = reversed[length - 1 - i];
+		}
+	return length;
+	}
+
+static void AppendVarint(std::vector<uint8_t>* pBytes, uint64_t value)
+	{
+	uint8_t varint[9];
+	pBytes->insert(pBytes->end(), varint, varint + PutVarint(varint, value));
+	}
+
+void SqliteRecord::Clear()
+	{
+	this->types.clear();
+	this->values.clear();
+	}
+
+void SqliteRecord::AddNull()
+	{
+	this->types.push_back(0);
+	}
+
+void SqliteRecord::AddInteger(int64_t value)
+	{
+	// 0 and 1 have serial types of their own, with no bytes in the values.
+	if ((value == 0) || (value == 1))
+		{
+		this->types.push_back((uint8_t)(8 + value));
+		return;
+		}
+
+	uint8_t type;
+	size_t size;
+	if ((value >= -128) && (value <= 127))
+		{
+		type = 1;
+		size = 1;
+		}
+	else if ((value >= -32768) && (value <= 32767))
+		{
+		type = 2;
+		size = 2;
+		}
+	else if ((value >= -8388608) && (value <= 8388607))
+		{
+		type = 3;
+		size = 3;
+		}
+	else if ((value >= -2147483648LL) && (value <= 2147483647LL))
+		{
+		type = 4;
+		size = 4;
+		}
+	else if ((value >= -140737488355328LL) && (value <= 140737488355327LL))
+		{
+		type = 5;
+		size = 6;
+		}
+	else
+		{
+		type = 6;
+		size = 8;
+		}
+
+	this->types.push_back(type);
+	for (size_t i = size; i > 0; i--)
+		{
+		this->values.push_back((uint8_t)((uint64_t)value >> (8 * (i - 1))));
+		}
+	}
+
+void SqliteRecord::AddText(const wchar_t* text, size_t length)
+	{
+	// The database's text is UTF-16, as the strings already are.  The serial type has the
+	// length in bytes.
+	AppendVarint(&this->types, length * 2 * 2 + 13);
+	for (size_t i = 0; i < length; i++)
+		{
+		this->values.push_back((uint8_t)text[i]);
+		this->values.push_back((uint8_t)((uint16_t)text[i] >> 8));
+		}
+	}
+
+void SqliteRecord::AddTime(const FILETIME* pTime)
+	{
+	SYSTEMTIME utc;
+	FileTimeToSystemTime(pTime, &utc);
+
+	wchar_t szTime[32];
+	swprintf_s(szTime, 32, L"%4d-%02d-%02d %02d:%02d:%02d", utc.wYear, utc.wMonth, utc.wDay, utc.wHour, utc.wMinute, utc.wSecond);
+	this->AddText(szTime, wcslen(szTime));
+	}
+
+const uint8_t* SqliteRecord::GetPayload(size_t* pcbPayload)
+	{
+	// The header's size includes the varint it is stored in.
+	uint8_t varint[9];
+	size_t headerSize = this->types.size() + 1;
+	while (PutVarint(varint, headerSize) + this->types.size() > headerSize)
+		{
+		headerSize++;
+		}
+
+	this->payload.clear();
+	AppendVarint(&this->payload, headerSize);
+	this->payload.insert(this->payload.end(), this->types.begin(), this->types.end());
+	this->payload.insert(this->payload.end(), this->values.begin(), this->values.end());
+
+	*pcbPayload = this->payload.size();
+	return this->payload.data();
+	}
+
+SqliteTableTree::SqliteTableTree(SqliteWriter* pWriter)
+	{
+	this->pWriter = pWriter;
+	this->lastRowid = 0;
+	}
+
+bool SqliteTableTree::Append(int64_t rowid, const uint8_t* pPayload, size_t cbPayload)
+	{
+	// What is not kept on the leaf page goes on overflow pages, written before it.
+	size_t local = cbPayload;
+	uint32_t firstOverflow = 0;
+	if (cbPayload > MAX_LOCAL)
+		{
+		local = MIN_LOCAL + (cbPayload - MIN_LOCAL) % OVERFLOW_SIZE;
+		if (local > MAX_LOCAL)
+			{
+			local = MIN_LOCAL;
+			}
+
+		uint8_t page[PAGE_SIZE];
+		firstOverflow = this->pWriter->GetNextPage();
+		for (size_t offset = local; offset < cbPayload; offset += OVERFLOW_SIZE)
+			{
+			size_t size = (cbPayload - offset < OVERFLOW_SIZE) ? cbPayload - offset : OVERFLOW_SIZE;
+			Put32(page, (offset + size < cbPayload) ? SqliteWriter::GetPageAfter(this->pWriter->GetNextPage()) : 0);
+			memcpy(page + 4, pPayload + offset, size);
+			memset(page + 4 + size, 0, OVERFLOW_SIZE - size);
+
+			if (this->pWriter->WritePage(page) == 0)
+				{
+				return false;
+				}
+			}
+		}
+
+	uint8_t prefix[18];
+	size_t prefixSize = PutVarint(prefix, cbPayload);
+	prefixSize += PutVarint(prefix + prefixSize, (uint64_t)rowid);
+	size_t cellSize = prefixSize + local + ((firstOverflow != 0) ? 4 : 0);
+
+	size_t pageUsed = LEAF_HEADER_SIZE + 2 * (this->cellSizes.size() + 1) + this->cells.size() + cellSize;
+	if (!this->cellSizes.empty() && (pageUsed > PAGE_SIZE) && !this->WriteLeaf())
+		{
+		return false;
+		}
+
+	this->cells.insert(this->cells.end(), prefix, prefix + prefixSize);
+	this->cells.insert(this->cells.end(), pPayload, pPayload + local);
+	if (firstOverflow != 0)
+		{
+		uint8_t overflow[4];
+		Put32(overflow, firstOverflow);
+		this->cells.insert(this->cells.end(), overflow, overflow + 4);
+		}
+
+	this->cellSizes.push_back((uint16_t)cellSize);
+	this->lastRowid = rowid;
+	return true;
+	}
+
+bool SqliteTableTree::WriteLeaf()
+	{
+	uint8_t page[PAGE_SIZE] = {};
+	size_t contentStart = PAGE_SIZE - this->cells.size();
+	page[0] = PAGE_TABLE_LEAF;
+	Put16(page + 3, (uint16_t)this->cellSizes.size());
+	Put16(page + 5, (uint16_t)contentStart);
+	memcpy(page + contentStart, this->cells.data(), this->cells.size());
+
+	size_t offset = contentStart;
+	for (size_t i = 0; i < this->cellSizes.size(); i++)
+		{
+		Put16(page + LEAF_HEADER_SIZE + 2 * i, (uint16_t)offset);
+		offset += this->cellSizes[i];
+		}
+
+	uint32_t number = this->pWriter->WritePage(page);
+	if (number == 0)
+		{
+		return false;
+		}
+
+	this->cells.clear();
+	this->cellSizes.clear();
+
+	Child child = { number, this->lastRowid };
+	return this->AddChild(0, child);
+	}
+
+bool SqliteTableTree::AddChild(size_t level, Child child)
+	{
+	if (this->levels.size() <= level)
+		{
+		this->levels.resize(level + 1);
+		}
+	this->levels[level].push_back(child);
+
+	// A page is only written once there are enough children for the next one, so that at the
+	// end no page of a level is left with a single child.
+	std::vector<Child>* pChildren = &this->levels[level];
+	if (pChildren->size() < 2 * (MAX_INTERIOR_CELLS + 1))
+		{
+		return true;
+		}
+
+	std::vector<Child> full(pChildren->begin(), pChildren->begin() + MAX_INTERIOR_CELLS + 1);
+	pChildren->erase(pChildren->begin(), pChildren->begin() + MAX_INTERIOR_CELLS + 1);
+	return this->WriteInterior(level, full.data(), full.size());
+	}
+
+bool SqliteTableTree::WriteInterior(size_t level, const Child* pChildren, size_t count)
+	{
+	// The last child is the page's right-most pointer, with no cell.
+	uint8_t page[PAGE_SIZE] = {};
+	page[0] = PAGE_TABLE_INTERIOR;
+	Put16(page + 3, (uint16_t)(count - 1));
+	Put32(page + 8, pChildren[count - 1].page);
+
+	size_t offset = PAGE_SIZE;
+	for (size_t i = 0; i + 1 < count; i++)
+		{
+		uint8_t cell[4 + 9];
+		Put32(cell, pChildren[i].page);
+		size_t cellSize = 4 + PutVarint(cell + 4, (uint64_t)pChildren[i].lastRowid);
+
+		offset -= cellSize;
+		memcpy(page + offset, cell, cellSize);
+		Put16(page + INTERIOR_HEADER_SIZE + 2 * i, (uint16_t)offset);
+		}
+	Put16(page + 5, (uint16_t)offset);
+
+	uint32_t number = this->pWriter->WritePage(page);
+	if (number == 0)
+		{
+		return false;
+		}
+
+	Child parent = { number, pChildren[count - 1].lastRowid };
+	return this->AddChild(level + 1, parent);
+	}
+
+uint32_t SqliteTableTree::Finish()
+	{
+	// The last leaf, which is empty (and the root) only if the table is.
+	if (!this->WriteLeaf())
+		{
+		return 0;
+		}
+
+	for (size_t level = 0; level < this->levels.size(); level++)
+		{
+		std::vector<Child> children;
+		children.swap(this->levels[level]);
+
+		if ((level + 1 == this->levels.size()) && (children.size() == 1))
+			{
+			return children[0].page;
+			}
+
+		// Children that do not fit on one page are split evenly between two.
+		size_t first = (children.size() > MAX_INTERIOR_CELLS + 1) ? children.size() / 2 : children.size();
+		if (!this->WriteInterior(level, children.data(), first))
+			{
+			return 0;
+			}
+
+		if ((first < children.size()) && !this->WriteInterior(level, children.data() + first, children.size() - first))
+			{
+			return 0;
+			}
+		}
+
+	return 0;
+	}
+
+SqliteWriter::SqliteWriter()
+	: bins(this), items(this), files(this)
+	{
+	this->pFile = NULL;
+	this->pageCount = 0;
+	this->isFailed = false;
+	this->binCount = 0;
+	this->itemCount = 0;
+	this->fileCount = 0;
+	this->path.resize(MAX_ORIGINAL_PATH);
+	}
+
+SqliteWriter::~SqliteWriter()
+	{
+	if (this->pFile != NULL)
+		{
+		fclose(this->pFile);
+		}
+	}
+
+bool SqliteWriter::Create(const wchar_t* szFileName)
+	{
+	if (_wfopen_s(&this->pFile, szFileName, L"wb") != 0)
+		{
+		this->pFile = NULL;
+		return false;
+		}
+	setvbuf(this->pFile, NULL, _IOFBF, 1024 * 1024);
+
+	// Page 1 has the file header and the schema, which are written once the tables are.
+	uint8_t page[PAGE_SIZE] = {};
+	return this->WritePage(page) == 1;
+	}
+
+uint32_t SqliteWriter::WritePage(const uint8_t* pPage)
+	{
+	if (this->pageCount + 1 == PENDING_BYTE_PAGE)
+		{
+		static const uint8_t zeroPage[PAGE_SIZE] = {};
+		if (this->isFailed || (fwrite(zeroPage, 1, PAGE_SIZE, this->pFile) != PAGE_SIZE))
+			{
+			this->isFailed = true;
+			return 0;
+			}
+		this->pageCount++;
+		}
+
+	if (this->isFailed || (fwrite(pPage, 1, PAGE_SIZE, this->pFile) != PAGE_SIZE))
+		{
+		this->isFailed = true;
+		return 0;
+		}
+
+	return ++this->pageCount;
+	}
+
+void SqliteWriter::AddBin(const wchar_t* szSid, const wchar_t* szUser)
+	{
+	this->record.Clear();
+	this->record.AddNull();
+	this->record.AddText(szSid, wcslen(szSid));
+	if ((szUser != NULL) && (szUser[0] != L'\0'))
+		{
+		this->record.AddText(szUser, wcslen(szUser));
+		}
+	else
+		{
+		this->record.AddNull();
+		}
+
+	size_t cbPayload;
+	const uint8_t* pPayload = this->record.GetPayload(&cbPayload);
+	if (!this->bins.Append(++this->binCount, pPayload, cbPayload))
+		{
+		this->isFailed = true;
+		}
+	this->itemDataFile.clear();
+	}
+
+void SqliteWriter::AddRow(RecycleRow* pRow)
+	{
+	// The id column is the rowid, which is not stored again in the record.
+	this->record.Clear();
+	this->record.AddNull();
+
+	if (pRow->isItem)
+		{
+		this->itemDataFile.assign(pRow->szFileName);
+
+		this->record.AddInteger(this->binCount);
+		if (pRow->szInfoFile[0] != L'\0')
+			{
+			this->record.AddText(pRow->szInfoFile, wcslen(pRow->szInfoFile));
+			}
+		else
+			{
+			this->record.AddNull();
+			}
+
+		if (pRow->pInfo != NULL)
+			{
+			this->record.AddInteger((int64_t)pRow->pInfo->version);
+			this->record.AddText(pRow->pInfo->fileName, pRow->pInfo->fileNameLength);
+			this->record.AddTime(&pRow->pInfo->deletedTime);
+			this->record.AddInteger((int64_t)pRow->pInfo->deletedSize);
+			}
+		else
+			{
+			this->record.AddNull();
+			this->record.AddNull();
+			this->record.AddNull();
+			this->record.AddNull();
+			}
+
+		this->record.AddText(pRow->szFileName, wcslen(pRow->szFileName));
+		this->record.AddInteger(pRow->isFolder ? 1 : 0);
+		this->record.AddInteger(pRow->isMissing ? 1 : 0);
+		}
+	else
+		{
+		// The deleted folder's own row is left out if the filters did not select it.
+		size_t itemLength = this->itemDataFile.size();
+		bool isInItem = (itemLength != 0) && (wcsncmp(pRow->szFileName, this->itemDataFile.c_str(), itemLength) == 0)
+			&& (pRow->szFileName[itemLength] == L'\\');
+		if (isInItem)
+			{
+			this->record.AddInteger(this->itemCount);
+			}
+		else
+			{
+			this->record.AddNull();
+			}
+
+		this->record.AddText(pRow->szFileName, wcslen(pRow->szFileName));
+		size_t length = GetOriginalPath(pRow, this->path.data(), MAX_ORIGINAL_PATH);
+		if (length != 0)
+			{
+			this->record.AddText(this->path.data(), length);
+			}
+		else
+			{
+			this->record.AddNull();
+			}
+
+		this->record.AddInteger(pRow->isFolder ? 1 : 0);
+		}
+
+	if (pRow->isMissing)
+		{
+		for (int i = 0; i < 4; i++)
+			{
+			this->record.AddNull();
+			}
+		}
+	else
+		{
+		if (pRow->isFolder)
+			{
+			this->record.AddNull();
+			}
+		else
+			{
+			this->record.AddInteger((int64_t)pRow->size);
+			}
+
+		this->record.AddTime(&pRow->created);
+		this->record.AddTime(&pRow->modified);
+		this->record.AddTime(&pRow->accessed);
+		}
+
+	size_t cbPayload;
+	const uint8_t* pPayload = this->record.GetPayload(&cbPayload);
+	bool appended = pRow->isItem ? this->items.Append(++this->itemCount, pPayload, cbPayload)
+		: this->files.Append(++this->fileCount, pPayload, cbPayload);
+	if (!appended)
+		{
+		this->isFailed = true;
+		}
+	}
+
+bool SqliteWriter::Close()
+	{
+	uint32_t roots[TABLE_COUNT] = { this->bins.Finish(), this->items.Finish(), this->files.Finish() };
+
+	uint8_t page[PAGE_SIZE] = {};
+	memcpy(page, "SQLite format 3", 16);
+	Put16(page + 16, (uint16_t)PAGE_SIZE);
+	page[18] = 1;                           // Rollback journal (not WAL), to write and to read.
+	page[19] = 1;
+	page[21] = 64;                          // Payload fractions, which must be these.
+	page[22] = 32;
+	page[23] = 32;
+	Put32(page + 24, 1);                    // Change counter.
+	Put32(page + 28, this->pageCount);
+	Put32(page + 40, 1);                    // Schema cookie.
+	Put32(page + 44, 4);                    // Schema format.
+	Put32(page + 56, TEXT_UTF16LE);
+	Put32(page + 92, 1);                    // The change counter the page count is valid for.
+	Put32(page + 96, SQLITE_VERSION);
+
+	// The schema table's root is a leaf page after the file header, with a row for each table.
+	std::vector<uint8_t> cells;
+	std::vector<size_t> cellOffsets;
+	for (size_t i = 0; i < TABLE_COUNT; i++)
+		{
+		this->record.Clear();
+		this->record.AddText(L"table", 5);
+		this->record.AddText(TABLE_NAMES[i], wcslen(TABLE_NAMES[i]));
+		this->record.AddText(TABLE_NAMES[i], wcslen(TABLE_NAMES[i]));
+		this->record.AddInteger(roots[i]);
+		this->record.AddText(TABLE_SQL[i], wcslen(TABLE_SQL[i]));
+
+		size_t cbPayload;
+		const uint8_t* pPayload = this->record.GetPayload(&cbPayload);
+		cellOffsets.push_back(cells.size());
+		AppendVarint(&cells, cbPayload);
+		AppendVarint(&cells, i + 1);
+		cells.insert(cells.end(), pPayload, pPayload + cbPayload);
+
+		if (roots[i] == 0)
+			{
+			this->isFailed = true;
+			}
+		}
+
+	size_t contentStart = PAGE_SIZE - cells.size();
+	uint8_t* pHeader = page + FILE_HEADER_SIZE;
+	pHeader[0] = PAGE_TABLE_LEAF;
+	Put16(pHeader + 3, (uint16_t)TABLE_COUNT);
+	Put16(pHeader + 5, (uint16_t)contentStart);
+	memcpy(page + contentStart, cells.data(), cells.size());
+	for (size_t i = 0; i < TABLE_COUNT; i++)
+		{
+		Put16(pHeader + LEAF_HEADER_SIZE + 2 * i, (uint16_t)(contentStart + cellOffsets[i]));
+		}
+
+	bool written = !this->isFailed && (fseek(this->pFile, 0, SEEK_SET) == 0) && (fwrite(page, 1, PAGE_SIZE, this->pFile) == PAGE_SIZE);
+	written = (fclose(this->pFile) == 0) && written;
+	this->pFile = NULL;
+
+	return written;
+	}
@@ -0,0 +1,141 @@
+// SqliteWriter.h
+//
+// The --sqlite mode: instead of csv, the rows are written to a SQLite database, in a table of
+// Recycle Bins, a table of deleted items and a table of the files and folders in the deleted
+// folders, ready to query with the sqlite3 shell or any SQLite library:
+//
+//   bins(id, sid, user)
+//   items(id, bin_id, info_file, version, original_path, deleted_time, deleted_size,
+//         data_file, is_folder, is_missing, size, created, modified, accessed)
+//   files(id, item_id, path, original_path, is_folder, size, created, modified, accessed)
+//
+// Times are UTC text (YYYY-MM-DD HH:MM:SS), as in the csv, so SQLite's date functions work on
+// them.  A value that is not known (e.g. the original path of an item with no $I file) is NULL,
+// as is the item_id of the files in a deleted folder whose own row the filters left out.
+//
+// The database file is written directly, like the other formats this reads and writes, with no
+// library to build against.  Every table's rows are appended in rowid order, so each table's
+// B-tree is built from the bottom up: a leaf page is written as soon as it is full, and a page
+// of the level above as soon as it has all its children.  Every page is written once, in order,
+// and memory is a few pages per level of each table however many rows there are; there is no
+// journal, transaction or SQL statement to go through at all.
+//
+// Indexes would need the rows in another order, so none are written.  They are quickest made
+// once, after the rows are in, e.g.
+//   CREATE INDEX files_by_item ON files(item_id);
+
+#pragma once
+
+#include "windows.h"
+#include "cstdint"
+#include "cstddef"
+#include "stdio.h"
+#include "RecycleRow.h"
+#include <string>
+#include <vector>
+
+class SqliteWriter;
+
+// The values of one row of a table, in the SQLite record format.
+class SqliteRecord
+	{
+	public:
+		void Clear();
+
+		void AddNull();
+		void AddInteger(int64_t value);
+		void AddText(const wchar_t* text, size_t length);
+		void AddTime(const FILETIME* pTime);
+
+		// The header and values together, as stored in the B-tree.
+		const uint8_t* GetPayload(size_t* pcbPayload);
+
+	protected:
+		std::vector<uint8_t> types;     // Serial type of each value, as varints.
+		std::vector<uint8_t> values;
+		std::vector<uint8_t> payload;
+	};
+
+// A table's B-tree, built from rows appended in rowid order.
+class SqliteTableTree
+	{
+	public:
+		SqliteTableTree(SqliteWriter* pWriter);
+
+		bool Append(int64_t rowid, const uint8_t* pPayload, size_t cbPayload);
+
+		// Write the pages not yet written.  Returns the root page, 0 if it could not be written.
+		uint32_t Finish();
+
+	protected:
+		struct Child
+			{
+			uint32_t page;
+			int64_t lastRowid;      // The largest rowid in the child's pages.
+			};
+
+		bool WriteLeaf();
+		bool AddChild(size_t level, Child child);
+		bool WriteInterior(size_t level, const Child* pChildren, size_t count);
+
+		SqliteWriter* pWriter;
+		std::vector<uint8_t> cells;         // Of the leaf being filled, one after another.
+		std::vector<uint16_t> cellSizes;
+		int64_t lastRowid;
+		std::vector<std::vector<Child>> levels;     // Pages not yet in a page of the level above.
+	};
+
+class SqliteWriter
+	{
+	public:
+		SqliteWriter();
+		~SqliteWriter();
+
+		// Returns false if the file could not be created.
+		bool Create(const wchar_t* szFileName);
+
+		// Rows are added to the Recycle Bin last added, and files and folders in a deleted folder
+		// to the item last added.
+		void AddBin(const wchar_t* szSid, const wchar_t* szUser);
+		void AddRow(RecycleRow* pRow);
+
+		// Write the rest of the database.  Returns false if any of it could not be written.
+		bool Close();
+
+		// Page size of the database (the one SQLite itself uses by default).
+		static const size_t PAGE_SIZE = 4096;
+
+		// The page holding the bytes from 1GB that SQLite uses for file locks, which must not be
+		// used for anything else.  It is left zero, and the numbers go from the one before to the
+		// one after it.
+		static const uint32_t PENDING_BYTE_PAGE = 0x40000000 / PAGE_SIZE + 1;
+
+		// Write a page at the end of the file.  Returns its number, 0 if it could not be written.
+		uint32_t WritePage(const uint8_t* pPage);
+
+		// Number the next page written will have.
+		uint32_t GetNextPage()
+			{
+			return GetPageAfter(this->pageCount);
+			}
+
+		// Number of the page written after the given one.
+		static uint32_t GetPageAfter(uint32_t page)
+			{
+			return (page + 1 == PENDING_BYTE_PAGE) ? page + 2 : page + 1;
+			}
+
+	protected:
+		FILE* pFile;
+		uint32_t pageCount;
+		bool isFailed;
+		int64_t binCount;
+		int64_t itemCount;
+		int64_t fileCount;
+		SqliteTableTree bins;
+		SqliteTableTree items;
+		SqliteTableTree files;
+		SqliteRecord record;
+		std::wstring itemDataFile;  // Of the item last added, the files and folders in it start with it.
+		std::vector<wchar_t> path;
+	};
@@ -0,0 +1,219 @@
+// Stats.cpp
+//
+// Per thread counters and latency histograms of the operations of a dump.
+
+#include "Stats.h"
+#include "stdio.h"
+#include <mutex>
+#include <vector>
+
+// 16 buckets for each power of 2, each 1/16 of it wide.
+static const int SUB_BUCKET_BITS = 4;
+static const uint32_t SUB_BUCKET_COUNT = 1 << SUB_BUCKET_BITS;
+static const uint32_t BUCKET_COUNT = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKET_COUNT;
+
+static const wchar_t* const OPERATION_NAMES[STATS_OPERATION_COUNT] =
+	{
+	L"FindFirstFile", L"FindNextFile", L"CreateFile", L"ReadFile", L"GetFileAttributesEx",
+	L"Image read", L"Format", L"Write row",
+	};
+
+static const double PERCENTILES[] = { 50, 90, 99, 99.9 };
+static const size_t PERCENTILE_COUNT = sizeof(PERCENTILES) / sizeof(PERCENTILES[0]);
+
+struct OperationStats
+	{
+	uint64_t count;
+	uint64_t totalNanoseconds;
+	uint64_t maxNanoseconds;
+	uint64_t bytes;
+	uint64_t buckets[BUCKET_COUNT];
+	};
+
+struct ThreadStats
+	{
+	OperationStats operations[STATS_OPERATION_COUNT];
+	};
+
+static bool isStatsEnabled = false;
+
+// The stats of each thread that has recorded an operation, kept after the thread ends.
+static std::mutex allThreadStatsLock;
+static std::vector<ThreadStats*> allThreadStats;
+static thread_local ThreadStats* pThreadStats = NULL;
+
+void EnableStats()
+	{
+	isStatsEnabled = true;
+	}
+
+bool IsStatsEnabled()
+	{
+	return isStatsEnabled;
+	}
+
+static uint32_t GetBucket(uint64_t value)
+	{
+	if (value < SUB_BUCKET_COUNT)
+		{
+		return (uint32_t)value;
+		}
+
+	int magnitude = SUB_BUCKET_BITS;
+	while ((value >> (magnitude + 1)) != 0)
+		{
+		magnitude++;
+		}
+
+	return ((magnitude - SUB_BUCKET_BITS + 1) << SUB_BUCKET_BITS) + (uint32_t)((value >> (magnitude - SUB_BUCKET_BITS)) - SUB_BUCKET_COUNT);
+	}
+
+// The largest value in the bucket (which wraps round to the largest 64 bit value for the last one).
+static uint64_t GetBucketLimit(uint32_t bucket)
+	{
+	uint32_t group = bucket >> SUB_BUCKET_BITS;
+	uint64_t subBucket = bucket & (SUB_BUCKET_COUNT - 1);
+	if (group == 0)
+		{
+		return subBucket;
+		}
+
+	return ((SUB_BUCKET_COUNT + subBucket + 1) << (group - 1)) - 1;
+	}
+
+static uint64_t GetPercentile(const OperationStats* pStats, double percentile)
+	{
+	uint64_t rank = (uint64_t)(percentile / 100 * pStats->count + 0.5);
+	rank = (rank == 0) ? 1 : rank;
+
+	uint64_t count = 0;
+	for (uint32_t i = 0; i < BUCKET_COUNT; i++)
+		{
+		count += pStats->buckets[i];
+		if (count >= rank)
+			{
+			uint64_t limit = GetBucketLimit(i);
+			return (limit < pStats->maxNanoseconds) ? limit : pStats->maxNanoseconds;
+			}
+		}
+
+	return pStats->maxNanoseconds;
+	}
+
+void RecordOperation(StatsOperation operation, uint64_t nanoseconds, uint64_t bytes)
+	{
+	if (pThreadStats == NULL)
+		{
+		pThreadStats = new ThreadStats();
+
+		std::lock_guard<std::mutex> guard(allThreadStatsLock);
+		allThreadStats.push_back(pThreadStats);
+		}
+
+	OperationStats* pStats = &pThreadStats->operations[operation];
+	pStats->count++;
+	pStats->totalNanoseconds += nanoseconds;
+	pStats->maxNanoseconds = (nanoseconds > pStats->maxNanoseconds) ? nanoseconds : pStats->maxNanoseconds;
+	pStats->bytes += bytes;
+	pStats->buckets[GetBucket(nanoseconds)]++;
+	}
+
+static void WriteJsonStats(FILE* pFile, ThreadStats* pTotals, size_t threadCount)
+	{
+	fprintf(pFile, "{\n  \"threads\": %zu,\n  \"operations\": [", threadCount);
+
+	bool isFirst = true;
+	for (int operation = 0; operation < STATS_OPERATION_COUNT; operation++)
+		{
+		OperationStats* pStats = &pTotals->operations[operation];
+		if (pStats->count == 0)
+			{
+			continue;
+			}
+
+		fprintf(pFile, "%s\n    {\n      \"name\": \"%ls\",\n      \"count\": %llu,\n      \"totalNanoseconds\": %llu,\n      \"maxNanoseconds\": %llu,\n      \"bytes\": %llu,\n      \"percentiles\": {",
+			isFirst ? "" : ",", OPERATION_NAMES[operation], pStats->count, pStats->totalNanoseconds, pStats->maxNanoseconds, pStats->bytes);
+		for (size_t i = 0; i < PERCENTILE_COUNT; i++)
+			{
+			fprintf(pFile, "%s\"%g\": %llu", (i == 0) ? " " : ", ", PERCENTILES[i], GetPercentile(pStats, PERCENTILES[i]));
+			}
+
+		// Only the buckets with a count, as [largest nanoseconds in the bucket, count].
+		fprintf(pFile, " },\n      \"histogram\": [");
+		bool isFirstBucket = true;
+		for (uint32_t i = 0; i < BUCKET_COUNT; i++)
+			{
+			if (pStats->buckets[i] != 0)
+				{
+				fprintf(pFile, "%s[%llu, %llu]", isFirstBucket ? "" : ", ", GetBucketLimit(i), pStats->buckets[i]);
+				isFirstBucket = false;
+				}
+			}
+		fprintf(pFile, "]\n    }");
+		isFirst = false;
+		}
+
+	fprintf(pFile, "\n  ]\n}\n");
+	}
+
+bool PrintStats(const wchar_t* szJsonFile)
+	{
+	std::lock_guard<std::mutex> guard(allThreadStatsLock);
+
+	ThreadStats* pTotals = new ThreadStats();
+	for (size_t thread = 0; thread < allThreadStats.size(); thread++)
+		{
+		for (int operation = 0; operation < STATS_OPERATION_COUNT; operation++)
+			{
+			OperationStats* pStats = &allThreadStats[thread]->operations[operation];
+			OperationStats* pTotal = &pTotals->operations[operation];
+			pTotal->count += pStats->count;
+			pTotal->totalNanoseconds += pStats->totalNanoseconds;
+			pTotal->maxNanoseconds = (pStats->maxNanoseconds > pTotal->maxNanoseconds) ? pStats->maxNanoseconds : pTotal->maxNanoseconds;
+			pTotal->bytes += pStats->bytes;
+			for (uint32_t i = 0; i < BUCKET_COUNT; i++)
+				{
+				pTotal->buckets[i] += pStats->buckets[i];
+				}
+			}
+		}
+
+	fwprintf(stderr, L"Operation,Count,Total Milliseconds,MB,Mean Microseconds");
+	for (size_t i = 0; i < PERCENTILE_COUNT; i++)
+		{
+		fwprintf(stderr, L",%g%% Microseconds", PERCENTILES[i]);
+		}
+	fwprintf(stderr, L",Max Microseconds\n");
+
+	for (int operation = 0; operation < STATS_OPERATION_COUNT; operation++)
+		{
+		OperationStats* pStats = &pTotals->operations[operation];
+		if (pStats->count == 0)
+			{
+			continue;
+			}
+
+		fwprintf(stderr, L"%s,%llu,%.3f,%.1f,%.3f", OPERATION_NAMES[operation], pStats->count, pStats->totalNanoseconds / 1e6,
+			pStats->bytes / (1024.0 * 1024), pStats->totalNanoseconds / 1e3 / pStats->count);
+		for (size_t i = 0; i < PERCENTILE_COUNT; i++)
+			{
+			fwprintf(stderr, L",%.3f", GetPercentile(pStats, PERCENTILES[i]) / 1e3);
+			}
+		fwprintf(stderr, L",%.3f\n", pStats->maxNanoseconds / 1e3);
+		}
+
+	bool written = true;
+	if (szJsonFile != NULL)
+		{
+		FILE* pFile;
+		written = (_wfopen_s(&pFile, szJsonFile, L"w") == 0);
+		if (written)
+			{
+			WriteJsonStats(pFile, pTotals, allThreadStats.size());
+			written = (fclose(pFile) == 0);
+			}
+		}
+
+	delete pTotals;
+	return written;
+	}
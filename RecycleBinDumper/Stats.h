@@ -0,0 +1,73 @@
+// Stats.h
+//
+// Counts and latency histograms of the operations a dump spends its time in (--stats), to tell
+// a run held up by the storage (slow FindNextFile or ReadFile calls) from one held up by
+// formatting or by writing the output.
+//
+// Each thread records into its own counters and histograms, with no locking after its first
+// operation, and those of every thread are added together when the stats are printed.  The
+// histograms have 16 buckets for each power of 2 of nanoseconds (as HDR histograms do), so any
+// latency from a nanosecond to centuries is placed to within about 6% in 8 KB per operation.
+//
+// Timing an operation reads the clock twice, so when --stats is not given the timers do not
+// read it at all.
+
+#pragma once
+
+#include "windows.h"
+#include "cstdint"
+#include <chrono>
+
+enum StatsOperation
+	{
+	STATS_FIND_FIRST_FILE,      // FindFirstFile, which opens the folder.
+	STATS_FIND_NEXT_FILE,
+	STATS_OPEN_FILE,            // CreateFile of a $I file, or of a file to hash.
+	STATS_READ_FILE,
+	STATS_GET_ATTRIBUTES,
+	STATS_READ_IMAGE,           // A read of a raw image file, including any wait for another volume's thread.
+	STATS_FORMAT,               // Formatting of the columns of a row.
+	STATS_WRITE_ROW,
+	STATS_OPERATION_COUNT
+	};
+
+// Turn on the timers.  Must be called before any thread starts.
+void EnableStats();
+
+bool IsStatsEnabled();
+
+void RecordOperation(StatsOperation operation, uint64_t nanoseconds, uint64_t bytes);
+
+// Print the stats of every thread so far to stderr, and to a JSON file if szJsonFile is not
+// NULL.  Returns false if the JSON file could not be written.
+bool PrintStats(const wchar_t* szJsonFile);
+
+// Times one operation, from when it is made to when Stop() is called.
+class StatsTimer
+	{
+	public:
+		StatsTimer(StatsOperation operation)
+			{
+			this->operation = operation;
+			this->isTiming = IsStatsEnabled();
+			if (this->isTiming)
+				{
+				this->start = std::chrono::steady_clock::now();
+				}
+			}
+
+		void Stop(uint64_t bytes = 0)
+			{
+			if (this->isTiming)
+				{
+				std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - this->start;
+				RecordOperation(this->operation, (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(), bytes);
+				this->isTiming = false;
+				}
+			}
+
+	protected:
+		StatsOperation operation;
+		bool isTiming;
+		std::chrono::steady_clock::time_point start;
+	};
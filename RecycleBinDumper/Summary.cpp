@@ -0,0 +1,216 @@
+// Summary.cpp
+//
+// Fixed memory totals for the --summary mode.
+
+#include "Summary.h"
+#include "stdio.h"
+#include "string.h"
+#include "wchar.h"
+#include <algorithm>
+
+// Extensions longer than this are not really extensions (e.g. "archive.2019-04-17 backup").
+static const size_t MAX_EXTENSION_LENGTH = 16;
+
+SummaryTable::SummaryTable(const wchar_t* szName)
+	{
+	this->szName = szName;
+	this->entries = new Entry[CAPACITY];
+	memset(this->entries, 0, CAPACITY * sizeof(Entry));
+	this->entryCount = 0;
+
+	memset(&this->other, 0, sizeof(this->other));
+	wcscpy_s(this->other.key, KEY_SIZE, L"(other)");
+	}
+
+SummaryTable::~SummaryTable()
+	{
+	delete[] this->entries;
+	}
+
+void SummaryTable::AddToEntry(Entry* pEntry, RecycleRow* pRow)
+	{
+	if (pRow->isItem)
+		{
+		pEntry->itemCount++;
+		if (pRow->pInfo != NULL)
+			{
+			pEntry->deletedBytes += pRow->pInfo->deletedSize;
+			}
+		}
+
+	if (!pRow->isFolder && !pRow->isMissing)
+		{
+		pEntry->fileCount++;
+		pEntry->fileBytes += pRow->size;
+		}
+	}
+
+void SummaryTable::Add(const wchar_t* key, size_t keyLength, RecycleRow* pRow)
+	{
+	if (keyLength >= KEY_SIZE)
+		{
+		keyLength = KEY_SIZE - 1;
+		}
+
+	// A zero hash marks an empty slot.
+	uint64_t hash = HashString(key, keyLength) | 1;
+	size_t slot = (size_t)(hash & (CAPACITY - 1));
+
+	for (;;)
+		{
+		Entry* pEntry = &this->entries[slot];
+
+		if (pEntry->hash == 0)
+			{
+			if (this->entryCount == MAX_ENTRIES)
+				{
+				this->AddToEntry(&this->other, pRow);
+				return;
+				}
+
+			pEntry->hash = hash;
+			memcpy(pEntry->key, key, keyLength * sizeof(wchar_t));
+			pEntry->key[keyLength] = L'\0';
+			this->entryCount++;
+			}
+
+		if ((pEntry->hash == hash)
+			&& (_wcsnicmp(pEntry->key, key, keyLength) == 0)
+			&& (pEntry->key[keyLength] == L'\0'))
+			{
+			this->AddToEntry(pEntry, pRow);
+			return;
+			}
+
+		slot = (slot + 1) & (CAPACITY - 1);
+		}
+	}
+
+bool SummaryTable::CompareKeys(const Entry* pLeft, const Entry* pRight)
+	{
+	return _wcsicmp(pLeft->key, pRight->key) < 0;
+	}
+
+void SummaryTable::Print()
+	{
+	std::vector<const Entry*> sorted;
+	sorted.reserve(this->entryCount);
+	for (size_t i = 0; i < CAPACITY; i++)
+		{
+		if (this->entries[i].hash != 0)
+			{
+			sorted.push_back(&this->entries[i]);
+			}
+		}
+	std::sort(sorted.begin(), sorted.end(), CompareKeys);
+
+	if ((this->other.itemCount != 0) || (this->other.fileCount != 0))
+		{
+		sorted.push_back(&this->other);
+		}
+
+	for (size_t i = 0; i < sorted.size(); i++)
+		{
+		const Entry* pEntry = sorted[i];
+		wprintf(L"%s,%s,%lld,%lld,%lld,%lld,\n", this->szName, pEntry->key,
+			pEntry->itemCount, pEntry->deletedBytes, pEntry->fileCount, pEntry->fileBytes);
+		}
+	}
+
+Summary::Summary()
+	: sids(L"SID"), extensions(L"Extension"), days(L"Deleted Date"), folders(L"Top Level Folder")
+	{
+	}
+
+void Summary::AddRow(RecycleRow* pRow)
+	{
+	this->sids.Add(pRow->szSid, wcslen(pRow->szSid), pRow);
+
+	size_t length = GetOriginalPath(pRow, this->originalPath, MAX_ORIGINAL_PATH);
+	if (length > 0)
+		{
+		this->distinctPaths.Add(HashString(this->originalPath, length));
+
+		// The top level folder is the drive (or UNC share) and the first folder below it.
+		const wchar_t* pStart = this->originalPath;
+		const wchar_t* pEnd = pStart + length;
+		const wchar_t* p = pStart;
+		const wchar_t* pLastSeparator = NULL;
+		int separators = (wcsncmp(pStart, L"\\\\", 2) == 0) ? 4 : 1;
+		while (p < pEnd)
+			{
+			if (*p == L'\\')
+				{
+				if (--separators < 0)
+					{
+					break;
+					}
+				pLastSeparator = p;
+				}
+			p++;
+			}
+
+		// A file directly in the root is counted under the root itself.
+		if ((p == pEnd) && !pRow->isFolder && (pLastSeparator != NULL))
+			{
+			p = pLastSeparator + 1;
+			}
+		this->folders.Add(pStart, p - pStart, pRow);
+
+		if (!pRow->isFolder)
+			{
+			const wchar_t* pExtension = pEnd;
+			for (p = pEnd; (p > pStart) && (p[-1] != L'\\'); p--)
+				{
+				if (p[-1] == L'.')
+					{
+					pExtension = p - 1;
+					break;
+					}
+				}
+
+			if ((pExtension == pEnd) || ((size_t)(pEnd - pExtension) > MAX_EXTENSION_LENGTH))
+				{
+				this->extensions.Add(L"(none)", 6, pRow);
+				}
+			else
+				{
+				this->extensions.Add(pExtension, pEnd - pExtension, pRow);
+				}
+			}
+		}
+
+	if (pRow->pInfo != NULL)
+		{
+		SYSTEMTIME utc;
+		FileTimeToSystemTime(&pRow->pInfo->deletedTime, &utc);
+
+		wchar_t day[16];
+		int dayLength = swprintf_s(day, 16, L"%4d-%02d-%02d", utc.wYear, utc.wMonth, utc.wDay);
+		this->days.Add(day, dayLength, pRow);
+		}
+
+	if (!pRow->isFolder && !pRow->isMissing)
+		{
+		this->fileSizes.Add((double)pRow->size);
+		}
+	}
+
+void Summary::Print()
+	{
+	wprintf(L"Summary,Key,Deleted Items,Deleted Size,Files,File Size,\n");
+
+	this->sids.Print();
+	this->extensions.Print();
+	this->days.Print();
+	this->folders.Print();
+
+	wprintf(L"Distinct Original Paths,(estimate),%.0f,,,,\n", this->distinctPaths.Estimate());
+
+	const double quantiles[] = { 0, 0.5, 0.9, 0.99, 0.999, 1 };
+	for (size_t i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); i++)
+		{
+		wprintf(L"File Size Quantile,%g,,,%lld,%.0f,\n", quantiles[i],
+			this->fileSizes.GetCount(), this->fileSizes.Quantile(quantiles[i]));
+		}
+	}
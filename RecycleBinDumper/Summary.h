@@ -0,0 +1,76 @@
+// Summary.h
+//
+// The --summary mode: instead of a row for every file and folder, totals are output per user
+// (SID), per file extension, per day of deletion and per top level folder of the original
+// path, along with an estimate of the number of distinct original paths and of the file size
+// quantiles.
+//
+// Every table and sketch has a fixed size, so a Recycle Bin with hundreds of millions of
+// entries is summarized in the same few megabytes as a small one.  Once a table is full, rows
+// with new keys are added to a single "(other)" entry of that table.
+
+#pragma once
+
+#include "cstdint"
+#include "RecycleRow.h"
+#include "Sketches.h"
+
+class SummaryTable
+	{
+	public:
+		SummaryTable(const wchar_t* szName);
+		~SummaryTable();
+
+		void Add(const wchar_t* key, size_t keyLength, RecycleRow* pRow);
+
+		// Output a csv row for each key, in key order.
+		void Print();
+
+	protected:
+		// Keys longer than this are truncated.
+		static const size_t KEY_SIZE = 128;
+
+		// Open addressing table, which is treated as full at 3/4 of its capacity.
+		static const size_t CAPACITY = 4096;
+		static const size_t MAX_ENTRIES = CAPACITY * 3 / 4;
+
+		struct Entry
+			{
+			uint64_t hash;
+			uint64_t itemCount;
+			uint64_t deletedBytes;
+			uint64_t fileCount;
+			uint64_t fileBytes;
+			wchar_t key[KEY_SIZE];
+			};
+
+		void AddToEntry(Entry* pEntry, RecycleRow* pRow);
+
+		static bool CompareKeys(const Entry* pLeft, const Entry* pRight);
+
+		const wchar_t* szName;
+		Entry* entries;
+		size_t entryCount;
+		Entry other;
+	};
+
+class Summary
+	{
+	public:
+		Summary();
+
+		void AddRow(RecycleRow* pRow);
+
+		void Print();
+
+	protected:
+		SummaryTable sids;
+		SummaryTable extensions;
+		SummaryTable days;
+		SummaryTable folders;
+
+		HyperLogLog distinctPaths;
+		TDigest fileSizes;
+
+		wchar_t originalPath[MAX_ORIGINAL_PATH];
+	};
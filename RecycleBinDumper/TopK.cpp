@@ -0,0 +1,114 @@
+// TopK.cpp
+//
+// Bounded heap of the K largest rows for the --top mode.
+
+#include "TopK.h"
+#include "stdio.h"
+#include "string.h"
+#include "wchar.h"
+#include <algorithm>
+
+// Entries reserved up front, so a K far larger than the number of rows does not reserve memory
+// that is never used.  The heap grows past it if it has to.
+static const size_t MAX_RESERVED_ENTRIES = 64 * 1024;
+
+TopK::TopK(size_t k, TopKKey key)
+	{
+	this->k = k;
+	this->keyType = key;
+	this->sequence = 0;
+	this->heap.reserve((k < MAX_RESERVED_ENTRIES) ? k : MAX_RESERVED_ENTRIES);
+	}
+
+TopK::~TopK()
+	{
+	for (size_t i = 0; i < this->heap.size(); i++)
+		{
+		delete[] this->heap[i].line;
+		}
+	}
+
+bool TopK::IsBetter(const Entry& left, const Entry& right)
+	{
+	if (left.key != right.key)
+		{
+		return left.key > right.key;
+		}
+
+	return left.sequence < right.sequence;
+	}
+
+void TopK::AddRow(RecycleRow* pRow, const wchar_t* szLine)
+	{
+	uint64_t key = 0;
+
+	switch (this->keyType)
+		{
+		case TOP_BY_SIZE:
+			if (pRow->isFolder || pRow->isMissing)
+				{
+				return;
+				}
+			key = pRow->size;
+			break;
+
+		// Rows for the files in a deleted folder repeat the folder's deleted size and time,
+		// so only the deleted item itself is ranked.
+		case TOP_BY_DELETED_SIZE:
+			if (!pRow->isItem || (pRow->pInfo == NULL))
+				{
+				return;
+				}
+			key = pRow->pInfo->deletedSize;
+			break;
+
+		case TOP_BY_DELETED_TIME:
+			if (!pRow->isItem || (pRow->pInfo == NULL))
+				{
+				return;
+				}
+			key = (((uint64_t)pRow->pInfo->deletedTime.dwHighDateTime) << 32) + pRow->pInfo->deletedTime.dwLowDateTime;
+			break;
+		}
+
+	Entry entry = { key, this->sequence++, NULL, 0 };
+
+	// The front of the heap is the worst row kept; a row that is no better is dropped
+	// without copying it.
+	if (this->heap.size() == this->k)
+		{
+		if ((this->k == 0) || !IsBetter(entry, this->heap.front()))
+			{
+			return;
+			}
+
+		std::pop_heap(this->heap.begin(), this->heap.end(), IsBetter);
+		entry.line = this->heap.back().line;
+		entry.lineCapacity = this->heap.back().lineCapacity;
+		this->heap.pop_back();
+		}
+
+	// Reuse the replaced row's buffer when the new row fits.
+	size_t length = wcslen(szLine);
+	if (entry.lineCapacity < length + 1)
+		{
+		delete[] entry.line;
+		entry.lineCapacity = length + 1;
+		entry.line = new wchar_t[entry.lineCapacity];
+		}
+	memcpy(entry.line, szLine, (length + 1) * sizeof(wchar_t));
+
+	this->heap.push_back(entry);
+	std::push_heap(this->heap.begin(), this->heap.end(), IsBetter);
+	}
+
+void TopK::Print(const wchar_t* szHeader)
+	{
+	std::sort_heap(this->heap.begin(), this->heap.end(), IsBetter);
+
+	wprintf(L"%s\n", szHeader);
+	for (size_t i = 0; i < this->heap.size(); i++)
+		{
+		wprintf(L"%s\n", this->heap[i].line);
+		}
+	}
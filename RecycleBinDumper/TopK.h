@@ -0,0 +1,52 @@
+// TopK.h
+//
+// The --top mode: only the K rows with the largest size, deleted size or deleted time are
+// output, found in the same single pass over the Recycle Bins.
+//
+// The best K rows so far are held in a min-heap, so each row costs one comparison against the
+// smallest of them and only rows that make it into the top K are copied.  Memory is O(K) no
+// matter how many rows there are, and the K rows are sorted once at the end.
+
+#pragma once
+
+#include "cstdint"
+#include "cstddef"
+#include "RecycleRow.h"
+#include <vector>
+
+enum TopKKey
+	{
+	TOP_BY_SIZE,            // "Original File Size" of every file, including files in deleted folders.
+	TOP_BY_DELETED_SIZE,    // "Deleted Size" of each deleted item.
+	TOP_BY_DELETED_TIME,    // Time each item was deleted, i.e. the most recently deleted items.
+	};
+
+class TopK
+	{
+	public:
+		TopK(size_t k, TopKKey key);
+		~TopK();
+
+		// szLine is the formatted csv row.
+		void AddRow(RecycleRow* pRow, const wchar_t* szLine);
+
+		// Output the header and the rows kept, largest first.
+		void Print(const wchar_t* szHeader);
+
+	protected:
+		struct Entry
+			{
+			uint64_t key;
+			uint64_t sequence;      // Order the row was seen, so ties keep the earliest rows.
+			wchar_t* line;
+			size_t lineCapacity;
+			};
+
+		// Orders the heap so the front is the entry to be replaced first.
+		static bool IsBetter(const Entry& left, const Entry& right);
+
+		size_t k;
+		TopKKey keyType;
+		uint64_t sequence;
+		std::vector<Entry> heap;
+	};
@@ -0,0 +1,142 @@
+// Trace.cpp
+//
+// Per thread ring buffers of spans, written as a Chrome trace.
+
+#include "Trace.h"
+#include "stdio.h"
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+struct TraceEvent
+	{
+	const wchar_t* szName;
+	uint64_t start;
+	uint64_t duration;
+	wchar_t detail[TRACE_DETAIL_LENGTH];    // Null terminated unless it fills the array.
+	};
+
+struct ThreadTrace
+	{
+	uint32_t threadNumber;      // In the order the threads recorded their first span.
+	uint64_t count;             // Spans recorded, of which the last TRACE_RING_SIZE are kept.
+	TraceEvent events[TRACE_RING_SIZE];
+	};
+
+static bool isTraceEnabled = false;
+static std::chrono::steady_clock::time_point traceStart;
+
+// The trace of each thread that has recorded a span, kept after the thread ends.
+static std::mutex allThreadTracesLock;
+static std::vector<ThreadTrace*> allThreadTraces;
+static thread_local ThreadTrace* pThreadTrace = NULL;
+
+void EnableTrace()
+	{
+	isTraceEnabled = true;
+	traceStart = std::chrono::steady_clock::now();
+	}
+
+bool IsTraceEnabled()
+	{
+	return isTraceEnabled;
+	}
+
+uint64_t GetTraceTime()
+	{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - traceStart).count();
+	}
+
+void RecordSpan(const wchar_t* szName, const wchar_t* szDetail, uint64_t start, uint64_t end)
+	{
+	if (pThreadTrace == NULL)
+		{
+		pThreadTrace = new ThreadTrace;
+		pThreadTrace->count = 0;
+
+		std::lock_guard<std::mutex> guard(allThreadTracesLock);
+		pThreadTrace->threadNumber = (uint32_t)allThreadTraces.size() + 1;
+		allThreadTraces.push_back(pThreadTrace);
+		}
+
+	TraceEvent* pEvent = &pThreadTrace->events[pThreadTrace->count++ % TRACE_RING_SIZE];
+	pEvent->szName = szName;
+	pEvent->start = start;
+	pEvent->duration = end - start;
+
+	size_t length = 0;
+	if (szDetail != NULL)
+		{
+		for (; (length < TRACE_DETAIL_LENGTH) && (szDetail[length] != L'\0'); length++)
+			{
+			pEvent->detail[length] = szDetail[length];
+			}
+		}
+	if (length < TRACE_DETAIL_LENGTH)
+		{
+		pEvent->detail[length] = L'\0';
+		}
+	}
+
+// Write a JSON string, with anything but printable ASCII escaped.
+static void WriteJsonString(FILE* pFile, const wchar_t* s, size_t maxLength)
+	{
+	fputc('"', pFile);
+	for (size_t i = 0; (i < maxLength) && (s[i] != L'\0'); i++)
+		{
+		if ((s[i] == L'"') || (s[i] == L'\\'))
+			{
+			fprintf(pFile, "\\%c", (char)s[i]);
+			}
+		else if ((s[i] < 0x20) || (s[i] > 0x7E))
+			{
+			fprintf(pFile, "\\u%04x", (unsigned)s[i] & 0xFFFF);
+			}
+		else
+			{
+			fputc((char)s[i], pFile);
+			}
+		}
+	fputc('"', pFile);
+	}
+
+bool WriteTrace(const wchar_t* szFileName)
+	{
+	FILE* pFile;
+	if (_wfopen_s(&pFile, szFileName, L"w") != 0)
+		{
+		return false;
+		}
+
+	std::lock_guard<std::mutex> guard(allThreadTracesLock);
+
+	uint64_t droppedCount = 0;
+	fprintf(pFile, "{\"traceEvents\":[\n");
+	for (size_t thread = 0; thread < allThreadTraces.size(); thread++)
+		{
+		ThreadTrace* pTrace = allThreadTraces[thread];
+		fprintf(pFile, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"Thread %u\"}}",
+			(thread == 0) ? "" : ",\n", pTrace->threadNumber, pTrace->threadNumber);
+
+		// Oldest first, once the ring has wrapped round.
+		uint64_t first = (pTrace->count > TRACE_RING_SIZE) ? pTrace->count - TRACE_RING_SIZE : 0;
+		droppedCount += first;
+		for (uint64_t i = first; i < pTrace->count; i++)
+			{
+			TraceEvent* pEvent = &pTrace->events[i % TRACE_RING_SIZE];
+			fprintf(pFile, ",\n{\"name\":");
+			WriteJsonString(pFile, pEvent->szName, (size_t)-1);
+			fprintf(pFile, ",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f", pTrace->threadNumber, pEvent->start / 1e3, pEvent->duration / 1e3);
+			if (pEvent->detail[0] != L'\0')
+				{
+				fprintf(pFile, ",\"args\":{\"detail\":");
+				WriteJsonString(pFile, pEvent->detail, TRACE_DETAIL_LENGTH);
+				fprintf(pFile, "}");
+				}
+			fprintf(pFile, "}");
+			}
+		}
+
+	fprintf(pFile, "\n],\n\"displayTimeUnit\":\"ms\",\n\"otherData\":{\"droppedSpans\":%llu}}\n", droppedCount);
+	return (fclose(pFile) == 0);
+	}
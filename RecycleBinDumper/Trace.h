@@ -0,0 +1,71 @@
+// Trace.h
+//
+// A timeline of what each thread of a run was doing (--trace), written at exit as a Chrome
+// trace file to open in chrome://tracing or ui.perfetto.dev, to see where the threads stalled
+// (e.g. a volume's thread waiting for another to finish its output, or one slow folder) rather
+// than only the totals that --stats gives.
+//
+// A span is recorded for each Recycle Bin, each $I file, each folder walked below a deleted
+// folder, each row written, each volume scanned from an image and each stripe of an image
+// carved.  Each thread records its spans into a ring buffer of its own, with no locking, which
+// keeps the last TRACE_RING_SIZE of them.  A span's detail (e.g. the folder's name) is kept to
+// its first TRACE_DETAIL_LENGTH characters.
+
+#pragma once
+
+#include "windows.h"
+#include "cstdint"
+
+const size_t TRACE_RING_SIZE = 65536;
+const size_t TRACE_DETAIL_LENGTH = 40;
+
+// Start the timeline.  Must be called before any thread starts.
+void EnableTrace();
+
+bool IsTraceEnabled();
+
+// Nanoseconds since the timeline started.
+uint64_t GetTraceTime();
+
+// szName must be a string that lasts until the trace is written (a literal).
+void RecordSpan(const wchar_t* szName, const wchar_t* szDetail, uint64_t start, uint64_t end);
+
+// Write the spans of every thread so far as a Chrome trace (JSON) file.  Returns false if it
+// could not be written.
+bool WriteTrace(const wchar_t* szFileName);
+
+// A span from when this is made to when it is destroyed (or End() is called).
+class TraceSpan
+	{
+	public:
+		TraceSpan(const wchar_t* szName, const wchar_t* szDetail = NULL)
+			{
+			this->szName = szName;
+			this->szDetail = szDetail;
+			this->isTracing = IsTraceEnabled();
+			if (this->isTracing)
+				{
+				this->start = GetTraceTime();
+				}
+			}
+
+		~TraceSpan()
+			{
+			this->End();
+			}
+
+		void End()
+			{
+			if (this->isTracing)
+				{
+				RecordSpan(this->szName, this->szDetail, this->start, GetTraceTime());
+				this->isTracing = false;
+				}
+			}
+
+	protected:
+		const wchar_t* szName;
+		const wchar_t* szDetail;    // Copied when the span ends.
+		bool isTracing;
+		uint64_t start;
+	};
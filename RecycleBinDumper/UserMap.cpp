@@ -0,0 +1,166 @@
+// UserMap.cpp
+//
+// SID to user name map read from offline registry hives.
+
+#include "UserMap.h"
+#include "RegistryHive.h"
+#include "stdio.h"
+#include "string.h"
+#include "wchar.h"
+#include "wctype.h"
+#include <vector>
+
+// Accounts that have a profile but whose profile folder is not named after them.
+static const wchar_t* wellKnownUsers[][2] =
+	{
+	{ L"S-1-5-18", L"SYSTEM" },
+	{ L"S-1-5-19", L"LOCAL SERVICE" },
+	{ L"S-1-5-20", L"NETWORK SERVICE" },
+	};
+
+// The binary form of S-1-5-21-x-y-z: revision 1, 4 subauthorities, NT authority, 21.
+static const uint8_t machineSidPrefix[12] = { 1, 4, 0, 0, 0, 0, 0, 5, 21, 0, 0, 0 };
+
+UserMap::UserMap()
+	{
+	for (size_t i = 0; i < sizeof(wellKnownUsers) / sizeof(wellKnownUsers[0]); i++)
+		{
+		this->Add(wellKnownUsers[i][0], wellKnownUsers[i][1], true);
+		}
+	}
+
+void UserMap::Add(const wchar_t* szSid, const wchar_t* szUser, bool replace)
+	{
+	std::wstring sid(szSid);
+	for (size_t i = 0; i < sid.size(); i++)
+		{
+		sid[i] = (wchar_t)towupper(sid[i]);
+		}
+
+	if (replace)
+		{
+		this->users[sid] = szUser;
+		}
+	else
+		{
+		this->users.insert(std::make_pair(sid, std::wstring(szUser)));
+		}
+	}
+
+bool UserMap::LoadSoftwareHive(const wchar_t* szFileName)
+	{
+	RegistryHive hive;
+	if (!hive.Open(szFileName))
+		{
+		return false;
+		}
+
+	uint32_t profileList = hive.FindKey(hive.GetRootKey(), L"Microsoft\\Windows NT\\CurrentVersion\\ProfileList");
+	if (profileList == 0)
+		{
+		return false;
+		}
+
+	std::vector<uint32_t> profiles;
+	hive.GetSubkeys(profileList, &profiles);
+
+	wchar_t szSid[256];
+	wchar_t szProfilePath[MAX_PATH];
+	for (size_t i = 0; i < profiles.size(); i++)
+		{
+		if ((hive.GetKeyName(profiles[i], szSid, 256) == 0)
+			|| !hive.GetStringValue(profiles[i], L"ProfileImagePath", szProfilePath, MAX_PATH))
+			{
+			continue;
+			}
+
+		const wchar_t* szUser = wcsrchr(szProfilePath, L'\\');
+		szUser = (szUser != NULL) ? szUser + 1 : szProfilePath;
+		if (*szUser != L'\0')
+			{
+			this->Add(szSid, szUser, false);
+			}
+		}
+
+	return true;
+	}
+
+bool UserMap::LoadSamHive(const wchar_t* szFileName)
+	{
+	RegistryHive hive;
+	if (!hive.Open(szFileName))
+		{
+		return false;
+		}
+
+	uint32_t account = hive.FindKey(hive.GetRootKey(), L"SAM\\Domains\\Account");
+	uint32_t names = hive.FindKey(account, L"Users\\Names");
+	if (names == 0)
+		{
+		return false;
+		}
+
+	// The machine SID is the last SID in the account domain's V value.
+	uint32_t type;
+	const uint8_t* pV;
+	uint32_t cbV;
+	wchar_t szMachineSid[64] = L"";
+
+	if (hive.GetValue(account, L"V", &type, &pV, &cbV) && (pV != NULL) && (cbV >= 24))
+		{
+		uint32_t offset = cbV - 24;
+		while ((offset > 0) && (memcmp(pV + offset, machineSidPrefix, sizeof(machineSidPrefix)) != 0))
+			{
+			offset--;
+			}
+
+		if (memcmp(pV + offset, machineSidPrefix, sizeof(machineSidPrefix)) == 0)
+			{
+			const uint8_t* p = pV + offset + sizeof(machineSidPrefix);
+			swprintf_s(szMachineSid, 64, L"S-1-5-21-%u-%u-%u",
+				(uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24),
+				(uint32_t)p[4] | ((uint32_t)p[5] << 8) | ((uint32_t)p[6] << 16) | ((uint32_t)p[7] << 24),
+				(uint32_t)p[8] | ((uint32_t)p[9] << 8) | ((uint32_t)p[10] << 16) | ((uint32_t)p[11] << 24));
+			}
+		}
+
+	if (szMachineSid[0] == L'\0')
+		{
+		return false;
+		}
+
+	std::vector<uint32_t> users;
+	hive.GetSubkeys(names, &users);
+
+	wchar_t szUser[256];
+	wchar_t szSid[128];
+	for (size_t i = 0; i < users.size(); i++)
+		{
+		const uint8_t* pData;
+		uint32_t cbData;
+
+		// The RID is stored as the type of the default value, which has no data.
+		if ((hive.GetKeyName(users[i], szUser, 256) == 0)
+			|| !hive.GetValue(users[i], L"", &type, &pData, &cbData))
+			{
+			continue;
+			}
+
+		swprintf_s(szSid, 128, L"%s-%u", szMachineSid, type);
+		this->Add(szSid, szUser, true);
+		}
+
+	return true;
+	}
+
+const wchar_t* UserMap::Lookup(const wchar_t* szSid)
+	{
+	std::wstring sid(szSid);
+	for (size_t i = 0; i < sid.size(); i++)
+		{
+		sid[i] = (wchar_t)towupper(sid[i]);
+		}
+
+	std::unordered_map<std::wstring, std::wstring>::iterator it = this->users.find(sid);
+	return (it != this->users.end()) ? it->second.c_str() : NULL;
+	}
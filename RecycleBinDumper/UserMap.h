@@ -0,0 +1,39 @@
+// UserMap.h
+//
+// Map from the SIDs that name the Recycle Bin folders to user names, built from the registry
+// hives of the system the Recycle Bins came from:
+//
+//   SOFTWARE  Microsoft\Windows NT\CurrentVersion\ProfileList\<SID> has the ProfileImagePath
+//             of every user who has logged on, local or domain, and its last component is
+//             (usually) the user name.
+//   SAM       Domains\Account\Users\Names\<name> has the RID of each local account as the type
+//             of its default value, and the machine SID is at the end of Domains\Account\V.
+//
+// Account names from the SAM are preferred over profile folder names, which can have a suffix
+// such as ".DOMAIN" or ".000".  The map is built once, before any Recycle Bin is read, and each
+// Recycle Bin's user is looked up once, so the rows just repeat it.
+
+#pragma once
+
+#include "windows.h"
+#include "cstdint"
+#include <string>
+#include <unordered_map>
+
+class UserMap
+	{
+	public:
+		UserMap();
+
+		bool LoadSoftwareHive(const wchar_t* szFileName);
+		bool LoadSamHive(const wchar_t* szFileName);
+
+		// Returns the user name for the SID, or NULL if it is not known.
+		const wchar_t* Lookup(const wchar_t* szSid);
+
+	protected:
+		void Add(const wchar_t* szSid, const wchar_t* szUser, bool replace);
+
+		// Keyed by the upper case SID.
+		std::unordered_map<std::wstring, std::wstring> users;
+	};
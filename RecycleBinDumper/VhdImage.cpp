@@ -0,0 +1,410 @@
+// VhdImage.cpp
+//
+// VHD and VHDX block allocation tables.
+
+#include "VhdImage.h"
+#include "string.h"
+
+static const uint32_t VHD_FOOTER_SIZE = 512;
+static const uint32_t VHD_FOOTER_DATA_OFFSET = 16;
+static const uint32_t VHD_FOOTER_CURRENT_SIZE = 48;
+static const uint32_t VHD_FOOTER_DISK_TYPE = 60;
+static const uint32_t VHD_TYPE_FIXED = 2;
+static const uint32_t VHD_TYPE_DYNAMIC = 3;
+
+static const uint32_t VHD_HEADER_SIZE = 1024;
+static const uint32_t VHD_HEADER_TABLE_OFFSET = 16;
+static const uint32_t VHD_HEADER_MAX_TABLE_ENTRIES = 28;
+static const uint32_t VHD_HEADER_BLOCK_SIZE = 32;
+static const uint32_t VHD_SPARSE_ENTRY = 0xFFFFFFFF;
+static const uint32_t VHD_SECTOR_SIZE = 512;
+
+// A fixed VHD has no blocks of its own, it is read as if it had blocks of this size.
+static const uint64_t FIXED_BLOCK_SIZE = 2 * 1024 * 1024;
+
+static const uint64_t VHDX_HEADER_OFFSETS[2] = { 64 * 1024, 128 * 1024 };
+static const uint32_t VHDX_HEADER_SIZE = 4096;
+static const uint32_t VHDX_HEADER_CHECKSUM = 4;
+static const uint32_t VHDX_HEADER_SEQUENCE = 8;
+static const uint32_t VHDX_HEADER_LOG_GUID = 48;
+
+static const uint64_t VHDX_REGION_OFFSETS[2] = { 192 * 1024, 256 * 1024 };
+static const uint32_t VHDX_REGION_SIZE = 64 * 1024;
+static const uint32_t VHDX_REGION_COUNT = 8;
+static const uint32_t VHDX_REGION_ENTRIES = 16;
+static const uint32_t VHDX_REGION_ENTRY_SIZE = 32;
+
+static const uint32_t VHDX_METADATA_HEADER_SIZE = 32;
+static const uint32_t VHDX_METADATA_COUNT = 10;
+static const uint32_t VHDX_METADATA_ENTRY_SIZE = 32;
+static const uint32_t VHDX_HAS_PARENT = 0x2;
+
+static const uint64_t VHDX_STATE_MASK = 0x7;
+static const uint64_t VHDX_FULLY_PRESENT = 6;
+static const uint64_t VHDX_PARTIALLY_PRESENT = 7;
+static const uint64_t MB = 1024 * 1024;
+
+// GUIDs as stored in the file (the first three fields little endian).
+static const uint8_t GUID_BAT[16] = { 0x66, 0x77, 0xC2, 0x2D, 0x23, 0xF6, 0x00, 0x42, 0x9D, 0x64, 0x11, 0x5E, 0x9B, 0xFD, 0x4A, 0x08 };
+static const uint8_t GUID_METADATA[16] = { 0x06, 0xA2, 0x7C, 0x8B, 0x90, 0x47, 0x9A, 0x4B, 0xB8, 0xFE, 0x57, 0x5F, 0x05, 0x0F, 0x88, 0x6E };
+static const uint8_t GUID_FILE_PARAMETERS[16] = { 0x37, 0x67, 0xA1, 0xCA, 0x36, 0xFA, 0x43, 0x4D, 0xB3, 0xB6, 0x33, 0xF0, 0xAA, 0x44, 0xE7, 0x6B };
+static const uint8_t GUID_VIRTUAL_DISK_SIZE[16] = { 0x24, 0x42, 0xA5, 0x2F, 0x1B, 0xCD, 0x76, 0x48, 0xB2, 0x11, 0x5D, 0xBE, 0xD8, 0x3B, 0xF4, 0xB8 };
+static const uint8_t GUID_LOGICAL_SECTOR_SIZE[16] = { 0x1D, 0xBF, 0x41, 0x81, 0x6F, 0xA9, 0x09, 0x47, 0xBA, 0x47, 0xF2, 0x33, 0xA8, 0xFA, 0xAB, 0x5F };
+
+static uint32_t Read32(const uint8_t* p)
+	{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+	}
+
+static uint64_t Read64(const uint8_t* p)
+	{
+	return (uint64_t)Read32(p) | ((uint64_t)Read32(p + 4) << 32);
+	}
+
+// VHD is big endian.
+static uint32_t ReadBig32(const uint8_t* p)
+	{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+	}
+
+static uint64_t ReadBig64(const uint8_t* p)
+	{
+	return ((uint64_t)ReadBig32(p) << 32) | (uint64_t)ReadBig32(p + 4);
+	}
+
+// Table for CRC-32C (Castagnoli), built on first use.
+struct Crc32cTable
+	{
+	uint32_t entries[256];
+
+	Crc32cTable()
+		{
+		for (uint32_t i = 0; i < 256; i++)
+			{
+			uint32_t crc = i;
+			for (int bit = 0; bit < 8; bit++)
+				{
+				crc = (crc & 1) ? (crc >> 1) ^ 0x82F63B78 : crc >> 1;
+				}
+			this->entries[i] = crc;
+			}
+		}
+	};
+
+// CRC-32C of the data, with the checksum field itself taken as zero.
+static uint32_t Crc32c(const uint8_t* pData, size_t cbData, size_t checksumOffset)
+	{
+	static const Crc32cTable table;
+
+	uint32_t crc = 0xFFFFFFFF;
+	for (size_t i = 0; i < cbData; i++)
+		{
+		uint8_t byte = ((i >= checksumOffset) && (i < checksumOffset + 4)) ? 0 : pData[i];
+		crc = table.entries[(crc ^ byte) & 0xFF] ^ (crc >> 8);
+		}
+
+	return ~crc;
+	}
+
+VhdImage::VhdImage()
+	{
+	this->pFile = NULL;
+	this->size = 0;
+	this->blockSize = 0;
+	}
+
+VhdImage::~VhdImage()
+	{
+	delete this->pFile;
+	}
+
+bool VhdImage::IsVhdImage(BlockDevice* pFile)
+	{
+	uint8_t signature[8];
+
+	if (pFile->Read(0, signature, 8) && (memcmp(signature, "vhdxfile", 8) == 0))
+		{
+		return true;
+		}
+
+	return (pFile->GetSize() >= VHD_FOOTER_SIZE) && pFile->Read(pFile->GetSize() - VHD_FOOTER_SIZE, signature, 8)
+		&& (memcmp(signature, "conectix", 8) == 0);
+	}
+
+bool VhdImage::Open(const wchar_t* szFileName)
+	{
+	this->pFile = new RawImage();
+	if (!this->pFile->Open(szFileName))
+		{
+		return false;
+		}
+
+	uint8_t signature[8];
+	if (!this->pFile->Read(0, signature, 8))
+		{
+		return false;
+		}
+
+	bool opened = (memcmp(signature, "vhdxfile", 8) == 0) ? this->OpenVhdx() : this->OpenVhd();
+	return opened && (this->blockSize > 0) && ((this->size + this->blockSize - 1) / this->blockSize <= this->blocks.size());
+	}
+
+bool VhdImage::OpenVhd()
+	{
+	uint64_t fileSize = this->pFile->GetSize();
+	uint8_t footer[VHD_FOOTER_SIZE];
+
+	if ((fileSize < VHD_FOOTER_SIZE) || !this->pFile->Read(fileSize - VHD_FOOTER_SIZE, footer, VHD_FOOTER_SIZE) || (memcmp(footer, "conectix", 8) != 0))
+		{
+		return false;
+		}
+
+	this->size = ReadBig64(footer + VHD_FOOTER_CURRENT_SIZE);
+	uint32_t diskType = ReadBig32(footer + VHD_FOOTER_DISK_TYPE);
+
+	if (diskType == VHD_TYPE_FIXED)
+		{
+		if (this->size > fileSize - VHD_FOOTER_SIZE)
+			{
+			this->size = fileSize - VHD_FOOTER_SIZE;
+			}
+
+		this->blockSize = FIXED_BLOCK_SIZE;
+		for (uint64_t offset = 0; offset < this->size; offset += FIXED_BLOCK_SIZE)
+			{
+			this->blocks.push_back(offset);
+			}
+		return true;
+		}
+
+	if (diskType != VHD_TYPE_DYNAMIC)
+		{
+		return false;
+		}
+
+	uint8_t header[VHD_HEADER_SIZE];
+	if (!this->pFile->Read(ReadBig64(footer + VHD_FOOTER_DATA_OFFSET), header, VHD_HEADER_SIZE) || (memcmp(header, "cxsparse", 8) != 0))
+		{
+		return false;
+		}
+
+	uint64_t tableOffset = ReadBig64(header + VHD_HEADER_TABLE_OFFSET);
+	uint32_t entryCount = ReadBig32(header + VHD_HEADER_MAX_TABLE_ENTRIES);
+	this->blockSize = ReadBig32(header + VHD_HEADER_BLOCK_SIZE);
+
+	if ((this->blockSize < VHD_SECTOR_SIZE) || ((uint64_t)entryCount * this->blockSize < this->size))
+		{
+		return false;
+		}
+
+	std::vector<uint8_t> table((size_t)entryCount * 4);
+	if (!this->pFile->Read(tableOffset, table.data(), table.size()))
+		{
+		return false;
+		}
+
+	// Each block starts with a bitmap of the sectors written, a bit per sector rounded up to
+	// whole sectors.  Sectors not written in an allocated block are zero anyway.
+	uint64_t bitmapSize = ((this->blockSize / VHD_SECTOR_SIZE + 7) / 8 + VHD_SECTOR_SIZE - 1) / VHD_SECTOR_SIZE * VHD_SECTOR_SIZE;
+
+	this->blocks.resize(entryCount);
+	for (uint32_t i = 0; i < entryCount; i++)
+		{
+		uint32_t entry = ReadBig32(table.data() + 4 * i);
+		this->blocks[i] = (entry == VHD_SPARSE_ENTRY) ? SPARSE_BLOCK : (uint64_t)entry * VHD_SECTOR_SIZE + bitmapSize;
+		}
+
+	return true;
+	}
+
+bool VhdImage::OpenVhdx()
+	{
+	// The current header is the valid one with the higher sequence number.
+	uint8_t header[VHDX_HEADER_SIZE];
+	uint64_t sequence = 0;
+	bool hasHeader = false;
+	bool hasLog = false;
+
+	for (int i = 0; i < 2; i++)
+		{
+		if (!this->pFile->Read(VHDX_HEADER_OFFSETS[i], header, VHDX_HEADER_SIZE) || (memcmp(header, "head", 4) != 0)
+			|| (Crc32c(header, VHDX_HEADER_SIZE, VHDX_HEADER_CHECKSUM) != Read32(header + VHDX_HEADER_CHECKSUM)))
+			{
+			continue;
+			}
+
+		if (!hasHeader || (Read64(header + VHDX_HEADER_SEQUENCE) > sequence))
+			{
+			static const uint8_t noLog[16] = {};
+			sequence = Read64(header + VHDX_HEADER_SEQUENCE);
+			hasLog = memcmp(header + VHDX_HEADER_LOG_GUID, noLog, 16) != 0;
+			hasHeader = true;
+			}
+		}
+
+	// Until the log is replayed the BAT and metadata may be out of date.
+	if (!hasHeader || hasLog)
+		{
+		return false;
+		}
+
+	std::vector<uint8_t> region(VHDX_REGION_SIZE);
+	bool hasRegion = false;
+	for (int i = 0; (i < 2) && !hasRegion; i++)
+		{
+		hasRegion = this->pFile->Read(VHDX_REGION_OFFSETS[i], region.data(), VHDX_REGION_SIZE) && (memcmp(region.data(), "regi", 4) == 0)
+			&& (Crc32c(region.data(), VHDX_REGION_SIZE, VHDX_HEADER_CHECKSUM) == Read32(region.data() + VHDX_HEADER_CHECKSUM));
+		}
+
+	if (!hasRegion)
+		{
+		return false;
+		}
+
+	uint64_t batOffset = 0;
+	uint32_t batLength = 0;
+	uint64_t metadataOffset = 0;
+	uint32_t metadataLength = 0;
+
+	uint32_t entryCount = Read32(region.data() + VHDX_REGION_COUNT);
+	for (uint32_t i = 0; (i < entryCount) && (VHDX_REGION_ENTRIES + (i + 1) * VHDX_REGION_ENTRY_SIZE <= VHDX_REGION_SIZE); i++)
+		{
+		const uint8_t* pEntry = region.data() + VHDX_REGION_ENTRIES + i * VHDX_REGION_ENTRY_SIZE;
+		if (memcmp(pEntry, GUID_BAT, 16) == 0)
+			{
+			batOffset = Read64(pEntry + 16);
+			batLength = Read32(pEntry + 24);
+			}
+		else if (memcmp(pEntry, GUID_METADATA, 16) == 0)
+			{
+			metadataOffset = Read64(pEntry + 16);
+			metadataLength = Read32(pEntry + 24);
+			}
+		}
+
+	uint32_t sectorSize = 0;
+	if ((batLength == 0) || !this->ReadVhdxMetadata(metadataOffset, metadataLength, &sectorSize))
+		{
+		return false;
+		}
+
+	// After every chunk of payload blocks comes the entry for their sector bitmap block.
+	uint64_t chunkRatio = ((1ULL << 23) * sectorSize) / this->blockSize;
+	uint64_t blockCount = (this->size + this->blockSize - 1) / this->blockSize;
+	if ((chunkRatio == 0) || ((blockCount + blockCount / chunkRatio) * 8 > batLength))
+		{
+		return false;
+		}
+
+	std::vector<uint8_t> bat(batLength);
+	if (!this->pFile->Read(batOffset, bat.data(), bat.size()))
+		{
+		return false;
+		}
+
+	this->blocks.resize((size_t)blockCount);
+	for (uint64_t i = 0; i < blockCount; i++)
+		{
+		uint64_t entry = Read64(bat.data() + 8 * (i + i / chunkRatio));
+		uint64_t state = entry & VHDX_STATE_MASK;
+
+		// Blocks not present, zeroed or unmapped all read as zeros.
+		bool isPresent = (state == VHDX_FULLY_PRESENT) || (state == VHDX_PARTIALLY_PRESENT);
+		this->blocks[(size_t)i] = isPresent ? (entry >> 20) * MB : SPARSE_BLOCK;
+		}
+
+	return true;
+	}
+
+bool VhdImage::ReadVhdxMetadata(uint64_t offset, uint32_t length, uint32_t* pSectorSize)
+	{
+	if (length < VHDX_METADATA_HEADER_SIZE)
+		{
+		return false;
+		}
+
+	std::vector<uint8_t> metadata(length);
+	if (!this->pFile->Read(offset, metadata.data(), metadata.size()) || (memcmp(metadata.data(), "metadata", 8) != 0))
+		{
+		return false;
+		}
+
+	uint32_t entryCount = metadata[VHDX_METADATA_COUNT] | (metadata[VHDX_METADATA_COUNT + 1] << 8);
+	uint32_t flags = 0;
+
+	for (uint32_t i = 0; (i < entryCount) && (VHDX_METADATA_HEADER_SIZE + (i + 1) * VHDX_METADATA_ENTRY_SIZE <= length); i++)
+		{
+		const uint8_t* pEntry = metadata.data() + VHDX_METADATA_HEADER_SIZE + i * VHDX_METADATA_ENTRY_SIZE;
+		uint32_t itemOffset = Read32(pEntry + 16);
+		uint32_t itemLength = Read32(pEntry + 20);
+
+		if ((itemLength < 4) || (itemOffset > length) || (itemLength > length - itemOffset))
+			{
+			continue;
+			}
+
+		const uint8_t* pItem = metadata.data() + itemOffset;
+		if ((memcmp(pEntry, GUID_FILE_PARAMETERS, 16) == 0) && (itemLength >= 8))
+			{
+			this->blockSize = Read32(pItem);
+			flags = Read32(pItem + 4);
+			}
+		else if ((memcmp(pEntry, GUID_VIRTUAL_DISK_SIZE, 16) == 0) && (itemLength >= 8))
+			{
+			this->size = Read64(pItem);
+			}
+		else if (memcmp(pEntry, GUID_LOGICAL_SECTOR_SIZE, 16) == 0)
+			{
+			*pSectorSize = Read32(pItem);
+			}
+		}
+
+	// A differencing disk's unwritten blocks are in its parent.
+	return ((flags & VHDX_HAS_PARENT) == 0) && (this->blockSize > 0) && (*pSectorSize > 0);
+	}
+
+uint64_t VhdImage::GetSize()
+	{
+	return this->size;
+	}
+
+bool VhdImage::Read(uint64_t offset, void* pBuffer, size_t cbData)
+	{
+	if ((offset > this->size) || (cbData > this->size - offset))
+		{
+		return false;
+		}
+
+	uint8_t* p = (uint8_t*)pBuffer;
+	while (cbData > 0)
+		{
+		size_t block = (size_t)(offset / this->blockSize);
+		uint64_t within = offset % this->blockSize;
+		uint64_t fileOffset = this->blocks[block];
+
+		// Blocks that follow on in the file are read together, so a large read is one read.
+		uint64_t count = this->blockSize - within;
+		while ((count < cbData) && (block + 1 < this->blocks.size()) && (fileOffset != SPARSE_BLOCK)
+			&& (this->blocks[block + 1] == this->blocks[block] + this->blockSize))
+			{
+			block++;
+			count += this->blockSize;
+			}
+		count = (count < cbData) ? count : cbData;
+
+		if (fileOffset == SPARSE_BLOCK)
+			{
+			memset(p, 0, (size_t)count);
+			}
+		else if (!this->pFile->Read(fileOffset + within, p, (size_t)count))
+			{
+			return false;
+			}
+
+		p += count;
+		offset += count;
+		cbData -= (size_t)count;
+		}
+
+	return true;
+	}
@@ -0,0 +1,54 @@
+// VhdImage.h
+//
+// Reads the disk in a VHD or VHDX virtual disk file (e.g. a triage collection container)
+// without it being mounted.
+//
+//   VHD   a 512 byte footer ("conectix") at the end of the file.  A fixed disk is the raw disk
+//         followed by the footer.  A dynamic disk has a header ("cxsparse") giving a block
+//         allocation table (BAT) of big endian sector numbers, one per block (usually 2MB),
+//         with each allocated block's data after a sector bitmap.
+//   VHDX  a file identifier ("vhdxfile"), two headers of which the one with the higher sequence
+//         number is current, and a region table locating the BAT and the metadata (block size,
+//         disk size, sector size).  BAT entries are 64 bits, the state in the low 3 bits and the
+//         block's file offset in MB in the high 44, with an entry for a sector bitmap block
+//         after every chunk of payload blocks.
+//
+// Either way the BAT is read once when the image is opened and kept as a file offset per block,
+// so any read costs one read of the file, and blocks that were never written are returned as
+// zeros without reading anything.  Differencing disks (which need their parent) and VHDX files
+// with a log still to be replayed are not supported.
+
+#pragma once
+
+#include "windows.h"
+#include "cstdint"
+#include "cstddef"
+#include "BlockDevice.h"
+#include <vector>
+
+class VhdImage : public BlockDevice
+	{
+	public:
+		VhdImage();
+		~VhdImage();
+
+		bool Open(const wchar_t* szFileName);
+
+		virtual uint64_t GetSize();
+		virtual bool Read(uint64_t offset, void* pBuffer, size_t cbData);
+
+		// Whether the file is a VHD or VHDX file.
+		static bool IsVhdImage(BlockDevice* pFile);
+
+	protected:
+		bool OpenVhd();
+		bool OpenVhdx();
+		bool ReadVhdxMetadata(uint64_t offset, uint32_t length, uint32_t* pSectorSize);
+
+		static const uint64_t SPARSE_BLOCK = 0xFFFFFFFFFFFFFFFFULL;
+
+		RawImage* pFile;
+		uint64_t size;
+		uint64_t blockSize;
+		std::vector<uint64_t> blocks;       // File offset of each block's data, or SPARSE_BLOCK.
+	};
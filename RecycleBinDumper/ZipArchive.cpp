@@ -0,0 +1,523 @@
+// ZipArchive.cpp
+//
+// The central directory of a ZIP archive and reading its members.
+
+#include "ZipArchive.h"
+#include "Inflate.h"
+#include "strsafe.h"
+#include "string.h"
+#include "wchar.h"
+#include "wctype.h"
+#include <algorithm>
+
+static const uint32_t END_SIGNATURE = 0x06054B50;
+static const uint32_t END_SIZE = 22;
+static const uint32_t END_ENTRY_COUNT = 10;
+static const uint32_t END_DIRECTORY_SIZE = 12;
+static const uint32_t END_DIRECTORY_OFFSET = 16;
+
+// The end of central directory record is followed by a comment of up to 64KB.
+static const uint32_t MAX_END_SEARCH = END_SIZE + 0xFFFF;
+
+static const uint32_t ZIP64_LOCATOR_SIGNATURE = 0x07064B50;
+static const uint32_t ZIP64_LOCATOR_SIZE = 20;
+static const uint32_t ZIP64_LOCATOR_END_OFFSET = 8;
+static const uint32_t ZIP64_END_SIGNATURE = 0x06064B50;
+static const uint32_t ZIP64_END_SIZE = 56;
+static const uint32_t ZIP64_END_ENTRY_COUNT = 32;
+static const uint32_t ZIP64_END_DIRECTORY_SIZE = 40;
+static const uint32_t ZIP64_END_DIRECTORY_OFFSET = 48;
+
+static const uint32_t HEADER_SIGNATURE = 0x02014B50;
+static const uint32_t HEADER_SIZE = 46;
+static const uint32_t HEADER_FLAGS = 8;
+static const uint32_t HEADER_METHOD = 10;
+static const uint32_t HEADER_TIME = 12;
+static const uint32_t HEADER_DATE = 14;
+static const uint32_t HEADER_COMPRESSED_SIZE = 20;
+static const uint32_t HEADER_SIZE_FIELD = 24;
+static const uint32_t HEADER_NAME_LENGTH = 28;
+static const uint32_t HEADER_EXTRA_LENGTH = 30;
+static const uint32_t HEADER_COMMENT_LENGTH = 32;
+static const uint32_t HEADER_EXTERNAL_ATTRIBUTES = 38;
+static const uint32_t HEADER_LOCAL_OFFSET = 42;
+
+static const uint32_t LOCAL_SIGNATURE = 0x04034B50;
+static const uint32_t LOCAL_SIZE = 30;
+static const uint32_t LOCAL_NAME_LENGTH = 26;
+static const uint32_t LOCAL_EXTRA_LENGTH = 28;
+
+static const uint16_t FLAG_ENCRYPTED = 0x0001;
+static const uint16_t FLAG_UTF8 = 0x0800;
+static const uint16_t METHOD_STORED = 0;
+static const uint16_t METHOD_DEFLATE = 8;
+
+static const uint16_t EXTRA_ZIP64 = 0x0001;
+static const uint16_t EXTRA_NTFS = 0x000A;
+static const uint16_t NTFS_TIMES = 0x0001;
+
+// A 32 bit field with this value is in the ZIP64 extra field instead.
+static const uint32_t ZIP64_VALUE = 0xFFFFFFFF;
+
+// Deflated members are decompressed in memory, so larger ones are not read.
+static const uint64_t MAX_INFLATE_SIZE = 1024 * 1024 * 1024;
+
+static uint16_t Read16(const uint8_t* p)
+	{
+	return (uint16_t)(p[0] | (p[1] << 8));
+	}
+
+static uint32_t Read32(const uint8_t* p)
+	{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+	}
+
+static uint64_t Read64(const uint8_t* p)
+	{
+	return (uint64_t)Read32(p) | ((uint64_t)Read32(p + 4) << 32);
+	}
+
+static FILETIME ReadFileTime(const uint8_t* p)
+	{
+	FILETIME fileTime;
+	fileTime.dwLowDateTime = Read32(p);
+	fileTime.dwHighDateTime = Read32(p + 4);
+	return fileTime;
+	}
+
+// MS-DOS date and time, in 2 second steps.
+static FILETIME DosTimeToFileTime(uint16_t date, uint16_t time)
+	{
+	SYSTEMTIME systemTime = {};
+	systemTime.wYear = (WORD)((date >> 9) + 1980);
+	systemTime.wMonth = (WORD)((date >> 5) & 0x0F);
+	systemTime.wDay = (WORD)(date & 0x1F);
+	systemTime.wHour = (WORD)(time >> 11);
+	systemTime.wMinute = (WORD)((time >> 5) & 0x3F);
+	systemTime.wSecond = (WORD)((time & 0x1F) * 2);
+
+	FILETIME fileTime = {};
+	SystemTimeToFileTime(&systemTime, &fileTime);
+	return fileTime;
+	}
+
+static bool NameStartsWith(const std::wstring& name, const wchar_t* szPrefix)
+	{
+	size_t length = wcslen(szPrefix);
+	return (name.size() >= length) && (_wcsnicmp(name.c_str(), szPrefix, length) == 0);
+	}
+
+ZipArchive::ZipArchive()
+	{
+	this->readBuffer = new uint8_t[READ_SIZE];
+	}
+
+ZipArchive::~ZipArchive()
+	{
+	delete[] this->readBuffer;
+	}
+
+bool ZipArchive::Open(const wchar_t* szFileName)
+	{
+	uint64_t offset;
+	uint64_t size;
+	uint64_t count;
+
+	if (!this->file.Open(szFileName) || !this->FindCentralDirectory(&offset, &size, &count))
+		{
+		return false;
+		}
+
+	ZipEntry root = {};
+	root.parent = ROOT;
+	root.isFolder = true;
+	this->entries.push_back(root);
+
+	if (!this->ReadCentralDirectory(offset, size, count))
+		{
+		return false;
+		}
+
+	for (uint32_t i = 0; i < this->entries.size(); i++)
+		{
+		ZipEntry& entry = this->entries[i];
+		std::sort(entry.children.begin(), entry.children.end(), [this](uint32_t left, uint32_t right)
+			{ return _wcsicmp(this->entries[left].name.c_str(), this->entries[right].name.c_str()) < 0; });
+
+		if ((i != ROOT) && entry.isFolder && NameStartsWith(entry.name, L"S-1-") && (entry.parent != ROOT)
+			&& ((_wcsicmp(this->entries[entry.parent].name.c_str(), L"$Recycle.Bin") == 0) || (_wcsicmp(this->entries[entry.parent].name.c_str(), L"RECYCLER") == 0)))
+			{
+			this->recycleBins.push_back(i);
+			}
+		}
+
+	return true;
+	}
+
+bool ZipArchive::FindCentralDirectory(uint64_t* pOffset, uint64_t* pSize, uint64_t* pCount)
+	{
+	uint64_t fileSize = this->file.GetSize();
+	if (fileSize < END_SIZE)
+		{
+		return false;
+		}
+
+	uint64_t searchSize = (fileSize < MAX_END_SEARCH) ? fileSize : MAX_END_SEARCH;
+	std::vector<uint8_t> tail((size_t)searchSize);
+	if (!this->file.Read(fileSize - searchSize, tail.data(), tail.size()))
+		{
+		return false;
+		}
+
+	// The end record is the last one in the file, the comment after it is unlikely to hold one.
+	size_t end = tail.size() - END_SIZE + 1;
+	do
+		{
+		end--;
+		} while ((end > 0) && (Read32(tail.data() + end) != END_SIGNATURE));
+
+	if (Read32(tail.data() + end) != END_SIGNATURE)
+		{
+		return false;
+		}
+
+	const uint8_t* pEnd = tail.data() + end;
+	*pCount = Read16(pEnd + END_ENTRY_COUNT);
+	*pSize = Read32(pEnd + END_DIRECTORY_SIZE);
+	*pOffset = Read32(pEnd + END_DIRECTORY_OFFSET);
+
+	// A ZIP64 archive has a locator just before the end record, pointing to the ZIP64 end record.
+	uint64_t endOffset = fileSize - searchSize + end;
+	uint8_t locator[ZIP64_LOCATOR_SIZE];
+	if ((endOffset >= ZIP64_LOCATOR_SIZE) && this->file.Read(endOffset - ZIP64_LOCATOR_SIZE, locator, ZIP64_LOCATOR_SIZE)
+		&& (Read32(locator) == ZIP64_LOCATOR_SIGNATURE))
+		{
+		uint8_t zip64End[ZIP64_END_SIZE];
+		if (!this->file.Read(Read64(locator + ZIP64_LOCATOR_END_OFFSET), zip64End, ZIP64_END_SIZE) || (Read32(zip64End) != ZIP64_END_SIGNATURE))
+			{
+			return false;
+			}
+
+		*pCount = Read64(zip64End + ZIP64_END_ENTRY_COUNT);
+		*pSize = Read64(zip64End + ZIP64_END_DIRECTORY_SIZE);
+		*pOffset = Read64(zip64End + ZIP64_END_DIRECTORY_OFFSET);
+		}
+
+	return (*pOffset <= fileSize) && (*pSize <= fileSize - *pOffset);
+	}
+
+bool ZipArchive::ReadCentralDirectory(uint64_t offset, uint64_t size, uint64_t count)
+	{
+	// The whole directory is read at once, it is small next to the members.
+	std::vector<uint8_t> directory((size_t)size);
+	if (!this->file.Read(offset, directory.data(), directory.size()))
+		{
+		return false;
+		}
+
+	std::vector<wchar_t> name;
+	size_t position = 0;
+
+	for (uint64_t i = 0; i < count; i++)
+		{
+		if ((position + HEADER_SIZE > directory.size()) || (Read32(directory.data() + position) != HEADER_SIGNATURE))
+			{
+			return false;
+			}
+
+		const uint8_t* pHeader = directory.data() + position;
+		uint16_t flags = Read16(pHeader + HEADER_FLAGS);
+		uint32_t nameLength = Read16(pHeader + HEADER_NAME_LENGTH);
+		uint32_t extraLength = Read16(pHeader + HEADER_EXTRA_LENGTH);
+		uint32_t commentLength = Read16(pHeader + HEADER_COMMENT_LENGTH);
+
+		size_t headerLength = HEADER_SIZE + nameLength + extraLength + commentLength;
+		if (position + headerLength > directory.size())
+			{
+			return false;
+			}
+		position += headerLength;
+
+		// Names are UTF-8 if the flag says so, and in the OEM code page otherwise.
+		name.resize(nameLength + 1);
+		int length = (nameLength == 0) ? 0 : MultiByteToWideChar((flags & FLAG_UTF8) ? CP_UTF8 : CP_OEMCP, 0, (const char*)pHeader + HEADER_SIZE, (int)nameLength, name.data(), (int)nameLength);
+		std::wstring path(name.data(), (size_t)length);
+
+		// Some archivers use \ rather than /, and folder names end with one.
+		std::replace(path.begin(), path.end(), L'\\', L'/');
+		bool isFolder = (!path.empty() && (path.back() == L'/')) || ((Read32(pHeader + HEADER_EXTERNAL_ATTRIBUTES) & FILE_ATTRIBUTE_DIRECTORY) != 0);
+		while (!path.empty() && (path.back() == L'/'))
+			{
+			path.pop_back();
+			}
+		while (!path.empty() && (path[0] == L'/'))
+			{
+			path.erase(0, 1);
+			}
+
+		if (path.empty())
+			{
+			continue;
+			}
+
+		uint32_t index = this->AddPath(path, isFolder);
+		ZipEntry& entry = this->entries[index];
+
+		entry.isFolder = isFolder;
+		entry.method = Read16(pHeader + HEADER_METHOD);
+		entry.isUnreadable = ((flags & FLAG_ENCRYPTED) != 0) || ((entry.method != METHOD_STORED) && (entry.method != METHOD_DEFLATE));
+		entry.compressedSize = Read32(pHeader + HEADER_COMPRESSED_SIZE);
+		entry.size = Read32(pHeader + HEADER_SIZE_FIELD);
+		entry.headerOffset = Read32(pHeader + HEADER_LOCAL_OFFSET);
+		entry.modified = DosTimeToFileTime(Read16(pHeader + HEADER_DATE), Read16(pHeader + HEADER_TIME));
+		entry.created = entry.modified;
+		entry.accessed = entry.modified;
+
+		const uint8_t* pExtra = pHeader + HEADER_SIZE + nameLength;
+		const uint8_t* pExtraEnd = pExtra + extraLength;
+		while (pExtra + 4 <= pExtraEnd)
+			{
+			uint16_t id = Read16(pExtra);
+			uint16_t length = Read16(pExtra + 2);
+			const uint8_t* pData = pExtra + 4;
+			if (pData + length > pExtraEnd)
+				{
+				break;
+				}
+
+			if (id == EXTRA_ZIP64)
+				{
+				// Only the fields that did not fit are here, in this order.
+				const uint8_t* p = pData;
+				if ((entry.size == ZIP64_VALUE) && (p + 8 <= pData + length))
+					{
+					entry.size = Read64(p);
+					p += 8;
+					}
+				if ((entry.compressedSize == ZIP64_VALUE) && (p + 8 <= pData + length))
+					{
+					entry.compressedSize = Read64(p);
+					p += 8;
+					}
+				if ((entry.headerOffset == ZIP64_VALUE) && (p + 8 <= pData + length))
+					{
+					entry.headerOffset = Read64(p);
+					}
+				}
+			else if ((id == EXTRA_NTFS) && (length >= 32) && (Read16(pData + 4) == NTFS_TIMES) && (Read16(pData + 6) >= 24))
+				{
+				// The full NTFS times, which the MS-DOS time only approximates.
+				entry.modified = ReadFileTime(pData + 8);
+				entry.accessed = ReadFileTime(pData + 16);
+				entry.created = ReadFileTime(pData + 24);
+				}
+
+			pExtra = pData + length;
+			}
+		}
+
+	return true;
+	}
+
+std::wstring ZipArchive::GetKey(const std::wstring& path)
+	{
+	std::wstring key(path);
+	for (size_t i = 0; i < key.size(); i++)
+		{
+		key[i] = (key[i] == L'\\') ? L'/' : (wchar_t)towupper(key[i]);
+		}
+	return key;
+	}
+
+std::wstring ZipArchive::GetPath(uint32_t index)
+	{
+	std::wstring path;
+	while (index != ROOT)
+		{
+		path = path.empty() ? this->entries[index].name : this->entries[index].name + L"/" + path;
+		index = this->entries[index].parent;
+		}
+	return path;
+	}
+
+uint32_t ZipArchive::AddPath(const std::wstring& path, bool isFolder)
+	{
+	std::wstring key = GetKey(path);
+	std::unordered_map<std::wstring, uint32_t>::iterator it = this->paths.find(key);
+	if (it != this->paths.end())
+		{
+		return it->second;
+		}
+
+	size_t slash = path.rfind(L'/');
+	uint32_t parent = (slash == std::wstring::npos) ? ROOT : this->AddPath(path.substr(0, slash), true);
+
+	ZipEntry entry = {};
+	entry.name = (slash == std::wstring::npos) ? path : path.substr(slash + 1);
+	entry.parent = parent;
+	entry.isFolder = isFolder;
+
+	uint32_t index = (uint32_t)this->entries.size();
+	this->entries.push_back(entry);
+	this->entries[parent].children.push_back(index);
+	this->paths[key] = index;
+	return index;
+	}
+
+size_t ZipArchive::GetRecycleBinCount()
+	{
+	return this->recycleBins.size();
+	}
+
+ZipEntry* ZipArchive::GetRecycleBin(size_t index)
+	{
+	return &this->entries[this->recycleBins[index]];
+	}
+
+ZipEntry* ZipArchive::GetEntry(uint32_t index)
+	{
+	return (index < this->entries.size()) ? &this->entries[index] : NULL;
+	}
+
+ZipEntry* ZipArchive::Find(ZipEntry* pFolder, const wchar_t* szPath)
+	{
+	std::wstring path = this->GetPath((uint32_t)(pFolder - this->entries.data()));
+
+	// "." parts (e.g. the ".\$IABC123.txt" of the dump) are dropped.
+	while (*szPath != L'\0')
+		{
+		const wchar_t* pEnd = szPath;
+		while ((*pEnd != L'\0') && (*pEnd != L'\\') && (*pEnd != L'/'))
+			{
+			pEnd++;
+			}
+
+		size_t length = (size_t)(pEnd - szPath);
+		if ((length > 0) && !((length == 1) && (szPath[0] == L'.')))
+			{
+			if (!path.empty())
+				{
+				path += L'/';
+				}
+			path.append(szPath, length);
+			}
+
+		szPath = (*pEnd != L'\0') ? pEnd + 1 : pEnd;
+		}
+
+	std::unordered_map<std::wstring, uint32_t>::iterator it = this->paths.find(GetKey(path));
+	if (it != this->paths.end())
+		{
+		return &this->entries[it->second];
+		}
+
+	return path.empty() ? &this->entries[ROOT] : NULL;
+	}
+
+bool ZipArchive::ReadFileData(ZipEntry* pEntry, FileDataHandler fn, void* context)
+	{
+	if (pEntry->isFolder || pEntry->isUnreadable)
+		{
+		return false;
+		}
+
+	// The data follows the local header, whose name and extra field may differ in length from
+	// those in the central directory.
+	uint8_t header[LOCAL_SIZE];
+	if (!this->file.Read(pEntry->headerOffset, header, LOCAL_SIZE) || (Read32(header) != LOCAL_SIGNATURE))
+		{
+		return false;
+		}
+
+	uint64_t offset = pEntry->headerOffset + LOCAL_SIZE + Read16(header + LOCAL_NAME_LENGTH) + Read16(header + LOCAL_EXTRA_LENGTH);
+
+	if (pEntry->method == METHOD_STORED)
+		{
+		for (uint64_t position = 0; position < pEntry->size; )
+			{
+			size_t count = (size_t)((pEntry->size - position < READ_SIZE) ? pEntry->size - position : READ_SIZE);
+			if (!this->file.Read(offset + position, this->readBuffer, count) || !fn(this->readBuffer, count, context))
+				{
+				return false;
+				}
+			position += count;
+			}
+
+		return true;
+		}
+
+	if ((pEntry->size > MAX_INFLATE_SIZE) || (pEntry->compressedSize > MAX_INFLATE_SIZE))
+		{
+		return false;
+		}
+
+	std::vector<uint8_t> compressed((size_t)pEntry->compressedSize);
+	std::vector<uint8_t> data((size_t)pEntry->size);
+	size_t written = 0;
+
+	if (!this->file.Read(offset, compressed.data(), compressed.size())
+		|| !Inflate(compressed.data(), compressed.size(), data.data(), data.size(), &written) || (written != data.size()))
+		{
+		return false;
+		}
+
+	return (written == 0) || fn(data.data(), written, context);
+	}
+
+ZipRecycleBin::ZipRecycleBin(ZipArchive* pArchive, ZipEntry* pFolder)
+	{
+	this->pArchive = pArchive;
+	this->pFolder = pFolder;
+	}
+
+void ZipRecycleBin::FindFiles(const wchar_t* szFolder, const wchar_t* szWild, FoundFileHandler fn, void* context)
+	{
+	ZipEntry* pFolder = this->pArchive->Find(this->pFolder, szFolder);
+	if ((pFolder == NULL) || !pFolder->isFolder)
+		{
+		return;
+		}
+
+	for (size_t i = 0; i < pFolder->children.size(); i++)
+		{
+		ZipEntry* pEntry = this->pArchive->GetEntry(pFolder->children[i]);
+		if ((pEntry == NULL) || !MatchWildcard(szWild, pEntry->name.c_str()))
+			{
+			continue;
+			}
+
+		WIN32_FIND_DATA ffd = {};
+		ffd.dwFileAttributes = pEntry->isFolder ? FILE_ATTRIBUTE_DIRECTORY : FILE_ATTRIBUTE_NORMAL;
+		ffd.ftCreationTime = pEntry->created;
+		ffd.ftLastWriteTime = pEntry->modified;
+		ffd.ftLastAccessTime = pEntry->accessed;
+		ffd.nFileSizeHigh = pEntry->isFolder ? 0 : (DWORD)(pEntry->size >> 32);
+		ffd.nFileSizeLow = pEntry->isFolder ? 0 : (DWORD)pEntry->size;
+		StringCchCopy(ffd.cFileName, MAX_PATH, pEntry->name.c_str());
+
+		fn(&ffd, context);
+		}
+	}
+
+bool ZipRecycleBin::GetAttributes(const wchar_t* szFileName, WIN32_FILE_ATTRIBUTE_DATA* pAttributes)
+	{
+	ZipEntry* pEntry = this->pArchive->Find(this->pFolder, szFileName);
+	if (pEntry == NULL)
+		{
+		return false;
+		}
+
+	pAttributes->dwFileAttributes = pEntry->isFolder ? FILE_ATTRIBUTE_DIRECTORY : FILE_ATTRIBUTE_NORMAL;
+	pAttributes->ftCreationTime = pEntry->created;
+	pAttributes->ftLastWriteTime = pEntry->modified;
+	pAttributes->ftLastAccessTime = pEntry->accessed;
+	pAttributes->nFileSizeHigh = pEntry->isFolder ? 0 : (DWORD)(pEntry->size >> 32);
+	pAttributes->nFileSizeLow = pEntry->isFolder ? 0 : (DWORD)pEntry->size;
+	return true;
+	}
+
+bool ZipRecycleBin::ReadFileData(const wchar_t* szFileName, FileDataHandler fn, void* context)
+	{
+	ZipEntry* pEntry = this->pArchive->Find(this->pFolder, szFileName);
+	return (pEntry != NULL) && this->pArchive->ReadFileData(pEntry, fn, context);
+	}
@@ -0,0 +1,101 @@
+// ZipArchive.h
+//
+// Reads the Recycle Bins in a ZIP archive of collected files (e.g. a KAPE or other triage
+// collection of $Recycle.Bin) without extracting them first.
+//
+// The central directory at the end of the archive lists every member with its size, times and
+// where its data is, so it is read once when the archive is opened, and a folder tree is built
+// from the member names (folders with no member of their own are added).  Every file and folder
+// is also put in a hash map by its full path, upper cased, so finding the $R file for a $I file
+// (or any other file by name) is a single lookup.  A member's data is read with one read of the
+// archive and, if it is deflated, decompressed in memory.
+//
+// Every folder named $Recycle.Bin (or RECYCLER, from before Windows Vista) in the archive,
+// whatever it is below (e.g. "C/$Recycle.Bin" or "$Recycle.Bin"), has its SID folders dumped as
+// Recycle Bins.  ZIP64 archives are supported, encrypted members and compression methods other
+// than stored and deflate are not.
+
+#pragma once
+
+#include "windows.h"
+#include "cstdint"
+#include "cstddef"
+#include "BlockDevice.h"
+#include "FileSource.h"
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+struct ZipEntry
+	{
+	std::wstring name;
+	uint32_t parent;
+	bool isFolder;
+	bool isUnreadable;          // Encrypted, or compressed with a method other than deflate.
+	uint16_t method;
+	uint64_t compressedSize;
+	uint64_t size;
+	uint64_t headerOffset;      // Of the member's local header.
+	FILETIME created;
+	FILETIME modified;
+	FILETIME accessed;
+	std::vector<uint32_t> children;
+	};
+
+class ZipArchive
+	{
+	public:
+		ZipArchive();
+		~ZipArchive();
+
+		// Read the central directory.  Returns false if the file is not a readable ZIP archive.
+		bool Open(const wchar_t* szFileName);
+
+		// The SID folders of the archive's Recycle Bins.
+		size_t GetRecycleBinCount();
+		ZipEntry* GetRecycleBin(size_t index);
+
+		ZipEntry* GetEntry(uint32_t index);
+
+		// Find a file or folder by its path below the folder (with \ or / separators).
+		// Returns NULL if there is no such file or folder.
+		ZipEntry* Find(ZipEntry* pFolder, const wchar_t* szPath);
+
+		bool ReadFileData(ZipEntry* pEntry, FileDataHandler fn, void* context);
+
+	protected:
+		bool FindCentralDirectory(uint64_t* pOffset, uint64_t* pSize, uint64_t* pCount);
+		bool ReadCentralDirectory(uint64_t offset, uint64_t size, uint64_t count);
+
+		// Add an entry for the path, and for any of its folders not already added.  Returns the
+		// index of the entry.
+		uint32_t AddPath(const std::wstring& path, bool isFolder);
+
+		// The key of a path in the paths map.
+		static std::wstring GetKey(const std::wstring& path);
+		std::wstring GetPath(uint32_t index);
+
+		static const uint32_t ROOT = 0;
+		static const size_t READ_SIZE = 1024 * 1024;
+
+		RawImage file;
+		std::vector<ZipEntry> entries;
+		std::unordered_map<std::wstring, uint32_t> paths;
+		std::vector<uint32_t> recycleBins;
+		uint8_t* readBuffer;
+	};
+
+// The files of one SID folder of a Recycle Bin in an archive.
+class ZipRecycleBin : public FileSource
+	{
+	public:
+		ZipRecycleBin(ZipArchive* pArchive, ZipEntry* pFolder);
+
+		virtual void FindFiles(const wchar_t* szFolder, const wchar_t* szWild, FoundFileHandler fn, void* context);
+		virtual bool GetAttributes(const wchar_t* szFileName, WIN32_FILE_ATTRIBUTE_DATA* pAttributes);
+		virtual bool ReadFileData(const wchar_t* szFileName, FileDataHandler fn, void* context);
+
+	protected:
+		ZipArchive* pArchive;
+		ZipEntry* pFolder;
+	};